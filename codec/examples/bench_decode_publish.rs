@@ -0,0 +1,99 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Apache-2.0 License that can be found
+// in the LICENSE file.
+
+//! Compare decoding publish packets with payload copied and payload shared.
+//!
+//! Usage: `cargo run --release --example bench_decode_publish [iterations]`
+
+use bytes::Bytes;
+use hebo_codec::{v3, v5, ByteArray, DecodePacket, EncodePacket, PacketId, QoS};
+use std::time::{Duration, Instant};
+
+const PAYLOAD_SIZES: &[usize] = &[64, 1024, 16 * 1024, 256 * 1024];
+
+fn report(name: &str, iterations: usize, size: usize, elapsed: Duration) {
+    let secs = elapsed.as_secs_f64();
+    println!(
+        "  {:<24} {:>10.0} packets/s, {:>8.1} MiB/s",
+        name,
+        iterations as f64 / secs,
+        (iterations * size) as f64 / secs / 1024.0 / 1024.0
+    );
+}
+
+fn bench_v3(iterations: usize, size: usize) {
+    let payload = vec![b'x'; size];
+    let mut packet = v3::PublishPacket::new("device/1234/telemetry", QoS::AtLeastOnce, &payload)
+        .expect("Invalid topic");
+    packet.set_packet_id(PacketId::new(1));
+    let mut buf = Vec::new();
+    packet.encode(&mut buf).expect("Failed to encode packet");
+    let frame = Bytes::from(buf);
+
+    let mut total = 0;
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let mut ba = ByteArray::new(&frame);
+        let packet = v3::PublishPacket::decode(&mut ba).expect("Failed to decode");
+        total += packet.message().len();
+    }
+    report("v3 decode (copy)", iterations, size, start.elapsed());
+
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let packet = v3::PublishPacket::decode_frame(&frame).expect("Failed to decode");
+        total += packet.message().len();
+    }
+    report("v3 decode_frame", iterations, size, start.elapsed());
+
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let mut ba = ByteArray::new(&frame);
+        let packet = v3::PublishPacketRef::decode(&mut ba).expect("Failed to decode");
+        total += packet.message().len();
+    }
+    report("v3 PublishPacketRef", iterations, size, start.elapsed());
+    assert_eq!(total, 3 * iterations * size);
+}
+
+fn bench_v5(iterations: usize, size: usize) {
+    let payload = vec![b'x'; size];
+    let packet = v5::PublishPacket::new("device/1234/telemetry", QoS::AtMostOnce, &payload)
+        .expect("Invalid topic");
+    let mut buf = Vec::new();
+    packet.encode(&mut buf).expect("Failed to encode packet");
+    let frame = Bytes::from(buf);
+
+    let mut total = 0;
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let mut ba = ByteArray::new(&frame);
+        let packet = v5::PublishPacket::decode(&mut ba).expect("Failed to decode");
+        total += packet.message().len();
+    }
+    report("v5 decode (copy)", iterations, size, start.elapsed());
+
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let packet = v5::PublishPacket::decode_frame(&frame).expect("Failed to decode");
+        total += packet.message().len();
+    }
+    report("v5 decode_frame", iterations, size, start.elapsed());
+    assert_eq!(total, 2 * iterations * size);
+}
+
+fn main() {
+    let iterations: usize = std::env::args()
+        .nth(1)
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(200_000);
+
+    for &size in PAYLOAD_SIZES {
+        // Keep total bytes of large payloads reasonable.
+        let iterations = (iterations * 1024 / size.max(1024)).max(1000);
+        println!("payload {} bytes, {} iterations:", size, iterations);
+        bench_v3(iterations, size);
+        bench_v5(iterations, size);
+    }
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Apache-2.0 License that can be found
+// in the LICENSE file.
+
+//! Compare encoding packets into a new growing buffer, into a new buffer with
+//! exact size reserved, and back-to-back into one reused buffer.
+//!
+//! Usage: `cargo run --release --example bench_encode_packets [iterations]`
+
+use bytes::BytesMut;
+use hebo_codec::{encode_packet, v3, v5, EncodePacket, Packet, PacketId, QoS};
+use std::time::{Duration, Instant};
+
+/// Number of packets encoded into the reused buffer before it is cleared.
+const BATCH: usize = 64;
+
+fn report(name: &str, iterations: usize, elapsed: Duration) {
+    println!(
+        "  {:<32} {:>10.0} packets/s",
+        name,
+        iterations as f64 / elapsed.as_secs_f64()
+    );
+}
+
+fn bench_packet<P: EncodePacket + Packet>(name: &str, packet: &P, iterations: usize) {
+    println!(
+        "{}, {} bytes:",
+        name,
+        packet.bytes().expect("Invalid packet")
+    );
+    let mut total = 0;
+
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let mut buf = Vec::new();
+        packet.encode(&mut buf).expect("Failed to encode packet");
+        total += buf.len();
+    }
+    report("new Vec", iterations, start.elapsed());
+
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let mut buf = Vec::new();
+        encode_packet(packet, &mut buf).expect("Failed to encode packet");
+        total += buf.len();
+    }
+    report("new Vec, reserved", iterations, start.elapsed());
+
+    let mut buf = BytesMut::new();
+    let start = Instant::now();
+    for i in 0..iterations {
+        if i % BATCH == 0 {
+            total += buf.len();
+            buf.clear();
+        }
+        encode_packet(packet, &mut buf).expect("Failed to encode packet");
+    }
+    total += buf.len();
+    report("back-to-back BytesMut", iterations, start.elapsed());
+
+    assert_eq!(total, 3 * iterations * packet.bytes().unwrap());
+}
+
+fn bench_v3(iterations: usize) {
+    let mut publish =
+        v3::PublishPacket::new("device/1234/telemetry", QoS::AtLeastOnce, &[b'x'; 64])
+            .expect("Invalid topic");
+    publish.set_packet_id(PacketId::new(1));
+    bench_packet("v3 publish", &publish, iterations);
+
+    let publish_ack = v3::PublishAckPacket::new(PacketId::new(1));
+    bench_packet("v3 publish ack", &publish_ack, iterations);
+
+    let subscribe =
+        v3::SubscribePacket::new("device/+/telemetry", QoS::AtLeastOnce, PacketId::new(2))
+            .expect("Invalid topic");
+    bench_packet("v3 subscribe", &subscribe, iterations);
+
+    let connect = v3::ConnectPacket::new("client-1234").expect("Invalid client id");
+    bench_packet("v3 connect", &connect, iterations);
+}
+
+fn bench_v5(iterations: usize) {
+    let mut publish =
+        v5::PublishPacket::new("device/1234/telemetry", QoS::AtLeastOnce, &[b'x'; 64])
+            .expect("Invalid topic");
+    publish.set_packet_id(PacketId::new(1));
+    bench_packet("v5 publish", &publish, iterations);
+
+    let publish_ack = v5::PublishAckPacket::new(PacketId::new(1));
+    bench_packet("v5 publish ack", &publish_ack, iterations);
+
+    let subscribe =
+        v5::SubscribePacket::new("device/+/telemetry", QoS::AtLeastOnce, PacketId::new(2))
+            .expect("Invalid topic");
+    bench_packet("v5 subscribe", &subscribe, iterations);
+
+    let connect = v5::ConnectPacket::new("client-1234").expect("Invalid client id");
+    bench_packet("v5 connect", &connect, iterations);
+}
+
+fn main() {
+    let iterations: usize = std::env::args()
+        .nth(1)
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(1_000_000);
+
+    bench_v3(iterations);
+    bench_v5(iterations);
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Apache-2.0 License that can be found
+// in the LICENSE file.
+
+//! Compare forwarding v5 publish packets with user properties decoded into
+//! a property list and re-encoded, and with encoded properties shared.
+//!
+//! Usage: `cargo run --release --example bench_publish_properties [iterations]`
+
+use bytes::Bytes;
+use hebo_codec::v5::{Properties, Property, PublishPacket, RawProperties};
+use hebo_codec::{EncodePacket, PacketId, QoS, StringPairData, U32Data};
+use std::time::{Duration, Instant};
+
+const USER_PROPERTIES: &[usize] = &[0, 5, 20];
+
+fn report(name: &str, iterations: usize, elapsed: Duration) {
+    println!(
+        "  {:<24} {:>10.0} packets/s",
+        name,
+        iterations as f64 / elapsed.as_secs_f64()
+    );
+}
+
+fn new_frame(user_properties: usize) -> Bytes {
+    let mut packet = PublishPacket::new("device/1234/telemetry", QoS::AtLeastOnce, &[b'x'; 256])
+        .expect("Invalid topic");
+    packet.set_packet_id(PacketId::new(1));
+    let mut properties = Properties::new();
+    properties
+        .push(Property::MessageExpiryInterval(U32Data::new(3600)))
+        .expect("Too many properties");
+    for i in 0..user_properties {
+        let pair = StringPairData::new(&format!("key-{}", i), "some value of user property")
+            .expect("Invalid user property");
+        properties
+            .push(Property::UserProperty(pair))
+            .expect("Too many properties");
+    }
+    packet
+        .set_properties(&properties)
+        .expect("Failed to encode properties");
+
+    let mut buf = Vec::new();
+    packet.encode(&mut buf).expect("Failed to encode packet");
+    Bytes::from(buf)
+}
+
+fn bench(iterations: usize, user_properties: usize) {
+    let frame = new_frame(user_properties);
+    println!(
+        "{} user properties, {} bytes:",
+        user_properties,
+        frame.len()
+    );
+    let mut total = 0;
+
+    // Decode every property, as before properties were kept encoded.
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let packet = PublishPacket::decode_frame(&frame).expect("Failed to decode");
+        let properties = packet
+            .properties()
+            .to_properties()
+            .expect("Failed to decode properties");
+        let forward = RawProperties::from_properties(&properties).expect("Failed to encode");
+        total += forward.bytes();
+    }
+    report("decode and re-encode", iterations, start.elapsed());
+
+    let start = Instant::now();
+    for _i in 0..iterations {
+        let packet = PublishPacket::decode_frame(&frame).expect("Failed to decode");
+        assert_eq!(packet.properties().message_expiry_interval(), Some(3600));
+        let forward = packet
+            .properties()
+            .without_topic_alias()
+            .expect("Failed to encode");
+        total += forward.bytes();
+    }
+    report("lazy decode", iterations, start.elapsed());
+
+    let packet = PublishPacket::decode_frame(&frame).expect("Failed to decode");
+    assert_eq!(total, 2 * iterations * packet.properties().bytes());
+}
+
+fn main() {
+    let iterations: usize = std::env::args()
+        .nth(1)
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(200_000);
+
+    for &user_properties in USER_PROPERTIES {
+        bench(iterations, user_properties);
+    }
+}
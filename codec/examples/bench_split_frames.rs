@@ -0,0 +1,86 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Apache-2.0 License that can be found
+// in the LICENSE file.
+
+//! Compare splitting a byte stream into packets with `FixedHeader::decode()`
+//! and with `FixedHeader::peek()`.
+//!
+//! Usage: `cargo run --release --example bench_split_frames [rounds]`
+
+use hebo_codec::{v3, ByteArray, DecodePacket, EncodePacket, FixedHeader, PacketId, QoS};
+use std::time::{Duration, Instant};
+
+/// Number of packets in the stream, which is small enough to stay in CPU cache.
+const PACKETS: usize = 1024;
+
+fn report(name: &str, frames: usize, elapsed: Duration) {
+    println!(
+        "  {:<24} {:>10.0} frames/ms",
+        name,
+        frames as f64 / elapsed.as_secs_f64() / 1000.0
+    );
+}
+
+/// Publish acks and publish packets, mostly small ones, with 1, 2 and 3 bytes
+/// of remaining length.
+fn new_stream() -> Vec<u8> {
+    let mut buf = Vec::new();
+    for i in 0..PACKETS {
+        if i % 2 == 0 {
+            let packet = v3::PublishAckPacket::new(PacketId::new(1));
+            packet.encode(&mut buf).expect("Failed to encode packet");
+        } else {
+            let payload_len = match i / 2 * 7 % 32 {
+                0 => 20 * 1024,
+                1..=8 => 512,
+                _ => 16,
+            };
+            let payload = vec![b'x'; payload_len];
+            let mut packet =
+                v3::PublishPacket::new("device/1234/telemetry", QoS::AtLeastOnce, &payload)
+                    .expect("Invalid topic");
+            packet.set_packet_id(PacketId::new(1));
+            packet.encode(&mut buf).expect("Failed to encode packet");
+        }
+    }
+    buf
+}
+
+fn main() {
+    let rounds: usize = std::env::args()
+        .nth(1)
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(10_000);
+
+    let stream = new_stream();
+    let frames = rounds * PACKETS;
+    println!("{} packets, {} bytes:", PACKETS, stream.len());
+    let mut total = 0;
+
+    let start = Instant::now();
+    for _round in 0..rounds {
+        let mut offset = 0;
+        while offset < stream.len() {
+            let mut ba = ByteArray::new(&stream[offset..]);
+            let fixed_header = FixedHeader::decode(&mut ba).expect("Invalid fixed header");
+            offset += ba.offset() + fixed_header.remaining_length();
+            total += 1;
+        }
+    }
+    report("FixedHeader::decode()", frames, start.elapsed());
+
+    let start = Instant::now();
+    for _round in 0..rounds {
+        let mut offset = 0;
+        while offset < stream.len() {
+            let (fixed_header, bytes) = FixedHeader::peek(&stream[offset..])
+                .expect("Invalid fixed header")
+                .expect("Incomplete fixed header");
+            offset += bytes + fixed_header.remaining_length();
+            total += 1;
+        }
+    }
+    report("FixedHeader::peek()", frames, start.elapsed());
+
+    assert_eq!(total, 2 * frames);
+}
@@ -0,0 +1,126 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Apache-2.0 License that can be found
+// in the LICENSE file.
+
+//! Compare single pass MQTT string validator with `from_utf8()` followed by
+//! a scan of chars.
+//!
+//! Usage: `cargo run --release --example bench_utf8 [rounds]`
+
+use hebo_codec::utils::{validate_utf8_bytes, StringError};
+use std::time::Instant;
+
+/// Previous implementation, UTF-8 check and forbidden chars check in two passes.
+fn two_pass(buf: &[u8]) -> Result<(), StringError> {
+    let s = String::from_utf8(buf.to_vec())?;
+    for c in s.chars() {
+        if c == '\u{0000}' {
+            return Err(StringError::SeriousError);
+        }
+        if ('\u{0001}'..='\u{001f}').contains(&c) || ('\u{007f}'..='\u{009f}').contains(&c) {
+            return Err(StringError::InvalidChar);
+        }
+    }
+    Ok(())
+}
+
+/// Same as `two_pass()`, without copying bytes.
+fn two_pass_borrowed(buf: &[u8]) -> Result<(), StringError> {
+    let s = std::str::from_utf8(buf)?;
+    for c in s.chars() {
+        if c == '\u{0000}' {
+            return Err(StringError::SeriousError);
+        }
+        if ('\u{0001}'..='\u{001f}').contains(&c) || ('\u{007f}'..='\u{009f}').contains(&c) {
+            return Err(StringError::InvalidChar);
+        }
+    }
+    Ok(())
+}
+
+fn topics() -> Vec<String> {
+    (0..1000)
+        .map(|i| match i % 4 {
+            0 => format!("factory/line-{}/machine-{}/sensor/temperature", i % 7, i),
+            1 => format!("device/{:08x}/cmd/reboot", i * 7919),
+            2 => format!("$SYS/broker/clients/{}", i),
+            _ => format!("fleet/{}/vehicle/{}/gps", i % 13, i),
+        })
+        .collect()
+}
+
+fn client_ids() -> Vec<String> {
+    (0..1000)
+        .map(|i| format!("hebo-client-{:016x}", i * 104_729))
+        .collect()
+}
+
+fn user_properties() -> Vec<String> {
+    (0..1000)
+        .map(|i| {
+            if i % 2 == 0 {
+                format!("trace-id={:032x}", i * 15_485_863)
+            } else {
+                format!(
+                    "{{\"site\":\"plant-{}\",\"unit\":\"celsius\",\"tags\":[\"line\",\"qa\",\"shift-{}\"]}}",
+                    i % 17,
+                    i % 3
+                )
+            }
+        })
+        .collect()
+}
+
+fn cjk_topics() -> Vec<String> {
+    (0..1000)
+        .map(|i| format!("工厂/{}号线/温度传感器/{}", i % 7, i))
+        .collect()
+}
+
+fn bench(name: &str, corpus: &[String], rounds: usize) {
+    let bytes: usize = corpus.iter().map(String::len).sum();
+    let total = (bytes * rounds) as f64 / 1024.0 / 1024.0;
+    println!(
+        "{}: {} strings, {} bytes on average",
+        name,
+        corpus.len(),
+        bytes / corpus.len()
+    );
+
+    let validators: [(&str, fn(&[u8]) -> Result<(), StringError>); 3] = [
+        ("two pass (copy)", two_pass),
+        ("two pass", two_pass_borrowed),
+        ("single pass", validate_utf8_bytes),
+    ];
+    for (validator_name, validator) in &validators {
+        let start = Instant::now();
+        let mut valid = 0;
+        for _round in 0..rounds {
+            for s in corpus {
+                if validator(s.as_bytes()).is_ok() {
+                    valid += 1;
+                }
+            }
+        }
+        let elapsed = start.elapsed();
+        assert_eq!(valid, corpus.len() * rounds);
+        println!(
+            "  {:<16} {:>8.1} MiB/s, {:>6.1} ns per string",
+            validator_name,
+            total / elapsed.as_secs_f64(),
+            elapsed.as_nanos() as f64 / (corpus.len() * rounds) as f64
+        );
+    }
+}
+
+fn main() {
+    let rounds: usize = std::env::args()
+        .nth(1)
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(2000);
+
+    bench("topics", &topics(), rounds);
+    bench("client ids", &client_ids(), rounds);
+    bench("user properties", &user_properties(), rounds);
+    bench("cjk topics", &cjk_topics(), rounds);
+}
@@ -2,22 +2,64 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::{BufMut, BytesMut};
 use serde::Deserialize;
 use std::convert::TryFrom;
 
-use super::{ByteArray, DecodeError, EncodeError};
+use super::{ByteArray, DecodeError, EncodeError, Packet};
 
 pub const PROTOCOL_NAME: &str = "MQTT";
 pub const PROTOCOL_NAME_V3: &str = "MQIsdp";
 
 /// Convert native data types to network byte stream.
 pub trait EncodePacket {
-    /// Encode packets into byte array.
+    /// Encode packets into byte array, after bytes already in `v`.
+    ///
+    /// Returns number of bytes written.
     ///
     /// # Errors
     ///
     /// Returns error if packet state is invalid of buffer capacity is insufficient.
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError>;
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError>;
+}
+
+/// Buffers which can grow before a packet is encoded into them.
+pub trait ReserveBuf: BufMut {
+    /// Reserve capacity for at least `additional` more bytes.
+    fn reserve_bytes(&mut self, additional: usize);
+}
+
+impl ReserveBuf for Vec<u8> {
+    fn reserve_bytes(&mut self, additional: usize) {
+        self.reserve(additional);
+    }
+}
+
+impl ReserveBuf for BytesMut {
+    fn reserve_bytes(&mut self, additional: usize) {
+        self.reserve(additional);
+    }
+}
+
+/// Encode `packet` after bytes already in `buf`.
+///
+/// Size of packet is computed first and reserved in `buf` at once, then fixed header
+/// and body are written in a single pass. Packets can be encoded back-to-back
+/// into the same buffer.
+///
+/// Returns number of bytes written.
+///
+/// # Errors
+///
+/// Returns error if packet state is invalid.
+pub fn encode_packet<P, B>(packet: &P, buf: &mut B) -> Result<usize, EncodeError>
+where
+    P: EncodePacket + Packet,
+    B: ReserveBuf,
+{
+    let n_bytes = packet.bytes()?;
+    buf.reserve_bytes(n_bytes);
+    packet.encode(buf)
 }
 
 pub trait DecodePacket: Sized {
@@ -70,8 +112,8 @@ impl TryFrom<u8> for QoS {
 }
 
 impl EncodePacket for QoS {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        v.push(*self as u8);
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
+        v.put_u8(*self as u8);
         Ok(Self::bytes())
     }
 }
@@ -2,8 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use byteorder::{BigEndian, WriteBytesExt};
-use std::io::Write;
+use bytes::BufMut;
 
 use crate::{utils, ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket};
 
@@ -73,11 +72,11 @@ impl DecodePacket for BinaryData {
 }
 
 impl EncodePacket for BinaryData {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         #[allow(clippy::cast_possible_truncation)]
         let len = self.0.len() as u16;
-        buf.write_u16::<BigEndian>(len)?;
-        buf.write_all(&self.0)?;
+        buf.put_u16(len);
+        buf.put_slice(&self.0);
         Ok(self.bytes())
     }
 }
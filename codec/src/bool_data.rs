@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use crate::{ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket};
 
 /// `BoolData` represents one byte value with two states.
@@ -40,9 +42,9 @@ impl DecodePacket for BoolData {
 }
 
 impl EncodePacket for BoolData {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let byte = if self.0 { 0x01 } else { 0x00 };
-        buf.push(byte);
+        buf.put_u8(byte);
         Ok(Self::bytes())
     }
 }
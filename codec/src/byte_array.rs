@@ -61,7 +61,7 @@ impl<'a> ByteArray<'a> {
     /// Returns error if the array has no length bytes.
     pub fn read_byte(&mut self) -> Result<u8, ByteArrayError> {
         let offset = self.offset + 1;
-        if self.offset > self.data.len() {
+        if offset > self.data.len() {
             Err(ByteArrayError::OutOfRangeError)
         } else {
             self.offset = offset;
@@ -97,11 +97,21 @@ impl<'a> ByteArray<'a> {
         utils::to_utf8_string(bytes).map_err(ByteArrayError::from)
     }
 
+    /// Read an UTF-8 string with `len` from slice, without copying.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if the array has no length bytes or bytes are not valid utf8 string.
+    pub fn read_str(&mut self, len: usize) -> Result<&'a str, ByteArrayError> {
+        let bytes = self.read_bytes(len)?;
+        utils::to_utf8_str(bytes).map_err(ByteArrayError::from)
+    }
+
     /// Read a byte array with `len` from slice.
     /// # Errors
     ///
     /// Returns error if the array has no length bytes.
-    pub fn read_bytes(&mut self, len: usize) -> Result<&[u8], ByteArrayError> {
+    pub fn read_bytes(&mut self, len: usize) -> Result<&'a [u8], ByteArrayError> {
         let offset = self.offset + len;
         if offset > self.data.len() {
             log::error!(
@@ -112,8 +122,9 @@ impl<'a> ByteArray<'a> {
             );
             Err(ByteArrayError::OutOfRangeError)
         } else {
+            let data = self.data;
             self.offset = offset;
-            Ok(&self.data[self.offset - len..self.offset])
+            Ok(&data[offset - len..offset])
         }
     }
 
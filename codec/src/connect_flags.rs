@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::convert::TryFrom;
 
 use crate::{ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, QoS};
@@ -166,7 +167,7 @@ impl Default for ConnectFlags {
 }
 
 impl EncodePacket for ConnectFlags {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         let flags = {
             let has_username = if self.has_username {
                 0b1000_0000
@@ -200,7 +201,7 @@ impl EncodePacket for ConnectFlags {
 
             has_username | has_password | will_retian | will_qos | will | clean_session
         };
-        v.push(flags);
+        v.put_u8(flags);
 
         Ok(1)
     }
@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::convert::TryFrom;
 use std::fmt;
 
@@ -329,6 +330,35 @@ impl FixedHeader {
         PacketType::bytes() + self.remaining_length.bytes()
     }
 
+    /// Decode fixed header at the front of `buf`, without a `ByteArray`.
+    ///
+    /// Returns fixed header and number of bytes it consumes, or `Ok(None)` if
+    /// remaining length is not fully available yet. If at least 5 bytes, the maximum
+    /// length of fixed header, are available, length of `buf` is checked only once
+    /// and remaining length is decoded with `VarInt::decode_word()`.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if packet type or remaining length is invalid.
+    pub fn peek(buf: &[u8]) -> Result<Option<(Self, usize)>, DecodeError> {
+        if let [flag, b1, b2, b3, b4, ..] = *buf {
+            let packet_type = PacketType::try_from(flag)?;
+            let (remaining_length, len) = VarInt::decode_word([b1, b2, b3, b4])?;
+            let fixed_header = Self {
+                packet_type,
+                remaining_length,
+            };
+            return Ok(Some((fixed_header, PacketType::bytes() + len)));
+        }
+
+        let mut ba = ByteArray::new(buf);
+        match Self::decode(&mut ba) {
+            Ok(fixed_header) => Ok(Some((fixed_header, ba.offset()))),
+            Err(DecodeError::OutOfRangeError) => Ok(None),
+            Err(err) => Err(err),
+        }
+    }
+
     /// Check whether this fixed header is valid within specific `protocol_level`.
     ///
     /// Note that `Auth` packet is only available in MQTT 5.0.
@@ -353,9 +383,9 @@ impl DecodePacket for FixedHeader {
 }
 
 impl EncodePacket for FixedHeader {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         let packet_type: u8 = self.packet_type.into();
-        v.push(packet_type);
+        v.put_u8(packet_type);
 
         self.remaining_length.encode(v)?;
         // TODO(Shaohua): Replace remaining_length.len() with remaining_length.bytes()
@@ -399,5 +429,20 @@ mod tests {
             }
         );
         assert_eq!(fixed_header.remaining_length(), 19);
+
+        let (peek_header, bytes) = FixedHeader::peek(&buf).unwrap().unwrap();
+        assert_eq!(peek_header, fixed_header);
+        assert_eq!(bytes, 2);
+
+        // Publish ack packet, shorter than 5 bytes.
+        let buf = [0x40, 0x02, 0x00, 0x01];
+        let (fixed_header, bytes) = FixedHeader::peek(&buf).unwrap().unwrap();
+        assert_eq!(fixed_header.packet_type(), PacketType::PublishAck);
+        assert_eq!(fixed_header.remaining_length(), 2);
+        assert_eq!(bytes, 2);
+
+        // Remaining length is not fully received yet.
+        assert_eq!(FixedHeader::peek(&[0x30, 0x80, 0x80]).unwrap(), None);
+        assert!(FixedHeader::peek(&[0x30, 0x80, 0x80, 0x80, 0x80]).is_err());
     }
 }
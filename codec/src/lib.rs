@@ -19,7 +19,7 @@ mod u32_data;
 pub mod utils;
 mod var_int;
 
-pub use base::{DecodePacket, EncodePacket, QoS};
+pub use base::{encode_packet, DecodePacket, EncodePacket, QoS, ReserveBuf};
 pub use binary_data::BinaryData;
 pub use bool_data::BoolData;
 pub use byte_array::ByteArray;
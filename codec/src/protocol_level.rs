@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::convert::TryFrom;
 
 use crate::base::PROTOCOL_NAME;
@@ -57,8 +58,8 @@ impl TryFrom<u8> for ProtocolLevel {
 }
 
 impl EncodePacket for ProtocolLevel {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        v.push(*self as u8);
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
+        v.put_u8(*self as u8);
         Ok(Self::bytes())
     }
 }
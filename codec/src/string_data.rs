@@ -2,9 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use byteorder::{BigEndian, WriteBytesExt};
+use bytes::BufMut;
 use std::fmt;
-use std::io::Write;
 
 use crate::{
     utils::validate_utf8_string, utils::StringError, ByteArray, DecodeError, DecodePacket,
@@ -116,11 +115,11 @@ impl DecodePacket for StringData {
 }
 
 impl EncodePacket for StringData {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         #[allow(clippy::cast_possible_truncation)]
         let len = self.0.len() as u16;
-        buf.write_u16::<BigEndian>(len)?;
-        buf.write_all(self.0.as_bytes())?;
+        buf.put_u16(len);
+        buf.put_slice(self.0.as_bytes());
         Ok(self.bytes())
     }
 }
@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::fmt;
 
 use crate::{ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, StringData};
@@ -79,7 +80,7 @@ impl DecodePacket for StringPairData {
 }
 
 impl EncodePacket for StringPairData {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let key_len = self.0.encode(buf)?;
         let value_len = self.1.encode(buf)?;
         Ok(key_len + value_len)
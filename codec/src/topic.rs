@@ -2,9 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use byteorder::{BigEndian, WriteBytesExt};
+use bytes::BufMut;
 use std::hash::{Hash, Hasher};
-use std::io::Write;
 
 use crate::QoS;
 use crate::{ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket};
@@ -57,24 +56,76 @@ impl Topic {
         s.split('/').map(TopicPart::parse).collect()
     }
 
-    /// Returns true if this topic matches string slice.
+    /// Returns true if this topic filter matches topic name `s`.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use hebo_codec::Topic;
+    /// let filter = Topic::parse("sport/tennis/#").unwrap();
+    /// assert!(filter.is_match("sport/tennis"));
+    /// assert!(filter.is_match("sport/tennis/player1/ranking"));
+    /// assert!(!filter.is_match("sport"));
+    ///
+    /// let filter = Topic::parse("sport/+/player1").unwrap();
+    /// assert!(filter.is_match("sport/tennis/player1"));
+    /// assert!(!filter.is_match("sport/tennis"));
+    ///
+    /// let filter = Topic::parse("+/monitor").unwrap();
+    /// assert!(!filter.is_match("$SYS/monitor"));
+    /// ```
     #[must_use]
     pub fn is_match(&self, s: &str) -> bool {
-        for (index, part) in s.split('/').into_iter().enumerate() {
-            match self.parts.get(index) {
-                None | Some(TopicPart::Empty) => return false,
-                Some(TopicPart::Normal(ref s_part) | TopicPart::Internal(ref s_part)) => {
-                    if s_part != part {
-                        return false;
-                    }
-                }
-                Some(TopicPart::SingleWildcard) => {
-                    // Continue
-                }
-                Some(TopicPart::MultiWildcard) => return true,
+        self.match_levels(s.split('/'))
+    }
+
+    /// Same as `is_match()`, with topic name split into `levels`.
+    ///
+    /// Used to match one topic name with many topic filters, it is split only once.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use hebo_codec::Topic;
+    /// let levels: Vec<&str> = "sport/tennis/player1".split('/').collect();
+    /// let filter = Topic::parse("sport/+/player1").unwrap();
+    /// assert!(filter.is_match_levels(&levels));
+    /// let filter = Topic::parse("sport/tennis").unwrap();
+    /// assert!(!filter.is_match_levels(&levels));
+    /// ```
+    #[must_use]
+    pub fn is_match_levels(&self, levels: &[&str]) -> bool {
+        self.match_levels(levels.iter().copied())
+    }
+
+    fn match_levels<'a, I>(&self, levels: I) -> bool
+    where
+        I: Iterator<Item = &'a str>,
+    {
+        let mut levels = levels.peekable();
+        // The Server MUST NOT match Topic Filters starting with a wildcard character (# or +)
+        // with Topic Names beginning with a $ character [MQTT-4.7.2-1].
+        let is_internal = levels.peek().map_or(false, |level| level.starts_with('$'));
+        for (index, part) in self.parts.iter().enumerate() {
+            if part == &TopicPart::MultiWildcard {
+                // `#` also matches the parent level.
+                return !(index == 0 && is_internal);
+            }
+            let level = match levels.next() {
+                Some(level) => level,
+                None => return false,
+            };
+            let matched = match part {
+                TopicPart::Empty => level.is_empty(),
+                TopicPart::Normal(ref s_part) | TopicPart::Internal(ref s_part) => s_part == level,
+                TopicPart::SingleWildcard => !(index == 0 && is_internal),
+                TopicPart::MultiWildcard => true,
+            };
+            if !matched {
+                return false;
             }
         }
-        true
+        levels.next().is_none()
     }
 
     /// Used as a string slice.
@@ -314,6 +365,11 @@ impl PubTopic {
         Ok(Self(topic.to_string()))
     }
 
+    /// Create a publish topic which has already been validated.
+    pub(crate) fn new_unchecked(topic: &str) -> Self {
+        Self(topic.to_string())
+    }
+
     /// Get byte length in packet.
     #[must_use]
     pub fn bytes(&self) -> usize {
@@ -337,11 +393,11 @@ impl DecodePacket for PubTopic {
 }
 
 impl EncodePacket for PubTopic {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         #[allow(clippy::cast_possible_truncation)]
         let len = self.0.len() as u16;
-        buf.write_u16::<BigEndian>(len)?;
-        buf.write_all(self.0.as_bytes())?;
+        buf.put_u16(len);
+        buf.put_slice(self.0.as_bytes());
         Ok(self.bytes())
     }
 }
@@ -385,11 +441,11 @@ impl DecodePacket for SubTopic {
 }
 
 impl EncodePacket for SubTopic {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         #[allow(clippy::cast_possible_truncation)]
         let len = self.0.len() as u16;
-        buf.write_u16::<BigEndian>(len)?;
-        buf.write_all(self.0.as_bytes())?;
+        buf.put_u16(len);
+        buf.put_slice(self.0.as_bytes());
         Ok(self.bytes())
     }
 }
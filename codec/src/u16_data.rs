@@ -2,7 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use byteorder::{BigEndian, WriteBytesExt};
+use bytes::BufMut;
 use std::cmp;
 use std::convert;
 use std::fmt;
@@ -49,8 +49,8 @@ impl DecodePacket for U16Data {
 }
 
 impl EncodePacket for U16Data {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        buf.write_u16::<BigEndian>(self.0)?;
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
+        buf.put_u16(self.0);
         Ok(Self::bytes())
     }
 }
@@ -2,7 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use byteorder::{BigEndian, WriteBytesExt};
+use bytes::BufMut;
 use std::fmt;
 
 use crate::{ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket};
@@ -44,8 +44,8 @@ impl DecodePacket for U32Data {
 }
 
 impl EncodePacket for U32Data {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        buf.write_u32::<BigEndian>(self.0)?;
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
+        buf.put_u32(self.0);
         Ok(Self::bytes())
     }
 }
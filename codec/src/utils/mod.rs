@@ -5,6 +5,10 @@
 use rand::distributions::Alphanumeric;
 use rand::{thread_rng, Rng};
 
+mod utf8;
+
+pub use utf8::validate_utf8_bytes;
+
 pub const MAXIMUM_CLIENT_ID: usize = 32;
 
 /// Generate random string.
@@ -51,6 +55,12 @@ impl From<std::string::FromUtf8Error> for StringError {
     }
 }
 
+impl From<std::str::Utf8Error> for StringError {
+    fn from(_e: std::str::Utf8Error) -> Self {
+        Self::SeriousError
+    }
+}
+
 /// Check data length exceeds 64k or not.
 ///
 /// # Errors
@@ -92,24 +102,8 @@ pub fn validate_utf8_string(s: &str) -> Result<(), StringError> {
         return Err(StringError::TooManyData);
     }
 
-    for c in s.chars() {
-        // Check control characters
-        if c == '\u{0000}' {
-            return Err(StringError::SeriousError);
-        }
-
-        // Not need to Check chars between 0xd800 and 0xfffd as they are invalid coded point and not allowed.
-        //if c >= '\u{d800}' && c <= '\u{fffd}' {
-        //    return Err(StringError::InvalidStringSerious);
-        //}
-
-        if ('\u{0001}'..='\u{001f}').contains(&c) || ('\u{007f}'..='\u{009f}').contains(&c) {
-            return Err(StringError::InvalidChar);
-        }
-    }
-
     // Empty string is valid.
-    Ok(())
+    validate_utf8_bytes(s.as_bytes())
 }
 
 /// Convert range of bytes to valid UTF-8 string.
@@ -118,9 +112,21 @@ pub fn validate_utf8_string(s: &str) -> Result<(), StringError> {
 ///
 /// Returns error if `buf` contains invalid UTF-8 chars.
 pub fn to_utf8_string(buf: &[u8]) -> Result<String, StringError> {
-    let s = String::from_utf8(buf.to_vec())?;
-    validate_utf8_string(&s)?;
-    Ok(s)
+    to_utf8_str(buf).map(ToString::to_string)
+}
+
+/// Validate range of bytes as UTF-8 string, without copying.
+///
+/// # Errors
+///
+/// Returns error if `buf` contains invalid UTF-8 chars.
+pub fn to_utf8_str(buf: &[u8]) -> Result<&str, StringError> {
+    if buf.len() > u16::MAX as usize {
+        return Err(StringError::TooManyData);
+    }
+    validate_utf8_bytes(buf)?;
+    // Safety: `buf` is checked to be well-formed UTF-8 above.
+    Ok(unsafe { std::str::from_utf8_unchecked(buf) })
 }
 
 /// `ClientId` is based on rules below:
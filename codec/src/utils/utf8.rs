@@ -0,0 +1,243 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Apache-2.0 License that can be found
+// in the LICENSE file.
+
+//! Single pass validator of MQTT UTF-8 encoded strings.
+//!
+//! Well-formedness of UTF-8 and code points not allowed in MQTT are checked
+//! together. Runs of printable ASCII characters, which make up most topics and
+//! client ids, are skipped with SSE2 or AVX2 instructions if available.
+
+use super::StringError;
+
+/// Validate `buf` as UTF-8 encoded string defined in MQTT.
+///
+/// # Errors
+///
+/// Returns `SeriousError` if `buf` is not well-formed UTF-8 or contains U+0000,
+/// and `InvalidChar` if it contains control characters U+0001..U+001F or U+007F..U+009F.
+pub fn validate_utf8_bytes(buf: &[u8]) -> Result<(), StringError> {
+    let mut pos = 0;
+    while pos < buf.len() {
+        pos += ascii_prefix(&buf[pos..]);
+        if pos < buf.len() {
+            pos = next_char(buf, pos)?;
+        }
+    }
+    Ok(())
+}
+
+/// Get number of leading printable ASCII characters, U+0020..U+007E.
+#[inline]
+fn ascii_prefix(buf: &[u8]) -> usize {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    {
+        if buf.len() >= 32 && is_x86_feature_detected!("avx2") {
+            // Safety: CPU feature is checked at runtime.
+            return unsafe { x86::ascii_prefix_avx2(buf) };
+        }
+        #[cfg(target_feature = "sse2")]
+        {
+            // Safety: SSE2 is enabled at compile time.
+            return unsafe { x86::ascii_prefix_sse2(buf) };
+        }
+    }
+
+    #[allow(unreachable_code)]
+    ascii_prefix_scalar(buf)
+}
+
+#[inline]
+fn ascii_prefix_scalar(buf: &[u8]) -> usize {
+    buf.iter()
+        .position(|byte| !(0x20..0x7f).contains(byte))
+        .unwrap_or(buf.len())
+}
+
+#[inline]
+fn continuation(buf: &[u8], pos: usize) -> Result<u8, StringError> {
+    match buf.get(pos) {
+        Some(&byte) if byte & 0xc0 == 0x80 => Ok(byte),
+        _ => Err(StringError::SeriousError),
+    }
+}
+
+/// Validate one character at `pos`, returns position of next character.
+///
+/// Byte ranges of well-formed sequences follow Table 3-7 of the Unicode Standard,
+/// which rejects overlong forms, surrogates and code points above U+10FFFF.
+fn next_char(buf: &[u8], pos: usize) -> Result<usize, StringError> {
+    let first = buf[pos];
+    match first {
+        // A UTF-8 encoded string MUST NOT include an encoding of the null character
+        // U+0000 [MQTT-1.5.3-2].
+        0x00 => Err(StringError::SeriousError),
+        0x01..=0x1f | 0x7f => Err(StringError::InvalidChar),
+        0x20..=0x7e => Ok(pos + 1),
+        0xc2..=0xdf => {
+            let second = continuation(buf, pos + 1)?;
+            // U+0080..U+009F control characters.
+            if first == 0xc2 && second <= 0x9f {
+                Err(StringError::InvalidChar)
+            } else {
+                Ok(pos + 2)
+            }
+        }
+        0xe0..=0xef => {
+            let second = continuation(buf, pos + 1)?;
+            let valid_second = match first {
+                0xe0 => second >= 0xa0,
+                // U+D800..U+DFFF surrogates [MQTT-1.5.3-1].
+                0xed => second <= 0x9f,
+                _ => true,
+            };
+            if !valid_second {
+                return Err(StringError::SeriousError);
+            }
+            continuation(buf, pos + 2)?;
+            Ok(pos + 3)
+        }
+        0xf0..=0xf4 => {
+            let second = continuation(buf, pos + 1)?;
+            let valid_second = match first {
+                0xf0 => second >= 0x90,
+                0xf4 => second <= 0x8f,
+                _ => true,
+            };
+            if !valid_second {
+                return Err(StringError::SeriousError);
+            }
+            continuation(buf, pos + 2)?;
+            continuation(buf, pos + 3)?;
+            Ok(pos + 4)
+        }
+        _ => Err(StringError::SeriousError),
+    }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+mod x86 {
+    #[cfg(target_arch = "x86")]
+    use std::arch::x86::*;
+    #[cfg(target_arch = "x86_64")]
+    use std::arch::x86_64::*;
+
+    use super::ascii_prefix_scalar;
+
+    #[allow(clippy::cast_possible_wrap)]
+    #[target_feature(enable = "sse2")]
+    pub(super) unsafe fn ascii_prefix_sse2(buf: &[u8]) -> usize {
+        let space = _mm_set1_epi8(0x1f);
+        let del = _mm_set1_epi8(0x7f);
+        let mut pos = 0;
+        while pos + 16 <= buf.len() {
+            let chunk = _mm_loadu_si128(buf.as_ptr().add(pos).cast::<__m128i>());
+            // Signed compare, bytes >= 0x80 are negative.
+            let printable =
+                _mm_andnot_si128(_mm_cmpeq_epi8(chunk, del), _mm_cmpgt_epi8(chunk, space));
+            let mask = _mm_movemask_epi8(printable) as u32;
+            if mask != 0xffff {
+                return pos + (!mask).trailing_zeros() as usize;
+            }
+            pos += 16;
+        }
+        pos + ascii_prefix_scalar(&buf[pos..])
+    }
+
+    #[allow(clippy::cast_possible_wrap, clippy::cast_sign_loss)]
+    #[target_feature(enable = "avx2")]
+    pub(super) unsafe fn ascii_prefix_avx2(buf: &[u8]) -> usize {
+        let space = _mm256_set1_epi8(0x1f);
+        let del = _mm256_set1_epi8(0x7f);
+        let mut pos = 0;
+        while pos + 32 <= buf.len() {
+            let chunk = _mm256_loadu_si256(buf.as_ptr().add(pos).cast::<__m256i>());
+            let printable = _mm256_andnot_si256(
+                _mm256_cmpeq_epi8(chunk, del),
+                _mm256_cmpgt_epi8(chunk, space),
+            );
+            let mask = _mm256_movemask_epi8(printable) as u32;
+            if mask != u32::MAX {
+                return pos + (!mask).trailing_zeros() as usize;
+            }
+            pos += 32;
+        }
+        pos + ascii_prefix_scalar(&buf[pos..])
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Two pass validation used before.
+    fn reference(buf: &[u8]) -> Result<(), StringError> {
+        let s = std::str::from_utf8(buf).map_err(|_| StringError::SeriousError)?;
+        for c in s.chars() {
+            if c == '\u{0000}' {
+                return Err(StringError::SeriousError);
+            }
+            if ('\u{0001}'..='\u{001f}').contains(&c) || ('\u{007f}'..='\u{009f}').contains(&c) {
+                return Err(StringError::InvalidChar);
+            }
+        }
+        Ok(())
+    }
+
+    #[test]
+    fn test_sequences() {
+        let valid: &[&[u8]] = &[
+            b"",
+            b"sport/tennis/player1",
+            "温度/传感器/1".as_bytes(),
+            "\u{00a0}\u{07ff}\u{0800}\u{d7ff}\u{e000}\u{fffd}\u{feff}".as_bytes(),
+            "\u{10000}\u{10ffff}".as_bytes(),
+        ];
+        for buf in valid {
+            assert_eq!(validate_utf8_bytes(buf), Ok(()));
+        }
+
+        let invalid: &[(&[u8], StringError)] = &[
+            (b"a\x00b", StringError::SeriousError),
+            (b"a\x1fb", StringError::InvalidChar),
+            (b"a\x7fb", StringError::InvalidChar),
+            (b"\xc2\x80", StringError::InvalidChar),
+            (b"\xc2\x9f", StringError::InvalidChar),
+            // Overlong forms.
+            (b"\xc0\xaf", StringError::SeriousError),
+            (b"\xe0\x80\xaf", StringError::SeriousError),
+            (b"\xf0\x80\x80\xaf", StringError::SeriousError),
+            // Surrogate.
+            (b"\xed\xa0\x80", StringError::SeriousError),
+            // Above U+10FFFF.
+            (b"\xf4\x90\x80\x80", StringError::SeriousError),
+            // Truncated and unexpected continuation bytes.
+            (b"\xe4\xbd", StringError::SeriousError),
+            (b"\x80", StringError::SeriousError),
+        ];
+        for (buf, err) in invalid {
+            assert_eq!(validate_utf8_bytes(buf).as_ref(), Err(err));
+            assert_eq!(reference(buf).as_ref(), Err(err));
+        }
+    }
+
+    #[test]
+    fn test_simd_boundaries() {
+        let bad_bytes: &[&[u8]] = &[b"\x00", b"\x01", b"\x7f", b"\xc2\x85", b"\xed\xb0\x80"];
+        for len in [15, 16, 31, 32, 33, 64, 100] {
+            let text = vec![b'a'; len];
+            assert_eq!(validate_utf8_bytes(&text), Ok(()));
+            for pos in 0..len {
+                for bad in bad_bytes {
+                    let mut buf = text.clone();
+                    buf.splice(pos..pos + 1, bad.iter().copied());
+                    assert_eq!(validate_utf8_bytes(&buf), reference(&buf));
+                    assert!(validate_utf8_bytes(&buf).is_err());
+                }
+                let mut buf = text.clone();
+                buf.splice(pos..pos + 1, "é".bytes());
+                assert_eq!(validate_utf8_bytes(&buf), Ok(()));
+            }
+        }
+    }
+}
@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use crate::{
     ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, FixedHeader, Packet,
     PacketType, VarIntError,
@@ -148,16 +150,15 @@ impl DecodePacket for ConnectAckPacket {
 }
 
 impl EncodePacket for ConnectAckPacket {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = buf.len();
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = FixedHeader::new(PacketType::ConnectAck, 2)?;
         fixed_header.encode(buf)?;
 
         let ack_flags = if self.session_present { 0b0000_0001 } else { 0 };
-        buf.push(ack_flags);
-        buf.push(self.return_code as u8);
+        buf.put_u8(ack_flags);
+        buf.put_u8(self.return_code as u8);
 
-        Ok(buf.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
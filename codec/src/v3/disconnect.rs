@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::default::Default;
 
 use crate::{
@@ -28,7 +29,7 @@ impl DisconnectPacket {
 }
 
 impl EncodePacket for DisconnectPacket {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         // No payload
         let fixed_header = FixedHeader::new(PacketType::Disconnect, 0)?;
         fixed_header.encode(v)
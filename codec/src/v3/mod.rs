@@ -22,7 +22,7 @@ pub use connect_ack::{ConnectAckPacket, ConnectReturnCode};
 pub use disconnect::DisconnectPacket;
 pub use ping_request::PingRequestPacket;
 pub use ping_response::PingResponsePacket;
-pub use publish::PublishPacket;
+pub use publish::{PublishPacket, PublishPacketRef};
 pub use publish_ack::PublishAckPacket;
 pub use publish_complete::PublishCompletePacket;
 pub use publish_received::PublishReceivedPacket;
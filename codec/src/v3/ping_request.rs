@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use crate::{
     ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, FixedHeader, Packet,
     PacketType, VarIntError,
@@ -25,7 +27,7 @@ impl PingRequestPacket {
 }
 
 impl EncodePacket for PingRequestPacket {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         // Payload is empty
         let fixed_header = FixedHeader::new(PacketType::PingRequest, 0)?;
         fixed_header.encode(v)
@@ -2,9 +2,9 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use bytes::BytesMut;
-use std::io::Write;
+use bytes::{BufMut, Bytes, BytesMut};
 
+use crate::topic::validate_pub_topic;
 use crate::{
     ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, FixedHeader, Packet, PacketId,
     PacketType, PubTopic, QoS, VarIntError,
@@ -83,8 +83,9 @@ pub struct PublishPacket {
     packet_id: PacketId,
 
     /// Payload contains `msg` field.
-    // TODO(Shaohua): Replace with Bytes or Vec<u8>, BytewMut is useless.
-    msg: BytesMut,
+    ///
+    /// It may share memory with the buffer this packet is decoded from.
+    msg: Bytes,
 }
 
 impl PublishPacket {
@@ -102,12 +103,33 @@ impl PublishPacket {
             retain: false,
             topic,
             packet_id: PacketId::new(0),
-            msg: BytesMut::from(msg),
+            msg: Bytes::copy_from_slice(msg),
         })
     }
 
+    /// Decode packet from `frame`.
+    ///
+    /// Payload of packet shares memory with `frame` instead of being copied.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if `frame` is not a valid publish packet.
+    pub fn decode_frame(frame: &Bytes) -> Result<Self, DecodeError> {
+        let mut ba = ByteArray::new(frame);
+        let packet = PublishPacketRef::decode(&mut ba)?;
+        let msg = if packet.msg.is_empty() {
+            Bytes::new()
+        } else {
+            frame.slice_ref(packet.msg)
+        };
+        Ok(packet.into_packet_with(msg))
+    }
+
     pub fn append(&mut self, msg_parts: &[u8]) {
-        self.msg.extend_from_slice(msg_parts);
+        let mut msg = BytesMut::with_capacity(self.msg.len() + msg_parts.len());
+        msg.extend_from_slice(&self.msg);
+        msg.extend_from_slice(msg_parts);
+        self.msg = msg.freeze();
     }
 
     /// Update `retain` flag.
@@ -189,6 +211,12 @@ impl PublishPacket {
         &self.msg
     }
 
+    /// Get a reference counted handle of payload.
+    #[must_use]
+    pub const fn message_bytes(&self) -> &Bytes {
+        &self.msg
+    }
+
     // TODO(Shaohua): Add message related operations.
 
     fn get_fixed_header(&self) -> Result<FixedHeader, VarIntError> {
@@ -206,8 +234,27 @@ impl PublishPacket {
     }
 }
 
-impl DecodePacket for PublishPacket {
-    fn decode(ba: &mut ByteArray) -> Result<Self, DecodeError> {
+/// Borrowed view of `PublishPacket`.
+///
+/// Topic and payload are borrowed from the input buffer, nothing is copied when decoding.
+#[allow(clippy::module_name_repetitions)]
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct PublishPacketRef<'a> {
+    dup: bool,
+    qos: QoS,
+    retain: bool,
+    topic: &'a str,
+    packet_id: PacketId,
+    msg: &'a [u8],
+}
+
+impl<'a> PublishPacketRef<'a> {
+    /// Decode packet from byte array.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if bytes are not a valid publish packet.
+    pub fn decode(ba: &mut ByteArray<'a>) -> Result<Self, DecodeError> {
         let fixed_header = FixedHeader::decode(ba)?;
 
         let (dup, qos, retain) =
@@ -229,8 +276,10 @@ impl DecodePacket for PublishPacket {
             return Err(DecodeError::InvalidPacketFlags);
         }
 
-        let topic = PubTopic::decode(ba)?;
-        log::info!("topic: {:?}", &topic);
+        let topic_len = ba.read_u16()? as usize;
+        let topic = ba.read_str(topic_len)?;
+        validate_pub_topic(topic)?;
+        let topic_bytes = 2 + topic_len;
 
         // Parse packet id.
         // The Packet Identifier field is only present in PUBLISH Packets where the QoS level is 1 or 2.
@@ -247,15 +296,15 @@ impl DecodePacket for PublishPacket {
         };
 
         // It is valid for a PUBLISH Packet to contain a zero length payload.
-        if fixed_header.remaining_length() < topic.bytes() {
+        if fixed_header.remaining_length() < topic_bytes {
             log::info!(
                 "remaining length: {}, topic bytes: {}",
                 fixed_header.remaining_length(),
-                topic.bytes()
+                topic_bytes
             );
             return Err(DecodeError::InvalidRemainingLength);
         }
-        let mut msg_len = fixed_header.remaining_length() - topic.bytes();
+        let mut msg_len = fixed_header.remaining_length() - topic_bytes;
         if qos != QoS::AtMostOnce {
             if msg_len < PacketId::bytes() {
                 return Err(DecodeError::InvalidRemainingLength);
@@ -265,7 +314,7 @@ impl DecodePacket for PublishPacket {
             msg_len -= PacketId::bytes();
         }
 
-        let msg = BytesMut::from(ba.read_bytes(msg_len)?);
+        let msg = ba.read_bytes(msg_len)?;
         Ok(Self {
             dup,
             qos,
@@ -275,12 +324,64 @@ impl DecodePacket for PublishPacket {
             msg,
         })
     }
+
+    #[must_use]
+    pub const fn dup(&self) -> bool {
+        self.dup
+    }
+
+    #[must_use]
+    pub const fn qos(&self) -> QoS {
+        self.qos
+    }
+
+    #[must_use]
+    pub const fn retain(&self) -> bool {
+        self.retain
+    }
+
+    #[must_use]
+    pub const fn topic(&self) -> &'a str {
+        self.topic
+    }
+
+    #[must_use]
+    pub const fn packet_id(&self) -> PacketId {
+        self.packet_id
+    }
+
+    #[must_use]
+    pub const fn message(&self) -> &'a [u8] {
+        self.msg
+    }
+
+    /// Convert to owned packet, payload is copied.
+    #[must_use]
+    pub fn into_packet(self) -> PublishPacket {
+        let msg = Bytes::copy_from_slice(self.msg);
+        self.into_packet_with(msg)
+    }
+
+    fn into_packet_with(self, msg: Bytes) -> PublishPacket {
+        PublishPacket {
+            dup: self.dup,
+            qos: self.qos,
+            retain: self.retain,
+            topic: PubTopic::new_unchecked(self.topic),
+            packet_id: self.packet_id,
+            msg,
+        }
+    }
 }
 
-impl EncodePacket for PublishPacket {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = v.len();
+impl DecodePacket for PublishPacket {
+    fn decode(ba: &mut ByteArray) -> Result<Self, DecodeError> {
+        PublishPacketRef::decode(ba).map(PublishPacketRef::into_packet)
+    }
+}
 
+impl EncodePacket for PublishPacket {
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = self.get_fixed_header()?;
         fixed_header.encode(v)?;
 
@@ -293,9 +394,9 @@ impl EncodePacket for PublishPacket {
         }
 
         // Write payload
-        v.write_all(&self.msg)?;
+        v.put_slice(&self.msg);
 
-        Ok(v.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
@@ -313,3 +414,29 @@ impl Packet for PublishPacket {
         Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_decode_frame() {
+        let mut packet = PublishPacket::new("sport/tennis", QoS::AtLeastOnce, b"hello").unwrap();
+        packet.set_packet_id(PacketId::new(7));
+        let mut buf = Vec::new();
+        packet.encode(&mut buf).unwrap();
+
+        let frame = Bytes::from(buf);
+        let decoded = PublishPacket::decode_frame(&frame).unwrap();
+        assert_eq!(decoded, packet);
+
+        // Payload points into frame.
+        let offset = decoded.message().as_ptr() as usize - frame.as_ptr() as usize;
+        assert_eq!(&frame[offset..], b"hello");
+
+        let mut ba = ByteArray::new(&frame);
+        let packet_ref = PublishPacketRef::decode(&mut ba).unwrap();
+        assert_eq!(packet_ref.topic(), "sport/tennis");
+        assert_eq!(packet_ref.into_packet(), packet);
+    }
+}
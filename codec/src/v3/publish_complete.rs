@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use crate::{
     ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, FixedHeader, Packet, PacketId,
     PacketType, VarIntError,
@@ -58,13 +60,11 @@ impl DecodePacket for PublishCompletePacket {
 }
 
 impl EncodePacket for PublishCompletePacket {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = buf.len();
-
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = FixedHeader::new(PacketType::PublishComplete, PacketId::bytes())?;
         fixed_header.encode(buf)?;
         self.packet_id.encode(buf)?;
-        Ok(buf.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
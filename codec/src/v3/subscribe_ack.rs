@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use crate::{
     ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, FixedHeader, Packet, PacketId,
     PacketType, QoS, VarIntError,
@@ -137,9 +139,7 @@ impl DecodePacket for SubscribeAckPacket {
 }
 
 impl EncodePacket for SubscribeAckPacket {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = buf.len();
-
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = self.get_fixed_header()?;
         fixed_header.encode(buf)?;
 
@@ -152,10 +152,10 @@ impl EncodePacket for SubscribeAckPacket {
                     SubscribeAck::QoS(qos) => qos as u8,
                 }
             };
-            buf.push(flag);
+            buf.put_u8(flag);
         }
 
-        Ok(buf.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use super::property::check_property_type_list;
 use super::{Properties, PropertyType, ReasonCode};
 use crate::{
@@ -76,16 +78,14 @@ pub const AUTH_PROPERTIES: &[PropertyType] = &[
 ];
 
 impl EncodePacket for AuthPacket {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = buf.len();
-
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let remaining_length = ReasonCode::bytes() + self.properties.bytes();
         let fixed_header = FixedHeader::new(PacketType::PingRequest, remaining_length)?;
         fixed_header.encode(buf)?;
         self.reason_code.encode(buf)?;
         self.properties.encode(buf)?;
 
-        Ok(buf.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::convert::TryFrom;
 
 use super::property::check_property_type_list;
@@ -459,9 +460,7 @@ impl ConnectPacket {
 }
 
 impl EncodePacket for ConnectPacket {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = v.len();
-
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         // Write fixed header
         let fixed_header = self.get_fixed_header()?;
         fixed_header.encode(v)?;
@@ -490,7 +489,7 @@ impl EncodePacket for ConnectPacket {
             self.password.encode(v)?;
         }
 
-        Ok(v.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use super::property::check_property_type_list;
 use super::{Properties, PropertyType, ReasonCode};
 use crate::{
@@ -206,19 +208,17 @@ impl DecodePacket for ConnectAckPacket {
 }
 
 impl EncodePacket for ConnectAckPacket {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = buf.len();
-
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let remaining_length = 1 + ReasonCode::bytes() + self.properties.bytes();
         let fixed_header = FixedHeader::new(PacketType::ConnectAck, remaining_length)?;
         fixed_header.encode(buf)?;
 
         let ack_flags = if self.session_present { 0b0000_0001 } else { 0 };
-        buf.push(ack_flags);
+        buf.put_u8(ack_flags);
         self.reason_code.encode(buf)?;
         self.properties.encode(buf)?;
 
-        Ok(buf.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
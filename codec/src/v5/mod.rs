@@ -14,6 +14,7 @@ mod publish_ack;
 mod publish_complete;
 mod publish_received;
 mod publish_release;
+mod raw_properties;
 mod reason_code;
 mod subscribe;
 mod subscribe_ack;
@@ -27,7 +28,7 @@ pub use disconnect::{DisconnectPacket, DISCONNECT_PROPERTIES, DISCONNECT_REASONS
 pub use ping_request::PingRequestPacket;
 pub use ping_response::PingResponsePacket;
 pub use property::{Properties, Property, PropertyType};
-pub use publish::PublishPacket;
+pub use publish::{PublishPacket, PublishPacketRef, PUBLISH_PROPERTIES};
 pub use publish_ack::{PublishAckPacket, PUBLISH_ACK_PROPERTIES, PUBLISH_ACK_REASONS};
 pub use publish_complete::{
     PublishCompletePacket, PUBLISH_COMPLETE_PROPERTIES, PUBLISH_COMPLETE_REASONS,
@@ -38,8 +39,9 @@ pub use publish_received::{
 pub use publish_release::{
     PublishReleasePacket, PUBLISH_RELEASE_PROPERTIES, PUBLISH_RELEASE_REASONS,
 };
+pub use raw_properties::RawProperties;
 pub use reason_code::ReasonCode;
-pub use subscribe::SubscribePacket;
+pub use subscribe::{RetainHandling, SubscribePacket};
 pub use subscribe_ack::{SubscribeAckPacket, SUBSCRIBE_ACK_PROPERTIES, SUBSCRIBE_REASONS};
 pub use unsubscribe::{UnsubscribePacket, UNSUBSCRIBE_PROPERTIES};
 pub use unsubscribe_ack::{UnsubscribeAckPacket, UNSUBSCRIBE_ACK_PROPERTIES, UNSUBSCRIBE_REASONS};
@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::convert::TryFrom;
 
 use crate::{
@@ -848,6 +849,14 @@ impl DecodePacket for Property {
                 let reference = StringData::decode(ba)?;
                 Ok(Self::ServerReference(reference))
             }
+            PropertyType::ReasonString => {
+                let reason = StringData::decode(ba)?;
+                Ok(Self::ReasonString(reason))
+            }
+            PropertyType::TopicAliasMaximum => {
+                let max = U16Data::decode(ba)?;
+                Ok(Self::TopicAliasMaximum(max))
+            }
             PropertyType::TopicAlias => {
                 let alias = U16Data::decode(ba)?;
                 Ok(Self::TopicAlias(alias))
@@ -859,16 +868,15 @@ impl DecodePacket for Property {
                 }
                 Ok(Self::SubscriptionIdentifier(id))
             }
-            _ => unimplemented!(),
         }
     }
 }
 
 impl EncodePacket for Property {
     #[allow(clippy::match_same_arms)]
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let property_type_byte = self.property_type() as u8;
-        buf.push(property_type_byte);
+        buf.put_u8(property_type_byte);
         let value_bytes = match self {
             Self::AssignedClientIdentifier(client_id) => client_id.encode(buf)?,
             Self::AuthenticationData(data) => data.encode(buf)?,
@@ -918,11 +926,16 @@ impl Properties {
         Self::default()
     }
 
-    /// Get byte length of property list.
+    /// Get byte length of property list, including property length.
     #[must_use]
     pub fn bytes(&self) -> usize {
-        let len = VarInt::from(self.len()).unwrap();
-        len.bytes() + self.0.iter().map(Property::bytes).sum::<usize>()
+        let list_bytes = self.list_bytes();
+        VarInt::from(list_bytes).map_or(0, |len| len.bytes()) + list_bytes
+    }
+
+    /// Get byte length of properties, which is the property length in packet.
+    fn list_bytes(&self) -> usize {
+        self.0.iter().map(Property::bytes).sum::<usize>()
     }
 
     /// Get length of property list.
@@ -994,21 +1007,30 @@ impl DecodePacket for Properties {
         }
 
         let remaining_length = VarInt::decode(ba)?;
-        let mut remaining_length = remaining_length.value();
+        let data = ba.read_bytes(remaining_length.value())?;
+        Self::decode_list(&mut ByteArray::new(data))
+    }
+}
+
+impl Properties {
+    /// Decode all properties in `ba`, which does not contain property length.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if any property is invalid.
+    pub fn decode_list(ba: &mut ByteArray) -> Result<Self, DecodeError> {
         let mut properties = Vec::new();
-        while remaining_length > 0 {
-            let property = Property::decode(ba)?;
-            remaining_length -= property.bytes();
-            properties.push(property);
+        while ba.remaining_bytes() > 0 {
+            properties.push(Property::decode(ba)?);
         }
-
         Ok(Self(properties))
     }
 }
 
 impl EncodePacket for Properties {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let len = VarInt::from(self.len())?;
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
+        // Property length is byte length of properties, not number of properties.
+        let len = VarInt::from(self.list_bytes())?;
         let mut bytes_written = len.bytes();
         len.encode(buf)?;
         for property in &self.0 {
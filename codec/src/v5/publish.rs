@@ -2,10 +2,10 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use std::io::Write;
+use bytes::{BufMut, Bytes, BytesMut};
 
-use super::property::check_property_type_list;
-use super::{Properties, PropertyType};
+use super::{Properties, PropertyType, RawProperties};
+use crate::topic::validate_pub_topic;
 use crate::{
     ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, FixedHeader, Packet, PacketId,
     PacketType, PubTopic, QoS, VarIntError,
@@ -146,10 +146,13 @@ pub struct PublishPacket {
     /// The Packet Identifier field is only present in PUBLISH packets where the QoS level is 1 or 2.
     packet_id: PacketId,
 
-    properties: Properties,
+    /// Properties are kept encoded, and forwarded without being decoded.
+    properties: RawProperties,
 
     /// Payload contains `msg` field.
-    msg: Vec<u8>,
+    ///
+    /// It may share memory with the buffer this packet is decoded from.
+    msg: Bytes,
 }
 
 /// Properties available in publish packets.
@@ -212,21 +215,42 @@ impl PublishPacket {
     /// Returns error if `topic` is invalid.
     pub fn new(topic: &str, qos: QoS, msg: &[u8]) -> Result<Self, EncodeError> {
         let topic = PubTopic::new(topic)?;
-        let msg = msg.to_vec();
+        let msg = Bytes::copy_from_slice(msg);
         Ok(Self {
             qos,
             dup: false,
             retain: false,
             topic,
             packet_id: PacketId::new(0),
-            properties: Properties::new(),
+            properties: RawProperties::new(),
             msg,
         })
     }
 
     /// Append bytes to messages.
+    /// Decode packet from `frame`.
+    ///
+    /// Payload of packet shares memory with `frame` instead of being copied.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if `frame` is not a valid publish packet.
+    pub fn decode_frame(frame: &Bytes) -> Result<Self, DecodeError> {
+        let mut ba = ByteArray::new(frame);
+        let packet = PublishPacketRef::decode_with(&mut ba, |data| frame.slice_ref(data))?;
+        let msg = if packet.msg.is_empty() {
+            Bytes::new()
+        } else {
+            frame.slice_ref(packet.msg)
+        };
+        Ok(packet.into_packet_with(msg))
+    }
+
     pub fn append(&mut self, msg_parts: &[u8]) {
-        self.msg.extend_from_slice(msg_parts);
+        let mut msg = BytesMut::with_capacity(self.msg.len() + msg_parts.len());
+        msg.extend_from_slice(&self.msg);
+        msg.extend_from_slice(msg_parts);
+        self.msg = msg.freeze();
     }
 
     /// Update `retian` flag.
@@ -306,14 +330,19 @@ impl PublishPacket {
         self.topic.as_ref()
     }
 
-    /// Get a mutable reference to property list.
-    pub fn properties_mut(&mut self) -> &mut Properties {
-        &mut self.properties
+    /// Update property list.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if properties are too large to encode.
+    pub fn set_properties(&mut self, properties: &Properties) -> Result<&mut Self, EncodeError> {
+        self.properties = RawProperties::from_properties(properties)?;
+        Ok(self)
     }
 
     /// Get a reference to property list.
     #[must_use]
-    pub const fn properties(&self) -> &Properties {
+    pub const fn properties(&self) -> &RawProperties {
         &self.properties
     }
 
@@ -323,11 +352,14 @@ impl PublishPacket {
         &self.msg
     }
 
+    /// Get a reference counted handle of payload.
+    #[must_use]
+    pub const fn message_bytes(&self) -> &Bytes {
+        &self.msg
+    }
+
     fn get_fixed_header(&self) -> Result<FixedHeader, VarIntError> {
-        // TODO(Shaohua): Add properties.bytes()
-        let mut remaining_length = self.topic.bytes()
-            //+ self.properties.bytes()
-            + self.msg.len();
+        let mut remaining_length = self.topic.bytes() + self.properties.bytes() + self.msg.len();
         if self.qos != QoS::AtMostOnce {
             remaining_length += PacketId::bytes();
         }
@@ -341,8 +373,37 @@ impl PublishPacket {
     }
 }
 
-impl DecodePacket for PublishPacket {
-    fn decode(ba: &mut ByteArray) -> Result<Self, DecodeError> {
+/// Borrowed view of `PublishPacket`.
+///
+/// Topic and payload are borrowed from the input buffer, only encoded property list
+/// is copied when decoding.
+#[allow(clippy::module_name_repetitions)]
+#[derive(Clone, Debug, PartialEq)]
+pub struct PublishPacketRef<'a> {
+    dup: bool,
+    qos: QoS,
+    retain: bool,
+    topic: &'a str,
+    packet_id: PacketId,
+    properties: RawProperties,
+    msg: &'a [u8],
+}
+
+impl<'a> PublishPacketRef<'a> {
+    /// Decode packet from byte array.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if bytes are not a valid publish packet.
+    pub fn decode(ba: &mut ByteArray<'a>) -> Result<Self, DecodeError> {
+        Self::decode_with(ba, Bytes::copy_from_slice)
+    }
+
+    /// Decode packet, `slice_properties` converts encoded property list to `Bytes`.
+    fn decode_with<F>(ba: &mut ByteArray<'a>, slice_properties: F) -> Result<Self, DecodeError>
+    where
+        F: FnOnce(&'a [u8]) -> Bytes,
+    {
         let fixed_header = FixedHeader::decode(ba)?;
         let (dup, qos, retain) =
             if let PacketType::Publish { dup, qos, retain } = fixed_header.packet_type() {
@@ -363,7 +424,10 @@ impl DecodePacket for PublishPacket {
             return Err(DecodeError::InvalidPacketFlags);
         }
 
-        let topic = PubTopic::decode(ba)?;
+        let header_end = ba.offset();
+        let topic_len = ba.read_u16()? as usize;
+        let topic = ba.read_str(topic_len)?;
+        validate_pub_topic(topic)?;
 
         // Parse packet id.
         //
@@ -382,33 +446,22 @@ impl DecodePacket for PublishPacket {
             packet_id
         };
 
-        let properties = Properties::decode(ba)?;
-        if let Err(property_type) = check_property_type_list(properties.props(), PUBLISH_PROPERTIES)
-        {
-            log::error!(
-                "v5/PublishPacket: property type {:?} cannot be used in properties!",
-                property_type
-            );
-            return Err(DecodeError::InvalidPropertyType);
-        }
+        // Properties are validated but not decoded.
+        let properties = RawProperties::decode_with(ba, PUBLISH_PROPERTIES, slice_properties)?;
 
-        let got_length = if qos == QoS::AtMostOnce {
-            topic.bytes() + properties.bytes()
-        } else {
-            topic.bytes() + properties.bytes() + PacketId::bytes()
-        };
+        // Length of variable header, read from byte array directly.
+        let got_length = ba.offset() - header_end;
         // It is valid for a PUBLISH Packet to contain a zero length payload.
         if fixed_header.remaining_length() < got_length {
             log::error!(
                 "got {} bytes, expected: {}",
-                topic.bytes(),
+                got_length,
                 fixed_header.remaining_length()
             );
             return Err(DecodeError::InvalidRemainingLength);
         }
         let payload_len = fixed_header.remaining_length() - got_length;
         let msg = ba.read_bytes(payload_len)?;
-        let msg = msg.to_vec();
         Ok(Self {
             dup,
             qos,
@@ -419,12 +472,70 @@ impl DecodePacket for PublishPacket {
             msg,
         })
     }
+
+    #[must_use]
+    pub const fn dup(&self) -> bool {
+        self.dup
+    }
+
+    #[must_use]
+    pub const fn qos(&self) -> QoS {
+        self.qos
+    }
+
+    #[must_use]
+    pub const fn retain(&self) -> bool {
+        self.retain
+    }
+
+    #[must_use]
+    pub const fn topic(&self) -> &'a str {
+        self.topic
+    }
+
+    #[must_use]
+    pub const fn packet_id(&self) -> PacketId {
+        self.packet_id
+    }
+
+    #[must_use]
+    pub const fn properties(&self) -> &RawProperties {
+        &self.properties
+    }
+
+    #[must_use]
+    pub const fn message(&self) -> &'a [u8] {
+        self.msg
+    }
+
+    /// Convert to owned packet, payload is copied.
+    #[must_use]
+    pub fn into_packet(self) -> PublishPacket {
+        let msg = Bytes::copy_from_slice(self.msg);
+        self.into_packet_with(msg)
+    }
+
+    fn into_packet_with(self, msg: Bytes) -> PublishPacket {
+        PublishPacket {
+            dup: self.dup,
+            qos: self.qos,
+            retain: self.retain,
+            topic: PubTopic::new_unchecked(self.topic),
+            packet_id: self.packet_id,
+            properties: self.properties,
+            msg,
+        }
+    }
 }
 
-impl EncodePacket for PublishPacket {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = v.len();
+impl DecodePacket for PublishPacket {
+    fn decode(ba: &mut ByteArray) -> Result<Self, DecodeError> {
+        PublishPacketRef::decode(ba).map(PublishPacketRef::into_packet)
+    }
+}
 
+impl EncodePacket for PublishPacket {
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = self.get_fixed_header()?;
         fixed_header.encode(v)?;
 
@@ -439,9 +550,9 @@ impl EncodePacket for PublishPacket {
         self.properties.encode(v)?;
 
         // Write payload
-        v.write_all(&self.msg)?;
+        v.put_slice(&self.msg);
 
-        Ok(v.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
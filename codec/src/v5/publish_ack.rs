@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use super::property::check_property_type_list;
 use super::{Properties, PropertyType, ReasonCode};
 use crate::{
@@ -131,20 +133,18 @@ impl PublishAckPacket {
 }
 
 impl EncodePacket for PublishAckPacket {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = buf.len();
-
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = self.get_fixed_header()?;
         fixed_header.encode(buf)?;
         self.packet_id.encode(buf)?;
         if self.reason_code != ReasonCode::Success || !self.properties.is_empty() {
-            buf.push(self.reason_code as u8);
+            buf.put_u8(self.reason_code as u8);
         }
         if !self.properties.is_empty() {
             self.properties.encode(buf)?;
         }
 
-        Ok(buf.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
@@ -0,0 +1,355 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Apache-2.0 License that can be found
+// in the LICENSE file.
+
+use bytes::{BufMut, Bytes, BytesMut};
+use std::convert::TryFrom;
+
+use super::property::MULTIPLE_PROPERTIES;
+use super::{Properties, PropertyType};
+use crate::topic::validate_pub_topic;
+use crate::utils::validate_client_id;
+use crate::{
+    BoolData, ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket, QoS, VarInt,
+};
+
+/// Offsets of properties which are inspected by broker.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub(crate) struct PropertyIndex {
+    message_expiry_interval: Option<usize>,
+    topic_alias: Option<usize>,
+    subscription_identifiers: Vec<usize>,
+}
+
+/// Property list kept as encoded bytes, which is decoded lazily.
+///
+/// When decoding a packet, properties are validated without allocation and only
+/// offsets of Message Expiry Interval, Topic Alias and Subscription Identifier are
+/// indexed. Other properties, like user properties, are forwarded to subscribers
+/// with the bytes as they are received.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct RawProperties {
+    /// Property length, in bytes.
+    len: VarInt,
+
+    /// Encoded property list, without property length.
+    data: Bytes,
+
+    index: PropertyIndex,
+}
+
+impl Default for RawProperties {
+    fn default() -> Self {
+        Self {
+            len: VarInt::default(),
+            data: Bytes::new(),
+            index: PropertyIndex::default(),
+        }
+    }
+}
+
+fn read_str<'a>(ba: &mut ByteArray<'a>) -> Result<&'a str, DecodeError> {
+    let len = ba.read_u16()?;
+    Ok(ba.read_str(len as usize)?)
+}
+
+/// Skip value of a property, with the same checks as `Property::decode()`.
+fn skip_value(ba: &mut ByteArray, property_type: PropertyType) -> Result<(), DecodeError> {
+    match property_type {
+        PropertyType::PayloadFormatIndicator
+        | PropertyType::RequestProblemInformation
+        | PropertyType::RequestResponseInformation
+        | PropertyType::RetainAvailable
+        | PropertyType::WildcardSubscriptionAvailable
+        | PropertyType::SubscriptionIdentifierAvailable
+        | PropertyType::SharedSubscriptionAvailable => {
+            BoolData::decode(ba)?;
+        }
+        PropertyType::MaximumQoS => {
+            let qos = QoS::decode(ba)?;
+            if qos != QoS::AtLeastOnce && qos != QoS::AtMostOnce {
+                return Err(DecodeError::InvalidPropertyValue);
+            }
+        }
+        PropertyType::ServerKeepAlive
+        | PropertyType::ReceiveMaximum
+        | PropertyType::TopicAliasMaximum
+        | PropertyType::TopicAlias => {
+            ba.read_u16()?;
+        }
+        PropertyType::MessageExpiryInterval
+        | PropertyType::SessionExpiryInterval
+        | PropertyType::WillDelayInterval
+        | PropertyType::MaximumPacketSize => {
+            ba.read_u32()?;
+        }
+        PropertyType::SubscriptionIdentifier => {
+            let id = VarInt::decode(ba)?;
+            if id.value() == 0 {
+                return Err(DecodeError::InvalidPropertyValue);
+            }
+        }
+        PropertyType::ContentType
+        | PropertyType::AuthenticationMethod
+        | PropertyType::ResponseInformation
+        | PropertyType::ServerReference
+        | PropertyType::ReasonString => {
+            read_str(ba)?;
+        }
+        PropertyType::ResponseTopic => validate_pub_topic(read_str(ba)?)?,
+        PropertyType::AssignedClientIdentifier => validate_client_id(read_str(ba)?)?,
+        PropertyType::UserProperty => {
+            read_str(ba)?;
+            read_str(ba)?;
+        }
+        PropertyType::CorrelationData | PropertyType::AuthenticationData => {
+            let len = ba.read_u16()?;
+            ba.read_bytes(len as usize)?;
+        }
+    }
+    Ok(())
+}
+
+/// Validate encoded property list and index offsets of properties.
+///
+/// If `types` is set, only properties in it are allowed, and only user properties
+/// and subscription identifiers may appear more than once.
+fn scan(data: &[u8], types: Option<&[PropertyType]>) -> Result<PropertyIndex, DecodeError> {
+    let mut ba = ByteArray::new(data);
+    let mut index = PropertyIndex::default();
+    // Property types are less than 64.
+    let mut found: u64 = 0;
+
+    while ba.remaining_bytes() > 0 {
+        let offset = ba.offset();
+        let property_type = PropertyType::try_from(ba.read_byte()?)?;
+        if let Some(types) = types {
+            let mask = 1_u64 << (property_type as u8);
+            if !types.contains(&property_type)
+                || (found & mask != 0 && !MULTIPLE_PROPERTIES.contains(&property_type))
+            {
+                log::error!(
+                    "v5/RawProperties: property type {:?} cannot be used in properties!",
+                    property_type
+                );
+                return Err(DecodeError::InvalidPropertyType);
+            }
+            found |= mask;
+        }
+        skip_value(&mut ba, property_type)?;
+
+        match property_type {
+            PropertyType::MessageExpiryInterval => index.message_expiry_interval = Some(offset),
+            PropertyType::TopicAlias => index.topic_alias = Some(offset),
+            PropertyType::SubscriptionIdentifier => index.subscription_identifiers.push(offset),
+            _ => (),
+        }
+    }
+
+    Ok(index)
+}
+
+impl RawProperties {
+    /// Create an empty property list.
+    #[must_use]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Encode `properties` into a raw property list.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if properties are too large to encode.
+    pub fn from_properties(properties: &Properties) -> Result<Self, EncodeError> {
+        let mut data = BytesMut::with_capacity(properties.bytes());
+        for property in properties.props() {
+            property.encode(&mut data)?;
+        }
+        Self::from_data(data.freeze())
+    }
+
+    /// Build property list from encoded properties, without property length.
+    fn from_data(data: Bytes) -> Result<Self, EncodeError> {
+        let len = VarInt::from(data.len())?;
+        let index = scan(&data, None).map_err(|_err| EncodeError::InvalidData)?;
+        Ok(Self { len, data, index })
+    }
+
+    /// Decode property list and validate properties in it.
+    ///
+    /// `slice_data` converts encoded properties to `Bytes`, by copying or
+    /// by slicing the buffer which `ba` reads from.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if any property is invalid or not in `types`.
+    pub(crate) fn decode_with<'a, F>(
+        ba: &mut ByteArray<'a>,
+        types: &[PropertyType],
+        slice_data: F,
+    ) -> Result<Self, DecodeError>
+    where
+        F: FnOnce(&'a [u8]) -> Bytes,
+    {
+        // If Property Length is not present in packet Variable Header, use default value.
+        if ba.remaining_bytes() == 0 {
+            return Ok(Self::new());
+        }
+
+        let len = VarInt::decode(ba)?;
+        let data = ba.read_bytes(len.value())?;
+        let index = scan(data, Some(types))?;
+        let data = if data.is_empty() {
+            Bytes::new()
+        } else {
+            slice_data(data)
+        };
+        Ok(Self { len, data, index })
+    }
+
+    /// Decode property list, encoded properties are copied.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if any property is invalid or not in `types`.
+    pub fn decode(ba: &mut ByteArray, types: &[PropertyType]) -> Result<Self, DecodeError> {
+        Self::decode_with(ba, types, Bytes::copy_from_slice)
+    }
+
+    /// Get byte length in packet, including property length.
+    #[must_use]
+    pub const fn bytes(&self) -> usize {
+        self.len.bytes() + self.data.len()
+    }
+
+    /// Check whether property list is empty.
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.data.is_empty()
+    }
+
+    /// Get encoded properties, without property length.
+    #[must_use]
+    pub const fn data(&self) -> &Bytes {
+        &self.data
+    }
+
+    /// Get value of Message Expiry Interval property, in seconds.
+    #[must_use]
+    pub fn message_expiry_interval(&self) -> Option<u32> {
+        self.index.message_expiry_interval.and_then(|offset| {
+            let mut ba = ByteArray::new(&self.data[offset + 1..]);
+            ba.read_u32().ok()
+        })
+    }
+
+    /// Get value of Topic Alias property.
+    #[must_use]
+    pub fn topic_alias(&self) -> Option<u16> {
+        self.index.topic_alias.and_then(|offset| {
+            let mut ba = ByteArray::new(&self.data[offset + 1..]);
+            ba.read_u16().ok()
+        })
+    }
+
+    /// Get values of Subscription Identifier properties.
+    pub fn subscription_identifiers(&self) -> impl Iterator<Item = usize> + '_ {
+        self.index
+            .subscription_identifiers
+            .iter()
+            .filter_map(move |&offset| {
+                let mut ba = ByteArray::new(&self.data[offset + 1..]);
+                VarInt::decode(&mut ba).ok().map(|id| id.value())
+            })
+    }
+
+    /// Decode all properties in list.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if properties are invalid.
+    pub fn to_properties(&self) -> Result<Properties, DecodeError> {
+        let mut ba = ByteArray::new(&self.data);
+        Properties::decode_list(&mut ba)
+    }
+
+    /// Get a copy of property list without Topic Alias.
+    ///
+    /// Topic Alias mappings are scoped to a Network Connection, so this property
+    /// is removed when a message is forwarded to other clients. Encoded properties
+    /// are shared if Topic Alias is not present.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if properties are invalid.
+    pub fn without_topic_alias(&self) -> Result<Self, EncodeError> {
+        match self.index.topic_alias {
+            None => Ok(self.clone()),
+            Some(offset) => {
+                // Property type and a Two Byte Integer.
+                let end = offset + 1 + 2;
+                let mut data = BytesMut::with_capacity(self.data.len() - (end - offset));
+                data.extend_from_slice(&self.data[..offset]);
+                data.extend_from_slice(&self.data[end..]);
+                Self::from_data(data.freeze())
+            }
+        }
+    }
+}
+
+impl EncodePacket for RawProperties {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
+        self.len.encode(buf)?;
+        buf.put_slice(&self.data);
+        Ok(self.bytes())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::v5::{Property, PUBLISH_PROPERTIES};
+    use crate::{StringPairData, U16Data, U32Data};
+
+    #[test]
+    fn test_lazy_decode() {
+        let mut properties = Properties::new();
+        properties
+            .push(Property::MessageExpiryInterval(U32Data::new(60)))
+            .unwrap();
+        properties
+            .push(Property::UserProperty(
+                StringPairData::new("key", "value").unwrap(),
+            ))
+            .unwrap();
+        properties
+            .push(Property::TopicAlias(U16Data::new(3)))
+            .unwrap();
+        let mut buf = Vec::new();
+        properties.encode(&mut buf).unwrap();
+        assert_eq!(buf.len(), properties.bytes());
+
+        let mut ba = ByteArray::new(&buf);
+        let raw = RawProperties::decode(&mut ba, PUBLISH_PROPERTIES).unwrap();
+        assert_eq!(raw.bytes(), buf.len());
+        assert_eq!(raw.message_expiry_interval(), Some(60));
+        assert_eq!(raw.topic_alias(), Some(3));
+        assert_eq!(raw.subscription_identifiers().count(), 0);
+        assert_eq!(raw.to_properties().unwrap(), properties);
+
+        let forward = raw.without_topic_alias().unwrap();
+        assert_eq!(forward.topic_alias(), None);
+        assert_eq!(forward.message_expiry_interval(), Some(60));
+        assert_eq!(forward.bytes(), raw.bytes() - 3);
+
+        // Topic Alias MUST NOT appear more than once.
+        properties
+            .push(Property::TopicAlias(U16Data::new(4)))
+            .unwrap();
+        buf.clear();
+        properties.encode(&mut buf).unwrap();
+        let mut ba = ByteArray::new(&buf);
+        assert!(RawProperties::decode(&mut ba, PUBLISH_PROPERTIES).is_err());
+    }
+}
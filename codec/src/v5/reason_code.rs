@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::convert::TryFrom;
 
 use crate::{ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket};
@@ -414,8 +415,8 @@ impl DecodePacket for ReasonCode {
 }
 
 impl EncodePacket for ReasonCode {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        buf.push(*self as u8);
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
+        buf.put_u8(*self as u8);
         Ok(Self::bytes())
     }
 }
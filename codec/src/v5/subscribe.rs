@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::convert::TryFrom;
 
 use super::{
@@ -174,7 +175,7 @@ impl SubscribeTopic {
 }
 
 impl EncodePacket for SubscribeTopic {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         self.topic.encode(buf)?;
         let mut flag: u8 = 0b0000_0011 & (self.qos as u8);
         if self.no_local {
@@ -184,7 +185,7 @@ impl EncodePacket for SubscribeTopic {
             flag |= 0b0000_1000;
         }
         flag |= 0b0011_0000 & (self.retain_handling as u8);
-        buf.push(flag);
+        buf.put_u8(flag);
 
         Ok(self.bytes())
     }
@@ -412,9 +413,7 @@ impl DecodePacket for SubscribePacket {
 }
 
 impl EncodePacket for SubscribePacket {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = buf.len();
-
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = self.get_fixed_header()?;
         fixed_header.encode(buf)?;
 
@@ -426,7 +425,7 @@ impl EncodePacket for SubscribePacket {
             topic.encode(buf)?;
         }
 
-        Ok(buf.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
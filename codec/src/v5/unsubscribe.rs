@@ -2,6 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
+
 use super::property::check_property_type_list;
 use super::{Properties, PropertyType};
 use crate::{
@@ -204,9 +206,7 @@ impl DecodePacket for UnsubscribePacket {
 }
 
 impl EncodePacket for UnsubscribePacket {
-    fn encode(&self, v: &mut Vec<u8>) -> Result<usize, EncodeError> {
-        let old_len = v.len();
-
+    fn encode<B: BufMut>(&self, v: &mut B) -> Result<usize, EncodeError> {
         let fixed_header = self.get_fixed_header()?;
         fixed_header.encode(v)?;
 
@@ -217,7 +217,7 @@ impl EncodePacket for UnsubscribePacket {
             topic.encode(v)?;
         }
 
-        Ok(v.len() - old_len)
+        Ok(fixed_header.bytes() + fixed_header.remaining_length())
     }
 }
 
@@ -2,6 +2,7 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
+use bytes::BufMut;
 use std::fmt;
 
 use crate::{ByteArray, DecodeError, DecodePacket, EncodeError, EncodePacket};
@@ -96,12 +97,43 @@ impl VarInt {
         Ok(())
     }
 
+    /// Decode var int from 4 bytes at once, instead of reading byte by byte.
+    ///
+    /// Returns var int and number of bytes it consumes, bytes after the last one
+    /// are ignored.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if continuation bit is set in all of the 4 bytes.
+    pub fn decode_word(bytes: [u8; 4]) -> Result<(Self, usize), DecodeError> {
+        // Most packets are smaller than 128 bytes.
+        if bytes[0] & 0x80 == 0 {
+            return Ok((Self(bytes[0] as usize), 1));
+        }
+        let word = u32::from_le_bytes(bytes);
+
+        // The last byte is the first one without continuation bit.
+        let last_bytes = !word & 0x8080_8080;
+        if last_bytes == 0 {
+            return Err(DecodeError::InvalidVarInt);
+        }
+        let len = (last_bytes.trailing_zeros() / 8 + 1) as usize;
+        let word = word & (u32::MAX >> (32 - 8 * len));
+
+        // Pack the lower 7 bits of each byte.
+        let value = (word & 0x7f)
+            | ((word >> 1) & 0x3f80)
+            | ((word >> 2) & 0x001f_c000)
+            | ((word >> 3) & 0x0fe0_0000);
+        Ok((Self(value as usize), len))
+    }
+
     /// Returns number of bytes of this var int object consums.
     #[must_use]
     pub const fn bytes(&self) -> usize {
-        if self.0 > 0x007f_ffff {
+        if self.0 > 0x001f_ffff {
             4
-        } else if self.0 > 0x7fff {
+        } else if self.0 > 0x3fff {
             3
         } else if self.0 > 0x7f {
             2
@@ -119,33 +151,23 @@ impl fmt::Display for VarInt {
 
 impl DecodePacket for VarInt {
     fn decode(ba: &mut ByteArray) -> Result<Self, DecodeError> {
-        let mut byte: usize;
-        let mut remaining_length: usize = 0;
-        let mut multiplier = 1;
-
-        // Read variant length
-        loop {
-            byte = ba.read_byte()? as usize;
-            remaining_length += (byte & 127) * multiplier;
-            multiplier *= 128;
-
-            if multiplier > 128 * 128 * 128 * 128 {
-                return Err(DecodeError::InvalidVarInt);
-            }
-
-            if (byte & 128) == 0 {
-                break;
+        let mut value: usize = 0;
+        // The maximum number of bytes in the Variable Byte Integer field is four.
+        for shift in (0..28).step_by(7) {
+            let byte = ba.read_byte()?;
+            value |= ((byte & 0x7f) as usize) << shift;
+            if byte & 0x80 == 0 {
+                return Ok(Self(value));
             }
         }
-
-        Ok(Self(remaining_length))
+        Err(DecodeError::InvalidVarInt)
     }
 }
 
 impl EncodePacket for VarInt {
-    fn encode(&self, buf: &mut Vec<u8>) -> Result<usize, EncodeError> {
+    fn encode<B: BufMut>(&self, buf: &mut B) -> Result<usize, EncodeError> {
         if self.0 == 0 {
-            buf.push(0);
+            buf.put_u8(0);
             return Ok(1);
         }
 
@@ -159,7 +181,7 @@ impl EncodePacket for VarInt {
                 m |= 128;
             }
             #[allow(clippy::cast_possible_truncation)]
-            buf.push(m as u8);
+            buf.put_u8(m as u8);
         }
         Ok(count)
     }
@@ -186,11 +208,13 @@ mod tests {
         let remaining_len = VarInt(16_385);
         let _ret = remaining_len.encode(&mut buf);
         assert_eq!(&buf, &[0x81, 0x80, 0x01]);
+        assert_eq!(remaining_len.bytes(), buf.len());
         buf.clear();
 
         let remaining_len = VarInt(2_097_152);
         let _ret = remaining_len.encode(&mut buf);
         assert_eq!(&buf, &[0x80, 0x80, 0x80, 0x01]);
+        assert_eq!(remaining_len.bytes(), buf.len());
         buf.clear();
     }
 
@@ -230,5 +254,48 @@ mod tests {
         assert!(ret.is_ok());
         let ret = ret.unwrap();
         assert_eq!(ret.0, 268_435_455);
+
+        // Bytes after var int are not consumed.
+        let buf = [0x92, 0x01, 0xff, 0xff];
+        let mut ba = ByteArray::new(&buf);
+        assert_eq!(VarInt::decode(&mut ba).unwrap().0, 146);
+        assert_eq!(ba.offset(), 2);
+
+        let buf = [0x80, 0x80, 0x80, 0x80, 0x01];
+        let mut ba = ByteArray::new(&buf);
+        assert!(matches!(
+            VarInt::decode(&mut ba),
+            Err(DecodeError::InvalidVarInt)
+        ));
+
+        let buf = [0x80, 0x80];
+        let mut ba = ByteArray::new(&buf);
+        assert!(matches!(
+            VarInt::decode(&mut ba),
+            Err(DecodeError::OutOfRangeError)
+        ));
+    }
+
+    #[test]
+    fn test_var_int_decode_word() {
+        for &value in &[
+            0,
+            127,
+            128,
+            16_383,
+            16_384,
+            2_097_151,
+            2_097_152,
+            268_435_455,
+        ] {
+            let mut buf = Vec::with_capacity(4);
+            VarInt(value).encode(&mut buf).unwrap();
+            let len = buf.len();
+            buf.resize(4, 0xff);
+            let (var_int, bytes) = VarInt::decode_word([buf[0], buf[1], buf[2], buf[3]]).unwrap();
+            assert_eq!(var_int.value(), value);
+            assert_eq!(bytes, len);
+        }
+        assert!(VarInt::decode_word([0x80, 0x80, 0x80, 0x80]).is_err());
     }
 }
@@ -0,0 +1,122 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Measure rate of new tcp connections accepted with different number of acceptors.
+//!
+//! Clients connect to a loopback address in a loop and close the socket at once.
+//! Accepted sockets are received in a single task, as listener does.
+//!
+//! Usage: `cargo run --release --example bench-accept-rate [max_acceptors] [clients] [seconds]`
+
+use hebo::config::SocketOptions;
+use hebo::socket::{new_tcp_listener, new_tcp_listeners, AcceptorPool};
+use std::net::{SocketAddr, TcpStream};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+const ADDRESS: &str = "127.0.0.1:0";
+const BACKLOG: u32 = 4096;
+
+fn spawn_clients(
+    address: SocketAddr,
+    clients: usize,
+    stopped: &Arc<AtomicBool>,
+    finished: &Arc<AtomicUsize>,
+) {
+    for _i in 0..clients {
+        let stopped = Arc::clone(stopped);
+        let finished = Arc::clone(finished);
+        thread::spawn(move || {
+            while !stopped.load(Ordering::Relaxed) {
+                let _ret = TcpStream::connect(address);
+            }
+            finished.fetch_add(1, Ordering::Relaxed);
+        });
+    }
+}
+
+fn report(name: &str, accepted: usize, elapsed: Duration) {
+    println!(
+        "{:>10}: {} connections in {:?}, {:.0} conn/s",
+        name,
+        accepted,
+        elapsed,
+        accepted as f64 / elapsed.as_secs_f64()
+    );
+}
+
+fn main() {
+    let mut args = std::env::args().skip(1);
+    let cpus = num_cpus::get();
+    let max_acceptors: usize = args.next().and_then(|s| s.parse().ok()).unwrap_or(cpus);
+    let clients: usize = args.next().and_then(|s| s.parse().ok()).unwrap_or(cpus);
+    let seconds: u64 = args.next().and_then(|s| s.parse().ok()).unwrap_or(3);
+    let duration = Duration::from_secs(seconds);
+
+    let runtime = tokio::runtime::Builder::new_current_thread()
+        .enable_all()
+        .build()
+        .unwrap();
+
+    // Accept in the task which receives sockets, as a listener without acceptors.
+    runtime.block_on(async {
+        let listener = new_tcp_listener(ADDRESS, "", BACKLOG, &SocketOptions::default())
+            .await
+            .unwrap();
+        let stopped = Arc::new(AtomicBool::new(false));
+        let finished = Arc::new(AtomicUsize::new(0));
+        spawn_clients(listener.local_addr().unwrap(), clients, &stopped, &finished);
+        let start = Instant::now();
+        let mut accepted = 0;
+        while start.elapsed() < duration {
+            if let Ok((_stream, _address)) = listener.accept().await {
+                accepted += 1;
+            }
+        }
+        let elapsed = start.elapsed();
+        stopped.store(true, Ordering::Relaxed);
+        // Unblock clients waiting in connect().
+        drop(listener);
+        while finished.load(Ordering::Relaxed) < clients {
+            thread::sleep(Duration::from_millis(1));
+        }
+        report("in task", accepted, elapsed);
+    });
+
+    let mut acceptors = 1;
+    while acceptors <= max_acceptors {
+        runtime.block_on(async {
+            let listeners =
+                new_tcp_listeners(ADDRESS, "", BACKLOG, &SocketOptions::default(), acceptors)
+                    .await
+                    .unwrap();
+            let address = listeners[0].local_addr().unwrap();
+            let cpu_affinity = (0..acceptors).map(|index| index % cpus).collect();
+            let mut pool = AcceptorPool::new(listeners, cpu_affinity).unwrap();
+            let stopped = Arc::new(AtomicBool::new(false));
+            let finished = Arc::new(AtomicUsize::new(0));
+            spawn_clients(address, clients, &stopped, &finished);
+            let start = Instant::now();
+            let mut accepted = 0;
+            while start.elapsed() < duration {
+                if let Ok((_stream, _address)) = pool.accept().await {
+                    accepted += 1;
+                }
+            }
+            let elapsed = start.elapsed();
+            stopped.store(true, Ordering::Relaxed);
+            // Keep accepting until all clients exit, acceptor threads are leaked.
+            while finished.load(Ordering::Relaxed) < clients {
+                while let Ok(Ok(_socket)) =
+                    tokio::time::timeout(Duration::from_millis(1), pool.accept()).await
+                {
+                }
+            }
+            report(&format!("{} threads", acceptors), accepted, elapsed);
+        });
+        acceptors *= 2;
+    }
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Measure topic matching throughput of dispatcher shards, which share one
+//! subscription trie behind a read-write lock.
+//!
+//! Usage: `cargo run --release --example bench-dispatcher-shards [sessions] [publishes]`
+
+use codec::{v3, PacketId, QoS};
+use hebo::dispatcher::shard_index;
+use hebo::dispatcher::trie::SubTrie;
+use hebo::types::SessionGid;
+use std::sync::{Arc, RwLock};
+use std::thread;
+use std::time::Instant;
+
+const SHARDS: &[usize] = &[1, 2, 4, 8];
+
+fn publish_topic(index: usize, sessions: usize) -> String {
+    let device = index * 7919 % sessions;
+    match index % 3 {
+        0 => format!("device/{}/status", device),
+        1 => format!("region/{}/{}/temperature", device % 100, device),
+        _ => format!("fleet/{}/{}/gps", device % 1000, device),
+    }
+}
+
+fn main() {
+    let mut args = std::env::args().skip(1);
+    let sessions: usize = args.next().and_then(|s| s.parse().ok()).unwrap_or(20_000);
+    let publishes: usize = args.next().and_then(|s| s.parse().ok()).unwrap_or(200_000);
+
+    let mut trie = SubTrie::new();
+    for index in 0..sessions {
+        let session_gid = SessionGid::new(0, index as u64);
+        let filters = [
+            format!("device/{}/status", index),
+            format!("region/{}/+/temperature", index % 100),
+            format!("fleet/{}/#", index % 1000),
+        ];
+        for filter in &filters {
+            let packet = v3::SubscribePacket::new(filter, QoS::AtMostOnce, PacketId::new(1))
+                .expect("Invalid topic filter");
+            let _ret = trie.subscribe(session_gid, &packet);
+        }
+    }
+    let trie = Arc::new(RwLock::new(trie));
+    let topics: Arc<Vec<String>> = Arc::new(
+        (0..publishes)
+            .map(|index| publish_topic(index, sessions))
+            .collect(),
+    );
+
+    for &shards in SHARDS {
+        let start = Instant::now();
+        let handles: Vec<_> = (0..shards)
+            .map(|shard| {
+                let trie = Arc::clone(&trie);
+                let topics = Arc::clone(&topics);
+                thread::spawn(move || {
+                    let mut matches = 0;
+                    for topic in topics.iter() {
+                        if shard_index(topic, shards) == shard {
+                            matches += trie.read().unwrap().match_topic(topic).len();
+                        }
+                    }
+                    matches
+                })
+            })
+            .collect();
+        let matches: usize = handles
+            .into_iter()
+            .map(|handle| handle.join().unwrap())
+            .sum();
+        let elapsed = start.elapsed();
+        println!(
+            "{} shards: {} publishes, {} deliveries in {:?}, {:.0} publishes/s",
+            shards,
+            publishes,
+            matches,
+            elapsed,
+            publishes as f64 / elapsed.as_secs_f64()
+        );
+    }
+}
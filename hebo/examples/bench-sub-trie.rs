@@ -0,0 +1,130 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Compare subscription trie with linear scan of all topic filters.
+//!
+//! Usage: `cargo run --release --example bench-sub-trie [sessions] [publishes] [rounds]`
+//!
+//! Trie matching is repeated `rounds` times, as it is much faster than linear scan.
+
+use codec::{v3, PacketId, QoS, SubscribePattern};
+use hebo::dispatcher::trie::SubTrie;
+use hebo::types::SessionGid;
+use std::collections::HashMap;
+use std::time::Instant;
+
+const FILTERS_PER_SESSION: usize = 4;
+
+fn session_filters(index: usize) -> [String; FILTERS_PER_SESSION] {
+    [
+        format!("device/{}/status", index),
+        format!("device/{}/cmd/+", index),
+        format!("region/{}/+/temperature", index % 100),
+        format!("fleet/{}/#", index % 1000),
+    ]
+}
+
+fn publish_topic(index: usize, sessions: usize) -> String {
+    let device = index * 7919 % sessions;
+    match index % 4 {
+        0 => format!("device/{}/status", device),
+        1 => format!("device/{}/cmd/reboot", device),
+        2 => format!("region/{}/{}/temperature", device % 100, device),
+        _ => format!("fleet/{}/{}/gps", device % 1000, device),
+    }
+}
+
+/// Filters stored per session, matched by scanning every pattern.
+fn linear_match(map: &HashMap<SessionGid, Vec<SubscribePattern>>, topic: &str) -> Vec<SessionGid> {
+    let mut vec = vec![];
+    for (session_gid, patterns) in map {
+        if patterns
+            .iter()
+            .any(|pattern| pattern.topic().is_match(topic))
+        {
+            vec.push(*session_gid);
+        }
+    }
+    vec
+}
+
+fn main() {
+    let mut args = std::env::args().skip(1);
+    let sessions: usize = args.next().and_then(|s| s.parse().ok()).unwrap_or(20_000);
+    let publishes: usize = args.next().and_then(|s| s.parse().ok()).unwrap_or(2_000);
+    let rounds: usize = args.next().and_then(|s| s.parse().ok()).unwrap_or(50);
+
+    let mut trie = SubTrie::new();
+    let mut linear = HashMap::new();
+
+    let start = Instant::now();
+    for index in 0..sessions {
+        let session_gid = SessionGid::new(0, index as u64);
+        for filter in &session_filters(index) {
+            let packet = v3::SubscribePacket::new(filter, QoS::AtMostOnce, PacketId::new(1))
+                .expect("Invalid topic filter");
+            let _ret = trie.subscribe(session_gid, &packet);
+        }
+    }
+    println!(
+        "trie: subscribe {} filters in {:?}",
+        sessions * FILTERS_PER_SESSION,
+        start.elapsed()
+    );
+
+    for index in 0..sessions {
+        let session_gid = SessionGid::new(0, index as u64);
+        let patterns: Vec<SubscribePattern> = session_filters(index)
+            .iter()
+            .map(|filter| SubscribePattern::parse(filter, QoS::AtMostOnce).unwrap())
+            .collect();
+        linear.insert(session_gid, patterns);
+    }
+
+    let topics: Vec<String> = (0..publishes)
+        .map(|index| publish_topic(index, sessions))
+        .collect();
+
+    let start = Instant::now();
+    let mut trie_matches = 0;
+    for _round in 0..rounds {
+        for topic in &topics {
+            trie_matches += trie.match_topic(topic).len();
+        }
+    }
+    let trie_elapsed = start.elapsed();
+
+    let start = Instant::now();
+    let mut linear_matches = 0;
+    for topic in &topics {
+        linear_matches += linear_match(&linear, topic).len();
+    }
+    let linear_elapsed = start.elapsed();
+
+    println!(
+        "trie:   {} publishes, {} matches in {:?}, {:.0} msg/s",
+        publishes * rounds,
+        trie_matches,
+        trie_elapsed,
+        (publishes * rounds) as f64 / trie_elapsed.as_secs_f64()
+    );
+    println!(
+        "linear: {} publishes, {} matches in {:?}, {:.0} msg/s",
+        publishes,
+        linear_matches,
+        linear_elapsed,
+        publishes as f64 / linear_elapsed.as_secs_f64()
+    );
+
+    let start = Instant::now();
+    let mut removed = 0;
+    for index in 0..sessions {
+        removed += trie.remove_session(SessionGid::new(0, index as u64));
+    }
+    println!(
+        "trie: unsubscribe {} filters in {:?}",
+        removed,
+        start.elapsed()
+    );
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Compare timer wheel with scanning deadlines of all sessions on every tick.
+//!
+//! Sessions are idle, except a small part of them which send PINGREQ packets.
+//! Time is simulated, so that minutes of keep alive run in seconds.
+//!
+//! Usage: `cargo run --release --example bench-timer-wheel [sessions] [seconds]`
+
+use hebo::timer::TimerWheel;
+use std::time::{Duration, Instant};
+
+const TICK: Duration = Duration::from_millis(100);
+
+/// 1.5 times of default keep alive, 60s.
+const KEEP_ALIVE: Duration = Duration::from_secs(90);
+
+/// Sessions are connected during this time.
+const CONNECT_SPAN_MS: u64 = 30_000;
+
+/// One in this number of sessions is active in each second.
+const ACTIVE_RATIO: usize = 100;
+
+fn connected_at(index: usize, sessions: usize) -> Duration {
+    Duration::from_millis(index as u64 * CONNECT_SPAN_MS / sessions as u64)
+}
+
+/// Get sessions which send a packet at `second`.
+fn active_sessions(second: u64, sessions: usize) -> impl Iterator<Item = usize> {
+    let offset = (second as usize * 7919) % ACTIVE_RATIO;
+    (offset..sessions).step_by(ACTIVE_RATIO)
+}
+
+fn main() {
+    let mut args = std::env::args().skip(1);
+    let sessions: usize = args
+        .next()
+        .and_then(|s| s.parse().ok())
+        .unwrap_or(1_000_000);
+    let seconds: u64 = args.next().and_then(|s| s.parse().ok()).unwrap_or(300);
+    let ticks = seconds * 1000 / TICK.as_millis() as u64;
+    let ticks_per_second = 1000 / TICK.as_millis() as u64;
+
+    let base = Instant::now();
+
+    // Deadlines are updated on activity, as `SessionTimer` does.
+    let mut deadlines: Vec<Option<Instant>> = (0..sessions)
+        .map(|index| Some(base + connected_at(index, sessions) + KEEP_ALIVE))
+        .collect();
+
+    let start = Instant::now();
+    let mut wheel = TimerWheel::new(TICK, base);
+    for (index, deadline) in deadlines.iter().enumerate() {
+        if let Some(deadline) = deadline {
+            wheel.insert(*deadline, index);
+        }
+    }
+    println!(
+        "wheel: insert {} timers in {:?}",
+        wheel.len(),
+        start.elapsed()
+    );
+
+    let mut wheel_elapsed = Duration::default();
+    let mut wheel_max_tick = Duration::default();
+    let mut wheel_fired = 0;
+    let mut wheel_expired = 0;
+    let mut expired = Vec::new();
+    for tick in 1..=ticks {
+        let now = base + TICK * tick as u32;
+        if tick % ticks_per_second == 0 {
+            for index in active_sessions(tick / ticks_per_second, sessions) {
+                if deadlines[index].is_some() {
+                    deadlines[index] = Some(now + KEEP_ALIVE);
+                }
+            }
+        }
+
+        let start = Instant::now();
+        expired.clear();
+        wheel.advance(now, &mut expired);
+        for index in &expired {
+            wheel_fired += 1;
+            match deadlines[*index] {
+                Some(deadline) if deadline > now => wheel.insert(deadline, *index),
+                Some(_deadline) => {
+                    deadlines[*index] = None;
+                    wheel_expired += 1;
+                }
+                None => (),
+            }
+        }
+        let elapsed = start.elapsed();
+        wheel_elapsed += elapsed;
+        wheel_max_tick = wheel_max_tick.max(elapsed);
+    }
+    println!(
+        "wheel: {} ticks in {:?}, {:?} per tick, max {:?}, {} fired, {} expired",
+        ticks,
+        wheel_elapsed,
+        wheel_elapsed / ticks as u32,
+        wheel_max_tick,
+        wheel_fired,
+        wheel_expired
+    );
+
+    // Reset deadlines and scan them on every tick.
+    let mut deadlines: Vec<Option<Instant>> = (0..sessions)
+        .map(|index| Some(base + connected_at(index, sessions) + KEEP_ALIVE))
+        .collect();
+    let mut scan_elapsed = Duration::default();
+    let mut scan_expired = 0;
+    for tick in 1..=ticks {
+        let now = base + TICK * tick as u32;
+        if tick % ticks_per_second == 0 {
+            for index in active_sessions(tick / ticks_per_second, sessions) {
+                if deadlines[index].is_some() {
+                    deadlines[index] = Some(now + KEEP_ALIVE);
+                }
+            }
+        }
+
+        let start = Instant::now();
+        for deadline in &mut deadlines {
+            if matches!(deadline, Some(deadline) if *deadline <= now) {
+                *deadline = None;
+                scan_expired += 1;
+            }
+        }
+        scan_elapsed += start.elapsed();
+    }
+    println!(
+        "scan:  {} ticks in {:?}, {:?} per tick, {} expired",
+        ticks,
+        scan_elapsed,
+        scan_elapsed / ticks as u32,
+        scan_expired
+    );
+}
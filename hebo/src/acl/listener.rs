@@ -12,12 +12,6 @@ use crate::types::SessionGid;
 impl AclApp {
     pub(super) async fn handle_listener_cmd(&mut self, cmd: ListenerToAclCmd) -> Result<(), Error> {
         match cmd {
-            ListenerToAclCmd::Publish(session_gid, packet) => {
-                self.on_listener_publish(session_gid, packet).await
-            }
-            ListenerToAclCmd::PublishV5(session_gid, packet) => {
-                self.on_listener_publish_v5(session_gid, packet).await
-            }
             ListenerToAclCmd::Subscribe(session_gid, packet) => {
                 self.on_listener_subscribe(session_gid, packet).await
             }
@@ -27,58 +21,6 @@ impl AclApp {
         }
     }
 
-    async fn on_listener_publish(
-        &mut self,
-        session_gid: SessionGid,
-        packet: v3::PublishPacket,
-    ) -> Result<(), Error> {
-        // TODO(Shaohua): Read acl list from config.
-        let accepted = true;
-        if let Some(listener_sender) = self.listener_senders.get(&session_gid.listener_id()) {
-            let cmd = AclToListenerCmd::PublishAck(session_gid.session_id(), packet, accepted);
-            if let Err(err) = listener_sender.send(cmd).await {
-                log::error!(
-                    "acl: Failed to send publish ack to listener: {:?}, err: {:?}",
-                    session_gid,
-                    err
-                );
-            }
-        } else {
-            log::error!(
-                "acl: Failed to find listener sender with id: {}",
-                session_gid.listener_id()
-            );
-        }
-        // TODO(Shaohua): Return errors
-        Ok(())
-    }
-
-    async fn on_listener_publish_v5(
-        &mut self,
-        session_gid: SessionGid,
-        packet: v5::PublishPacket,
-    ) -> Result<(), Error> {
-        // TODO(Shaohua): Read acl list from config.
-        let accepted = true;
-        if let Some(listener_sender) = self.listener_senders.get(&session_gid.listener_id()) {
-            let cmd = AclToListenerCmd::PublishAckV5(session_gid.session_id(), packet, accepted);
-            if let Err(err) = listener_sender.send(cmd).await {
-                log::error!(
-                    "acl: Failed to send publish ack to listener: {:?}, err: {:?}",
-                    session_gid,
-                    err
-                );
-            }
-        } else {
-            log::error!(
-                "acl: Failed to find listener sender with id: {}",
-                session_gid.listener_id()
-            );
-        }
-        // TODO(Shaohua): Return errors
-        Ok(())
-    }
-
     async fn on_listener_subscribe(
         &mut self,
         session_gid: SessionGid,
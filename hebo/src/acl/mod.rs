@@ -4,12 +4,16 @@
 
 use std::collections::HashMap;
 use tokio::sync::mpsc::{Receiver, Sender};
+use tokio::sync::watch;
 
 use crate::commands::{AclToListenerCmd, ListenerToAclCmd, ServerContextToAclCmd};
 use crate::types::ListenerId;
 
 mod listener;
 mod server;
+mod snapshot;
+
+pub use snapshot::{AclAction, AclRule, AclSnapshot};
 
 #[allow(clippy::module_name_repetitions)]
 #[derive(Debug)]
@@ -17,6 +21,9 @@ pub struct AclApp {
     listener_senders: HashMap<ListenerId, Sender<AclToListenerCmd>>,
     listener_receiver: Receiver<ListenerToAclCmd>,
 
+    /// Publish new ACL rules to sessions.
+    snapshot_sender: watch::Sender<AclSnapshot>,
+
     server_ctx_receiver: Receiver<ServerContextToAclCmd>,
 }
 
@@ -26,6 +33,7 @@ impl AclApp {
         // listeners
         listener_senders: Vec<(ListenerId, Sender<AclToListenerCmd>)>,
         listener_receiver: Receiver<ListenerToAclCmd>,
+        snapshot_sender: watch::Sender<AclSnapshot>,
         // server ctx
         server_ctx_receiver: Receiver<ServerContextToAclCmd>,
     ) -> Self {
@@ -33,6 +41,8 @@ impl AclApp {
             listener_senders: listener_senders.into_iter().collect(),
             listener_receiver,
 
+            snapshot_sender,
+
             server_ctx_receiver,
         }
     }
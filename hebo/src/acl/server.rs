@@ -8,6 +8,11 @@ use crate::commands::ServerContextToAclCmd;
 impl AclApp {
     /// Server context handler
     pub(super) async fn handle_server_ctx_cmd(&mut self, cmd: ServerContextToAclCmd) {
-        log::info!("cmd: {:?}", cmd);
+        match cmd {
+            ServerContextToAclCmd::UpdateSnapshot(snapshot) => {
+                // Sessions will use new rules to check next packet, no need to wait for them.
+                self.snapshot_sender.send_replace(snapshot);
+            }
+        }
     }
 }
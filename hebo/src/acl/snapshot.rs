@@ -0,0 +1,128 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Immutable ACL rules shared with sessions.
+//!
+//! A new snapshot is published by `AclApp` with `tokio::sync::watch` to replace
+//! the old one, so that sessions can check publish packets inline without
+//! sending them to `AclApp`.
+
+use codec::{Topic, TopicError};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum AclAction {
+    Publish,
+    Subscribe,
+    All,
+}
+
+/// Allow or deny `action` on topics matching `topic` filter.
+#[derive(Debug, Clone)]
+pub struct AclRule {
+    allow: bool,
+    action: AclAction,
+
+    /// Apply to all clients if it is None.
+    username: Option<String>,
+
+    topic: Topic,
+}
+
+impl AclRule {
+    /// Create a new rule.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if `topic` is not a valid topic filter.
+    pub fn new(
+        allow: bool,
+        action: AclAction,
+        username: Option<&str>,
+        topic: &str,
+    ) -> Result<Self, TopicError> {
+        Ok(Self {
+            allow,
+            action,
+            username: username.map(ToString::to_string),
+            topic: Topic::parse(topic)?,
+        })
+    }
+
+    fn is_match(&self, action: AclAction, username: &str, levels: &[&str]) -> bool {
+        (self.action == AclAction::All || self.action == action)
+            && self
+                .username
+                .as_ref()
+                .map_or(true, |rule_username| rule_username == username)
+            && self.topic.is_match_levels(levels)
+    }
+}
+
+#[derive(Debug, Clone)]
+pub struct AclSnapshot {
+    /// Rules are checked in order, the first matched one is used.
+    rules: Vec<AclRule>,
+
+    /// Used if no rule matches.
+    default_allow: bool,
+}
+
+impl Default for AclSnapshot {
+    /// Allow all actions.
+    fn default() -> Self {
+        Self::new(Vec::new(), true)
+    }
+}
+
+impl AclSnapshot {
+    #[must_use]
+    pub fn new(rules: Vec<AclRule>, default_allow: bool) -> Self {
+        Self {
+            rules,
+            default_allow,
+        }
+    }
+
+    #[must_use]
+    pub fn check_publish(&self, username: &str, topic: &str) -> bool {
+        self.check(AclAction::Publish, username, topic)
+    }
+
+    #[must_use]
+    pub fn check_subscribe(&self, username: &str, topic: &str) -> bool {
+        self.check(AclAction::Subscribe, username, topic)
+    }
+
+    fn check(&self, action: AclAction, username: &str, topic: &str) -> bool {
+        // Split topic once and match it with each rule.
+        let levels: Vec<&str> = topic.split('/').collect();
+        self.rules
+            .iter()
+            .find(|rule| rule.is_match(action, username, &levels))
+            .map_or(self.default_allow, |rule| rule.allow)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_check() {
+        let rules = vec![
+            AclRule::new(true, AclAction::All, Some("admin"), "#").unwrap(),
+            AclRule::new(false, AclAction::Publish, None, "$SYS/#").unwrap(),
+            AclRule::new(true, AclAction::Publish, None, "device/+/telemetry").unwrap(),
+            AclRule::new(true, AclAction::Subscribe, None, "device/+/cmd").unwrap(),
+        ];
+        let snapshot = AclSnapshot::new(rules, false);
+        assert!(snapshot.check_publish("sensor", "device/1/telemetry"));
+        assert!(!snapshot.check_publish("sensor", "device/1/cmd"));
+        assert!(snapshot.check_subscribe("sensor", "device/1/cmd"));
+        assert!(!snapshot.check_publish("sensor", "$SYS/uptime"));
+        assert!(snapshot.check_publish("admin", "device/1/cmd"));
+
+        assert!(AclSnapshot::default().check_publish("", "any/topic"));
+    }
+}
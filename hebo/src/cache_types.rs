@@ -3,6 +3,66 @@
 // in the LICENSE file.
 
 use std::collections::HashMap;
+use std::time::Duration;
+
+/// Upper bounds of latency histogram buckets, in milliseconds.
+pub const LATENCY_BUCKETS_MS: [u64; 12] = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000];
+
+/// Histogram of latency, values above the largest bound are counted in the last bucket.
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct LatencyHistogram {
+    buckets: [u64; LATENCY_BUCKETS_MS.len() + 1],
+    count: u64,
+}
+
+impl LatencyHistogram {
+    pub fn record(&mut self, latency: Duration) {
+        let millis = latency.as_millis();
+        let index = LATENCY_BUCKETS_MS
+            .iter()
+            .position(|bound| millis <= u128::from(*bound))
+            .unwrap_or(LATENCY_BUCKETS_MS.len());
+        self.buckets[index] += 1;
+        self.count += 1;
+    }
+
+    pub fn merge(&mut self, other: &Self) {
+        for (bucket, other_bucket) in self.buckets.iter_mut().zip(other.buckets.iter()) {
+            *bucket += other_bucket;
+        }
+        self.count += other.count;
+    }
+
+    /// Get number of recorded values.
+    #[must_use]
+    pub const fn count(&self) -> u64 {
+        self.count
+    }
+
+    #[must_use]
+    pub const fn is_empty(&self) -> bool {
+        self.count == 0
+    }
+
+    /// Get upper bound of bucket which contains `percent` of recorded values.
+    ///
+    /// Returns None if histogram is empty, or if that value is above the largest bound.
+    #[must_use]
+    pub fn percentile(&self, percent: u8) -> Option<Duration> {
+        if self.count == 0 {
+            return None;
+        }
+        let rank = (self.count * u64::from(percent.min(100)) + 99) / 100;
+        let mut total = 0;
+        for (bucket, bound) in self.buckets.iter().zip(LATENCY_BUCKETS_MS.iter()) {
+            total += bucket;
+            if total >= rank.max(1) {
+                return Some(Duration::from_millis(*bound));
+            }
+        }
+        None
+    }
+}
 
 #[derive(Debug, Default, Clone)]
 pub struct ListenerMetrics {
@@ -11,6 +71,13 @@ pub struct ListenerMetrics {
 
     pub sessions: i64,
 
+    /// New connections rejected by admission control.
+    pub connections_rejected: i64,
+
+    /// Latency of TLS, WebSocket and QUIC handshakes.
+    pub handshake_latency: LatencyHistogram,
+    pub handshakes_failed: i64,
+
     pub subscriptions: i64,
 
     pub retained_messages: i64,
@@ -47,6 +114,8 @@ pub type ListenersVectorMetrics = Vec<ListenerMetrics>;
 pub struct SystemMetrics {
     pub listener_count: usize,
     pub sessions: i64,
+    pub connections_rejected: i64,
+    pub handshakes_failed: i64,
     pub subscriptions: i64,
 
     pub retained_messages: i64,
@@ -66,3 +135,28 @@ pub struct SystemMetrics {
     pub publish_bytes_sent: i64,
     pub publish_bytes_received: i64,
 }
+
+#[cfg(test)]
+mod tests {
+    use super::LatencyHistogram;
+    use std::time::Duration;
+
+    #[test]
+    fn test_latency_histogram() {
+        let mut histogram = LatencyHistogram::default();
+        assert_eq!(histogram.percentile(50), None);
+        for millis in [1, 3, 3, 8, 40, 40, 90, 150, 900, 10_000] {
+            histogram.record(Duration::from_millis(millis));
+        }
+        assert_eq!(histogram.count(), 10);
+        assert_eq!(histogram.percentile(0), Some(Duration::from_millis(1)));
+        assert_eq!(histogram.percentile(50), Some(Duration::from_millis(50)));
+        assert_eq!(histogram.percentile(90), Some(Duration::from_millis(1000)));
+        assert_eq!(histogram.percentile(100), None);
+
+        let mut other = LatencyHistogram::default();
+        other.record(Duration::from_millis(2));
+        histogram.merge(&other);
+        assert_eq!(histogram.count(), 11);
+    }
+}
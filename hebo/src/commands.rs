@@ -2,10 +2,13 @@
 // Use of this source is governed by Affero General Public License that can be found
 // in the LICENSE file.
 
-use codec::{v3, v5, PacketId, ProtocolLevel, QoS};
+use codec::{v3, v5, ProtocolLevel, QoS};
 use tokio::sync::oneshot;
 
-use crate::types::{ListenerId, SessionGid, SessionId, SessionInfo, Uptime};
+use crate::acl::AclSnapshot;
+use crate::cache_types::LatencyHistogram;
+use crate::message::PublishMessage;
+use crate::types::{InflightCounter, ListenerId, SessionGid, SessionId, SessionInfo, Uptime};
 
 use crate::session::CachedSession;
 
@@ -25,21 +28,16 @@ pub enum AuthToListenerCmd {
 
 #[derive(Debug, Clone)]
 pub enum AclToListenerCmd {
-    /// `(session_id, publish_packet, accepted)` pair.
-    PublishAck(SessionId, v3::PublishPacket, bool),
-    PublishAckV5(SessionId, v5::PublishPacket, bool),
-
+    /// `(session_id, subscribe_packet, acks, accepted)` pair.
     SubscribeAck(SessionId, v3::SubscribePacket, Vec<v3::SubscribeAck>, bool),
     SubscribeAckV5(SessionId, v5::SubscribePacket, Vec<v5::ReasonCode>, bool),
 }
 
 #[derive(Debug, Clone)]
 pub enum ListenerToAclCmd {
-    /// Check publish packet.
-    Publish(SessionGid, v3::PublishPacket),
-    PublishV5(SessionGid, v5::PublishPacket),
-
     /// Check subscribe packet.
+    ///
+    /// Publish packets are checked by sessions with `AclSnapshot`.
     Subscribe(SessionGid, v3::SubscribePacket),
     SubscribeV5(SessionGid, v5::SubscribePacket),
 }
@@ -50,14 +48,11 @@ pub enum ListenerToSessionCmd {
     ConnectAck(v3::ConnectAckPacket, Option<CachedSession>),
     ConnectAckV5(v5::ConnectAckPacket, Option<CachedSession>),
 
-    /// Response to Publish packet.
-    ///
-    /// `(packet_id, qos, accepted)` pair.
-    PublishAck(PacketId, QoS, bool),
-    PublishAckV5(PacketId, QoS, bool),
+    /// `(granted_qos, message)` pair.
+    Publish(QoS, PublishMessage),
 
-    Publish(v3::PublishPacket),
-    PublishV5(v5::PublishPacket),
+    /// Retained message, sent with RETAIN flag.
+    PublishRetained(QoS, PublishMessage),
 
     SubscribeAck(v3::SubscribeAckPacket),
     SubscribeAckV5(v5::SubscribeAckPacket),
@@ -65,6 +60,9 @@ pub enum ListenerToSessionCmd {
     /// Disconnect client connection.
     Disconnect,
     DisconnectV5,
+
+    /// CONNECT packet is not received in time, or client is idle for too long.
+    Timeout,
 }
 
 #[derive(Debug, Clone)]
@@ -81,16 +79,19 @@ pub enum SessionToListenerCmd {
     Unsubscribe(SessionId, v3::UnsubscribePacket),
     UnsubscribeV5(SessionId, v5::UnsubscribePacket),
 
-    Disconnect(SessionId),
-    DisconnectV5(SessionId),
+    /// Session exits, with state of persistent session.
+    Disconnect(SessionId, Option<CachedSession>),
 }
 
 #[derive(Debug, Clone)]
 pub enum DispatcherToListenerCmd {
     CheckCachedSessionResp(SessionId, ProtocolLevel, Option<CachedSession>),
 
-    Publish(SessionId, v3::PublishPacket),
-    PublishV5(SessionId, v5::PublishPacket),
+    /// `(session_id, granted_qos, message)` pair.
+    Publish(SessionId, QoS, PublishMessage),
+
+    /// Retained message sent to a new subscription.
+    PublishRetained(SessionId, QoS, PublishMessage),
 
     SubscribeAck(SessionId, v3::SubscribeAckPacket),
     SubscribeAckV5(SessionId, v5::SubscribeAckPacket),
@@ -98,11 +99,10 @@ pub enum DispatcherToListenerCmd {
 
 #[derive(Debug, Clone)]
 pub enum ListenerToDispatcherCmd {
-    // `(session_gid, client_id, protocol_level)` pair.
-    CheckCachedSession(SessionGid, String, ProtocolLevel),
-
-    Publish(v3::PublishPacket),
-    PublishV5(v5::PublishPacket),
+    /// `(session_gid, client_id, protocol_level, clean_session)` pair.
+    ///
+    /// Cached session is discarded if `clean_session` is true.
+    CheckCachedSession(SessionGid, String, ProtocolLevel, bool),
 
     Subscribe(SessionGid, v3::SubscribePacket),
     SubscribeV5(SessionGid, v5::SubscribePacket),
@@ -110,8 +110,28 @@ pub enum ListenerToDispatcherCmd {
     Unsubscribe(SessionGid, v3::UnsubscribePacket),
     UnsubscribeV5(SessionGid, v5::UnsubscribePacket),
 
-    SessionAdded(ListenerId),
-    SessionRemoved(ListenerId),
+    SessionAdded(SessionGid, InflightCounter),
+
+    /// Subscriptions are kept if session state is cached.
+    SessionRemoved(SessionGid, Option<CachedSession>),
+
+    /// Publish messages dropped by slow consumer policy, `(count, bytes)` pair.
+    PublishDropped(usize, usize),
+
+    /// New connections rejected by admission control, `(listener_id, count)` pair.
+    ConnectionsRejected(ListenerId, usize),
+
+    /// Latency of finished handshakes and number of failed handshakes,
+    /// `(listener_id, latency, failed)`.
+    HandshakeStats(ListenerId, LatencyHistogram, usize),
+}
+
+/// Publish packets routed by one of dispatcher shards.
+#[derive(Debug, Clone)]
+pub enum DispatcherShardCmd {
+    /// `(publisher, packet)` pair, publisher is None if packet is generated by server.
+    Publish(Option<SessionGid>, v3::PublishPacket),
+    PublishV5(Option<SessionGid>, v5::PublishPacket),
 }
 
 #[derive(Debug, Clone)]
@@ -143,6 +163,12 @@ pub enum DispatcherToMetricsCmd {
     /// count, bytes
     PublishPacketDropped(usize, usize),
 
+    /// listener id, count
+    ConnectionsRejected(ListenerId, usize),
+
+    /// listener id, handshake latency, failed handshakes
+    HandshakeStats(ListenerId, LatencyHistogram, usize),
+
     /// listener id, count, bytes
     PacketSent(ListenerId, usize, usize),
     /// listener id, count, bytes
@@ -188,7 +214,10 @@ pub enum RuleEngineToDispatcherCmd {}
 // Server context
 
 #[derive(Debug)]
-pub enum ServerContextToAclCmd {}
+pub enum ServerContextToAclCmd {
+    /// Replace ACL rules used by all sessions.
+    UpdateSnapshot(AclSnapshot),
+}
 
 #[derive(Debug)]
 pub enum ServerContextToAuthCmd {}
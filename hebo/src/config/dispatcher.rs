@@ -0,0 +1,156 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+use serde::Deserialize;
+
+use crate::error::{Error, ErrorKind};
+
+/// Upper limit of `shards`.
+const MAX_SHARDS: usize = 1024;
+
+/// Dispatcher section in config.
+#[derive(Debug, Deserialize, Clone)]
+pub struct Dispatcher {
+    /// Number of dispatcher shards to route publish messages.
+    ///
+    /// Publish messages are routed by topic hash, each shard runs as a separate task,
+    /// so that matching subscriptions scales with cpu cores.
+    ///
+    /// Set to 0 to use the number of cpu cores.
+    ///
+    /// Default is 0.
+    #[serde(default = "Dispatcher::default_shards")]
+    shards: usize,
+
+    /// How to choose one member of a shared subscription group, like `$share/group/topic`,
+    /// to receive a message.
+    ///
+    /// Avaliable values are:
+    /// - round_robin, members receive messages in turn
+    /// - random, choose a member randomly
+    /// - sticky, messages from the same publisher session are sent to the same member
+    /// - least_inflight, choose the member with least messages not yet written to its socket
+    ///
+    /// Default is "round_robin".
+    #[serde(default = "Dispatcher::default_shared_subscription_strategy")]
+    shared_subscription_strategy: SharedStrategy,
+
+    /// Maximum number of retained messages.
+    ///
+    /// New retained messages are not stored if this limit is reached,
+    /// but they are still sent to subscribers. The old retained message of
+    /// the same topic is removed in that case.
+    ///
+    /// Set to 0 to disable this limit.
+    ///
+    /// Default is 100000.
+    #[serde(default = "Dispatcher::default_max_retained_messages")]
+    max_retained_messages: usize,
+
+    /// Maximum bytes of topics and payloads of all retained messages.
+    ///
+    /// Set to 0 to disable this limit.
+    ///
+    /// Default is 64MB.
+    #[serde(default = "Dispatcher::default_max_retained_bytes")]
+    max_retained_bytes: usize,
+}
+
+/// Load balancing strategy of shared subscriptions.
+#[derive(Debug, Deserialize, Clone, Copy, PartialEq, Eq)]
+pub enum SharedStrategy {
+    #[serde(alias = "round_robin")]
+    RoundRobin,
+
+    #[serde(alias = "random")]
+    Random,
+
+    #[serde(alias = "sticky")]
+    Sticky,
+
+    #[serde(alias = "least_inflight")]
+    LeastInflight,
+}
+
+impl Default for SharedStrategy {
+    fn default() -> Self {
+        Self::RoundRobin
+    }
+}
+
+impl Dispatcher {
+    #[must_use]
+    pub const fn default_shards() -> usize {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_shared_subscription_strategy() -> SharedStrategy {
+        SharedStrategy::RoundRobin
+    }
+
+    #[must_use]
+    pub const fn default_max_retained_messages() -> usize {
+        100_000
+    }
+
+    #[must_use]
+    pub const fn default_max_retained_bytes() -> usize {
+        64 * 1024 * 1024
+    }
+
+    /// Get number of dispatcher shards, which is at least 1.
+    #[must_use]
+    pub fn shards(&self) -> usize {
+        if self.shards == 0 {
+            num_cpus::get()
+        } else {
+            self.shards
+        }
+    }
+
+    #[must_use]
+    pub const fn shared_subscription_strategy(&self) -> SharedStrategy {
+        self.shared_subscription_strategy
+    }
+
+    #[must_use]
+    pub const fn max_retained_messages(&self) -> usize {
+        self.max_retained_messages
+    }
+
+    #[must_use]
+    pub const fn max_retained_bytes(&self) -> usize {
+        self.max_retained_bytes
+    }
+
+    /// Validate config.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if some options are invalid.
+    pub fn validate(&self) -> Result<(), Error> {
+        if self.shards > MAX_SHARDS {
+            return Err(Error::from_string(
+                ErrorKind::ConfigError,
+                format!(
+                    "dispatcher: shards {} is larger than {}",
+                    self.shards, MAX_SHARDS
+                ),
+            ));
+        }
+        Ok(())
+    }
+}
+
+impl Default for Dispatcher {
+    fn default() -> Self {
+        Self {
+            shards: Self::default_shards(),
+            shared_subscription_strategy: Self::default_shared_subscription_strategy(),
+            max_retained_messages: Self::default_max_retained_messages(),
+            max_retained_bytes: Self::default_max_retained_bytes(),
+        }
+    }
+}
@@ -40,6 +40,8 @@ pub struct General {
     /// This has the effect of reducing latency of individual messages
     /// at the potential cost of increasing the number of packets being sent.
     ///
+    /// It is overridden by `socket.no_delay` of a listener.
+    ///
     /// Default is false.
     #[serde(default = "General::default_no_delay")]
     no_delay: bool,
@@ -91,8 +93,49 @@ pub struct General {
     /// Defaults is 0, which means no limit.
     #[serde(default = "General::default_maximum_packet_size")]
     maximum_packet_size: u32,
-    //pub max_queued_messages: usize,
-    //pub max_queued_bytes: usize,
+
+    /// Maximum number of QoS 1 and 2 messages queued for each persistent session
+    /// while its client is disconnected.
+    ///
+    /// Set to 0 to disable this limit.
+    ///
+    /// Default is 1000.
+    #[serde(default = "General::default_max_queued_messages")]
+    max_queued_messages: usize,
+
+    /// Maximum bytes of topics and payloads queued for each persistent session.
+    ///
+    /// Set to 0 to disable this limit.
+    ///
+    /// Default is 1MB.
+    #[serde(default = "General::default_max_queued_bytes")]
+    max_queued_bytes: usize,
+
+    /// Which message to drop when queue of a persistent session is full.
+    ///
+    /// Available values are:
+    /// - drop_oldest, remove the oldest queued messages to save the new one
+    /// - drop_newest, discard the new message
+    ///
+    /// Default is "drop_oldest".
+    #[serde(default = "General::default_queue_drop_policy")]
+    queue_drop_policy: QueueDropPolicy,
+}
+
+/// Policy to drop messages if offline queue is full.
+#[derive(Debug, Deserialize, Clone, Copy, PartialEq, Eq)]
+pub enum QueueDropPolicy {
+    #[serde(alias = "drop_oldest")]
+    DropOldest,
+
+    #[serde(alias = "drop_newest")]
+    DropNewest,
+}
+
+impl Default for QueueDropPolicy {
+    fn default() -> Self {
+        Self::DropOldest
+    }
 }
 
 impl General {
@@ -141,6 +184,21 @@ impl General {
         0
     }
 
+    #[must_use]
+    pub const fn default_max_queued_messages() -> usize {
+        1000
+    }
+
+    #[must_use]
+    pub const fn default_max_queued_bytes() -> usize {
+        1024 * 1024
+    }
+
+    #[must_use]
+    pub const fn default_queue_drop_policy() -> QueueDropPolicy {
+        QueueDropPolicy::DropOldest
+    }
+
     #[must_use]
     pub const fn sys_interval(&self) -> Duration {
         Duration::from_secs(self.sys_interval as u64)
@@ -181,6 +239,21 @@ impl General {
         self.maximum_packet_size
     }
 
+    #[must_use]
+    pub const fn max_queued_messages(&self) -> usize {
+        self.max_queued_messages
+    }
+
+    #[must_use]
+    pub const fn max_queued_bytes(&self) -> usize {
+        self.max_queued_bytes
+    }
+
+    #[must_use]
+    pub const fn queue_drop_policy(&self) -> QueueDropPolicy {
+        self.queue_drop_policy
+    }
+
     /// Validate config.
     ///
     /// # Errors
@@ -212,6 +285,9 @@ impl Default for General {
             maximum_qos: Self::default_maximum_qos(),
             maximum_keep_alive: Self::default_maximum_keep_alive(),
             maximum_packet_size: Self::default_maximum_packet_size(),
+            max_queued_messages: Self::default_max_queued_messages(),
+            max_queued_bytes: Self::default_max_queued_bytes(),
+            queue_drop_policy: Self::default_queue_drop_policy(),
         }
     }
 }
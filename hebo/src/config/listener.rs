@@ -7,6 +7,7 @@ use std::net::{TcpListener, ToSocketAddrs};
 use std::os::unix::net::UnixListener;
 use std::path::{Path, PathBuf};
 
+use super::SocketOptions;
 use crate::error::{Error, ErrorKind};
 
 /// Binding protocol types.
@@ -21,10 +22,14 @@ pub enum Protocol {
     Mqtts,
 
     /// Websocket protocol
+    ///
+    /// Frames are not compressed, permessage-deflate extension is not supported.
     #[serde(alias = "ws")]
     Ws,
 
     /// Secure Websocket protocol
+    ///
+    /// Like `Ws`, frames are not compressed.
     #[serde(alias = "wss")]
     Wss,
 
@@ -37,6 +42,50 @@ pub enum Protocol {
     Quic,
 }
 
+/// How to handle messages to a session whose outgoing queue is full.
+#[derive(Debug, Deserialize, Clone, Copy, PartialEq, Eq)]
+pub enum SlowConsumerPolicy {
+    /// Drop QoS 0 messages, QoS 1 and QoS 2 messages are kept in an offline queue
+    /// of the session if they cannot be sent without blocking.
+    #[serde(alias = "drop_qos0")]
+    DropQos0,
+
+    /// Disconnect the client, state of persistent session is kept.
+    #[serde(alias = "disconnect")]
+    Disconnect,
+
+    /// Keep messages in an offline queue of the session, which is limited by
+    /// `max_queued_messages` and `max_queued_bytes` in general section, and send them
+    /// once the client catches up.
+    #[serde(alias = "spill_offline")]
+    SpillOffline,
+}
+
+impl Default for SlowConsumerPolicy {
+    fn default() -> Self {
+        Self::DropQos0
+    }
+}
+
+/// How to handle new connections when listener is saturated.
+#[derive(Debug, Deserialize, Clone, Copy, PartialEq, Eq)]
+pub enum AdmissionPolicy {
+    /// Accept and close new sockets immediately.
+    #[serde(alias = "reject")]
+    Reject,
+
+    /// Stop accepting new sockets until there are free slots, pending connections
+    /// are kept in listen backlog of kernel.
+    #[serde(alias = "delay")]
+    Delay,
+}
+
+impl Default for AdmissionPolicy {
+    fn default() -> Self {
+        Self::Reject
+    }
+}
+
 /// Listener represent an unique ip/port combination and mqtt connection protocol.
 #[derive(Debug, Deserialize, Clone)]
 pub struct Listener {
@@ -61,6 +110,75 @@ pub struct Listener {
     #[serde(default = "Listener::default_maximum_connections")]
     maximum_connections: usize,
 
+    /// Maximum number of new connections accepted per second.
+    ///
+    /// Up to this number of connections are allowed in a burst.
+    ///
+    /// Default is 0, which means no limit.
+    #[serde(default = "Listener::default_accept_rate")]
+    accept_rate: u32,
+
+    /// Maximum number of new connections accepted per second from the same
+    /// ip address.
+    ///
+    /// Connections over this limit are always rejected.
+    ///
+    /// Default is 0, which means no limit.
+    #[serde(default = "Listener::default_accept_rate_per_ip")]
+    accept_rate_per_ip: u32,
+
+    /// Available values are:
+    /// - reject, close new connections if `maximum_connections` or `accept_rate`
+    ///   is reached
+    /// - delay, stop accepting new connections until there are free slots
+    ///
+    /// Default is "reject".
+    #[serde(default = "Listener::default_admission_policy")]
+    admission_policy: AdmissionPolicy,
+
+    /// Maximum length of queue of pending connections in kernel.
+    ///
+    /// Only used for tcp based protocols.
+    ///
+    /// Default is 1024.
+    #[serde(default = "Listener::default_backlog")]
+    backlog: u32,
+
+    /// Number of sockets bound to `address` with SO_REUSEPORT, each of them is
+    /// accepted in a dedicated thread.
+    ///
+    /// Kernel distributes new connections among these sockets. Set it to number of
+    /// cores reserved for accepting connections on a busy listener.
+    ///
+    /// Only used for tcp based protocols.
+    ///
+    /// Default is 1, which means new sockets are accepted in listener task.
+    #[serde(default = "Listener::default_acceptors")]
+    acceptors: usize,
+
+    /// Pin acceptor threads to these cpus, in turn.
+    ///
+    /// Example: cpu_affinity = [0, 1, 2, 3]
+    ///
+    /// Default is empty, which means acceptor threads are not pinned.
+    #[serde(default = "Listener::default_cpu_affinity")]
+    cpu_affinity: Vec<usize>,
+
+    /// Send QoS 0 messages to client in QUIC datagrams, if they fit in one datagram
+    /// and client supports datagrams.
+    ///
+    /// Datagrams are unreliable and are not ordered with other packets, so that
+    /// QoS 0 messages may be lost or reordered even if connection is healthy.
+    /// Datagrams from client are always accepted.
+    ///
+    /// Only used for quic protocol. Default is false.
+    #[serde(default = "Listener::default_quic_datagrams")]
+    quic_datagrams: bool,
+
+    /// Options of tcp sockets, only used for tcp based protocols.
+    #[serde(default = "SocketOptions::default")]
+    socket: SocketOptions,
+
     /// Binding protocol.
     ///
     /// Default is mqtt.
@@ -132,6 +250,20 @@ pub struct Listener {
     #[serde(default = "Listener::default_connect_timeout")]
     connect_timeout: u16,
 
+    /// Timeout value in seconds of TLS, WebSocket and QUIC handshakes.
+    ///
+    /// Default is 10s, 0 means no timeout.
+    #[serde(default = "Listener::default_handshake_timeout")]
+    handshake_timeout: u16,
+
+    /// Maximum number of handshakes running at the same time.
+    ///
+    /// New connections are not accepted until a running handshake finishes.
+    ///
+    /// Default is 256.
+    #[serde(default = "Listener::default_max_concurrent_handshakes")]
+    max_concurrent_handshakes: usize,
+
     /// MAY allow a Client to supply a ClientId that has a length of zero bytes.
     ///
     /// Hebo treats this as a special case and assignis a unique ClientId to that Client.
@@ -152,6 +284,52 @@ pub struct Listener {
     /// Defaults to 20.
     #[serde(default = "Listener::default_maximum_inflight_messages")]
     maximum_inflight_messages: u16,
+
+    /// Incoming packets of a session are read into a buffer of this size in bytes.
+    ///
+    /// Packets larger than it, like large publish packets, are moved into a buffer
+    /// of their own as data arrives. That buffer holds the whole packet, which is
+    /// limited by `maximum_packet_size` in general section. ACL of such a publish
+    /// packet is checked as soon as its topic is received, and the payload is
+    /// discarded if it is not authorized.
+    ///
+    /// Default is 64KiB.
+    #[serde(default = "Listener::default_read_buffer_size")]
+    read_buffer_size: usize,
+
+    /// Outgoing packets of a session are buffered and written to client stream
+    /// in batches. Buffer is flushed once it reaches this size in bytes.
+    ///
+    /// Default is 64KiB.
+    #[serde(default = "Listener::default_write_buffer_size")]
+    write_buffer_size: usize,
+
+    /// Maximum delay in milliseconds to wait for more outgoing packets before
+    /// buffered packets are flushed.
+    ///
+    /// Default is 0, which means flush as soon as all pending messages of a session
+    /// are handled.
+    #[serde(default = "Listener::default_write_flush_delay")]
+    write_flush_delay: u16,
+
+    /// Maximum bytes of topics and payloads queued for a session and not written
+    /// to client yet.
+    ///
+    /// Messages are never blocked by a slow client, `slow_consumer_policy` is applied
+    /// once its queue is full.
+    ///
+    /// Set to 0 to disable this limit. Default is 1MiB.
+    #[serde(default = "Listener::default_max_session_queue_bytes")]
+    max_session_queue_bytes: usize,
+
+    /// Available values are:
+    /// - drop_qos0, drop QoS 0 messages
+    /// - disconnect, disconnect the client
+    /// - spill_offline, keep messages in offline queue of the session
+    ///
+    /// Default is "drop_qos0".
+    #[serde(default = "Listener::default_slow_consumer_policy")]
+    slow_consumer_policy: SlowConsumerPolicy,
 }
 
 impl Listener {
@@ -170,6 +348,41 @@ impl Listener {
         0
     }
 
+    #[must_use]
+    pub const fn default_accept_rate() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_accept_rate_per_ip() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_admission_policy() -> AdmissionPolicy {
+        AdmissionPolicy::Reject
+    }
+
+    #[must_use]
+    pub const fn default_backlog() -> u32 {
+        1024
+    }
+
+    #[must_use]
+    pub const fn default_acceptors() -> usize {
+        1
+    }
+
+    #[must_use]
+    pub const fn default_cpu_affinity() -> Vec<usize> {
+        Vec::new()
+    }
+
+    #[must_use]
+    pub const fn default_quic_datagrams() -> bool {
+        false
+    }
+
     #[must_use]
     pub const fn default_protocol() -> Protocol {
         Protocol::Mqtt
@@ -210,6 +423,16 @@ impl Listener {
         60
     }
 
+    #[must_use]
+    pub const fn default_handshake_timeout() -> u16 {
+        10
+    }
+
+    #[must_use]
+    pub const fn default_max_concurrent_handshakes() -> usize {
+        256
+    }
+
     #[must_use]
     pub const fn default_allow_empty_client_id() -> bool {
         false
@@ -220,6 +443,31 @@ impl Listener {
         20
     }
 
+    #[must_use]
+    pub const fn default_read_buffer_size() -> usize {
+        64 * 1024
+    }
+
+    #[must_use]
+    pub const fn default_write_buffer_size() -> usize {
+        64 * 1024
+    }
+
+    #[must_use]
+    pub const fn default_write_flush_delay() -> u16 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_max_session_queue_bytes() -> usize {
+        1024 * 1024
+    }
+
+    #[must_use]
+    pub const fn default_slow_consumer_policy() -> SlowConsumerPolicy {
+        SlowConsumerPolicy::DropQos0
+    }
+
     #[must_use]
     pub fn bind_device(&self) -> &str {
         &self.bind_device
@@ -230,6 +478,46 @@ impl Listener {
         self.maximum_connections
     }
 
+    #[must_use]
+    pub const fn accept_rate(&self) -> u32 {
+        self.accept_rate
+    }
+
+    #[must_use]
+    pub const fn accept_rate_per_ip(&self) -> u32 {
+        self.accept_rate_per_ip
+    }
+
+    #[must_use]
+    pub const fn admission_policy(&self) -> AdmissionPolicy {
+        self.admission_policy
+    }
+
+    #[must_use]
+    pub const fn backlog(&self) -> u32 {
+        self.backlog
+    }
+
+    #[must_use]
+    pub const fn acceptors(&self) -> usize {
+        self.acceptors
+    }
+
+    #[must_use]
+    pub fn cpu_affinity(&self) -> &[usize] {
+        &self.cpu_affinity
+    }
+
+    #[must_use]
+    pub const fn quic_datagrams(&self) -> bool {
+        self.quic_datagrams
+    }
+
+    #[must_use]
+    pub const fn socket(&self) -> &SocketOptions {
+        &self.socket
+    }
+
     #[must_use]
     pub const fn protocol(&self) -> Protocol {
         self.protocol
@@ -270,6 +558,16 @@ impl Listener {
         self.connect_timeout
     }
 
+    #[must_use]
+    pub const fn handshake_timeout(&self) -> u16 {
+        self.handshake_timeout
+    }
+
+    #[must_use]
+    pub const fn max_concurrent_handshakes(&self) -> usize {
+        self.max_concurrent_handshakes
+    }
+
     #[must_use]
     pub const fn allow_empty_client_id(&self) -> bool {
         self.allow_empty_client_id
@@ -280,12 +578,56 @@ impl Listener {
         self.maximum_inflight_messages
     }
 
+    #[must_use]
+    pub const fn read_buffer_size(&self) -> usize {
+        self.read_buffer_size
+    }
+
+    #[must_use]
+    pub const fn write_buffer_size(&self) -> usize {
+        self.write_buffer_size
+    }
+
+    #[must_use]
+    pub const fn write_flush_delay(&self) -> u16 {
+        self.write_flush_delay
+    }
+
+    #[must_use]
+    pub const fn max_session_queue_bytes(&self) -> usize {
+        self.max_session_queue_bytes
+    }
+
+    #[must_use]
+    pub const fn slow_consumer_policy(&self) -> SlowConsumerPolicy {
+        self.slow_consumer_policy
+    }
+
     /// Validate config.
     ///
     /// # Errors
     ///
-    /// Returns error if socket address is invalid or already in use.
+    /// Returns error if socket address is invalid or already in use, or if acceptors
+    /// are invalid.
     pub fn validate(&self, bind_address: bool) -> Result<(), Error> {
+        if self.acceptors == 0 {
+            return Err(Error::new(
+                ErrorKind::ConfigError,
+                "acceptors of listener shall be greater than 0",
+            ));
+        }
+        if (self.acceptors > 1 || !self.cpu_affinity.is_empty())
+            && matches!(self.protocol(), Protocol::Uds | Protocol::Quic)
+        {
+            return Err(Error::from_string(
+                ErrorKind::ConfigError,
+                format!(
+                    "acceptors and cpu_affinity are only used for tcp based protocols, got {:?}",
+                    self.protocol()
+                ),
+            ));
+        }
+
         if bind_address {
             if self.protocol() == Protocol::Uds {
                 let listener = UnixListener::bind(&self.address).map_err(|err| {
@@ -330,6 +672,14 @@ impl Default for Listener {
         Self {
             bind_device: Self::default_bind_device(),
             maximum_connections: Self::default_maximum_connections(),
+            accept_rate: Self::default_accept_rate(),
+            accept_rate_per_ip: Self::default_accept_rate_per_ip(),
+            admission_policy: Self::default_admission_policy(),
+            backlog: Self::default_backlog(),
+            acceptors: Self::default_acceptors(),
+            cpu_affinity: Self::default_cpu_affinity(),
+            quic_datagrams: Self::default_quic_datagrams(),
+            socket: SocketOptions::default(),
             protocol: Self::default_protocol(),
             address: Self::default_address(),
             path: Self::default_path(),
@@ -338,8 +688,15 @@ impl Default for Listener {
             username_as_client_id: Self::default_username_as_client_id(),
             keep_alive: Self::default_keep_alive(),
             connect_timeout: Self::default_connect_timeout(),
+            handshake_timeout: Self::default_handshake_timeout(),
+            max_concurrent_handshakes: Self::default_max_concurrent_handshakes(),
             allow_empty_client_id: Self::default_allow_empty_client_id(),
             maximum_inflight_messages: Self::default_maximum_inflight_messages(),
+            read_buffer_size: Self::default_read_buffer_size(),
+            write_buffer_size: Self::default_write_buffer_size(),
+            write_flush_delay: Self::default_write_flush_delay(),
+            max_session_queue_bytes: Self::default_max_session_queue_bytes(),
+            slow_consumer_policy: Self::default_slow_consumer_policy(),
         }
     }
 }
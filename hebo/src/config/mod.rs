@@ -7,17 +7,21 @@ use serde::Deserialize;
 use crate::error::Error;
 
 mod dashboard;
+mod dispatcher;
 mod general;
 mod listener;
 mod log;
 mod security;
+mod socket;
 mod storage;
 
 pub use self::log::{Log, LogLevel};
 pub use dashboard::Dashboard;
-pub use general::General;
-pub use listener::{Listener, Protocol};
+pub use dispatcher::{Dispatcher, SharedStrategy};
+pub use general::{General, QueueDropPolicy};
+pub use listener::{AdmissionPolicy, Listener, Protocol, SlowConsumerPolicy};
 pub use security::Security;
+pub use socket::SocketOptions;
 pub use storage::Storage;
 
 /// Server main config.
@@ -40,6 +44,9 @@ pub struct Config {
 
     #[serde(default = "Dashboard::default")]
     dashboard: Dashboard,
+
+    #[serde(default = "Dispatcher::default")]
+    dispatcher: Dispatcher,
 }
 
 impl Config {
@@ -73,6 +80,11 @@ impl Config {
         &self.dashboard
     }
 
+    #[must_use]
+    pub const fn dispatcher(&self) -> &Dispatcher {
+        &self.dispatcher
+    }
+
     /// Validate config.
     ///
     /// # Errors
@@ -88,6 +100,7 @@ impl Config {
         self.security.validate()?;
         self.storage.validate()?;
         self.log.validate()?;
+        self.dispatcher.validate()?;
         self.dashboard.validate(bind_address)
     }
 }
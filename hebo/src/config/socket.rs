@@ -0,0 +1,188 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+use serde::Deserialize;
+
+/// Options of tcp sockets of a listener.
+///
+/// Options of listening socket are set when it is bound, and options of client
+/// sockets are set when they are accepted.
+///
+/// Values of 0 mean system default values are used.
+#[derive(Debug, Deserialize, Clone)]
+pub struct SocketOptions {
+    /// Disable Nagle's algorithm on client sockets, by setting TCP_NODELAY.
+    ///
+    /// Small messages are sent at once, at the cost of more packets. Disable it
+    /// for bulk throughput.
+    ///
+    /// Default is None, which means `no_delay` in general section is used.
+    #[serde(default = "SocketOptions::default_no_delay")]
+    no_delay: Option<bool>,
+
+    /// Enable tcp keep alive probes with SO_KEEPALIVE.
+    ///
+    /// Dead peers are detected by kernel even if MQTT keep alive is disabled
+    /// by client.
+    ///
+    /// Default is false.
+    #[serde(default = "SocketOptions::default_keep_alive")]
+    keep_alive: bool,
+
+    /// Seconds of idle time before the first keep alive probe, TCP_KEEPIDLE.
+    ///
+    /// Default is 0.
+    #[serde(default = "SocketOptions::default_keep_alive_idle")]
+    keep_alive_idle: u32,
+
+    /// Seconds between keep alive probes, TCP_KEEPINTVL.
+    ///
+    /// Default is 0.
+    #[serde(default = "SocketOptions::default_keep_alive_interval")]
+    keep_alive_interval: u32,
+
+    /// Number of unanswered probes before connection is dropped, TCP_KEEPCNT.
+    ///
+    /// Default is 0.
+    #[serde(default = "SocketOptions::default_keep_alive_count")]
+    keep_alive_count: u32,
+
+    /// Size of kernel receive buffer in bytes, SO_RCVBUF.
+    ///
+    /// Also set on listening socket, so that tcp window scale of new connections
+    /// is chosen for this size.
+    ///
+    /// Default is 0.
+    #[serde(default = "SocketOptions::default_recv_buffer_size")]
+    recv_buffer_size: u32,
+
+    /// Size of kernel send buffer in bytes, SO_SNDBUF.
+    ///
+    /// Default is 0.
+    #[serde(default = "SocketOptions::default_send_buffer_size")]
+    send_buffer_size: u32,
+
+    /// Milliseconds that sent data may remain unacknowledged before connection is
+    /// closed by kernel, TCP_USER_TIMEOUT. Only available on Linux.
+    ///
+    /// Default is 0.
+    #[serde(default = "SocketOptions::default_user_timeout")]
+    user_timeout: u32,
+
+    /// Queue length of pending TCP_FASTOPEN requests on listening socket.
+    ///
+    /// Set to 0 to disable tcp fast open.
+    ///
+    /// Default is 5.
+    #[serde(default = "SocketOptions::default_fast_open_queue_len")]
+    fast_open_queue_len: u32,
+}
+
+impl SocketOptions {
+    #[must_use]
+    pub const fn default_no_delay() -> Option<bool> {
+        None
+    }
+
+    #[must_use]
+    pub const fn default_keep_alive() -> bool {
+        false
+    }
+
+    #[must_use]
+    pub const fn default_keep_alive_idle() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_keep_alive_interval() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_keep_alive_count() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_recv_buffer_size() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_send_buffer_size() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_user_timeout() -> u32 {
+        0
+    }
+
+    #[must_use]
+    pub const fn default_fast_open_queue_len() -> u32 {
+        5
+    }
+
+    #[must_use]
+    pub const fn no_delay(&self) -> Option<bool> {
+        self.no_delay
+    }
+
+    #[must_use]
+    pub const fn keep_alive(&self) -> bool {
+        self.keep_alive
+    }
+
+    #[must_use]
+    pub const fn keep_alive_idle(&self) -> u32 {
+        self.keep_alive_idle
+    }
+
+    #[must_use]
+    pub const fn keep_alive_interval(&self) -> u32 {
+        self.keep_alive_interval
+    }
+
+    #[must_use]
+    pub const fn keep_alive_count(&self) -> u32 {
+        self.keep_alive_count
+    }
+
+    #[must_use]
+    pub const fn recv_buffer_size(&self) -> u32 {
+        self.recv_buffer_size
+    }
+
+    #[must_use]
+    pub const fn send_buffer_size(&self) -> u32 {
+        self.send_buffer_size
+    }
+
+    #[must_use]
+    pub const fn user_timeout(&self) -> u32 {
+        self.user_timeout
+    }
+
+    #[must_use]
+    pub const fn fast_open_queue_len(&self) -> u32 {
+        self.fast_open_queue_len
+    }
+}
+
+impl Default for SocketOptions {
+    fn default() -> Self {
+        Self {
+            no_delay: Self::default_no_delay(),
+            keep_alive: Self::default_keep_alive(),
+            keep_alive_idle: Self::default_keep_alive_idle(),
+            keep_alive_interval: Self::default_keep_alive_interval(),
+            keep_alive_count: Self::default_keep_alive_count(),
+            recv_buffer_size: Self::default_recv_buffer_size(),
+            send_buffer_size: Self::default_send_buffer_size(),
+            user_timeout: Self::default_user_timeout(),
+            fast_open_queue_len: Self::default_fast_open_queue_len(),
+        }
+    }
+}
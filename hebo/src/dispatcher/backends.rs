@@ -4,16 +4,9 @@
 
 //! Backends app handlers
 
-use codec::{v3, v5};
-
 use super::Dispatcher;
 use crate::commands::BackendsToDispatcherCmd;
 
 impl Dispatcher {
-    /// Send packet to backends.
-    pub(super) async fn backends_store_packet(&mut self, _packet: &v3::PublishPacket) {}
-
-    pub(super) async fn backends_store_packet_v5(&mut self, _packet: &v5::PublishPacket) {}
-
     pub(super) async fn handle_backends_cmd(&mut self, _cmd: BackendsToDispatcherCmd) {}
 }
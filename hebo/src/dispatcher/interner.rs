@@ -0,0 +1,182 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Intern topic levels as integer ids.
+//!
+//! Nodes of subscription trie and retained message store are keyed by level ids
+//! instead of owned strings. A topic is split once and each level is looked up
+//! in the interner, then walking the tree only compares and hashes integers.
+//!
+//! Each tree owns its interner, which is protected by the same lock as the tree.
+//! Ids are reference counted by tree nodes and recycled when a level is no longer
+//! used, so that levels of removed subscriptions do not pile up.
+
+use std::collections::HashMap;
+use std::hash::{BuildHasherDefault, Hasher};
+use std::sync::Arc;
+
+/// Id of an interned topic level.
+pub type LevelId = u32;
+
+/// Hasher for level ids.
+///
+/// Ids are small sequential integers, multiply them with a 64 bits odd constant
+/// (Fibonacci hashing) to spread them over high bits of hash value.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct LevelIdHasher(u64);
+
+impl Hasher for LevelIdHasher {
+    fn finish(&self) -> u64 {
+        self.0
+    }
+
+    fn write(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.0 = ((self.0 << 8) | u64::from(b)).wrapping_mul(0x9e37_79b9_7f4a_7c15);
+        }
+    }
+
+    fn write_u32(&mut self, id: u32) {
+        self.0 = u64::from(id).wrapping_mul(0x9e37_79b9_7f4a_7c15);
+    }
+}
+
+/// `HashMap` keyed by level ids.
+pub type LevelMap<V> = HashMap<LevelId, V, BuildHasherDefault<LevelIdHasher>>;
+
+#[derive(Debug)]
+struct Level {
+    /// Shared with key of `TopicInterner::ids`, so that each name is stored once.
+    name: Arc<str>,
+
+    /// Number of tree nodes of this level.
+    refs: usize,
+}
+
+#[derive(Debug, Default)]
+pub struct TopicInterner {
+    ids: HashMap<Arc<str>, LevelId>,
+
+    /// Interned levels indexed by id, None if that id is free.
+    levels: Vec<Option<Level>>,
+
+    /// Ids which can be reused.
+    free_ids: Vec<LevelId>,
+}
+
+impl TopicInterner {
+    #[must_use]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Number of interned levels.
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.ids.len()
+    }
+
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.ids.is_empty()
+    }
+
+    /// Get id of `level`, or None if it is not interned.
+    #[must_use]
+    pub fn get(&self, level: &str) -> Option<LevelId> {
+        self.ids.get(level).copied()
+    }
+
+    /// Get name of level `id`.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `id` is not interned.
+    #[must_use]
+    pub fn name(&self, id: LevelId) -> &str {
+        match &self.levels[id as usize] {
+            Some(level) => &level.name,
+            None => panic!("interner: Level id {} is not interned", id),
+        }
+    }
+
+    /// Get id of `level` and increase its reference count, interning it if not found.
+    ///
+    /// # Panics
+    ///
+    /// Panics if more than `u32::MAX` levels are interned.
+    pub fn intern(&mut self, level: &str) -> LevelId {
+        if let Some(&id) = self.ids.get(level) {
+            if let Some(level) = self.levels[id as usize].as_mut() {
+                level.refs += 1;
+            }
+            return id;
+        }
+
+        let name: Arc<str> = Arc::from(level);
+        let new_level = Level {
+            name: Arc::clone(&name),
+            refs: 1,
+        };
+        let id = if let Some(id) = self.free_ids.pop() {
+            self.levels[id as usize] = Some(new_level);
+            id
+        } else {
+            let id = LevelId::try_from(self.levels.len()).expect("interner: Too many levels");
+            self.levels.push(Some(new_level));
+            id
+        };
+        self.ids.insert(name, id);
+        id
+    }
+
+    /// Decrease reference count of level `id`, the level is removed if it is not used any more.
+    pub fn release(&mut self, id: LevelId) {
+        let slot = &mut self.levels[id as usize];
+        let removed = match slot.as_mut() {
+            Some(level) => {
+                level.refs -= 1;
+                level.refs == 0
+            }
+            None => {
+                log::error!("interner: Level id {} is not interned", id);
+                false
+            }
+        };
+        if removed {
+            if let Some(level) = slot.take() {
+                self.ids.remove(&level.name);
+            }
+            self.free_ids.push(id);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::TopicInterner;
+
+    #[test]
+    fn test_intern() {
+        let mut interner = TopicInterner::new();
+        let a = interner.intern("sport");
+        let b = interner.intern("tennis");
+        assert_ne!(a, b);
+        assert_eq!(interner.intern("sport"), a);
+        assert_eq!(interner.get("tennis"), Some(b));
+        assert_eq!(interner.name(a), "sport");
+
+        interner.release(a);
+        assert_eq!(interner.get("sport"), Some(a));
+        interner.release(a);
+        assert_eq!(interner.get("sport"), None);
+        assert_eq!(interner.len(), 1);
+
+        // Id of removed level is reused.
+        assert_eq!(interner.intern("player"), a);
+        interner.release(a);
+        interner.release(b);
+        assert!(interner.is_empty());
+    }
+}
@@ -2,26 +2,31 @@
 // Use of this source is governed by Affero General Public License that can be found
 // in the LICENSE file.
 
-use codec::{v3, v5, ProtocolLevel};
+use codec::{v3, v5, ProtocolLevel, QoS};
+use std::sync::PoisonError;
 
+use super::trie::is_shared;
 use super::Dispatcher;
 use crate::commands::{DispatcherToListenerCmd, ListenerToDispatcherCmd};
-use crate::types::SessionGid;
+use crate::session::CachedSession;
+use crate::types::{InflightCounter, SessionGid};
 
 impl Dispatcher {
     pub(super) async fn handle_listener_cmd(&mut self, cmd: ListenerToDispatcherCmd) {
         match cmd {
-            ListenerToDispatcherCmd::CheckCachedSession(session_gid, client_id, protocol_level) => {
-                self.on_listener_check_cached_session(session_gid, client_id, protocol_level)
-                    .await;
-            }
-            ListenerToDispatcherCmd::Publish(packet) => {
-                self.backends_store_packet(&packet).await;
-                self.on_listener_publish(&packet).await;
-            }
-            ListenerToDispatcherCmd::PublishV5(packet) => {
-                self.backends_store_packet_v5(&packet).await;
-                self.on_listener_publish_v5(&packet).await;
+            ListenerToDispatcherCmd::CheckCachedSession(
+                session_gid,
+                client_id,
+                protocol_level,
+                clean_session,
+            ) => {
+                self.on_listener_check_cached_session(
+                    session_gid,
+                    client_id,
+                    protocol_level,
+                    clean_session,
+                )
+                .await;
             }
             ListenerToDispatcherCmd::Subscribe(session_gid, packet) => {
                 self.on_listener_subscribe(session_gid, packet).await;
@@ -35,11 +40,23 @@ impl Dispatcher {
             ListenerToDispatcherCmd::UnsubscribeV5(session_gid, packet) => {
                 self.on_listener_unsubscribe_v5(session_gid, packet).await;
             }
-            ListenerToDispatcherCmd::SessionAdded(listener_id) => {
-                self.metrics_on_session_added(listener_id).await;
+            ListenerToDispatcherCmd::SessionAdded(session_gid, inflight) => {
+                self.on_listener_session_added(session_gid, inflight).await;
             }
-            ListenerToDispatcherCmd::SessionRemoved(listener_id) => {
-                self.metrics_on_session_removed(listener_id).await;
+            ListenerToDispatcherCmd::SessionRemoved(session_gid, cached_session) => {
+                self.on_listener_session_removed(session_gid, cached_session)
+                    .await;
+            }
+            ListenerToDispatcherCmd::PublishDropped(count, bytes) => {
+                self.metrics_publish_packet_dropped(count, bytes).await;
+            }
+            ListenerToDispatcherCmd::ConnectionsRejected(listener_id, count) => {
+                self.metrics_on_connections_rejected(listener_id, count)
+                    .await;
+            }
+            ListenerToDispatcherCmd::HandshakeStats(listener_id, latency, failed) => {
+                self.metrics_on_handshake_stats(listener_id, latency, failed)
+                    .await;
             }
         }
     }
@@ -49,8 +66,34 @@ impl Dispatcher {
         session_gid: SessionGid,
         client_id: String,
         protocol_level: ProtocolLevel,
+        clean_session: bool,
     ) {
-        let cached_session = self.cached_sessions.pop(&client_id);
+        let (cached_session, n_unsubscribed) = {
+            let mut sub_trie = self.sub_trie_mut();
+            match self.cached_sessions_mut().pop(&client_id) {
+                // If CleanSession is set to 1, the Client and Server MUST discard any previous
+                // Session and start a new one [MQTT-3.1.2-6].
+                Some((old_gid, _cached_session)) if clean_session => {
+                    (None, Some((old_gid, sub_trie.remove_session(old_gid))))
+                }
+                Some((old_gid, cached_session)) => {
+                    // Subscriptions are moved to the new session, so that messages are
+                    // delivered to it directly from now on. Listener queues them until
+                    // cached state is handed over and CONNACK is sent.
+                    sub_trie.rename_session(old_gid, session_gid);
+                    (Some(cached_session), Some((old_gid, 0)))
+                }
+                None => (None, None),
+            }
+        };
+        if let Some((old_gid, n_unsubscribed)) = n_unsubscribed {
+            if n_unsubscribed > 0 {
+                self.metrics_on_subscription_removed(old_gid.listener_id(), n_unsubscribed)
+                    .await;
+            }
+            self.metrics_on_session_removed(old_gid.listener_id()).await;
+        }
+
         if let Some(listener_sender) = self.listener_senders.get(&session_gid.listener_id()) {
             let cmd = DispatcherToListenerCmd::CheckCachedSessionResp(
                 session_gid.session_id(),
@@ -72,12 +115,43 @@ impl Dispatcher {
         }
     }
 
-    pub(super) async fn on_listener_publish(&mut self, packet: &v3::PublishPacket) {
-        self.publish_packet_to_sub_trie(packet).await;
+    async fn on_listener_session_added(
+        &mut self,
+        session_gid: SessionGid,
+        inflight: InflightCounter,
+    ) {
+        self.sub_trie_mut().add_session(session_gid, inflight);
+        self.metrics_on_session_added(session_gid.listener_id())
+            .await;
     }
 
-    pub(super) async fn on_listener_publish_v5(&mut self, packet: &v5::PublishPacket) {
-        self.publish_packet_to_sub_trie_v5(packet).await;
+    async fn on_listener_session_removed(
+        &mut self,
+        session_gid: SessionGid,
+        cached_session: Option<CachedSession>,
+    ) {
+        let removed = {
+            let mut sub_trie = self.sub_trie_mut();
+            match cached_session {
+                Some(cached_session) => {
+                    // Subscriptions of persistent session are kept until it expires.
+                    sub_trie.set_offline(session_gid);
+                    self.cached_sessions_mut()
+                        .insert(session_gid, cached_session)
+                        .map(|old_gid| (old_gid, sub_trie.remove_session(old_gid)))
+                }
+                None => Some((session_gid, sub_trie.remove_session(session_gid))),
+            }
+        };
+
+        if let Some((session_gid, n_unsubscribed)) = removed {
+            if n_unsubscribed > 0 {
+                self.metrics_on_subscription_removed(session_gid.listener_id(), n_unsubscribed)
+                    .await;
+            }
+            self.metrics_on_session_removed(session_gid.listener_id())
+                .await;
+        }
     }
 
     async fn on_listener_subscribe(
@@ -85,11 +159,24 @@ impl Dispatcher {
         session_gid: SessionGid,
         packet: v3::SubscribePacket,
     ) {
-        let (sub_ack_packet, n_subscribed) = self.sub_trie.subscribe(session_gid, &packet);
+        let (sub_ack_packet, n_subscribed) = self.sub_trie_mut().subscribe(session_gid, &packet);
 
         self.metrics_on_subscription_added(session_gid.listener_id(), n_subscribed)
             .await;
 
+        // Retained messages are sent to each accepted topic filter after SUBACK.
+        let retained_filters: Vec<(String, QoS)> = packet
+            .topics()
+            .iter()
+            .zip(sub_ack_packet.acknowledgements())
+            .filter_map(|(topic, ack)| match ack {
+                v3::SubscribeAck::QoS(qos) if !is_shared(topic.topic()) => {
+                    Some((topic.topic().to_string(), *qos))
+                }
+                _ => None,
+            })
+            .collect();
+
         if let Some(listener_sender) = self.listener_senders.get(&session_gid.listener_id()) {
             let cmd =
                 DispatcherToListenerCmd::SubscribeAck(session_gid.session_id(), sub_ack_packet);
@@ -106,6 +193,9 @@ impl Dispatcher {
                 session_gid.listener_id()
             );
         }
+
+        self.send_retained_messages(session_gid, &retained_filters)
+            .await;
     }
 
     async fn on_listener_subscribe_v5(
@@ -113,11 +203,40 @@ impl Dispatcher {
         session_gid: SessionGid,
         packet: v5::SubscribePacket,
     ) {
-        let (sub_ack_packet, n_subscribed) = self.sub_trie.subscribe_v5(session_gid, &packet);
+        let (sub_ack_packet, n_subscribed, send_retained) = {
+            let mut sub_trie = self.sub_trie_mut();
+            // Check retain handling option before subscriptions are updated.
+            let send_retained: Vec<bool> = packet
+                .topics()
+                .iter()
+                .map(|topic| match topic.retain_handling() {
+                    v5::RetainHandling::Send => true,
+                    v5::RetainHandling::SendFirst => {
+                        !sub_trie.is_subscribed(session_gid, topic.topic())
+                    }
+                    v5::RetainHandling::NoSend => false,
+                })
+                .collect();
+            let (sub_ack_packet, n_subscribed) = sub_trie.subscribe_v5(session_gid, &packet);
+            (sub_ack_packet, n_subscribed, send_retained)
+        };
 
         self.metrics_on_subscription_added(session_gid.listener_id(), n_subscribed)
             .await;
 
+        // Retained messages are not sent to the session when it establishes
+        // a new Shared Subscription.
+        let retained_filters: Vec<(String, QoS)> = packet
+            .topics()
+            .iter()
+            .zip(sub_ack_packet.reasons())
+            .zip(send_retained)
+            .filter(|((topic, reason), send_retained)| {
+                *send_retained && **reason == v5::ReasonCode::Success && !is_shared(topic.topic())
+            })
+            .map(|((topic, _reason), _send_retained)| (topic.topic().to_string(), topic.qos()))
+            .collect();
+
         if let Some(listener_sender) = self.listener_senders.get(&session_gid.listener_id()) {
             let cmd =
                 DispatcherToListenerCmd::SubscribeAckV5(session_gid.session_id(), sub_ack_packet);
@@ -134,6 +253,9 @@ impl Dispatcher {
                 session_gid.listener_id()
             );
         }
+
+        self.send_retained_messages(session_gid, &retained_filters)
+            .await;
     }
 
     async fn on_listener_unsubscribe(
@@ -141,7 +263,7 @@ impl Dispatcher {
         session_gid: SessionGid,
         packet: v3::UnsubscribePacket,
     ) {
-        let n_unsubscribed = self.sub_trie.unsubscribe(session_gid, &packet);
+        let n_unsubscribed = self.sub_trie_mut().unsubscribe(session_gid, &packet);
         self.metrics_on_subscription_removed(session_gid.listener_id(), n_unsubscribed)
             .await;
     }
@@ -151,8 +273,41 @@ impl Dispatcher {
         session_gid: SessionGid,
         packet: v5::UnsubscribePacket,
     ) {
-        let n_unsubscribed = self.sub_trie.unsubscribe_v5(session_gid, &packet);
+        let n_unsubscribed = self.sub_trie_mut().unsubscribe_v5(session_gid, &packet);
         self.metrics_on_subscription_removed(session_gid.listener_id(), n_unsubscribed)
             .await;
     }
+
+    /// Send retained messages matching `topic_filters` to a session.
+    ///
+    /// Dispatcher does not wait for a busy listener, QoS 0 messages are dropped
+    /// if channel of listener is full.
+    async fn send_retained_messages(
+        &mut self,
+        session_gid: SessionGid,
+        topic_filters: &[(String, QoS)],
+    ) {
+        if topic_filters.is_empty() {
+            return;
+        }
+        let mut dropped = (0, 0);
+        for (topic_filter, qos) in topic_filters {
+            // Lock is released before sending to listener.
+            let messages = self
+                .retain_store
+                .read()
+                .unwrap_or_else(PoisonError::into_inner)
+                .match_filter(topic_filter);
+            for message in messages {
+                if !self.outbox.send_publish(session_gid, *qos, &message, true) {
+                    dropped.0 += 1;
+                    dropped.1 += message.size();
+                }
+            }
+        }
+        if dropped.0 > 0 {
+            self.metrics_publish_packet_dropped(dropped.0, dropped.1)
+                .await;
+        }
+    }
 }
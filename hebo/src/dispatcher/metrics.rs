@@ -5,6 +5,7 @@
 //! Metrics app handler
 
 use super::Dispatcher;
+use crate::cache_types::LatencyHistogram;
 use crate::commands::{DispatcherToMetricsCmd, MetricsToDispatcherCmd};
 use crate::types::ListenerId;
 
@@ -12,10 +13,10 @@ impl Dispatcher {
     pub(super) async fn handle_metrics_cmd(&mut self, cmd: MetricsToDispatcherCmd) {
         match cmd {
             MetricsToDispatcherCmd::Publish(packet) => {
-                self.publish_packet_to_sub_trie(&packet).await;
+                self.publish_packet_to_shard(packet).await;
             }
             MetricsToDispatcherCmd::PublishV5(packet) => {
-                self.publish_packet_to_sub_trie_v5(&packet).await;
+                self.publish_packet_to_shard_v5(packet).await;
             }
         }
     }
@@ -43,6 +44,61 @@ impl Dispatcher {
         }
     }
 
+    pub(super) async fn metrics_publish_packet_dropped(&mut self, count: usize, bytes: usize) {
+        if let Err(err) = self
+            .metrics_sender
+            .send(DispatcherToMetricsCmd::PublishPacketDropped(count, bytes))
+            .await
+        {
+            log::error!(
+                "Dispatcher: Failed to send PublishPacketDropped cmd, err: {:?}",
+                err
+            );
+        }
+    }
+
+    pub(super) async fn metrics_on_connections_rejected(
+        &mut self,
+        listener_id: ListenerId,
+        count: usize,
+    ) {
+        if let Err(err) = self
+            .metrics_sender
+            .send(DispatcherToMetricsCmd::ConnectionsRejected(
+                listener_id,
+                count,
+            ))
+            .await
+        {
+            log::error!(
+                "Dispatcher: Failed to send ConnectionsRejected cmd, err: {:?}",
+                err
+            );
+        }
+    }
+
+    pub(super) async fn metrics_on_handshake_stats(
+        &mut self,
+        listener_id: ListenerId,
+        latency: LatencyHistogram,
+        failed: usize,
+    ) {
+        if let Err(err) = self
+            .metrics_sender
+            .send(DispatcherToMetricsCmd::HandshakeStats(
+                listener_id,
+                latency,
+                failed,
+            ))
+            .await
+        {
+            log::error!(
+                "Dispatcher: Failed to send HandshakeStats cmd, err: {:?}",
+                err
+            );
+        }
+    }
+
     pub(super) async fn metrics_on_session_added(&mut self, listener_id: ListenerId) {
         if let Err(err) = self
             .metrics_sender
@@ -3,31 +3,51 @@
 // in the LICENSE file.
 
 use std::collections::HashMap;
+use std::sync::{Arc, Mutex, MutexGuard, PoisonError, RwLock, RwLockWriteGuard};
+use std::time::{Duration, Instant};
 use tokio::sync::mpsc::{Receiver, Sender};
 
 use crate::commands::{
-    BackendsToDispatcherCmd, BridgeToDispatcherCmd, DispatcherToBackendsCmd, DispatcherToBridgeCmd,
-    DispatcherToGatewayCmd, DispatcherToListenerCmd, DispatcherToMetricsCmd,
+    BackendsToDispatcherCmd, BridgeToDispatcherCmd, DispatcherShardCmd, DispatcherToBackendsCmd,
+    DispatcherToBridgeCmd, DispatcherToGatewayCmd, DispatcherToListenerCmd, DispatcherToMetricsCmd,
     DispatcherToRuleEngineCmd, GatewayToDispatcherCmd, ListenerToDispatcherCmd,
     MetricsToDispatcherCmd, RuleEngineToDispatcherCmd,
 };
-use crate::types::ListenerId;
+use crate::config;
+use crate::types::{ListenerId, SessionGid};
 
 mod backends;
 mod bridge;
 mod gateway;
+pub mod interner;
 mod listener;
 mod metrics;
+mod outbox;
+pub mod retain;
 mod rule_engine;
-mod sessions;
-mod trie;
+pub mod sessions;
+mod shard;
+pub mod trie;
+
+pub use shard::{shard_index, DispatcherShard};
+
+/// Interval to remove expired persistent sessions.
+const SESSION_EXPIRY_CHECK_INTERVAL: Duration = Duration::from_secs(1);
 
 /// Dispatcher is a message router.
 #[allow(dead_code)]
 pub struct Dispatcher {
-    sub_trie: trie::SubTrie,
+    config: config::Dispatcher,
+
+    /// Subscriptions are updated here and read by shards.
+    sub_trie: Arc<RwLock<trie::SubTrie>>,
+    shard_senders: Vec<Sender<DispatcherShardCmd>>,
+
+    /// Retained messages are updated by shards and read here on subscribe.
+    retain_store: Arc<RwLock<retain::RetainStore>>,
 
-    cached_sessions: sessions::CachedSessions,
+    /// Persistent sessions whose clients are disconnected, shared with shards.
+    cached_sessions: Arc<Mutex<sessions::CachedSessions>>,
 
     backends_sender: Sender<DispatcherToBackendsCmd>,
     backends_receiver: Receiver<BackendsToDispatcherCmd>,
@@ -42,6 +62,9 @@ pub struct Dispatcher {
     metrics_receiver: Receiver<MetricsToDispatcherCmd>,
 
     listener_senders: HashMap<ListenerId, Sender<DispatcherToListenerCmd>>,
+
+    /// Retained messages are sent to listeners without waiting.
+    outbox: outbox::ListenerOutbox,
     listener_receiver: Receiver<ListenerToDispatcherCmd>,
 
     rule_engine_sender: Sender<DispatcherToRuleEngineCmd>,
@@ -52,6 +75,12 @@ impl Dispatcher {
     #[allow(clippy::too_many_arguments)]
     #[must_use]
     pub fn new(
+        config: config::Dispatcher,
+        sub_trie: Arc<RwLock<trie::SubTrie>>,
+        shard_senders: Vec<Sender<DispatcherShardCmd>>,
+        retain_store: Arc<RwLock<retain::RetainStore>>,
+        cached_sessions: Arc<Mutex<sessions::CachedSessions>>,
+
         backends_sender: Sender<DispatcherToBackendsCmd>,
         backends_receiver: Receiver<BackendsToDispatcherCmd>,
 
@@ -71,9 +100,12 @@ impl Dispatcher {
         rule_engine_receiver: Receiver<RuleEngineToDispatcherCmd>,
     ) -> Self {
         Self {
-            sub_trie: trie::SubTrie::new(),
+            config,
+            sub_trie,
+            shard_senders,
+            retain_store,
 
-            cached_sessions: sessions::CachedSessions::new(),
+            cached_sessions,
 
             backends_sender,
             backends_receiver,
@@ -87,6 +119,7 @@ impl Dispatcher {
             metrics_sender,
             metrics_receiver,
 
+            outbox: outbox::ListenerOutbox::new(listener_senders.clone()),
             listener_senders: listener_senders.into_iter().collect(),
             listener_receiver,
 
@@ -95,9 +128,55 @@ impl Dispatcher {
         }
     }
 
+    /// Lock subscription trie to update it.
+    fn sub_trie_mut(&self) -> RwLockWriteGuard<'_, trie::SubTrie> {
+        self.sub_trie
+            .write()
+            .unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// Lock cached sessions.
+    ///
+    /// Lock subscription trie first if both of them are required.
+    fn cached_sessions_mut(&self) -> MutexGuard<'_, sessions::CachedSessions> {
+        self.cached_sessions
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// Remove cached sessions which are expired, with their subscriptions.
+    async fn remove_expired_sessions(&mut self) {
+        let removed: Vec<(SessionGid, usize)> = {
+            let mut sub_trie = self.sub_trie_mut();
+            let expired = self.cached_sessions_mut().remove_expired(Instant::now());
+            expired
+                .into_iter()
+                .map(|session_gid| (session_gid, sub_trie.remove_session(session_gid)))
+                .collect()
+        };
+        for (session_gid, n_unsubscribed) in removed {
+            log::info!("dispatcher: Session expired: {:?}", session_gid);
+            if n_unsubscribed > 0 {
+                self.metrics_on_subscription_removed(session_gid.listener_id(), n_unsubscribed)
+                    .await;
+            }
+            self.metrics_on_session_removed(session_gid.listener_id())
+                .await;
+        }
+    }
+
     pub async fn run_loop(&mut self) -> ! {
+        let mut expiry_timer = tokio::time::interval(SESSION_EXPIRY_CHECK_INTERVAL);
+        let mut flush_timer = tokio::time::interval(outbox::FLUSH_INTERVAL);
+        flush_timer.set_missed_tick_behavior(tokio::time::MissedTickBehavior::Delay);
         loop {
             tokio::select! {
+                _ = expiry_timer.tick() => {
+                    self.remove_expired_sessions().await;
+                }
+                _ = flush_timer.tick(), if self.outbox.has_overflow() => {
+                    self.outbox.flush();
+                }
                 Some(cmd) = self.backends_receiver.recv() => {
                     self.handle_backends_cmd(cmd).await;
                 }
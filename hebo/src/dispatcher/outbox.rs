@@ -0,0 +1,195 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Send publish messages to listeners without waiting.
+//!
+//! Dispatcher and its shards never wait for a busy listener. A listener may be
+//! waiting for a shard to receive publish packets of its sessions at the same time,
+//! and the two would wait for each other forever.
+//!
+//! If channel of a listener is full, QoS 0 messages are dropped. QoS 1 and QoS 2
+//! messages are kept in a bounded overflow queue of that listener, and sent in order
+//! on next flush.
+
+use codec::QoS;
+use std::collections::{HashMap, VecDeque};
+use std::time::Duration;
+use tokio::sync::mpsc::error::TrySendError;
+use tokio::sync::mpsc::Sender;
+
+use crate::commands::DispatcherToListenerCmd;
+use crate::message::PublishMessage;
+use crate::types::{ListenerId, SessionGid};
+
+/// Interval to resend messages in overflow queues.
+pub const FLUSH_INTERVAL: Duration = Duration::from_millis(10);
+
+/// Maximum number of messages kept for a busy listener.
+const MAX_OVERFLOW_MESSAGES: usize = 4096;
+
+#[derive(Debug, Default)]
+pub struct ListenerOutbox {
+    senders: HashMap<ListenerId, Sender<DispatcherToListenerCmd>>,
+
+    /// QoS 1 and QoS 2 messages to busy listeners.
+    overflow: HashMap<ListenerId, VecDeque<DispatcherToListenerCmd>>,
+}
+
+impl ListenerOutbox {
+    #[must_use]
+    pub fn new(senders: Vec<(ListenerId, Sender<DispatcherToListenerCmd>)>) -> Self {
+        Self {
+            senders: senders.into_iter().collect(),
+            overflow: HashMap::new(),
+        }
+    }
+
+    /// Returns true if some messages are waiting for busy listeners.
+    #[must_use]
+    pub fn has_overflow(&self) -> bool {
+        self.overflow.values().any(|queue| !queue.is_empty())
+    }
+
+    /// Send publish message to listener of a session.
+    ///
+    /// Returns false if message is dropped as listener is busy.
+    pub fn send_publish(
+        &mut self,
+        session_gid: SessionGid,
+        qos: QoS,
+        message: &PublishMessage,
+        retained: bool,
+    ) -> bool {
+        let listener_id = session_gid.listener_id();
+        let sender = match self.senders.get(&listener_id) {
+            Some(sender) => sender,
+            None => {
+                log::error!(
+                    "dispatcher: Failed to get listener sender with id: {}",
+                    listener_id
+                );
+                return true;
+            }
+        };
+        let session_id = session_gid.session_id();
+        let cmd = if retained {
+            DispatcherToListenerCmd::PublishRetained(session_id, qos, message.clone())
+        } else {
+            DispatcherToListenerCmd::Publish(session_id, qos, message.clone())
+        };
+
+        // Keep order of messages, new messages are appended to overflow queue
+        // until it is empty.
+        let queue = self.overflow.entry(listener_id).or_default();
+        let cmd = if queue.is_empty() {
+            match sender.try_send(cmd) {
+                Ok(()) => return true,
+                Err(TrySendError::Full(cmd)) => cmd,
+                Err(TrySendError::Closed(_cmd)) => {
+                    log::error!(
+                        "dispatcher: Failed to send publish packet to listener: {}, channel closed",
+                        listener_id
+                    );
+                    return true;
+                }
+            }
+        } else {
+            cmd
+        };
+
+        if message.qos().min(qos) == QoS::AtMostOnce || queue.len() >= MAX_OVERFLOW_MESSAGES {
+            log::warn!(
+                "dispatcher: Listener {} is busy, drop message to {:?}",
+                listener_id,
+                session_gid
+            );
+            return false;
+        }
+        queue.push_back(cmd);
+        true
+    }
+
+    /// Send messages in overflow queues in order, until listeners are busy again.
+    pub fn flush(&mut self) {
+        for (listener_id, queue) in &mut self.overflow {
+            let sender = match self.senders.get(listener_id) {
+                Some(sender) => sender,
+                None => {
+                    queue.clear();
+                    continue;
+                }
+            };
+            while let Some(cmd) = queue.pop_front() {
+                match sender.try_send(cmd) {
+                    Ok(()) => (),
+                    Err(TrySendError::Full(cmd)) => {
+                        queue.push_front(cmd);
+                        break;
+                    }
+                    Err(TrySendError::Closed(_cmd)) => {
+                        queue.clear();
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use codec::{v3, QoS};
+    use tokio::sync::mpsc;
+
+    use super::ListenerOutbox;
+    use crate::commands::DispatcherToListenerCmd;
+    use crate::message::PublishMessage;
+    use crate::types::SessionGid;
+
+    fn new_message(qos: QoS) -> PublishMessage {
+        let packet = v3::PublishPacket::new("sport/tennis", qos, b"hello").unwrap();
+        PublishMessage::from_v3(&packet)
+    }
+
+    #[test]
+    fn test_busy_listener() {
+        let (sender, mut receiver) = mpsc::channel(1);
+        let mut outbox = ListenerOutbox::new(vec![(1, sender)]);
+        let session_gid = SessionGid::new(1, 2);
+
+        // Channel of listener is full after the first message.
+        assert!(outbox.send_publish(
+            session_gid,
+            QoS::AtMostOnce,
+            &new_message(QoS::AtMostOnce),
+            false
+        ));
+        assert!(!outbox.send_publish(
+            session_gid,
+            QoS::AtMostOnce,
+            &new_message(QoS::AtMostOnce),
+            false
+        ));
+        assert!(outbox.send_publish(
+            session_gid,
+            QoS::AtLeastOnce,
+            &new_message(QoS::AtLeastOnce),
+            false
+        ));
+        assert!(outbox.has_overflow());
+
+        outbox.flush();
+        assert!(outbox.has_overflow());
+        assert!(matches!(
+            receiver.try_recv(),
+            Ok(DispatcherToListenerCmd::Publish(2, QoS::AtMostOnce, _))
+        ));
+        outbox.flush();
+        assert!(!outbox.has_overflow());
+        assert!(matches!(
+            receiver.try_recv(),
+            Ok(DispatcherToListenerCmd::Publish(2, QoS::AtLeastOnce, _))
+        ));
+    }
+}
@@ -0,0 +1,416 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Store retained messages.
+//!
+//! Messages are indexed by topic levels. Looking up a topic filter only visits nodes
+//! reachable from its levels: an exact level follows one child, `+` visits all children
+//! of that level and `#` collects the whole subtree, so that retained messages
+//! are not scanned one by one on each SUBSCRIBE. Children are keyed by interned
+//! level ids, like nodes of subscription trie.
+
+use super::interner::{LevelId, LevelMap, TopicInterner};
+use crate::message::PublishMessage;
+use crate::types::ListenerId;
+
+const LEVEL_SEPARATOR: char = '/';
+const SINGLE_WILDCARD: &str = "+";
+const MULTI_WILDCARD: &str = "#";
+
+#[derive(Debug, Clone)]
+struct Retained {
+    /// Listener of publisher, None if message is generated by server.
+    listener_id: Option<ListenerId>,
+    message: PublishMessage,
+}
+
+impl Retained {
+    fn bytes(&self) -> usize {
+        message_bytes(&self.message)
+    }
+}
+
+fn message_bytes(message: &PublishMessage) -> usize {
+    message.topic().len() + message.payload().len()
+}
+
+#[derive(Debug, Default)]
+struct RetainNode {
+    /// Children keyed by interned level id.
+    children: LevelMap<RetainNode>,
+    retained: Option<Retained>,
+}
+
+impl RetainNode {
+    fn get(&self, interner: &TopicInterner, levels: &[&str]) -> Option<&Retained> {
+        match levels.split_first() {
+            None => self.retained.as_ref(),
+            Some((level, rest)) => {
+                let id = interner.get(level)?;
+                self.children.get(&id)?.get(interner, rest)
+            }
+        }
+    }
+
+    /// Get message slot at topic `levels`, creating nodes if not found.
+    ///
+    /// Levels of new nodes are interned.
+    fn get_mut(&mut self, interner: &mut TopicInterner, levels: &[&str]) -> &mut Option<Retained> {
+        match levels.split_first() {
+            None => &mut self.retained,
+            Some((level, rest)) => {
+                let id = match interner.get(level) {
+                    Some(id) if self.children.contains_key(&id) => id,
+                    _ => {
+                        let id = interner.intern(level);
+                        self.children.insert(id, Self::default());
+                        id
+                    }
+                };
+                self.children
+                    .get_mut(&id)
+                    .expect("retain: Child node not found")
+                    .get_mut(interner, rest)
+            }
+        }
+    }
+
+    /// Take message at topic `levels` and prune empty child nodes.
+    fn take(&mut self, interner: &mut TopicInterner, levels: &[&str]) -> Option<Retained> {
+        match levels.split_first() {
+            None => self.retained.take(),
+            Some((level, rest)) => {
+                let id = interner.get(level)?;
+                let child = self.children.get_mut(&id)?;
+                let retained = child.take(interner, rest);
+                if child.retained.is_none() && child.children.is_empty() {
+                    self.children.remove(&id);
+                    interner.release(id);
+                }
+                retained
+            }
+        }
+    }
+
+    /// Append messages whose topic matches topic filter `levels`.
+    fn collect(
+        &self,
+        interner: &TopicInterner,
+        levels: &[FilterLevel],
+        is_first_level: bool,
+        messages: &mut Vec<PublishMessage>,
+    ) {
+        // The Server MUST NOT match Topic Filters starting with a wildcard character
+        // (# or +) with Topic Names beginning with a $ character [MQTT-4.7.2-1].
+        let wildcard_allowed =
+            |id: LevelId| !(is_first_level && interner.name(id).starts_with('$'));
+
+        match levels.split_first() {
+            None => {
+                if let Some(retained) = &self.retained {
+                    messages.push(retained.message.clone());
+                }
+            }
+            Some((FilterLevel::MultiWildcard, _)) => {
+                // `#` also matches the parent level, so `sport/#` matches `sport`.
+                if let Some(retained) = &self.retained {
+                    messages.push(retained.message.clone());
+                }
+                for (&id, child) in &self.children {
+                    if wildcard_allowed(id) {
+                        child.collect_all(messages);
+                    }
+                }
+            }
+            Some((FilterLevel::SingleWildcard, rest)) => {
+                for (&id, child) in &self.children {
+                    if wildcard_allowed(id) {
+                        child.collect(interner, rest, false, messages);
+                    }
+                }
+            }
+            Some((FilterLevel::Level(id), rest)) => {
+                if let Some(child) = self.children.get(id) {
+                    child.collect(interner, rest, false, messages);
+                }
+            }
+        }
+    }
+
+    fn collect_all(&self, messages: &mut Vec<PublishMessage>) {
+        if let Some(retained) = &self.retained {
+            messages.push(retained.message.clone());
+        }
+        for child in self.children.values() {
+            child.collect_all(messages);
+        }
+    }
+}
+
+/// Level of topic filter, exact levels are interned.
+#[derive(Debug, Clone, Copy)]
+enum FilterLevel {
+    Level(LevelId),
+    SingleWildcard,
+    MultiWildcard,
+}
+
+/// Changes of retained messages, used to update metrics.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct RetainChange {
+    /// `(listener_id, bytes)` of the replaced or removed message.
+    pub removed: Option<(Option<ListenerId>, usize)>,
+
+    /// `(listener_id, bytes)` of the new message.
+    pub added: Option<(Option<ListenerId>, usize)>,
+
+    /// New message is not stored as message count or bytes limit is exceeded.
+    pub rejected: bool,
+}
+
+/// Retained messages, bounded by number of messages and total bytes.
+#[derive(Debug)]
+pub struct RetainStore {
+    root: RetainNode,
+
+    /// Levels of topics in `root`.
+    interner: TopicInterner,
+
+    count: usize,
+    bytes: usize,
+
+    /// 0 means no limit.
+    max_count: usize,
+
+    /// 0 means no limit.
+    max_bytes: usize,
+}
+
+impl Default for RetainStore {
+    fn default() -> Self {
+        Self::new(0, 0)
+    }
+}
+
+impl RetainStore {
+    #[must_use]
+    pub fn new(max_count: usize, max_bytes: usize) -> Self {
+        Self {
+            root: RetainNode::default(),
+            interner: TopicInterner::new(),
+            count: 0,
+            bytes: 0,
+            max_count,
+            max_bytes,
+        }
+    }
+
+    /// Number of retained messages.
+    #[must_use]
+    pub const fn len(&self) -> usize {
+        self.count
+    }
+
+    #[must_use]
+    pub const fn is_empty(&self) -> bool {
+        self.count == 0
+    }
+
+    /// Total bytes of topics and payloads of retained messages.
+    #[must_use]
+    pub const fn bytes(&self) -> usize {
+        self.bytes
+    }
+
+    /// Store or remove retained message of its topic.
+    ///
+    /// If the payload is empty, the retained message of that topic is removed.
+    ///
+    /// If message count or bytes limit is exceeded, the new message is rejected.
+    /// The old message of the same topic is removed in that case too, as it is
+    /// not the latest one of that topic any more.
+    pub fn store(
+        &mut self,
+        listener_id: Option<ListenerId>,
+        message: &PublishMessage,
+    ) -> RetainChange {
+        let levels: Vec<&str> = message.topic().split(LEVEL_SEPARATOR).collect();
+
+        // A PUBLISH Packet with a RETAIN flag set to 1 and a payload containing zero bytes
+        // will be processed as normal by the Server and sent to Clients with a subscription
+        // matching the topic name. Additionally any existing retained message with
+        // the same topic name MUST be removed [MQTT-3.3.1-10].
+        if message.payload().is_empty() {
+            return RetainChange {
+                removed: self.remove(&levels),
+                ..RetainChange::default()
+            };
+        }
+
+        let new_bytes = message_bytes(message);
+        let (old_count, old_bytes) = self
+            .root
+            .get(&self.interner, &levels)
+            .map_or((0, 0), |old| (1, old.bytes()));
+        let count = self.count - old_count + 1;
+        let bytes = self.bytes - old_bytes + new_bytes;
+
+        // If the Server receives a QoS 0 message with the RETAIN flag set to 1 it MUST
+        // discard any message previously retained for that topic. It SHOULD store
+        // the new QoS 0 message as the new retained message for that topic [MQTT-3.3.1-7].
+        if self.max_count > 0 && count > self.max_count {
+            log::warn!(
+                "retain: Too many retained messages, max: {}, topic: {}",
+                self.max_count,
+                message.topic()
+            );
+            return RetainChange {
+                removed: self.remove(&levels),
+                added: None,
+                rejected: true,
+            };
+        }
+        if self.max_bytes > 0 && bytes > self.max_bytes {
+            log::warn!(
+                "retain: Too many bytes of retained messages, max: {}, topic: {}",
+                self.max_bytes,
+                message.topic()
+            );
+            return RetainChange {
+                removed: self.remove(&levels),
+                added: None,
+                rejected: true,
+            };
+        }
+
+        let old = self
+            .root
+            .get_mut(&mut self.interner, &levels)
+            .replace(Retained {
+                listener_id,
+                message: message.clone(),
+            });
+        self.count = count;
+        self.bytes = bytes;
+        RetainChange {
+            removed: old.map(|old| (old.listener_id, old_bytes)),
+            added: Some((listener_id, new_bytes)),
+            rejected: false,
+        }
+    }
+
+    /// Remove retained message at topic `levels`.
+    ///
+    /// Returns `(listener_id, bytes)` of the removed message.
+    fn remove(&mut self, levels: &[&str]) -> Option<(Option<ListenerId>, usize)> {
+        self.root.take(&mut self.interner, levels).map(|retained| {
+            let bytes = retained.bytes();
+            self.count -= 1;
+            self.bytes -= bytes;
+            (retained.listener_id, bytes)
+        })
+    }
+
+    /// Get retained messages matching topic filter.
+    #[must_use]
+    pub fn match_filter(&self, topic_filter: &str) -> Vec<PublishMessage> {
+        let mut levels = Vec::new();
+        for level in topic_filter.split(LEVEL_SEPARATOR) {
+            let level = match level {
+                SINGLE_WILDCARD => FilterLevel::SingleWildcard,
+                MULTI_WILDCARD => FilterLevel::MultiWildcard,
+                // No topic contains a level which is not interned.
+                _ => match self.interner.get(level) {
+                    Some(id) => FilterLevel::Level(id),
+                    None => return Vec::new(),
+                },
+            };
+            levels.push(level);
+        }
+        let mut messages = Vec::new();
+        self.root
+            .collect(&self.interner, &levels, true, &mut messages);
+        messages
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::RetainStore;
+    use crate::message::PublishMessage;
+    use codec::{v3, QoS};
+
+    fn message(topic: &str, payload: &[u8]) -> PublishMessage {
+        let mut packet = v3::PublishPacket::new(topic, QoS::AtMostOnce, payload).unwrap();
+        packet.set_retain(true);
+        PublishMessage::from_v3(&packet)
+    }
+
+    fn topics(store: &RetainStore, filter: &str) -> Vec<String> {
+        let mut topics: Vec<String> = store
+            .match_filter(filter)
+            .iter()
+            .map(|message| message.topic().to_string())
+            .collect();
+        topics.sort();
+        topics
+    }
+
+    #[test]
+    fn test_match_filter() {
+        let mut store = RetainStore::default();
+        for topic in &["a", "a/b/c", "a/x/c", "a/b/c/d", "a/b", "$SYS/uptime"] {
+            assert!(!store.store(Some(0), &message(topic, b"1")).rejected);
+        }
+        assert_eq!(store.len(), 6);
+        assert_eq!(topics(&store, "a/+/c"), vec!["a/b/c", "a/x/c"]);
+        assert_eq!(topics(&store, "a/+/c/#"), vec!["a/b/c", "a/b/c/d", "a/x/c"]);
+        assert_eq!(topics(&store, "a/#").len(), 5);
+        assert_eq!(topics(&store, "#").len(), 5);
+        assert_eq!(topics(&store, "+/uptime").len(), 0);
+        assert_eq!(topics(&store, "$SYS/#"), vec!["$SYS/uptime"]);
+
+        let change = store.store(Some(0), &message("a/b", b""));
+        assert_eq!(change.removed, Some((Some(0), 4)));
+        assert_eq!(store.len(), 5);
+        assert!(topics(&store, "a/b").is_empty());
+        assert_eq!(topics(&store, "a/b/c"), vec!["a/b/c"]);
+        assert_eq!(topics(&store, "a/y/c"), Vec::<String>::new());
+
+        for topic in &["a", "a/b/c", "a/x/c", "a/b/c/d", "$SYS/uptime"] {
+            assert!(!store.store(Some(0), &message(topic, b"")).rejected);
+        }
+        assert!(store.is_empty());
+        assert!(store.interner.is_empty());
+    }
+
+    #[test]
+    fn test_limits() {
+        let mut store = RetainStore::new(2, 10);
+        assert!(!store.store(None, &message("a", b"1234")).rejected);
+        assert!(!store.store(None, &message("b", b"1234")).rejected);
+        assert!(store.store(None, &message("c", b"1")).rejected);
+        // Replacing an existing message does not increase count.
+        assert!(!store.store(None, &message("a", b"12")).rejected);
+        assert_eq!(store.bytes(), 8);
+    }
+
+    #[test]
+    fn test_rejected_replacement() {
+        let mut store = RetainStore::new(2, 10);
+        assert!(!store.store(Some(1), &message("a", b"12")).rejected);
+        assert!(!store.store(Some(1), &message("b", b"1234")).rejected);
+
+        // Old message of "b" is stale once a newer one is published, it is removed
+        // even if the newer one is too large to be retained.
+        let change = store.store(Some(1), &message("b", b"1234567"));
+        assert!(change.rejected);
+        assert_eq!(change.removed, Some((Some(1), 5)));
+        assert_eq!(change.added, None);
+        assert_eq!(store.len(), 1);
+        assert_eq!(store.bytes(), 3);
+        assert!(topics(&store, "b").is_empty());
+        assert_eq!(topics(&store, "#"), vec!["a"]);
+    }
+}
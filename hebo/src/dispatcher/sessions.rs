@@ -2,24 +2,179 @@
 // Use of this source is governed by Affero General Public License that can be found
 // in the LICENSE file.
 
+//! Persistent sessions whose clients are disconnected.
+//!
+//! Cached sessions are shared with dispatcher shards, which append messages
+//! to their offline queues. To avoid losing messages while a session is moved
+//! back to a new connection, lock subscription trie before locking this store.
+
+use codec::QoS;
 use std::collections::HashMap;
+use std::time::Instant;
 
+use crate::config::QueueDropPolicy;
+use crate::message::PublishMessage;
 use crate::session::CachedSession;
+use crate::types::SessionGid;
+
+#[derive(Debug)]
+struct CachedEntry {
+    /// Id of disconnected session, its subscriptions are kept in trie.
+    session_gid: SessionGid,
+    expired_at: Instant,
+    session: CachedSession,
+}
 
 #[allow(clippy::module_name_repetitions)]
 #[derive(Debug)]
 pub struct CachedSessions {
-    map: HashMap<String, CachedSession>,
+    /// client id -> cached session.
+    map: HashMap<String, CachedEntry>,
+
+    /// session gid -> client id.
+    gids: HashMap<SessionGid, String>,
+
+    max_queued_messages: usize,
+    max_queued_bytes: usize,
+    queue_drop_policy: QueueDropPolicy,
+}
+
+impl Default for CachedSessions {
+    fn default() -> Self {
+        Self::new(0, 0, QueueDropPolicy::default())
+    }
 }
 
 impl CachedSessions {
-    pub fn new() -> Self {
+    #[must_use]
+    pub fn new(
+        max_queued_messages: usize,
+        max_queued_bytes: usize,
+        queue_drop_policy: QueueDropPolicy,
+    ) -> Self {
         Self {
             map: HashMap::new(),
+            gids: HashMap::new(),
+            max_queued_messages,
+            max_queued_bytes,
+            queue_drop_policy,
         }
     }
 
-    pub fn pop(&mut self, client_id: &str) -> Option<CachedSession> {
-        self.map.remove(client_id)
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.map.len()
+    }
+
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.map.is_empty()
+    }
+
+    /// Cache state of a disconnected session.
+    ///
+    /// Returns gid of the replaced session with the same client id.
+    pub fn insert(
+        &mut self,
+        session_gid: SessionGid,
+        session: CachedSession,
+    ) -> Option<SessionGid> {
+        let client_id = session.client_id().to_string();
+        let entry = CachedEntry {
+            session_gid,
+            expired_at: Instant::now() + session.expiry_interval(),
+            session,
+        };
+        self.gids.insert(session_gid, client_id.clone());
+        let old = self.map.insert(client_id, entry)?;
+        self.gids.remove(&old.session_gid);
+        Some(old.session_gid)
+    }
+
+    /// Remove cached session of `client_id`, with gid of the disconnected session.
+    pub fn pop(&mut self, client_id: &str) -> Option<(SessionGid, CachedSession)> {
+        let entry = self.map.remove(client_id)?;
+        self.gids.remove(&entry.session_gid);
+        Some((entry.session_gid, entry.session))
+    }
+
+    /// Append message to offline queue of session.
+    ///
+    /// Returns number of messages and bytes dropped.
+    pub fn push_message(
+        &mut self,
+        session_gid: SessionGid,
+        qos: QoS,
+        message: PublishMessage,
+    ) -> (usize, usize) {
+        let entry = match self
+            .gids
+            .get(&session_gid)
+            .and_then(|client_id| self.map.get_mut(client_id))
+        {
+            Some(entry) => entry,
+            None => return (0, 0),
+        };
+        entry.session.messages_mut().push(
+            qos,
+            message,
+            false,
+            self.max_queued_messages,
+            self.max_queued_bytes,
+            self.queue_drop_policy,
+        )
+    }
+
+    /// Remove expired sessions.
+    ///
+    /// Returns gids of removed sessions, their subscriptions shall be removed too.
+    pub fn remove_expired(&mut self, now: Instant) -> Vec<SessionGid> {
+        let expired: Vec<String> = self
+            .map
+            .iter()
+            .filter(|(_client_id, entry)| entry.expired_at <= now)
+            .map(|(client_id, _entry)| client_id.clone())
+            .collect();
+        expired
+            .iter()
+            .filter_map(|client_id| self.pop(client_id))
+            .map(|(session_gid, _session)| session_gid)
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::CachedSessions;
+    use crate::config::QueueDropPolicy;
+    use crate::message::PublishMessage;
+    use crate::session::CachedSession;
+    use crate::types::SessionGid;
+    use codec::{v3, QoS};
+    use std::time::{Duration, Instant};
+
+    #[test]
+    fn test_cached_sessions() {
+        let mut sessions = CachedSessions::new(10, 0, QueueDropPolicy::DropOldest);
+        let gid = SessionGid::new(0, 1);
+        let session = CachedSession::new("client-1".to_string(), Duration::from_secs(60));
+        assert_eq!(sessions.insert(gid, session), None);
+
+        let packet = v3::PublishPacket::new("a/b", QoS::AtLeastOnce, b"1").unwrap();
+        let message = PublishMessage::from_v3(&packet);
+        assert_eq!(
+            sessions.push_message(gid, QoS::AtLeastOnce, message),
+            (0, 0)
+        );
+
+        let gid2 = SessionGid::new(0, 2);
+        let session = CachedSession::new("client-2".to_string(), Duration::from_secs(0));
+        assert_eq!(sessions.insert(gid2, session), None);
+        assert_eq!(sessions.remove_expired(Instant::now()), vec![gid2]);
+
+        let (old_gid, session) = sessions.pop("client-1").unwrap();
+        assert_eq!(old_gid, gid);
+        assert_eq!(session.messages().len(), 1);
+        assert!(sessions.is_empty());
     }
 }
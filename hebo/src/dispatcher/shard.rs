@@ -0,0 +1,257 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Route publish messages in parallel.
+//!
+//! Subscriptions are updated by `Dispatcher` and read-shared by all shards.
+//! Each publish packet is sent to the shard chosen by hash of its topic, so that
+//! messages of the same topic are delivered in order.
+//!
+//! Retained messages are stored by shards too, as updates of the same topic come
+//! from the same shard.
+//!
+//! Messages to disconnected persistent sessions are appended to their offline queues
+//! while subscription trie is locked, so that none is lost when the session is
+//! moved to a new connection.
+//!
+//! Shards never wait for a busy listener, see `ListenerOutbox`. Slow consumers are
+//! handled by listener with `slow_consumer_policy`.
+
+use codec::{v3, v5, QoS};
+use std::sync::{Arc, Mutex, PoisonError, RwLock};
+use tokio::sync::mpsc::{Receiver, Sender};
+use tokio::time::{self, MissedTickBehavior};
+
+use super::outbox::{ListenerOutbox, FLUSH_INTERVAL};
+use super::retain::{RetainChange, RetainStore};
+use super::sessions::CachedSessions;
+use super::trie::SubTrie;
+use super::Dispatcher;
+use crate::commands::{DispatcherShardCmd, DispatcherToListenerCmd, DispatcherToMetricsCmd};
+use crate::message::PublishMessage;
+use crate::types::{ListenerId, SessionGid};
+
+/// Get index of shard which routes messages of `topic`.
+///
+/// Uses FNV-1a hash, which is stable and cheap for short strings.
+#[must_use]
+pub fn shard_index(topic: &str, shards: usize) -> usize {
+    let mut hash: u64 = 0xcbf2_9ce4_8422_2325;
+    for byte in topic.as_bytes() {
+        hash ^= u64::from(*byte);
+        hash = hash.wrapping_mul(0x0100_0000_01b3);
+    }
+    (hash % shards as u64) as usize
+}
+
+#[derive(Debug)]
+pub struct DispatcherShard {
+    id: usize,
+    sub_trie: Arc<RwLock<SubTrie>>,
+    retain_store: Arc<RwLock<RetainStore>>,
+    cached_sessions: Arc<Mutex<CachedSessions>>,
+    outbox: ListenerOutbox,
+    metrics_sender: Sender<DispatcherToMetricsCmd>,
+    receiver: Receiver<DispatcherShardCmd>,
+}
+
+impl DispatcherShard {
+    #[must_use]
+    pub fn new(
+        id: usize,
+        sub_trie: Arc<RwLock<SubTrie>>,
+        retain_store: Arc<RwLock<RetainStore>>,
+        cached_sessions: Arc<Mutex<CachedSessions>>,
+        listener_senders: Vec<(ListenerId, Sender<DispatcherToListenerCmd>)>,
+        metrics_sender: Sender<DispatcherToMetricsCmd>,
+        receiver: Receiver<DispatcherShardCmd>,
+    ) -> Self {
+        Self {
+            id,
+            sub_trie,
+            retain_store,
+            cached_sessions,
+            outbox: ListenerOutbox::new(listener_senders),
+            metrics_sender,
+            receiver,
+        }
+    }
+
+    pub async fn run_loop(&mut self) {
+        let mut flush_timer = time::interval(FLUSH_INTERVAL);
+        flush_timer.set_missed_tick_behavior(MissedTickBehavior::Delay);
+        loop {
+            tokio::select! {
+                cmd = self.receiver.recv() => match cmd {
+                    Some(cmd) => self.handle_cmd(cmd).await,
+                    None => break,
+                },
+                _ = flush_timer.tick(), if self.outbox.has_overflow() => self.outbox.flush(),
+            }
+        }
+        log::info!("dispatcher shard {} exit main loop", self.id);
+    }
+
+    async fn handle_cmd(&mut self, cmd: DispatcherShardCmd) {
+        // TODO(Shaohua): Send packet to backends.
+        match cmd {
+            DispatcherShardCmd::Publish(publisher, packet) => {
+                let message = PublishMessage::from_v3(&packet);
+                self.publish_message(publisher, &message).await;
+            }
+            DispatcherShardCmd::PublishV5(publisher, packet) => {
+                match PublishMessage::from_v5(&packet) {
+                    Ok(message) => self.publish_message(publisher, &message).await,
+                    Err(err) => log::error!(
+                        "dispatcher: Failed to encode publish packet, topic: {}, err: {:?}",
+                        packet.topic(),
+                        err
+                    ),
+                }
+            }
+        }
+    }
+
+    /// Send message to all matched sessions.
+    ///
+    /// Message is shared between sessions, only reference count is increased.
+    async fn publish_message(&mut self, publisher: Option<SessionGid>, message: &PublishMessage) {
+        if message.retain() {
+            self.store_retained(publisher, message).await;
+        }
+
+        // Lock is released before sending to listeners.
+        let (matches, dropped) = {
+            let sub_trie = self.sub_trie.read().unwrap_or_else(PoisonError::into_inner);
+            let (matches, offline): (Vec<_>, Vec<_>) = sub_trie
+                .match_topic_from(publisher, message.topic())
+                .into_iter()
+                .partition(|(session_gid, _qos)| !sub_trie.is_offline(*session_gid));
+            let dropped = self.queue_offline_message(&offline, message);
+            (matches, dropped)
+        };
+        let mut dropped = dropped;
+        for (session_gid, qos) in matches {
+            if !self.outbox.send_publish(session_gid, qos, message, false) {
+                dropped.0 += 1;
+                dropped.1 += message.size();
+            }
+        }
+        if dropped.0 > 0 {
+            self.send_metrics(DispatcherToMetricsCmd::PublishPacketDropped(
+                dropped.0, dropped.1,
+            ))
+            .await;
+        }
+    }
+
+    /// Append message to offline queues of disconnected sessions.
+    ///
+    /// Returns number of messages and bytes dropped as queues are full.
+    fn queue_offline_message(
+        &self,
+        offline: &[(SessionGid, QoS)],
+        message: &PublishMessage,
+    ) -> (usize, usize) {
+        let mut dropped = (0, 0);
+        if offline.is_empty() {
+            return dropped;
+        }
+        let mut cached_sessions = self
+            .cached_sessions
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner);
+        for (session_gid, granted_qos) in offline {
+            // QoS 0 messages are not stored for disconnected clients.
+            let qos = message.qos().min(*granted_qos);
+            if qos == QoS::AtMostOnce {
+                continue;
+            }
+            let (count, bytes) = cached_sessions.push_message(*session_gid, qos, message.clone());
+            dropped.0 += count;
+            dropped.1 += bytes;
+        }
+        dropped
+    }
+
+    /// Store or remove retained message, and update metrics.
+    async fn store_retained(&mut self, publisher: Option<SessionGid>, message: &PublishMessage) {
+        let listener_id = publisher.map(|session_gid| session_gid.listener_id());
+        // Lock is released before sending to metrics.
+        let RetainChange { removed, added, .. } = self
+            .retain_store
+            .write()
+            .unwrap_or_else(PoisonError::into_inner)
+            .store(listener_id, message);
+        // Messages generated by server are not counted in listener metrics.
+        if let Some((Some(listener_id), bytes)) = removed {
+            self.send_metrics(DispatcherToMetricsCmd::RetainedMessageRemoved(
+                listener_id,
+                1,
+                bytes,
+            ))
+            .await;
+        }
+        if let Some((Some(listener_id), bytes)) = added {
+            self.send_metrics(DispatcherToMetricsCmd::RetainedMessageAdded(
+                listener_id,
+                1,
+                bytes,
+            ))
+            .await;
+        }
+    }
+
+    async fn send_metrics(&mut self, cmd: DispatcherToMetricsCmd) {
+        if let Err(err) = self.metrics_sender.send(cmd).await {
+            log::error!("dispatcher: Failed to send metrics cmd, err: {:?}", err);
+        }
+    }
+}
+
+impl Dispatcher {
+    /// Send publish packet generated by server to its shard.
+    pub(super) async fn publish_packet_to_shard(&mut self, packet: v3::PublishPacket) {
+        let index = shard_index(packet.topic(), self.shard_senders.len());
+        let cmd = DispatcherShardCmd::Publish(None, packet);
+        if let Err(err) = self.shard_senders[index].send(cmd).await {
+            log::error!(
+                "dispatcher: Failed to send publish packet to shard {}, err: {:?}",
+                index,
+                err
+            );
+        }
+    }
+
+    pub(super) async fn publish_packet_to_shard_v5(&mut self, packet: v5::PublishPacket) {
+        let index = shard_index(packet.topic(), self.shard_senders.len());
+        let cmd = DispatcherShardCmd::PublishV5(None, packet);
+        if let Err(err) = self.shard_senders[index].send(cmd).await {
+            log::error!(
+                "dispatcher: Failed to send publish packet to shard {}, err: {:?}",
+                index,
+                err
+            );
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::shard_index;
+
+    #[test]
+    fn test_shard_index() {
+        assert_eq!(shard_index("sport/tennis", 1), 0);
+        let index = shard_index("sport/tennis", 8);
+        assert!(index < 8);
+        assert_eq!(shard_index("sport/tennis", 8), index);
+
+        let mut used = [false; 8];
+        for i in 0..64 {
+            used[shard_index(&format!("device/{}/telemetry", i), 8)] = true;
+        }
+        assert!(used.iter().all(|used| *used));
+    }
+}
@@ -3,55 +3,556 @@
 // in the LICENSE file.
 
 //! Manage subscription trie.
+//!
+//! Topic filters are split into levels and stored in a tree, each node holds
+//! exact-match children, an optional `+` branch and subscribers of `#` at that level.
+//! Matching a topic name only visits nodes reachable from its levels, so the cost
+//! is `O(topic depth + matched subscribers)` instead of scanning every filter.
+//! Children are keyed by interned level ids, a topic name is split and looked up
+//! in the interner once, then the walk only compares integers.
+//!
+//! Shared subscriptions, like `$share/{ShareName}/{filter}`, are kept in another tree
+//! indexed by `{filter}`. Each message is sent to only one member of a matched group,
+//! which is chosen by `SharedStrategy`.
 
-use codec::{v3, v5, SubscribePattern};
-use std::collections::HashMap;
+use codec::{v3, v5, QoS, SubscribePattern, TopicError};
+use rand::Rng;
+use std::collections::hash_map::DefaultHasher;
+use std::collections::{HashMap, HashSet};
+use std::hash::{Hash, Hasher};
+use std::sync::atomic::{AtomicUsize, Ordering};
 
-use super::Dispatcher;
-use crate::commands::DispatcherToListenerCmd;
-use crate::types::SessionGid;
+use super::interner::{LevelId, LevelMap, TopicInterner};
+use crate::config::SharedStrategy;
+use crate::types::{InflightCounter, SessionGid};
+
+const LEVEL_SEPARATOR: char = '/';
+const SINGLE_WILDCARD: &str = "+";
+const MULTI_WILDCARD: &str = "#";
+const SHARE_PREFIX: &str = "$share/";
+
+#[derive(Debug)]
+struct TrieNode<K, V> {
+    /// Children with exact level name, keyed by interned level id.
+    children: LevelMap<TrieNode<K, V>>,
+
+    /// Child of `+` level.
+    single_wildcard: Option<Box<TrieNode<K, V>>>,
+
+    /// Subscribers of `#` at this level.
+    multi_wildcard: HashMap<K, V>,
+
+    /// Subscribers whose topic filter ends at this node.
+    subscribers: HashMap<K, V>,
+}
+
+impl<K, V> Default for TrieNode<K, V> {
+    fn default() -> Self {
+        Self {
+            children: LevelMap::default(),
+            single_wildcard: None,
+            multi_wildcard: HashMap::new(),
+            subscribers: HashMap::new(),
+        }
+    }
+}
+
+impl<K, V> TrieNode<K, V> {
+    fn is_empty(&self) -> bool {
+        self.children.is_empty()
+            && self.single_wildcard.is_none()
+            && self.multi_wildcard.is_empty()
+            && self.subscribers.is_empty()
+    }
+
+    /// Get subscribers of topic filter `levels`, creating nodes if not found.
+    ///
+    /// Levels of new nodes are interned.
+    fn subscribers_mut(
+        &mut self,
+        interner: &mut TopicInterner,
+        levels: &[&str],
+    ) -> &mut HashMap<K, V> {
+        match levels.split_first() {
+            None => &mut self.subscribers,
+            Some((&MULTI_WILDCARD, _)) => &mut self.multi_wildcard,
+            Some((&SINGLE_WILDCARD, rest)) => self
+                .single_wildcard
+                .get_or_insert_with(Box::default)
+                .subscribers_mut(interner, rest),
+            Some((level, rest)) => {
+                let id = match interner.get(level) {
+                    Some(id) if self.children.contains_key(&id) => id,
+                    _ => {
+                        let id = interner.intern(level);
+                        self.children.insert(id, Self::default());
+                        id
+                    }
+                };
+                self.children
+                    .get_mut(&id)
+                    .expect("trie: Child node not found")
+                    .subscribers_mut(interner, rest)
+            }
+        }
+    }
+
+    /// Call `remove` on subscribers of topic filter `levels`, and prune empty child nodes.
+    ///
+    /// Returns result of `remove`, or false if topic filter is not found.
+    fn remove<F>(&mut self, interner: &mut TopicInterner, levels: &[&str], remove: F) -> bool
+    where
+        F: FnOnce(&mut HashMap<K, V>) -> bool,
+    {
+        match levels.split_first() {
+            None => remove(&mut self.subscribers),
+            Some((&MULTI_WILDCARD, _)) => remove(&mut self.multi_wildcard),
+            Some((&SINGLE_WILDCARD, rest)) => {
+                if let Some(child) = self.single_wildcard.as_mut() {
+                    let removed = child.remove(interner, rest, remove);
+                    if child.is_empty() {
+                        self.single_wildcard = None;
+                    }
+                    removed
+                } else {
+                    false
+                }
+            }
+            Some((level, rest)) => {
+                let id = match interner.get(level) {
+                    Some(id) => id,
+                    None => return false,
+                };
+                if let Some(child) = self.children.get_mut(&id) {
+                    let removed = child.remove(interner, rest, remove);
+                    if child.is_empty() {
+                        self.children.remove(&id);
+                        interner.release(id);
+                    }
+                    removed
+                } else {
+                    false
+                }
+            }
+        }
+    }
+
+    /// Call `visit` on subscribers of each topic filter matching topic name `levels`.
+    ///
+    /// Levels are interned ids of topic name, None if a level is not interned,
+    /// which matches only wildcards.
+    fn collect<F>(
+        &self,
+        levels: &[Option<LevelId>],
+        is_first_level: bool,
+        is_internal: bool,
+        visit: &mut F,
+    ) where
+        F: FnMut(&HashMap<K, V>),
+    {
+        // The Server MUST NOT match Topic Filters starting with a wildcard character (# or +)
+        // with Topic Names beginning with a $ character [MQTT-4.7.2-1].
+        let wildcard_allowed = !(is_first_level && is_internal);
+
+        // `#` also matches the parent level, so `sport/#` matches `sport`.
+        if wildcard_allowed && !self.multi_wildcard.is_empty() {
+            visit(&self.multi_wildcard);
+        }
+
+        match levels.split_first() {
+            None => {
+                if !self.subscribers.is_empty() {
+                    visit(&self.subscribers);
+                }
+            }
+            Some((id, rest)) => {
+                if let Some(child) = id.and_then(|id| self.children.get(&id)) {
+                    child.collect(rest, false, is_internal, visit);
+                }
+                if wildcard_allowed {
+                    if let Some(child) = &self.single_wildcard {
+                        child.collect(rest, false, is_internal, visit);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// When overlapping subscriptions match, deliver with the maximum `QoS` [MQTT-3.3.5-1].
+///
+/// Matches of all topic filters are sorted by session, and only the first one of
+/// each session is kept.
+fn merge(matches: &mut Vec<(SessionGid, QoS)>) {
+    matches.sort_unstable_by(|a, b| a.0.cmp(&b.0).then(b.1.cmp(&a.1)));
+    matches.dedup_by_key(|(session_gid, _qos)| *session_gid);
+}
+
+#[derive(Debug)]
+struct SharedMember {
+    session_gid: SessionGid,
+    qos: QoS,
+    inflight: InflightCounter,
+}
+
+/// Sessions subscribed to the same shared subscription.
+#[derive(Debug, Default)]
+struct SharedGroup {
+    members: Vec<SharedMember>,
+
+    /// Index of next member, used by round robin strategy.
+    cursor: AtomicUsize,
+}
+
+impl SharedGroup {
+    /// Returns true if `member` is a new one.
+    fn insert(&mut self, member: SharedMember) -> bool {
+        if let Some(old) = self
+            .members
+            .iter_mut()
+            .find(|old| old.session_gid == member.session_gid)
+        {
+            *old = member;
+            false
+        } else {
+            self.members.push(member);
+            true
+        }
+    }
+
+    /// Returns true if member with `session_gid` is removed.
+    fn remove(&mut self, session_gid: &SessionGid) -> bool {
+        let len = self.members.len();
+        self.members
+            .retain(|member| member.session_gid != *session_gid);
+        self.members.len() != len
+    }
+
+    /// Choose one member to receive message of `topic`.
+    fn select(
+        &self,
+        strategy: SharedStrategy,
+        publisher: Option<SessionGid>,
+        topic: &str,
+    ) -> Option<&SharedMember> {
+        let len = self.members.len();
+        if len == 0 {
+            return None;
+        }
+        let index = match strategy {
+            SharedStrategy::RoundRobin => self.cursor.fetch_add(1, Ordering::Relaxed) % len,
+            SharedStrategy::Random => rand::thread_rng().gen_range(0..len),
+            SharedStrategy::Sticky => {
+                // Messages from internal modules, like $SYS, have no publisher.
+                let mut hasher = DefaultHasher::new();
+                match publisher {
+                    Some(session_gid) => session_gid.hash(&mut hasher),
+                    None => topic.hash(&mut hasher),
+                }
+                (hasher.finish() % len as u64) as usize
+            }
+            SharedStrategy::LeastInflight => {
+                // Start from the round robin cursor, so that idle members take turns.
+                let start = self.cursor.fetch_add(1, Ordering::Relaxed) % len;
+                (0..len)
+                    .map(|i| (start + i) % len)
+                    .min_by_key(|&i| self.members[i].inflight.get())
+                    .unwrap_or(start)
+            }
+        };
+        self.members.get(index)
+    }
+}
+
+/// Check whether `topic` is a shared subscription.
+#[must_use]
+pub fn is_shared(topic: &str) -> bool {
+    topic.starts_with(SHARE_PREFIX)
+}
+
+/// Split shared subscription `$share/{ShareName}/{filter}` into share name and topic filter.
+///
+/// Returns `Ok(None)` if `topic` is not a shared subscription.
+fn parse_shared(topic: &str) -> Result<Option<(&str, &str)>, TopicError> {
+    let rest = match topic.strip_prefix(SHARE_PREFIX) {
+        Some(rest) => rest,
+        None => return Ok(None),
+    };
+
+    // A Shared Subscription's Topic Filter MUST start with $share/ and MUST contain
+    // a ShareName that is at least one character long [MQTT-4.8.2-1].
+    // The ShareName MUST NOT contain the characters "/", "+" or "#", but MUST be followed
+    // by a "/" character. This "/" character MUST be followed by a Topic Filter [MQTT-4.8.2-2].
+    match rest.split_once(LEVEL_SEPARATOR) {
+        Some((share_name, filter)) if !share_name.is_empty() && !filter.is_empty() => {
+            if share_name.contains(|c| c == '+' || c == '#') {
+                Err(TopicError::ContainsWildChar)
+            } else {
+                Ok(Some((share_name, filter)))
+            }
+        }
+        _ => Err(TopicError::EmptyTopic),
+    }
+}
 
 #[allow(clippy::module_name_repetitions)]
-#[derive(Debug, Default, Clone)]
+#[derive(Debug, Default)]
 pub struct SubTrie {
+    root: TrieNode<SessionGid, QoS>,
+
+    /// Shared subscription groups, keyed by share name in each node.
+    shared_root: TrieNode<String, SharedGroup>,
+
+    /// Levels of topic filters in `root` and `shared_root`.
+    interner: TopicInterner,
+
+    strategy: SharedStrategy,
+
+    /// Topic filters of each session, used to unsubscribe without walking the whole trie.
     map: HashMap<SessionGid, HashMap<String, SubscribePattern>>,
+
+    /// Inflight counters of connected sessions, used by least inflight strategy.
+    inflights: HashMap<SessionGid, InflightCounter>,
+
+    /// Persistent sessions whose clients are disconnected, their subscriptions are kept.
+    offline: HashSet<SessionGid>,
 }
 
 impl SubTrie {
+    #[must_use]
     pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Create a trie which chooses members of shared subscriptions with `strategy`.
+    #[must_use]
+    pub fn with_strategy(strategy: SharedStrategy) -> Self {
         Self {
-            map: HashMap::new(),
+            strategy,
+            ..Self::default()
         }
     }
 
-    pub fn subscribe(
+    #[must_use]
+    pub const fn strategy(&self) -> SharedStrategy {
+        self.strategy
+    }
+
+    /// Register a connected session.
+    pub fn add_session(&mut self, session_gid: SessionGid, inflight: InflightCounter) {
+        self.inflights.insert(session_gid, inflight);
+    }
+
+    /// Mark a persistent session as disconnected, its subscriptions are kept
+    /// and matching messages are queued.
+    pub fn set_offline(&mut self, session_gid: SessionGid) {
+        self.inflights.remove(&session_gid);
+        self.offline.insert(session_gid);
+    }
+
+    /// Check whether session is disconnected and its subscriptions are kept.
+    #[must_use]
+    pub fn is_offline(&self, session_gid: SessionGid) -> bool {
+        self.offline.contains(&session_gid)
+    }
+
+    /// Move subscriptions of a cached session to a new connected session.
+    ///
+    /// Returns number of topic filters moved.
+    pub fn rename_session(&mut self, old_gid: SessionGid, new_gid: SessionGid) -> usize {
+        self.offline.remove(&old_gid);
+        self.inflights.remove(&old_gid);
+        let patterns = match self.map.remove(&old_gid) {
+            Some(patterns) => patterns,
+            None => return 0,
+        };
+        let len = patterns.len();
+        for (topic, pattern) in patterns {
+            self.remove_filter(old_gid, &topic);
+            if let Err(err) = self.add_pattern(new_gid, pattern) {
+                log::error!(
+                    "trie: Failed to move topic filter: {}, err: {:?}",
+                    topic,
+                    err
+                );
+            }
+        }
+        len
+    }
+
+    /// Check whether session has subscribed to `topic_filter`.
+    #[must_use]
+    pub fn is_subscribed(&self, session_gid: SessionGid, topic_filter: &str) -> bool {
+        self.map
+            .get(&session_gid)
+            .map_or(false, |patterns| patterns.contains_key(topic_filter))
+    }
+
+    /// Add a topic filter.
+    ///
+    /// Returns true if it is a new subscription, or false if an existing one is replaced.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if it is an invalid shared subscription.
+    fn add_pattern(
         &mut self,
         session_gid: SessionGid,
-        packet: &v3::SubscribePacket,
-    ) -> (v3::SubscribeAckPacket, usize) {
+        pattern: SubscribePattern,
+    ) -> Result<bool, TopicError> {
+        let topic = pattern.topic().topic();
+        if let Some((share_name, filter)) = parse_shared(topic)? {
+            let levels: Vec<&str> = filter.split(LEVEL_SEPARATOR).collect();
+            let member = SharedMember {
+                session_gid,
+                qos: pattern.qos(),
+                inflight: self
+                    .inflights
+                    .get(&session_gid)
+                    .cloned()
+                    .unwrap_or_default(),
+            };
+            self.shared_root
+                .subscribers_mut(&mut self.interner, &levels)
+                .entry(share_name.to_string())
+                .or_default()
+                .insert(member);
+        } else {
+            let levels: Vec<&str> = topic.split(LEVEL_SEPARATOR).collect();
+            self.root
+                .subscribers_mut(&mut self.interner, &levels)
+                .insert(session_gid, pattern.qos());
+        }
+
+        // If a Server receives a SUBSCRIBE Packet containing a Topic Filter that is identical
+        // to an existing Subscription’s Topic Filter then it MUST completely replace
+        // that existing Subscription with a new Subscription [MQTT-3.8.4-3].
+        Ok(self
+            .map
+            .entry(session_gid)
+            .or_default()
+            .insert(topic.clone(), pattern)
+            .is_none())
+    }
+
+    /// Remove topic filter from trie, without updating `map`.
+    fn remove_filter(&mut self, session_gid: SessionGid, topic: &str) -> bool {
+        if let Ok(Some((share_name, filter))) = parse_shared(topic) {
+            let levels: Vec<&str> = filter.split(LEVEL_SEPARATOR).collect();
+            self.shared_root
+                .remove(&mut self.interner, &levels, |groups| {
+                    let removed = groups
+                        .get_mut(share_name)
+                        .map_or(false, |group| group.remove(&session_gid));
+                    if groups
+                        .get(share_name)
+                        .map_or(false, |group| group.members.is_empty())
+                    {
+                        groups.remove(share_name);
+                    }
+                    removed
+                })
+        } else {
+            let levels: Vec<&str> = topic.split(LEVEL_SEPARATOR).collect();
+            self.root
+                .remove(&mut self.interner, &levels, |subscribers| {
+                    subscribers.remove(&session_gid).is_some()
+                })
+        }
+    }
+
+    /// Remove a topic filter.
+    ///
+    /// Returns true if it was subscribed.
+    fn remove_pattern(&mut self, session_gid: SessionGid, topic: &str) -> bool {
         let patterns = match self.map.get_mut(&session_gid) {
             Some(patterns) => patterns,
-            None => {
-                let patterns = HashMap::new();
-                self.map.insert(session_gid, patterns);
-                self.map.get_mut(&session_gid).unwrap()
-            }
+            None => return false,
         };
+        if patterns.remove(topic).is_none() {
+            return false;
+        }
+        if patterns.is_empty() {
+            self.map.remove(&session_gid);
+        }
+
+        self.remove_filter(session_gid, topic)
+    }
+
+    /// Remove all subscriptions of a session.
+    ///
+    /// Returns number of topic filters removed.
+    pub fn remove_session(&mut self, session_gid: SessionGid) -> usize {
+        self.inflights.remove(&session_gid);
+        self.offline.remove(&session_gid);
+        self.map.remove(&session_gid).map_or(0, |patterns| {
+            for topic in patterns.keys() {
+                self.remove_filter(session_gid, topic);
+            }
+            patterns.len()
+        })
+    }
+
+    /// Get all sessions whose topic filters match `topic`, with granted `QoS` of each session.
+    #[must_use]
+    pub fn match_topic(&self, topic: &str) -> Vec<(SessionGid, QoS)> {
+        self.match_topic_from(None, topic)
+    }
 
+    /// Same as `match_topic()`, `publisher` is used by sticky strategy of shared subscriptions.
+    #[must_use]
+    pub fn match_topic_from(
+        &self,
+        publisher: Option<SessionGid>,
+        topic: &str,
+    ) -> Vec<(SessionGid, QoS)> {
+        // Split topic name once, and match levels with integer ids.
+        let levels: Vec<Option<LevelId>> = topic
+            .split(LEVEL_SEPARATOR)
+            .map(|level| self.interner.get(level))
+            .collect();
+        let is_internal = topic.starts_with('$');
+        let mut matches = Vec::new();
+        self.root
+            .collect(&levels, true, is_internal, &mut |subscribers| {
+                matches.extend(
+                    subscribers
+                        .iter()
+                        .map(|(session_gid, qos)| (*session_gid, *qos)),
+                );
+            });
+        self.shared_root
+            .collect(&levels, true, is_internal, &mut |groups| {
+                for group in groups.values() {
+                    if let Some(member) = group.select(self.strategy, publisher, topic) {
+                        matches.push((member.session_gid, member.qos));
+                    }
+                }
+            });
+        merge(&mut matches);
+        matches
+    }
+
+    pub fn subscribe(
+        &mut self,
+        session_gid: SessionGid,
+        packet: &v3::SubscribePacket,
+    ) -> (v3::SubscribeAckPacket, usize) {
         // If a Server receives a SUBSCRIBE packet that contains multiple Topic Filters
         // it MUST handle that packet as if it had received a sequence of multiple SUBSCRIBE packets,
         // except that it combines their responses into a single SUBACK response [MQTT-3.8.4-4].
         let mut ack_vec = vec![];
         let mut pattern_added = 0;
         for topic in packet.topics() {
-            // TODO(Shaohua): Send retained messages.
-            // TODO(Shaohua): Check topic filter has been subscribed.
             // TODO(Shaohua): Update qos in SubscribeAck.
-            match SubscribePattern::parse(topic.topic(), topic.qos()) {
-                Ok(pattern) => {
-                    patterns.insert(topic.topic().to_string(), pattern);
+            match SubscribePattern::parse(topic.topic(), topic.qos())
+                .and_then(|pattern| self.add_pattern(session_gid, pattern))
+            {
+                Ok(added) => {
+                    if added {
+                        pattern_added += 1;
+                    }
                     ack_vec.push(v3::SubscribeAck::QoS(topic.qos()));
-                    pattern_added += 1;
                 }
                 Err(err) => {
                     log::error!(
@@ -75,27 +576,30 @@ impl SubTrie {
         session_gid: SessionGid,
         packet: &v5::SubscribePacket,
     ) -> (v5::SubscribeAckPacket, usize) {
-        let patterns = match self.map.get_mut(&session_gid) {
-            Some(patterns) => patterns,
-            None => {
-                let patterns = HashMap::new();
-                self.map.insert(session_gid, patterns);
-                self.map.get_mut(&session_gid).unwrap()
-            }
-        };
-
         // TODO(Shaohua): Add comments
         let mut reasons = vec![];
         let mut pattern_added = 0;
         for topic in packet.topics() {
-            // TODO(Shaohua): Send retained messages.
-            // TODO(Shaohua): Check topic filter has been subscribed.
+            // It is a Protocol Error to set the No Local bit to 1 on a Shared Subscription
+            // [MQTT-3.8.3-4].
+            if topic.no_local() && topic.topic().starts_with(SHARE_PREFIX) {
+                log::error!(
+                    "trie: No Local is set on shared subscription: {}",
+                    topic.topic()
+                );
+                reasons.push(v5::ReasonCode::TopicFilterInvalid);
+                continue;
+            }
+
             // TODO(Shaohua): Update qos in SubscribeAck.
-            match SubscribePattern::parse(topic.topic(), topic.qos()) {
-                Ok(pattern) => {
-                    patterns.insert(topic.topic().to_string(), pattern);
+            match SubscribePattern::parse(topic.topic(), topic.qos())
+                .and_then(|pattern| self.add_pattern(session_gid, pattern))
+            {
+                Ok(added) => {
+                    if added {
+                        pattern_added += 1;
+                    }
                     reasons.push(v5::ReasonCode::Success);
-                    pattern_added += 1;
                 }
                 Err(err) => {
                     log::error!(
@@ -119,25 +623,15 @@ impl SubTrie {
         session_gid: SessionGid,
         packet: &v3::UnsubscribePacket,
     ) -> usize {
-        self.map.get_mut(&session_gid).map_or_else(
-            || {
-                log::error!("trie: No subscription for gid: {:?}", session_gid);
-                0
-            },
-            |set| {
-                let to_be_removed: Vec<String> = packet
-                    .topics()
-                    .iter()
-                    .filter(|topic| set.contains_key(topic.as_ref()))
-                    .map(|topic| topic.as_ref().to_string())
-                    .collect();
-                for p in &to_be_removed {
-                    set.remove(p);
-                }
-
-                to_be_removed.len()
-            },
-        )
+        if !self.map.contains_key(&session_gid) {
+            log::error!("trie: No subscription for gid: {:?}", session_gid);
+            return 0;
+        }
+        packet
+            .topics()
+            .iter()
+            .filter(|topic| self.remove_pattern(session_gid, topic.as_ref()))
+            .count()
     }
 
     pub fn unsubscribe_v5(
@@ -145,100 +639,183 @@ impl SubTrie {
         session_gid: SessionGid,
         packet: &v5::UnsubscribePacket,
     ) -> usize {
-        self.map.get_mut(&session_gid).map_or_else(
-            || {
-                log::error!("trie: No subscription for gid: {:?}", session_gid);
-                0
-            },
-            |set| {
-                let to_be_removed: Vec<String> = packet
-                    .topics()
-                    .iter()
-                    .filter(|topic| set.contains_key(topic.as_ref()))
-                    .map(|topic| topic.as_ref().to_string())
-                    .collect();
-                for p in &to_be_removed {
-                    set.remove(p);
-                }
-
-                to_be_removed.len()
-            },
-        )
+        if !self.map.contains_key(&session_gid) {
+            log::error!("trie: No subscription for gid: {:?}", session_gid);
+            return 0;
+        }
+        packet
+            .topics()
+            .iter()
+            .filter(|topic| self.remove_pattern(session_gid, topic.as_ref()))
+            .count()
     }
 
-    pub fn match_packet(&mut self, packet: &v3::PublishPacket) -> Vec<SessionGid> {
-        let mut vec = vec![];
-        let topic = packet.topic();
-        for (session_gid, topic_patterns) in &self.map {
-            for topic_pattern in topic_patterns.values() {
-                if topic_pattern.topic().is_match(topic) {
-                    vec.push(*session_gid);
-                    break;
-                }
-            }
-        }
-        vec
+    #[must_use]
+    pub fn match_packet(&self, packet: &v3::PublishPacket) -> Vec<(SessionGid, QoS)> {
+        self.match_topic(packet.topic())
     }
 
-    pub fn match_packet_v5(&mut self, packet: &v5::PublishPacket) -> Vec<SessionGid> {
-        let mut vec = vec![];
-        let topic = packet.topic();
-        for (session_gid, topic_patterns) in &self.map {
-            for topic_pattern in topic_patterns.values() {
-                if topic_pattern.topic().is_match(topic) {
-                    vec.push(*session_gid);
-                    break;
-                }
-            }
-        }
-        vec
+    #[must_use]
+    pub fn match_packet_v5(&self, packet: &v5::PublishPacket) -> Vec<(SessionGid, QoS)> {
+        self.match_topic(packet.topic())
     }
 }
 
-impl Dispatcher {
-    pub(super) async fn publish_packet_to_sub_trie(&mut self, packet: &v3::PublishPacket) {
-        // match topic in trie
-        for session_gid in self.sub_trie.match_packet(packet) {
-            // send packet to listener
-            if let Some(listener_sender) = self.listener_senders.get(&session_gid.listener_id()) {
-                let cmd =
-                    DispatcherToListenerCmd::Publish(session_gid.session_id(), packet.clone());
-                if let Err(err) = listener_sender.send(cmd).await {
-                    log::error!(
-                        "dispatcher: Failed to send publish packet to listener: {}, err: {:?}",
-                        session_gid.listener_id(),
-                        err
-                    );
-                }
-            } else {
-                log::error!(
-                    "dispatcher: Failed to get listener sender with id: {}",
-                    session_gid.listener_id()
-                );
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn subscribe(trie: &mut SubTrie, session_gid: SessionGid, topic: &str, qos: QoS) {
+        let pattern = SubscribePattern::parse(topic, qos).unwrap();
+        trie.add_pattern(session_gid, pattern).unwrap();
+    }
+
+    fn matched(trie: &SubTrie, topic: &str) -> Vec<SessionGid> {
+        let mut gids: Vec<SessionGid> = trie
+            .match_topic(topic)
+            .into_iter()
+            .map(|(session_gid, _qos)| session_gid)
+            .collect();
+        gids.sort();
+        gids
+    }
+
+    #[test]
+    fn test_match_wildcards() {
+        let mut trie = SubTrie::new();
+        let s1 = SessionGid::new(1, 1);
+        let s2 = SessionGid::new(1, 2);
+        let s3 = SessionGid::new(2, 3);
+        subscribe(&mut trie, s1, "sport/tennis/player1", QoS::AtMostOnce);
+        subscribe(&mut trie, s2, "sport/+/player1", QoS::AtMostOnce);
+        subscribe(&mut trie, s3, "sport/#", QoS::AtMostOnce);
+
+        assert_eq!(matched(&trie, "sport/tennis/player1"), vec![s1, s2, s3]);
+        assert_eq!(matched(&trie, "sport/golf/player1"), vec![s2, s3]);
+        assert_eq!(matched(&trie, "sport"), vec![s3]);
+        assert_eq!(matched(&trie, "sport/tennis"), vec![s3]);
+        assert!(matched(&trie, "news/tennis/player1").is_empty());
+        assert_eq!(matched(&trie, "sport/tennis/player1/ranking"), vec![s3]);
+    }
+
+    #[test]
+    fn test_match_internal_topic() {
+        let mut trie = SubTrie::new();
+        let s1 = SessionGid::new(1, 1);
+        let s2 = SessionGid::new(1, 2);
+        subscribe(&mut trie, s1, "#", QoS::AtMostOnce);
+        subscribe(&mut trie, s2, "$SYS/#", QoS::AtMostOnce);
+        assert_eq!(matched(&trie, "$SYS/uptime"), vec![s2]);
+        assert_eq!(matched(&trie, "sport"), vec![s1]);
+    }
+
+    #[test]
+    fn test_max_qos_and_remove() {
+        let mut trie = SubTrie::new();
+        let s1 = SessionGid::new(1, 1);
+        subscribe(&mut trie, s1, "a/+", QoS::AtMostOnce);
+        subscribe(&mut trie, s1, "a/#", QoS::ExactOnce);
+        assert_eq!(trie.match_topic("a/b"), vec![(s1, QoS::ExactOnce)]);
+
+        assert!(trie.remove_pattern(s1, "a/#"));
+        assert!(!trie.remove_pattern(s1, "a/#"));
+        assert_eq!(trie.match_topic("a/b"), vec![(s1, QoS::AtMostOnce)]);
+
+        assert_eq!(trie.remove_session(s1), 1);
+        assert!(trie.match_topic("a/b").is_empty());
+        assert!(trie.root.is_empty());
+        assert!(trie.interner.is_empty());
+    }
+
+    #[test]
+    fn test_offline_session() {
+        let mut trie = SubTrie::new();
+        let s1 = SessionGid::new(1, 1);
+        let s2 = SessionGid::new(2, 2);
+        subscribe(&mut trie, s1, "a/+", QoS::AtLeastOnce);
+        subscribe(&mut trie, s1, "$share/g/b", QoS::AtLeastOnce);
+        trie.set_offline(s1);
+        assert!(trie.is_offline(s1));
+        assert_eq!(matched(&trie, "a/b"), vec![s1]);
+
+        assert_eq!(trie.rename_session(s1, s2), 2);
+        assert!(!trie.is_offline(s1));
+        assert_eq!(matched(&trie, "a/b"), vec![s2]);
+        assert_eq!(matched(&trie, "b"), vec![s2]);
+        assert!(trie.is_subscribed(s2, "a/+"));
+        assert!(!trie.is_subscribed(s1, "a/+"));
+    }
+
+    #[test]
+    fn test_parse_shared() {
+        assert_eq!(parse_shared("sport/tennis"), Ok(None));
+        assert_eq!(
+            parse_shared("$share/group1/sport/+"),
+            Ok(Some(("group1", "sport/+")))
+        );
+        assert!(parse_shared("$share/group1").is_err());
+        assert!(parse_shared("$share//sport").is_err());
+        assert!(parse_shared("$share/group1/").is_err());
+        assert!(parse_shared("$share/group+/sport").is_err());
+    }
+
+    #[test]
+    fn test_shared_round_robin() {
+        let mut trie = SubTrie::with_strategy(SharedStrategy::RoundRobin);
+        let s1 = SessionGid::new(1, 1);
+        let s2 = SessionGid::new(1, 2);
+        let s3 = SessionGid::new(2, 3);
+        subscribe(&mut trie, s1, "$share/workers/jobs/+", QoS::AtMostOnce);
+        subscribe(&mut trie, s2, "$share/workers/jobs/+", QoS::AtMostOnce);
+        subscribe(&mut trie, s3, "jobs/#", QoS::AtMostOnce);
+
+        let mut counts: HashMap<SessionGid, usize> = HashMap::new();
+        for _i in 0..10 {
+            let gids = matched(&trie, "jobs/1");
+            assert_eq!(gids.len(), 2);
+            assert!(gids.contains(&s3));
+            for gid in gids {
+                *counts.entry(gid).or_default() += 1;
             }
         }
+        assert_eq!(counts[&s1], 5);
+        assert_eq!(counts[&s2], 5);
+        assert_eq!(counts[&s3], 10);
+
+        assert!(trie.remove_pattern(s1, "$share/workers/jobs/+"));
+        assert_eq!(matched(&trie, "jobs/1"), vec![s2, s3]);
+        assert_eq!(trie.remove_session(s2), 1);
+        assert!(trie.shared_root.is_empty());
     }
 
-    pub(super) async fn publish_packet_to_sub_trie_v5(&mut self, packet: &v5::PublishPacket) {
-        // match topic in trie
-        for session_gid in self.sub_trie.match_packet_v5(packet) {
-            // send packet to listener
-            if let Some(listener_sender) = self.listener_senders.get(&session_gid.listener_id()) {
-                let cmd =
-                    DispatcherToListenerCmd::PublishV5(session_gid.session_id(), packet.clone());
-                if let Err(err) = listener_sender.send(cmd).await {
-                    log::error!(
-                        "dispatcher: Failed to send publish packet to listener: {}, err: {:?}",
-                        session_gid.listener_id(),
-                        err
-                    );
-                }
-            } else {
-                log::error!(
-                    "dispatcher: Failed to get listener sender with id: {}",
-                    session_gid.listener_id()
-                );
-            }
+    #[test]
+    fn test_shared_strategies() {
+        let s1 = SessionGid::new(1, 1);
+        let s2 = SessionGid::new(1, 2);
+        let publisher = SessionGid::new(3, 3);
+
+        let mut trie = SubTrie::with_strategy(SharedStrategy::Sticky);
+        subscribe(&mut trie, s1, "$share/g/a/b", QoS::AtLeastOnce);
+        subscribe(&mut trie, s2, "$share/g/a/b", QoS::AtLeastOnce);
+        let first = trie.match_topic_from(Some(publisher), "a/b");
+        assert_eq!(first.len(), 1);
+        for _i in 0..10 {
+            assert_eq!(trie.match_topic_from(Some(publisher), "a/b"), first);
+        }
+
+        let mut trie = SubTrie::with_strategy(SharedStrategy::LeastInflight);
+        let c1 = InflightCounter::new();
+        let c2 = InflightCounter::new();
+        trie.add_session(s1, c1.clone());
+        trie.add_session(s2, c2.clone());
+        subscribe(&mut trie, s1, "$share/g/a/b", QoS::AtLeastOnce);
+        subscribe(&mut trie, s2, "$share/g/a/b", QoS::AtLeastOnce);
+        c1.increase();
+        for _i in 0..4 {
+            assert_eq!(matched(&trie, "a/b"), vec![s2]);
         }
+        c1.decrease(1);
+        c2.increase();
+        assert_eq!(matched(&trie, "a/b"), vec![s1]);
     }
 }
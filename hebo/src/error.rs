@@ -9,8 +9,8 @@ use tokio::sync::{mpsc, oneshot};
 use tokio_tungstenite::tungstenite;
 
 use crate::commands::{
-    AuthToListenerCmd, DispatcherToMetricsCmd, ListenerToAclCmd, ListenerToAuthCmd,
-    ListenerToDispatcherCmd, ListenerToSessionCmd, MetricsToDispatcherCmd,
+    AuthToListenerCmd, DispatcherShardCmd, DispatcherToMetricsCmd, ListenerToAclCmd,
+    ListenerToAuthCmd, ListenerToDispatcherCmd, ListenerToSessionCmd, MetricsToDispatcherCmd,
     ServerContextToMetricsCmd, SessionToListenerCmd,
 };
 use crate::types::SessionId;
@@ -65,6 +65,9 @@ pub enum ErrorKind {
     /// File format error.
     FormatError,
 
+    /// Resource limit exceeded, like number of retained messages.
+    LimitExceeded,
+
     RedisError,
     MySQLError,
     PgSQLError,
@@ -161,6 +164,15 @@ impl From<quinn::ConnectionError> for Error {
     }
 }
 
+impl From<quinn::SendDatagramError> for Error {
+    fn from(err: quinn::SendDatagramError) -> Self {
+        Self::from_string(
+            ErrorKind::SocketError,
+            format!("Quic send datagram error: {}", err),
+        )
+    }
+}
+
 //impl From<quinn::ParseError> for Error {
 //    fn from(err: quinn::ParseError) -> Self {
 //        Error::from_string(
@@ -258,6 +270,7 @@ macro_rules! convert_send_error {
 }
 
 convert_send_error!(AuthToListenerCmd);
+convert_send_error!(DispatcherShardCmd);
 convert_send_error!(DispatcherToMetricsCmd);
 convert_send_error!(ListenerToAclCmd);
 convert_send_error!(ListenerToAuthCmd);
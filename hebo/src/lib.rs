@@ -16,12 +16,14 @@ pub mod error;
 pub mod gateway;
 pub mod listener;
 pub mod log;
+pub mod message;
 pub mod metrics;
 pub mod rule_engine;
 pub mod server;
 pub mod session;
 pub mod socket;
 pub mod stream;
+pub mod timer;
 pub mod types;
 
 pub use error::Error;
@@ -0,0 +1,225 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Limit number of connections and rate of new connections.
+//!
+//! New sockets are checked before TLS or WebSocket handshake, so that a storm of
+//! reconnecting clients does not starve established sessions.
+
+use std::collections::HashMap;
+use std::net::IpAddr;
+use std::time::Instant;
+
+use super::Listener;
+use crate::commands::ListenerToDispatcherCmd;
+use crate::config::{self, AdmissionPolicy};
+use crate::error::{Error, ErrorKind};
+
+/// Token bucket, refilled with `rate` tokens per second, up to `rate` tokens.
+#[derive(Debug, Clone)]
+pub struct TokenBucket {
+    rate: f64,
+    tokens: f64,
+    updated_at: Instant,
+}
+
+impl TokenBucket {
+    /// Create a full bucket.
+    #[must_use]
+    pub fn new(rate: u32, now: Instant) -> Self {
+        let rate = f64::from(rate);
+        Self {
+            rate,
+            tokens: rate,
+            updated_at: now,
+        }
+    }
+
+    fn refill(&mut self, now: Instant) {
+        let elapsed = now.saturating_duration_since(self.updated_at);
+        self.tokens = elapsed
+            .as_secs_f64()
+            .mul_add(self.rate, self.tokens)
+            .min(self.rate);
+        self.updated_at = now;
+    }
+
+    /// Returns true if a token is available.
+    pub fn has_token(&mut self, now: Instant) -> bool {
+        self.refill(now);
+        self.tokens >= 1.0
+    }
+
+    /// Take one token, returns false if bucket is empty.
+    pub fn try_acquire(&mut self, now: Instant) -> bool {
+        if self.has_token(now) {
+            self.tokens -= 1.0;
+            true
+        } else {
+            false
+        }
+    }
+
+    /// Returns true if bucket is not used recently.
+    pub fn is_full(&mut self, now: Instant) -> bool {
+        self.refill(now);
+        self.tokens >= self.rate
+    }
+}
+
+#[derive(Debug)]
+pub struct Admission {
+    maximum_connections: usize,
+    policy: AdmissionPolicy,
+
+    /// Limit rate of all connections to this listener.
+    bucket: Option<TokenBucket>,
+
+    rate_per_ip: u32,
+    ip_buckets: HashMap<IpAddr, TokenBucket>,
+
+    /// Number of rejected connections since last report.
+    rejected: usize,
+}
+
+impl Admission {
+    #[must_use]
+    pub fn new(config: &config::Listener, now: Instant) -> Self {
+        let bucket = if config.accept_rate() > 0 {
+            Some(TokenBucket::new(config.accept_rate(), now))
+        } else {
+            None
+        };
+        Self {
+            maximum_connections: config.maximum_connections(),
+            policy: config.admission_policy(),
+            bucket,
+            rate_per_ip: config.accept_rate_per_ip(),
+            ip_buckets: HashMap::new(),
+            rejected: 0,
+        }
+    }
+
+    fn is_full(&self, connections: usize) -> bool {
+        self.maximum_connections > 0 && connections >= self.maximum_connections
+    }
+
+    /// Returns false if listener shall stop accepting new sockets for now.
+    ///
+    /// Only used with `Delay` policy.
+    pub fn can_accept(&mut self, connections: usize, now: Instant) -> bool {
+        if self.policy == AdmissionPolicy::Reject {
+            return true;
+        }
+        !self.is_full(connections)
+            && self
+                .bucket
+                .as_mut()
+                .map_or(true, |bucket| bucket.has_token(now))
+    }
+
+    /// Check a new socket from `ip`.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if this socket shall be closed.
+    pub fn admit(
+        &mut self,
+        connections: usize,
+        ip: Option<IpAddr>,
+        now: Instant,
+    ) -> Result<(), Error> {
+        if self.is_full(connections) {
+            self.rejected += 1;
+            return Err(Error::from_string(
+                ErrorKind::LimitExceeded,
+                format!("Maximum connections {} reached", self.maximum_connections),
+            ));
+        }
+
+        // Check rate of ip address first, so that a noisy client does not use up
+        // tokens of listener.
+        if let (Some(ip), true) = (ip, self.rate_per_ip > 0) {
+            let rate_per_ip = self.rate_per_ip;
+            let bucket = self
+                .ip_buckets
+                .entry(ip)
+                .or_insert_with(|| TokenBucket::new(rate_per_ip, now));
+            if !bucket.try_acquire(now) {
+                self.rejected += 1;
+                return Err(Error::from_string(
+                    ErrorKind::LimitExceeded,
+                    format!("Accept rate of {} reached", ip),
+                ));
+            }
+        }
+
+        if let Some(bucket) = self.bucket.as_mut() {
+            if !bucket.try_acquire(now) {
+                self.rejected += 1;
+                return Err(Error::new(
+                    ErrorKind::LimitExceeded,
+                    "Accept rate of listener reached",
+                ));
+            }
+        }
+        Ok(())
+    }
+
+    /// Get number of rejected connections since last call.
+    pub fn take_rejected(&mut self) -> usize {
+        std::mem::take(&mut self.rejected)
+    }
+
+    /// Remove buckets of ip addresses which are not used recently.
+    pub fn remove_idle_buckets(&mut self, now: Instant) {
+        self.ip_buckets.retain(|_ip, bucket| !bucket.is_full(now));
+    }
+}
+
+impl Listener {
+    /// Number of sessions in this listener, including those in handshake.
+    pub(super) fn connections(&self) -> usize {
+        self.inflight_counters.len() + self.pending_handshakes()
+    }
+
+    /// Report rejected connections and clean up idle buckets.
+    pub(super) fn on_admission_tick(&mut self) {
+        let now = Instant::now();
+        self.admission.remove_idle_buckets(now);
+
+        let rejected = self.admission.take_rejected();
+        if rejected > 0 {
+            log::warn!("listener: {} new connections rejected", rejected);
+            let cmd = ListenerToDispatcherCmd::ConnectionsRejected(self.id, rejected);
+            if self.dispatcher_sender.try_send(cmd).is_err() {
+                // Try again on next tick.
+                self.admission.rejected += rejected;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::TokenBucket;
+    use std::time::{Duration, Instant};
+
+    #[test]
+    fn test_token_bucket() {
+        let now = Instant::now();
+        let mut bucket = TokenBucket::new(2, now);
+        assert!(bucket.try_acquire(now));
+        assert!(bucket.try_acquire(now));
+        assert!(!bucket.try_acquire(now));
+
+        let now = now + Duration::from_millis(500);
+        assert!(bucket.try_acquire(now));
+        assert!(!bucket.try_acquire(now));
+        assert!(!bucket.is_full(now));
+
+        let now = now + Duration::from_secs(10);
+        assert!(bucket.is_full(now));
+    }
+}
@@ -48,26 +48,26 @@ impl Listener {
 
         // If not granted, reject this session here.
         if !access_granted {
-            return self
-                .session_send_connect_ack(session_id, v3::ConnectReturnCode::Unauthorized, None)
-                .await;
-        }
-
-        // Clean session flag is on.
-        if packet.connect_flags().clean_session() {
-            return self
-                .session_send_connect_ack(session_id, v3::ConnectReturnCode::Accepted, None)
-                .await;
+            return self.session_send_connect_ack(
+                session_id,
+                v3::ConnectReturnCode::Unauthorized,
+                None,
+            );
         }
 
         self.client_ids
             .insert(packet.client_id().to_string(), session_id);
 
         // Check cached session store and update session_present flag.
+        //
+        // If CleanSession is set to 1, the Client and Server MUST discard any previous Session
+        // and start a new one [MQTT-3.1.2-6].
+        self.restoring_sessions.insert(session_id);
         let cmd = ListenerToDispatcherCmd::CheckCachedSession(
             SessionGid::new(self.id, session_id),
             packet.client_id().to_string(),
             packet.protocol_level(),
+            packet.connect_flags().clean_session(),
         );
         self.dispatcher_sender.send(cmd).await.map_err(Into::into)
     }
@@ -83,26 +83,26 @@ impl Listener {
 
         // If not granted, reject this session here.
         if !access_granted {
-            return self
-                .session_send_connect_ack_v5(session_id, v5::ReasonCode::NotAuthorized, None)
-                .await;
-        }
-
-        // Clean session flag is on.
-        if packet.connect_flags().clean_session() {
-            return self
-                .session_send_connect_ack_v5(session_id, v5::ReasonCode::Success, None)
-                .await;
+            return self.session_send_connect_ack_v5(
+                session_id,
+                v5::ReasonCode::NotAuthorized,
+                None,
+            );
         }
 
         self.client_ids
             .insert(packet.client_id().to_string(), session_id);
 
         // Check cached session store and update session_present flag.
+        //
+        // If a CONNECT packet is received with Clean Start is set to 1, the Client and Server
+        // MUST discard any existing Session and start a new Session [MQTT-3.1.2-4].
+        self.restoring_sessions.insert(session_id);
         let cmd = ListenerToDispatcherCmd::CheckCachedSession(
             SessionGid::new(self.id, session_id),
             packet.client_id().to_string(),
             packet.protocol_level(),
+            packet.connect_flags().clean_session(),
         );
         self.dispatcher_sender.send(cmd).await.map_err(Into::into)
     }
@@ -0,0 +1,360 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Deliver publish messages to sessions.
+//!
+//! Listener never waits for a session. Messages are sent to a session only if its
+//! channel has free space and bytes queued for it are below `max_session_queue_bytes`,
+//! otherwise `slow_consumer_policy` is applied, so that a slow client does not block
+//! messages to other clients of the same listener.
+//!
+//! QoS 1 and QoS 2 messages are never dropped by `DropQos0` policy, they are kept
+//! in spill queue of the session until its channel has free space.
+//!
+//! Messages to a session whose cached state is not restored yet are also kept
+//! in spill queue, until CONNACK is sent to it.
+
+use codec::QoS;
+use tokio::sync::mpsc::error::TrySendError;
+
+use super::Listener;
+use crate::commands::{ListenerToDispatcherCmd, ListenerToSessionCmd};
+use crate::config::SlowConsumerPolicy;
+use crate::error::Error;
+use crate::message::PublishMessage;
+use crate::session::{CachedSession, OfflineQueue};
+use crate::types::SessionId;
+
+/// Result of sending a message to session.
+enum Delivery {
+    Sent,
+    Busy,
+    Closed,
+}
+
+impl Listener {
+    /// Send publish message to a session, without waiting.
+    pub(super) fn deliver_publish(
+        &mut self,
+        session_id: SessionId,
+        qos: QoS,
+        message: PublishMessage,
+        retained: bool,
+    ) -> Result<(), Error> {
+        if !self.session_senders.contains_key(&session_id) {
+            if self.closing_sessions.contains(&session_id) {
+                // Slow client is being disconnected.
+                self.dropped_publishes.0 += 1;
+                self.dropped_publishes.1 += message.size();
+                return Ok(());
+            }
+            return Err(Error::session_error(session_id));
+        }
+
+        if self.restoring_sessions.contains(&session_id) {
+            self.spill_message(session_id, qos, message, retained);
+            return Ok(());
+        }
+
+        // Keep order of messages, new messages are appended to spill queue
+        // until it is empty.
+        if self
+            .spill_queues
+            .get(&session_id)
+            .map_or(false, |queue| !queue.is_empty())
+        {
+            if self.config.slow_consumer_policy() == SlowConsumerPolicy::DropQos0
+                && message.qos().min(qos) == QoS::AtMostOnce
+            {
+                self.drop_message(session_id, &message);
+            } else {
+                self.spill_message(session_id, qos, message, retained);
+            }
+            self.flush_spill_queue(session_id);
+            return Ok(());
+        }
+
+        if self.is_session_queue_full(session_id, &message) {
+            // QoS 1 and QoS 2 messages are not limited by bytes with `DropQos0` policy,
+            // they are spilled only if channel of session is full.
+            let policy = self.config.slow_consumer_policy();
+            if policy != SlowConsumerPolicy::DropQos0 || message.qos().min(qos) == QoS::AtMostOnce {
+                self.on_slow_consumer(session_id, qos, message, retained);
+                return Ok(());
+            }
+        }
+
+        match self.try_send_publish(session_id, qos, &message, retained) {
+            Delivery::Sent | Delivery::Closed => (),
+            Delivery::Busy => self.on_slow_consumer(session_id, qos, message, retained),
+        }
+        Ok(())
+    }
+
+    /// Check bytes of messages sent to session but not written to its client yet.
+    fn is_session_queue_full(&self, session_id: SessionId, message: &PublishMessage) -> bool {
+        let max_bytes = self.config.max_session_queue_bytes();
+        if max_bytes == 0 {
+            return false;
+        }
+        // A message larger than limit is still sent if nothing is queued.
+        self.inflight_counters
+            .get(&session_id)
+            .map_or(false, |inflight| {
+                inflight.bytes() > 0 && inflight.bytes() + message.size() > max_bytes
+            })
+    }
+
+    fn try_send_publish(
+        &self,
+        session_id: SessionId,
+        qos: QoS,
+        message: &PublishMessage,
+        retained: bool,
+    ) -> Delivery {
+        let session_sender = match self.session_senders.get(&session_id) {
+            Some(session_sender) => session_sender,
+            None => return Delivery::Closed,
+        };
+        let cmd = if retained {
+            ListenerToSessionCmd::PublishRetained(qos, message.clone())
+        } else {
+            ListenerToSessionCmd::Publish(qos, message.clone())
+        };
+        match session_sender.try_send(cmd) {
+            Ok(()) => {
+                if let Some(inflight) = self.inflight_counters.get(&session_id) {
+                    inflight.increase();
+                    inflight.increase_bytes(message.size());
+                }
+                Delivery::Sent
+            }
+            Err(TrySendError::Full(_cmd)) => Delivery::Busy,
+            // Session is exiting, its state is handled in `on_session_disconnect()`.
+            Err(TrySendError::Closed(_cmd)) => Delivery::Closed,
+        }
+    }
+
+    fn on_slow_consumer(
+        &mut self,
+        session_id: SessionId,
+        qos: QoS,
+        message: PublishMessage,
+        retained: bool,
+    ) {
+        match self.config.slow_consumer_policy() {
+            SlowConsumerPolicy::DropQos0 => {
+                if message.qos().min(qos) == QoS::AtMostOnce {
+                    self.drop_message(session_id, &message);
+                } else {
+                    // Delivery of QoS 1 and QoS 2 messages is guaranteed, they are sent
+                    // once channel of session has free space.
+                    self.spill_message(session_id, qos, message, retained);
+                }
+            }
+            SlowConsumerPolicy::Disconnect => {
+                self.close_slow_session(session_id);
+                self.dropped_publishes.0 += 1;
+                self.dropped_publishes.1 += message.size();
+            }
+            SlowConsumerPolicy::SpillOffline => {
+                self.spill_message(session_id, qos, message, retained);
+            }
+        }
+    }
+
+    /// Close channel of a slow session.
+    ///
+    /// Session sends DISCONNECT packet to client and exits once its channel is closed.
+    pub(super) fn close_slow_session(&mut self, session_id: SessionId) {
+        log::warn!("listener: Disconnect slow session {}", session_id);
+        self.session_senders.remove(&session_id);
+        self.closing_sessions.insert(session_id);
+    }
+
+    fn drop_message(&mut self, session_id: SessionId, message: &PublishMessage) {
+        log::debug!("listener: Drop message to slow session {}", session_id);
+        self.dropped_publishes.0 += 1;
+        self.dropped_publishes.1 += message.size();
+    }
+
+    fn spill_message(
+        &mut self,
+        session_id: SessionId,
+        qos: QoS,
+        message: PublishMessage,
+        retained: bool,
+    ) {
+        let (count, bytes) = self.spill_queues.entry(session_id).or_default().push(
+            qos,
+            message,
+            retained,
+            self.general_config.max_queued_messages(),
+            self.general_config.max_queued_bytes(),
+            self.general_config.queue_drop_policy(),
+        );
+        self.dropped_publishes.0 += count;
+        self.dropped_publishes.1 += bytes;
+    }
+
+    /// Send spilled messages of a session in order, until it is busy again.
+    pub(super) fn flush_spill_queue(&mut self, session_id: SessionId) {
+        let mut queue = match self.spill_queues.remove(&session_id) {
+            Some(queue) => queue,
+            None => return,
+        };
+        while let Some((qos, message, retained)) = queue.front() {
+            if self.is_session_queue_full(session_id, message) {
+                break;
+            }
+            match self.try_send_publish(session_id, *qos, message, *retained) {
+                Delivery::Sent => {
+                    queue.pop_front();
+                }
+                // Queue of a closed session is moved to its cached state later.
+                Delivery::Busy | Delivery::Closed => break,
+            }
+        }
+        if !queue.is_empty() {
+            self.spill_queues.insert(session_id, queue);
+        }
+    }
+
+    /// Move spilled messages of a disconnected session to its cached state.
+    pub(super) fn take_spill_queue(
+        &mut self,
+        session_id: SessionId,
+        cached_session: Option<&mut CachedSession>,
+    ) {
+        let mut queue: OfflineQueue = match self.spill_queues.remove(&session_id) {
+            Some(queue) => queue,
+            None => return,
+        };
+        let cached_session = match cached_session {
+            Some(cached_session) => cached_session,
+            None => {
+                self.dropped_publishes.0 += queue.len();
+                self.dropped_publishes.1 += queue.bytes();
+                return;
+            }
+        };
+        while let Some((qos, message, retained)) = queue.pop_front() {
+            // QoS 0 messages are not stored for disconnected clients.
+            if message.qos().min(qos) == QoS::AtMostOnce {
+                self.dropped_publishes.0 += 1;
+                self.dropped_publishes.1 += message.size();
+                continue;
+            }
+            let (count, bytes) = cached_session.messages_mut().push(
+                qos,
+                message,
+                retained,
+                self.general_config.max_queued_messages(),
+                self.general_config.max_queued_bytes(),
+                self.general_config.queue_drop_policy(),
+            );
+            self.dropped_publishes.0 += count;
+            self.dropped_publishes.1 += bytes;
+        }
+    }
+
+    /// Resend spilled messages and report dropped messages to dispatcher.
+    pub(super) fn on_delivery_tick(&mut self) {
+        if !self.spill_queues.is_empty() {
+            let session_ids: Vec<SessionId> = self.spill_queues.keys().copied().collect();
+            for session_id in session_ids {
+                self.flush_spill_queue(session_id);
+            }
+        }
+
+        if self.dropped_publishes.0 > 0 {
+            let (count, bytes) = self.dropped_publishes;
+            // Metrics are not important enough to block listener, try again on next tick.
+            if self
+                .dispatcher_sender
+                .try_send(ListenerToDispatcherCmd::PublishDropped(count, bytes))
+                .is_ok()
+            {
+                self.dropped_publishes = (0, 0);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use codec::{v3, QoS};
+    use tokio::net::TcpListener;
+    use tokio::sync::{mpsc, watch};
+
+    use super::super::protocol::{Protocol, TcpAcceptor};
+    use super::super::Listener;
+    use crate::acl::AclSnapshot;
+    use crate::commands::ListenerToSessionCmd;
+    use crate::config;
+    use crate::message::PublishMessage;
+    use crate::types::InflightCounter;
+
+    async fn new_listener() -> Listener {
+        let tcp_listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let (dispatcher_sender, _) = mpsc::channel(1);
+        let (_, dispatcher_receiver) = mpsc::channel(1);
+        let (auth_sender, _) = mpsc::channel(1);
+        let (_, auth_receiver) = mpsc::channel(1);
+        let (acl_sender, _) = mpsc::channel(1);
+        let (_, acl_receiver) = mpsc::channel(1);
+        let (_, acl_snapshot) = watch::channel(AclSnapshot::default());
+        Listener::new(
+            0,
+            Protocol::Mqtt(TcpAcceptor::Single(tcp_listener)),
+            config::General::default(),
+            config::Listener::default(),
+            dispatcher_sender,
+            dispatcher_receiver,
+            Vec::new(),
+            auth_sender,
+            auth_receiver,
+            acl_sender,
+            acl_receiver,
+            acl_snapshot,
+        )
+    }
+
+    fn new_message(qos: QoS) -> PublishMessage {
+        let packet = v3::PublishPacket::new("sport/tennis", qos, b"hello").unwrap();
+        PublishMessage::from_v3(&packet)
+    }
+
+    #[tokio::test]
+    async fn test_drop_qos0_keeps_qos1() {
+        let mut listener = new_listener().await;
+        let session_id = 1;
+        let (session_sender, mut session_receiver) = mpsc::channel(1);
+        listener.session_senders.insert(session_id, session_sender);
+        listener
+            .inflight_counters
+            .insert(session_id, InflightCounter::new());
+
+        // Channel of session is full after the first message.
+        let qos0 = new_message(QoS::AtMostOnce);
+        let qos1 = new_message(QoS::AtLeastOnce);
+        for message in [qos0.clone(), qos0, qos1] {
+            let qos = message.qos();
+            listener
+                .deliver_publish(session_id, qos, message, false)
+                .unwrap();
+        }
+        assert_eq!(listener.dropped_publishes.0, 1);
+
+        assert!(matches!(
+            session_receiver.recv().await,
+            Some(ListenerToSessionCmd::Publish(QoS::AtMostOnce, _))
+        ));
+        listener.on_delivery_tick();
+        assert!(matches!(
+            session_receiver.recv().await,
+            Some(ListenerToSessionCmd::Publish(QoS::AtLeastOnce, _))
+        ));
+    }
+}
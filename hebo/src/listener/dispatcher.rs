@@ -7,7 +7,7 @@
 use codec::{v3, v5, ProtocolLevel};
 
 use super::Listener;
-use crate::commands::{DispatcherToListenerCmd, ListenerToSessionCmd};
+use crate::commands::DispatcherToListenerCmd;
 use crate::error::Error;
 use crate::session::CachedSession;
 use crate::types::SessionId;
@@ -26,11 +26,11 @@ impl Listener {
                 self.on_dispatcher_check_cached_session(session_id, protocol_level, cached_session)
                     .await
             }
-            DispatcherToListenerCmd::Publish(session_id, packet) => {
-                self.on_dispatcher_publish(session_id, packet).await
+            DispatcherToListenerCmd::Publish(session_id, qos, message) => {
+                self.deliver_publish(session_id, qos, message, false)
             }
-            DispatcherToListenerCmd::PublishV5(session_id, packet) => {
-                self.on_dispatcher_publish_v5(session_id, packet).await
+            DispatcherToListenerCmd::PublishRetained(session_id, qos, message) => {
+                self.deliver_publish(session_id, qos, message, true)
             }
             DispatcherToListenerCmd::SubscribeAck(session_id, packet) => {
                 self.on_dispatcher_subscribe_ack(session_id, packet).await
@@ -48,43 +48,20 @@ impl Listener {
         protocol_level: ProtocolLevel,
         cached_session: Option<CachedSession>,
     ) -> Result<(), Error> {
-        if protocol_level == ProtocolLevel::V5 {
+        let ret = if protocol_level == ProtocolLevel::V5 {
             self.session_send_connect_ack_v5(session_id, v5::ReasonCode::Success, cached_session)
-                .await
         } else {
             self.session_send_connect_ack(
                 session_id,
                 v3::ConnectReturnCode::Accepted,
                 cached_session,
             )
-            .await
-        }
-    }
-
-    async fn on_dispatcher_publish(
-        &mut self,
-        session_id: SessionId,
-        packet: v3::PublishPacket,
-    ) -> Result<(), Error> {
-        if let Some(session_sender) = self.session_senders.get(&session_id) {
-            let cmd = ListenerToSessionCmd::Publish(packet);
-            session_sender.send(cmd).await.map_err(Into::into)
-        } else {
-            Err(Error::session_error(session_id))
-        }
-    }
+        };
 
-    async fn on_dispatcher_publish_v5(
-        &mut self,
-        session_id: SessionId,
-        packet: v5::PublishPacket,
-    ) -> Result<(), Error> {
-        if let Some(session_sender) = self.session_senders.get(&session_id) {
-            let cmd = ListenerToSessionCmd::PublishV5(packet);
-            session_sender.send(cmd).await.map_err(Into::into)
-        } else {
-            Err(Error::session_error(session_id))
-        }
+        // Messages routed to this session before CONNACK are sent after it.
+        self.restoring_sessions.remove(&session_id);
+        self.flush_spill_queue(session_id);
+        ret
     }
 
     async fn on_dispatcher_subscribe_ack(
@@ -92,7 +69,7 @@ impl Listener {
         session_id: SessionId,
         packet: v3::SubscribeAckPacket,
     ) -> Result<(), Error> {
-        self.session_send_publish_ack(session_id, packet).await
+        self.session_send_publish_ack(session_id, packet)
     }
 
     async fn on_dispatcher_subscribe_ack_v5(
@@ -100,6 +77,6 @@ impl Listener {
         session_id: SessionId,
         packet: v5::SubscribeAckPacket,
     ) -> Result<(), Error> {
-        self.session_send_publish_ack_v5(session_id, packet).await
+        self.session_send_publish_ack_v5(session_id, packet)
     }
 }
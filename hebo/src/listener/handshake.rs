@@ -0,0 +1,187 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! TLS, WebSocket and QUIC handshakes of new connections.
+//!
+//! Handshakes run in their own tasks, so that a slow or malicious client does not
+//! block the listener from accepting other sockets and from serving commands.
+//! Finished streams are sent back to listener with `handshake_sender`.
+
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use tokio::net::TcpStream;
+use tokio_rustls::TlsAcceptor;
+use tokio_tungstenite::tungstenite::handshake::server as ws_server;
+
+use super::Listener;
+use crate::cache_types::LatencyHistogram;
+use crate::commands::ListenerToDispatcherCmd;
+use crate::error::{Error, ErrorKind};
+use crate::stream::{QuicStream, Stream, WsStream};
+
+/// New connection returned by `Listener::accept()`.
+pub enum Incoming {
+    /// No handshake is required.
+    Ready(Stream),
+
+    Tls(TcpStream, TlsAcceptor),
+
+    /// `(tcp_stream, path)` pair.
+    Ws(TcpStream, Option<String>),
+
+    /// `(tcp_stream, acceptor, path)` pair.
+    Wss(TcpStream, TlsAcceptor, Option<String>),
+
+    /// `(connecting, send_datagrams)` pair.
+    Quic(quinn::Connecting, bool),
+}
+
+/// Result of a handshake task, and time used.
+pub type HandshakeResult = (Result<Stream, Error>, Duration);
+
+/// Handshake statistics since last report to dispatcher.
+#[derive(Debug, Default)]
+pub struct HandshakeStats {
+    latency: LatencyHistogram,
+    failed: usize,
+}
+
+/// Build a callback to reply 404 if request path of websocket does not match.
+fn check_ws_path(
+    listener_path: String,
+) -> impl FnOnce(
+    &ws_server::Request,
+    ws_server::Response,
+) -> Result<ws_server::Response, ws_server::ErrorResponse> {
+    move |request, response| {
+        if request.uri().path() == listener_path {
+            return Ok(response);
+        }
+        let mut resp = ws_server::ErrorResponse::new(None);
+        *resp.status_mut() = http::StatusCode::NOT_FOUND;
+        Err(resp)
+    }
+}
+
+async fn handshake(incoming: Incoming) -> Result<Stream, Error> {
+    match incoming {
+        Incoming::Ready(stream) => Ok(stream),
+        Incoming::Tls(tcp_stream, acceptor) => {
+            let tls_stream = acceptor.accept(tcp_stream).await?;
+            Ok(Stream::Mqtts(Box::new(tls_stream)))
+        }
+        Incoming::Ws(tcp_stream, path) => {
+            let ws_stream = match path {
+                None => tokio_tungstenite::accept_async(tcp_stream).await?,
+                Some(path) => {
+                    tokio_tungstenite::accept_hdr_async(tcp_stream, check_ws_path(path)).await?
+                }
+            };
+            Ok(Stream::Ws(Box::new(WsStream::new(ws_stream))))
+        }
+        Incoming::Wss(tcp_stream, acceptor, path) => {
+            let tls_stream = acceptor.accept(tcp_stream).await?;
+            let ws_stream = match path {
+                None => tokio_tungstenite::accept_async(tls_stream).await?,
+                Some(path) => {
+                    tokio_tungstenite::accept_hdr_async(tls_stream, check_ws_path(path)).await?
+                }
+            };
+            Ok(Stream::Wss(Box::new(WsStream::new(ws_stream))))
+        }
+        Incoming::Quic(connecting, send_datagrams) => {
+            let connection: quinn::NewConnection = connecting.await?;
+            let quic_stream = QuicStream::accept(connection, send_datagrams).await?;
+            Ok(Stream::Quic(Box::new(quic_stream)))
+        }
+    }
+}
+
+impl Listener {
+    fn handshake_timeout(&self) -> Duration {
+        Duration::from_secs(u64::from(self.config.handshake_timeout()))
+    }
+
+    /// Number of handshakes running now.
+    pub(super) fn pending_handshakes(&self) -> usize {
+        self.config.max_concurrent_handshakes() - self.handshake_permits.available_permits()
+    }
+
+    /// Returns false if too many handshakes are running.
+    pub(super) fn can_handshake(&self) -> bool {
+        self.handshake_permits.available_permits() > 0
+    }
+
+    pub(super) async fn on_incoming(&mut self, incoming: Incoming) {
+        match incoming {
+            Incoming::Ready(stream) => self.new_connection(stream).await,
+            incoming => self.spawn_handshake(incoming),
+        }
+    }
+
+    fn spawn_handshake(&mut self, incoming: Incoming) {
+        // Accept loop stops when no permit is available, this is only a safety net.
+        let permit = match Arc::clone(&self.handshake_permits).try_acquire_owned() {
+            Ok(permit) => permit,
+            Err(err) => {
+                log::warn!("listener: Too many handshakes, drop connection: {:?}", err);
+                self.handshake_stats.failed += 1;
+                return;
+            }
+        };
+        let timeout = self.handshake_timeout();
+        let sender = self.handshake_sender.clone();
+
+        tokio::spawn(async move {
+            let start = Instant::now();
+            let ret = if timeout.is_zero() {
+                handshake(incoming).await
+            } else {
+                match tokio::time::timeout(timeout, handshake(incoming)).await {
+                    Ok(ret) => ret,
+                    Err(_elapsed) => Err(Error::from_string(
+                        ErrorKind::SocketError,
+                        format!("Handshake not finished in {:?}", timeout),
+                    )),
+                }
+            };
+            if let Err(err) = sender.send((ret, start.elapsed())).await {
+                log::error!("listener: Failed to send handshake result: {:?}", err);
+            }
+            // Stream is counted in connections of listener until it is handed over.
+            drop(permit);
+        });
+    }
+
+    pub(super) async fn on_handshake_done(&mut self, result: HandshakeResult) {
+        let (ret, elapsed) = result;
+        match ret {
+            Ok(stream) => {
+                self.handshake_stats.latency.record(elapsed);
+                self.new_connection(stream).await;
+            }
+            Err(err) => {
+                log::warn!("listener: Handshake failed after {:?}: {:?}", elapsed, err);
+                self.handshake_stats.failed += 1;
+            }
+        }
+    }
+
+    /// Report handshake latency and failures to dispatcher.
+    pub(super) fn on_handshake_tick(&mut self) {
+        if self.handshake_stats.latency.is_empty() && self.handshake_stats.failed == 0 {
+            return;
+        }
+        let stats = std::mem::take(&mut self.handshake_stats);
+        let cmd = ListenerToDispatcherCmd::HandshakeStats(self.id, stats.latency, stats.failed);
+        if let Err(err) = self.dispatcher_sender.try_send(cmd) {
+            // Try again on next tick.
+            if let ListenerToDispatcherCmd::HandshakeStats(_id, latency, failed) = err.into_inner()
+            {
+                self.handshake_stats.latency.merge(&latency);
+                self.handshake_stats.failed += failed;
+            }
+        }
+    }
+}
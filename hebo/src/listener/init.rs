@@ -8,64 +8,93 @@ use futures_util::StreamExt;
 use std::collections::{BTreeMap, HashMap, HashSet};
 use std::fs::{self, File};
 use std::io::BufReader;
+use std::net::{IpAddr, SocketAddr};
 use std::path::Path;
 use std::sync::Arc;
-use tokio::net::UnixListener;
+use std::time::Instant;
+use tokio::net::{TcpStream, UnixListener};
 use tokio::sync::mpsc::{self, Receiver, Sender};
+use tokio::sync::{watch, Semaphore};
 use tokio_rustls::{rustls, TlsAcceptor};
 
+use super::admission::Admission;
+use super::handshake::{HandshakeStats, Incoming};
+use super::protocol::{Protocol, TcpAcceptor};
 use super::Listener;
-use super::Protocol;
-use super::CHANNEL_CAPACITY;
+use super::{CHANNEL_CAPACITY, TICK_INTERVAL};
+use crate::acl::AclSnapshot;
 use crate::commands::{
-    AclToListenerCmd, AuthToListenerCmd, DispatcherToListenerCmd, ListenerToAclCmd,
-    ListenerToAuthCmd, ListenerToDispatcherCmd,
+    AclToListenerCmd, AuthToListenerCmd, DispatcherShardCmd, DispatcherToListenerCmd,
+    ListenerToAclCmd, ListenerToAuthCmd, ListenerToDispatcherCmd,
 };
 use crate::config;
 use crate::error::{Error, ErrorKind};
-use crate::socket::{new_tcp_listener, new_udp_socket};
+use crate::socket::{new_tcp_listeners, new_udp_socket, set_stream_options, AcceptorPool};
 use crate::stream::Stream;
+use crate::timer::TimerWheel;
 use crate::types::ListenerId;
 
 impl Listener {
     #[allow(clippy::too_many_arguments)]
-    fn new(
+    pub(super) fn new(
         id: ListenerId,
         protocol: Protocol,
+        general_config: config::General,
         listener_config: config::Listener,
         // dispatcher module
         dispatcher_sender: Sender<ListenerToDispatcherCmd>,
         dispatcher_receiver: Receiver<DispatcherToListenerCmd>,
+        shard_senders: Vec<Sender<DispatcherShardCmd>>,
         // auth module
         auth_sender: Sender<ListenerToAuthCmd>,
         auth_receiver: Receiver<AuthToListenerCmd>,
         // acl module
         acl_sender: Sender<ListenerToAclCmd>,
         acl_receiver: Receiver<AclToListenerCmd>,
+        acl_snapshot: watch::Receiver<AclSnapshot>,
     ) -> Self {
         let (session_sender, session_receiver) = mpsc::channel(CHANNEL_CAPACITY);
+        let admission = Admission::new(&listener_config, Instant::now());
+        let (handshake_sender, handshake_receiver) = mpsc::channel(CHANNEL_CAPACITY);
+        let handshake_permits =
+            Arc::new(Semaphore::new(listener_config.max_concurrent_handshakes()));
         Self {
             id,
             protocol,
+            general_config,
             config: listener_config,
             current_session_id: 0,
 
             session_senders: HashMap::new(),
+            inflight_counters: HashMap::new(),
             client_ids: BTreeMap::new(),
 
             connecting_sessions: HashSet::new(),
+            restoring_sessions: HashSet::new(),
+            spill_queues: HashMap::new(),
+            closing_sessions: HashSet::new(),
+            dropped_publishes: (0, 0),
+            admission,
+            session_timers: HashMap::new(),
+            timer_wheel: TimerWheel::new(TICK_INTERVAL, Instant::now()),
+            handshake_permits,
+            handshake_stats: HandshakeStats::default(),
+            handshake_sender,
+            handshake_receiver: Some(handshake_receiver),
 
             session_sender,
             session_receiver: Some(session_receiver),
 
             dispatcher_sender,
             dispatcher_receiver: Some(dispatcher_receiver),
+            shard_senders,
 
             auth_sender,
             auth_receiver: Some(auth_receiver),
 
             acl_sender,
             acl_receiver: Some(acl_receiver),
+            acl_snapshot,
         }
     }
 
@@ -130,6 +159,33 @@ impl Listener {
             })
     }
 
+    async fn new_tcp_acceptor(listener_config: &config::Listener) -> Result<TcpAcceptor, Error> {
+        let acceptors = listener_config.acceptors();
+        let listeners = new_tcp_listeners(
+            listener_config.address(),
+            listener_config.bind_device(),
+            listener_config.backlog(),
+            listener_config.socket(),
+            acceptors,
+        )
+        .await?;
+        if acceptors == 1 && listener_config.cpu_affinity().is_empty() {
+            let listener = listeners.into_iter().next().ok_or_else(|| {
+                Error::new(ErrorKind::SocketError, "Failed to create tcp listener")
+            })?;
+            Ok(TcpAcceptor::Single(listener))
+        } else {
+            log::info!(
+                "{} acceptors for {}, cpu affinity: {:?}",
+                acceptors,
+                listener_config.address(),
+                listener_config.cpu_affinity()
+            );
+            let pool = AcceptorPool::new(listeners, listener_config.cpu_affinity().to_vec())?;
+            Ok(TcpAcceptor::Pool(pool))
+        }
+    }
+
     /// Bind to specific socket address.
     ///
     /// # Errors
@@ -139,16 +195,19 @@ impl Listener {
     #[allow(clippy::too_many_arguments)]
     pub async fn bind(
         id: u32,
+        general_config: config::General,
         listener_config: config::Listener,
         // dispatcher
         dispatcher_sender: Sender<ListenerToDispatcherCmd>,
         dispatcher_receiver: Receiver<DispatcherToListenerCmd>,
+        shard_senders: Vec<Sender<DispatcherShardCmd>>,
         // auth
         auth_sender: Sender<ListenerToAuthCmd>,
         auth_receiver: Receiver<AuthToListenerCmd>,
         // acl
         acl_sender: Sender<ListenerToAclCmd>,
         acl_receiver: Receiver<AclToListenerCmd>,
+        acl_snapshot: watch::Receiver<AclSnapshot>,
     ) -> Result<Self, Error> {
         let device = listener_config.bind_device();
         let address = listener_config.address();
@@ -157,38 +216,41 @@ impl Listener {
             Ok(Self::new(
                 id,
                 protocol,
+                general_config,
                 listener_config.clone(),
                 dispatcher_sender,
                 dispatcher_receiver,
+                shard_senders,
                 auth_sender,
                 auth_receiver,
                 acl_sender,
                 acl_receiver,
+                acl_snapshot,
             ))
         };
         match listener_config.protocol() {
             config::Protocol::Mqtt => {
                 log::info!("bind mqtt://{}", address);
-                let listener = new_tcp_listener(address, device).await?;
+                let listener = Self::new_tcp_acceptor(&listener_config).await?;
                 new_listener(Protocol::Mqtt(listener))
             }
             config::Protocol::Mqtts => {
                 log::info!("bind mqtts://{}", address);
                 let config = Self::get_cert_config(&listener_config)?;
                 let acceptor = TlsAcceptor::from(Arc::new(config));
-                let listener = new_tcp_listener(address, device).await?;
+                let listener = Self::new_tcp_acceptor(&listener_config).await?;
                 new_listener(Protocol::Mqtts(listener, acceptor))
             }
             config::Protocol::Ws => {
                 log::info!("bind ws://{}", address);
-                let listener = new_tcp_listener(address, device).await?;
+                let listener = Self::new_tcp_acceptor(&listener_config).await?;
                 new_listener(Protocol::Ws(listener))
             }
             config::Protocol::Wss => {
                 log::info!("bind wss://{}", address);
                 let config = Self::get_cert_config(&listener_config)?;
                 let acceptor = TlsAcceptor::from(Arc::new(config));
-                let listener = new_tcp_listener(address, device).await?;
+                let listener = Self::new_tcp_acceptor(&listener_config).await?;
                 new_listener(Protocol::Wss(listener, acceptor))
             }
 
@@ -230,60 +292,56 @@ impl Listener {
         }
     }
 
-    pub(super) async fn accept(&mut self) -> Result<Stream, Error> {
-        use tokio_tungstenite::tungstenite::handshake::server as ws_server;
-        let listener_path = self.config.path();
-        let check_ws_path = |request: &ws_server::Request,
-                             response: ws_server::Response|
-         -> Result<ws_server::Response, ws_server::ErrorResponse> {
-            let path = request.uri().path();
-            if listener_path.is_none() || path == listener_path.unwrap() {
-                return Ok(response);
+    /// Accept a new socket, handshake is done later in a separated task.
+    pub(super) async fn accept(&mut self) -> Result<Incoming, Error> {
+        let listener_path = self.config.path().map(ToString::to_string);
+
+        // New sockets are checked before handshake.
+        let connections = self.connections();
+        let admission = &mut self.admission;
+        let socket_options = self.config.socket();
+        let no_delay = socket_options
+            .no_delay()
+            .unwrap_or_else(|| self.general_config.no_delay());
+        let mut admit = |ip: Option<IpAddr>| admission.admit(connections, ip, Instant::now());
+        let mut admit_tcp = |tcp_stream: &TcpStream, address: SocketAddr| {
+            admit(Some(address.ip()))?;
+            if let Err(err) = set_stream_options(tcp_stream, socket_options, no_delay) {
+                log::warn!("listener: Failed to set socket options: {:?}", err);
             }
-            let builder = http::Response::builder().status(http::StatusCode::NOT_FOUND);
-            let resp = builder.body(None);
-            // TODO(Shaohua): Remove unwrap()
-            let resp = resp.unwrap();
-            Err(resp)
+            Ok::<(), Error>(())
         };
 
         match &mut self.protocol {
             Protocol::Mqtt(listener) => {
-                let (tcp_stream, _address) = listener.accept().await?;
-                Ok(Stream::Mqtt(tcp_stream))
+                let (tcp_stream, address) = listener.accept().await?;
+                admit_tcp(&tcp_stream, address)?;
+                Ok(Incoming::Ready(Stream::Mqtt(tcp_stream)))
             }
             Protocol::Mqtts(listener, acceptor) => {
-                let (tcp_stream, _address) = listener.accept().await?;
-                let tls_stream = acceptor.accept(tcp_stream).await?;
-                Ok(Stream::Mqtts(Box::new(tls_stream)))
+                let (tcp_stream, address) = listener.accept().await?;
+                admit_tcp(&tcp_stream, address)?;
+                Ok(Incoming::Tls(tcp_stream, acceptor.clone()))
             }
             Protocol::Ws(listener) => {
-                let (tcp_stream, _address) = listener.accept().await?;
-                let ws_stream = if listener_path.is_none() {
-                    tokio_tungstenite::accept_async(tcp_stream).await?
-                } else {
-                    tokio_tungstenite::accept_hdr_async(tcp_stream, check_ws_path).await?
-                };
-                Ok(Stream::Ws(Box::new(ws_stream)))
+                let (tcp_stream, address) = listener.accept().await?;
+                admit_tcp(&tcp_stream, address)?;
+                Ok(Incoming::Ws(tcp_stream, listener_path))
             }
             Protocol::Wss(listener, acceptor) => {
-                let (tcp_stream, _address) = listener.accept().await?;
-                let tls_stream = acceptor.accept(tcp_stream).await?;
-                let ws_stream = if listener_path.is_none() {
-                    tokio_tungstenite::accept_async(tls_stream).await?
-                } else {
-                    tokio_tungstenite::accept_hdr_async(tls_stream, check_ws_path).await?
-                };
-                Ok(Stream::Wss(Box::new(ws_stream)))
+                let (tcp_stream, address) = listener.accept().await?;
+                admit_tcp(&tcp_stream, address)?;
+                Ok(Incoming::Wss(tcp_stream, acceptor.clone(), listener_path))
             }
             Protocol::Uds(listener) => {
                 let (uds_stream, _address) = listener.accept().await?;
-                Ok(Stream::Uds(uds_stream))
+                admit(None)?;
+                Ok(Incoming::Ready(Stream::Uds(uds_stream)))
             }
             Protocol::Quic(_endpoint, incoming) => {
                 if let Some(conn) = incoming.next().await {
-                    let connection: quinn::NewConnection = conn.await?;
-                    return Ok(Stream::Quic(connection));
+                    admit(Some(conn.remote_address().ip()))?;
+                    return Ok(Incoming::Quic(conn, self.config.quic_datagrams()));
                 }
                 Err(Error::new(
                     ErrorKind::SocketError,
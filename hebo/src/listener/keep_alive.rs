@@ -0,0 +1,92 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Keep alive and connect timeout of sessions.
+//!
+//! Deadlines of all sessions in a listener are kept in one timer wheel, instead of
+//! being checked by each session when it is woken up, so that idle connections
+//! are closed even if nothing is received from them.
+//!
+//! Sessions update their `SessionTimer` on activity, and the timer wheel is not
+//! touched. When a timer fires, its deadline is read again and the timer is
+//! re-inserted if client has been active since then.
+
+use std::time::{Duration, Instant};
+use tokio::sync::mpsc::error::TrySendError;
+
+use super::Listener;
+use crate::commands::ListenerToSessionCmd;
+use crate::types::{SessionId, SessionTimer};
+
+/// Interval to check again after a session is notified of timeout.
+const TIMEOUT_RETRY_INTERVAL: Duration = Duration::from_secs(1);
+
+impl Listener {
+    fn connect_timeout(&self) -> Duration {
+        Duration::from_secs(u64::from(self.config.connect_timeout()))
+    }
+
+    /// Start connect timeout timer of a new session.
+    pub(super) fn add_session_timer(&mut self, session_id: SessionId, timer: SessionTimer) {
+        if let Some(deadline) = timer.deadline(self.connect_timeout()) {
+            self.timer_wheel.insert(deadline, session_id);
+        }
+        self.session_timers.insert(session_id, timer);
+    }
+
+    /// Start keep alive timer after CONNECT packet is received.
+    pub(super) fn on_session_connect_timer(&mut self, session_id: SessionId) {
+        // Otherwise timer is already in wheel, and keep alive is checked when
+        // connect timeout fires.
+        if !self.connect_timeout().is_zero() {
+            return;
+        }
+        if let Some(deadline) = self
+            .session_timers
+            .get(&session_id)
+            .and_then(|timer| timer.deadline(Duration::from_secs(0)))
+        {
+            self.timer_wheel.insert(deadline, session_id);
+        }
+    }
+
+    /// Notify sessions whose timers are expired.
+    pub(super) fn on_timer_tick(&mut self) {
+        let now = Instant::now();
+        let mut expired = Vec::new();
+        self.timer_wheel.advance(now, &mut expired);
+        if expired.is_empty() {
+            return;
+        }
+
+        let connect_timeout = self.connect_timeout();
+        for session_id in expired {
+            // Session is removed already.
+            let timer = match self.session_timers.get(&session_id) {
+                Some(timer) => timer,
+                None => continue,
+            };
+            let deadline = match timer.deadline(connect_timeout) {
+                Some(deadline) => deadline,
+                None => continue,
+            };
+            if deadline > now {
+                // Client has been active since this timer is inserted.
+                self.timer_wheel.insert(deadline, session_id);
+                continue;
+            }
+
+            let ret = self
+                .session_senders
+                .get(&session_id)
+                .map(|session_sender| session_sender.try_send(ListenerToSessionCmd::Timeout));
+            let next_check = match ret {
+                Some(Ok(())) => now + TIMEOUT_RETRY_INTERVAL,
+                Some(Err(TrySendError::Full(_))) => now + self.timer_wheel.tick(),
+                Some(Err(TrySendError::Closed(_))) | None => continue,
+            };
+            self.timer_wheel.insert(next_check, session_id);
+        }
+    }
+}
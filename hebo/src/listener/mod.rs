@@ -4,51 +4,103 @@
 
 use std::collections::{BTreeMap, HashMap, HashSet};
 use std::fs;
+use std::sync::Arc;
+use std::time::Duration;
 use tokio::sync::mpsc::{Receiver, Sender};
+use tokio::sync::{watch, Semaphore};
 
+use crate::acl::AclSnapshot;
 use crate::commands::{
-    AclToListenerCmd, AuthToListenerCmd, DispatcherToListenerCmd, ListenerToAclCmd,
-    ListenerToAuthCmd, ListenerToDispatcherCmd, ListenerToSessionCmd, SessionToListenerCmd,
+    AclToListenerCmd, AuthToListenerCmd, DispatcherShardCmd, DispatcherToListenerCmd,
+    ListenerToAclCmd, ListenerToAuthCmd, ListenerToDispatcherCmd, ListenerToSessionCmd,
+    SessionToListenerCmd,
 };
 use crate::config;
-use crate::types::{ListenerId, SessionId};
+use crate::session::OfflineQueue;
+use crate::timer::TimerWheel;
+use crate::types::{InflightCounter, ListenerId, SessionId, SessionTimer};
 
 mod acl;
+mod admission;
 mod auth;
+mod delivery;
 mod dispatcher;
+mod handshake;
 mod init;
+mod keep_alive;
 mod protocol;
 mod run;
 mod session;
 
+use handshake::{HandshakeResult, HandshakeStats};
 use protocol::Protocol;
 
 const CHANNEL_CAPACITY: usize = 16;
 
+/// Interval to check timers of sessions, resend spilled messages and to report
+/// dropped messages.
+const TICK_INTERVAL: Duration = Duration::from_millis(100);
+
 #[derive(Debug)]
 pub struct Listener {
     id: ListenerId,
     protocol: Protocol,
+    general_config: config::General,
     config: config::Listener,
     current_session_id: SessionId,
 
     session_senders: HashMap<SessionId, Sender<ListenerToSessionCmd>>,
+    inflight_counters: HashMap<SessionId, InflightCounter>,
     client_ids: BTreeMap<String, SessionId>,
 
     // session_id -> clean_session.
     connecting_sessions: HashSet<SessionId>,
 
+    /// Sessions waiting for their cached state from dispatcher.
+    ///
+    /// Messages routed to them are queued in `spill_queues` until CONNACK is sent,
+    /// so that session handles them after its state is restored.
+    restoring_sessions: HashSet<SessionId>,
+
+    /// Messages to slow sessions, with `SpillOffline` policy.
+    spill_queues: HashMap<SessionId, OfflineQueue>,
+
+    /// Slow sessions being disconnected, with `Disconnect` policy.
+    closing_sessions: HashSet<SessionId>,
+
+    /// Number of messages and bytes dropped since last report to dispatcher.
+    dropped_publishes: (usize, usize),
+
+    /// Limit number and rate of new connections.
+    admission: admission::Admission,
+
+    /// Keep alive and connect timeout of sessions.
+    session_timers: HashMap<SessionId, SessionTimer>,
+    timer_wheel: TimerWheel<SessionId>,
+
+    /// Limit number of concurrent TLS, WebSocket and QUIC handshakes.
+    handshake_permits: Arc<Semaphore>,
+    handshake_stats: HandshakeStats,
+    handshake_sender: Sender<HandshakeResult>,
+    handshake_receiver: Option<Receiver<HandshakeResult>>,
+
     session_sender: Sender<SessionToListenerCmd>,
     session_receiver: Option<Receiver<SessionToListenerCmd>>,
 
     dispatcher_sender: Sender<ListenerToDispatcherCmd>,
     dispatcher_receiver: Option<Receiver<DispatcherToListenerCmd>>,
 
+    /// Publish packets are sent to dispatcher shards directly.
+    shard_senders: Vec<Sender<DispatcherShardCmd>>,
+
     auth_sender: Sender<ListenerToAuthCmd>,
     auth_receiver: Option<Receiver<AuthToListenerCmd>>,
 
     acl_sender: Sender<ListenerToAclCmd>,
     acl_receiver: Option<Receiver<AclToListenerCmd>>,
+
+    /// Passed to new sessions to check publish packets.
+    acl_snapshot: watch::Receiver<AclSnapshot>,
 }
 
 impl Drop for Listener {
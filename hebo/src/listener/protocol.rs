@@ -3,15 +3,35 @@
 // in the LICENSE file.
 
 use std::fmt;
-use tokio::net::{TcpListener, UnixListener};
+use std::net::SocketAddr;
+use tokio::net::{TcpListener, TcpStream, UnixListener};
 use tokio_rustls::TlsAcceptor;
 
+use crate::error::Error;
+use crate::socket::AcceptorPool;
+
+/// Tcp sockets are accepted in listener task, or in threads of a pool.
+#[derive(Debug)]
+pub enum TcpAcceptor {
+    Single(TcpListener),
+    Pool(AcceptorPool),
+}
+
+impl TcpAcceptor {
+    pub async fn accept(&mut self) -> Result<(TcpStream, SocketAddr), Error> {
+        match self {
+            Self::Single(listener) => Ok(listener.accept().await?),
+            Self::Pool(pool) => pool.accept().await,
+        }
+    }
+}
+
 /// Each Listener binds to a specific port
 pub enum Protocol {
-    Mqtt(TcpListener),
-    Mqtts(TcpListener, TlsAcceptor),
-    Ws(TcpListener),
-    Wss(TcpListener, TlsAcceptor),
+    Mqtt(TcpAcceptor),
+    Mqtts(TcpAcceptor, TlsAcceptor),
+    Ws(TcpAcceptor),
+    Wss(TcpAcceptor, TlsAcceptor),
     Uds(UnixListener),
     Quic(quinn::Endpoint, quinn::Incoming),
 }
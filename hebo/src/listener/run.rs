@@ -4,13 +4,15 @@
 
 //! Handles commands and new connections
 
+use std::time::Instant;
 use tokio::sync::mpsc;
 
 use super::Listener;
-use super::CHANNEL_CAPACITY;
+use super::{CHANNEL_CAPACITY, TICK_INTERVAL};
 use crate::commands::ListenerToDispatcherCmd;
 use crate::session::{Session, SessionConfig};
 use crate::stream::Stream;
+use crate::types::{InflightCounter, SessionGid, SessionTimer};
 
 impl Listener {
     pub async fn run_loop(&mut self) -> ! {
@@ -26,11 +28,24 @@ impl Listener {
             .expect("Invalid dispatcher receiver");
         let mut auth_receiver = self.auth_receiver.take().expect("Invalid auth receiver");
         let mut acl_receiver = self.acl_receiver.take().expect("Invalid acl receiver");
+        let mut handshake_receiver = self
+            .handshake_receiver
+            .take()
+            .expect("Invalid handshake receiver");
+        let mut tick_timer = tokio::time::interval(TICK_INTERVAL);
 
         loop {
+            let accepting = self.can_handshake()
+                && self
+                    .admission
+                    .can_accept(self.connections(), Instant::now());
             tokio::select! {
-                Ok(stream) = self.accept() => {
-                    self.new_connection(stream).await;
+                Ok(incoming) = self.accept(), if accepting => {
+                    self.on_incoming(incoming).await;
+                },
+
+                Some(result) = handshake_receiver.recv() => {
+                    self.on_handshake_done(result).await;
                 },
 
                 Some(cmd) = session_receiver.recv() => {
@@ -56,32 +71,53 @@ impl Listener {
                         log::error!("handle acl cmd failed: {:?}", err);
                     }
                 }
+
+                _ = tick_timer.tick() => {
+                    self.on_timer_tick();
+                    self.on_delivery_tick();
+                    self.on_admission_tick();
+                    self.on_handshake_tick();
+                }
             }
         }
     }
 
-    async fn new_connection(&mut self, stream: Stream) {
+    pub(super) async fn new_connection(&mut self, stream: Stream) {
         let (sender, receiver) = mpsc::channel(CHANNEL_CAPACITY);
         let session_id = self.next_session_id();
         self.session_senders.insert(session_id, sender);
+        let inflight = InflightCounter::new();
+        self.inflight_counters.insert(session_id, inflight.clone());
+        let timer = SessionTimer::new();
+        self.add_session_timer(session_id, timer.clone());
         let mut session_config = SessionConfig::new();
         session_config
             .set_keep_alive(self.config.keep_alive())
             .set_allow_empty_client_id(self.config.allow_empty_client_id())
             .set_maximum_inflight_messages(self.config.maximum_inflight_messages())
-            .set_connect_timeout(self.config.connect_timeout());
+            .set_maximum_incoming_packet_size(self.general_config.maximum_packet_size())
+            .set_connect_timeout(self.config.connect_timeout())
+            .set_read_buffer_size(self.config.read_buffer_size())
+            .set_write_buffer_size(self.config.write_buffer_size())
+            .set_write_flush_delay(self.config.write_flush_delay());
         let session = Session::new(
             session_id,
             session_config,
             stream,
             self.session_sender.clone(),
             receiver,
+            inflight.clone(),
+            timer,
+            self.acl_snapshot.clone(),
         );
         tokio::spawn(session.run_loop());
 
         if let Err(err) = self
             .dispatcher_sender
-            .send(ListenerToDispatcherCmd::SessionAdded(self.id))
+            .send(ListenerToDispatcherCmd::SessionAdded(
+                SessionGid::new(self.id, session_id),
+                inflight,
+            ))
             .await
         {
             log::error!("Failed to send NewSession cmd: {:?}", err);
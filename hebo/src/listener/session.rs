@@ -5,11 +5,13 @@
 //! Session cmd handlers.
 
 use codec::{v3, v5};
+use tokio::sync::mpsc::error::TrySendError;
 
 use super::Listener;
+use crate::dispatcher::shard_index;
 use crate::listener::{
-    ListenerToAclCmd, ListenerToAuthCmd, ListenerToDispatcherCmd, ListenerToSessionCmd,
-    SessionToListenerCmd,
+    DispatcherShardCmd, ListenerToAclCmd, ListenerToAuthCmd, ListenerToDispatcherCmd,
+    ListenerToSessionCmd, SessionToListenerCmd,
 };
 use crate::session::CachedSession;
 use crate::types::{SessionGid, SessionId};
@@ -51,11 +53,8 @@ impl Listener {
             SessionToListenerCmd::UnsubscribeV5(session_id, packet) => {
                 self.on_session_unsubscribe_v5(session_id, packet).await
             }
-            SessionToListenerCmd::Disconnect(session_id) => {
-                self.on_session_disconnect(session_id).await
-            }
-            SessionToListenerCmd::DisconnectV5(session_id) => {
-                self.on_session_disconnect_v5(session_id).await
+            SessionToListenerCmd::Disconnect(session_id, cached_session) => {
+                self.on_session_disconnect(session_id, cached_session).await
             }
         }
     }
@@ -66,13 +65,14 @@ impl Listener {
         packet: v3::ConnectPacket,
     ) -> Result<(), Error> {
         log::info!("Listener::on_session_connect()");
+        self.on_session_connect_timer(session_id);
 
         // If the ClientId represents a Client already connected to the Server then the Server MUST
         // disconnect the existing Client [MQTT-3.1.4-2].
         let old_session_id = self.client_ids.get(packet.client_id());
         if let Some(old_session_id) = old_session_id {
             let old_session_id = *old_session_id;
-            if let Err(err) = self.disconnect_session(old_session_id).await {
+            if let Err(err) = self.disconnect_session(old_session_id) {
                 log::error!(
                     "Failed to send disconnect cmd to {}, err: {:?}",
                     old_session_id,
@@ -100,6 +100,7 @@ impl Listener {
         packet: v5::ConnectPacket,
     ) -> Result<(), Error> {
         log::info!("Listener::on_session_connect_v5()");
+        self.on_session_connect_timer(session_id);
 
         // TODO(Shaohua): Update comments.
         // If the ClientId represents a Client already connected to the Server then the Server MUST
@@ -107,7 +108,7 @@ impl Listener {
         let old_session_id = self.client_ids.get(packet.client_id());
         if let Some(old_session_id) = old_session_id {
             let old_session_id = *old_session_id;
-            if let Err(err) = self.disconnect_session(old_session_id).await {
+            if let Err(err) = self.disconnect_session(old_session_id) {
                 log::error!(
                     "Failed to send disconnect cmd to {}, err: {:?}",
                     old_session_id,
@@ -129,28 +130,33 @@ impl Listener {
             .map_err(Into::into)
     }
 
-    async fn on_session_disconnect(&mut self, session_id: SessionId) -> Result<(), Error> {
+    async fn on_session_disconnect(
+        &mut self,
+        session_id: SessionId,
+        mut cached_session: Option<CachedSession>,
+    ) -> Result<(), Error> {
         log::info!("Listener::on_session_disconnect()");
-        // Delete session info
-        if self.session_senders.remove(&session_id).is_none() {
+        // Delete session info, sender of slow session may have been removed already.
+        self.session_senders.remove(&session_id);
+        self.closing_sessions.remove(&session_id);
+        self.restoring_sessions.remove(&session_id);
+        if self.inflight_counters.remove(&session_id).is_none() {
             log::error!("Failed to remove pipeline with session id: {}", session_id);
         }
-
-        self.dispatcher_sender
-            .send(ListenerToDispatcherCmd::SessionRemoved(self.id))
-            .await
-            .map_err(Into::into)
-    }
-
-    async fn on_session_disconnect_v5(&mut self, session_id: SessionId) -> Result<(), Error> {
-        log::info!("Listener::on_session_disconnect_v5()");
-        // Delete session info
-        if self.session_senders.remove(&session_id).is_none() {
-            log::error!("Failed to remove pipeline with session id: {}", session_id);
+        self.take_spill_queue(session_id, cached_session.as_mut());
+        // Timer in wheel is ignored once it fires.
+        self.session_timers.remove(&session_id);
+        if let Some(cached_session) = &cached_session {
+            if self.client_ids.get(cached_session.client_id()) == Some(&session_id) {
+                self.client_ids.remove(cached_session.client_id());
+            }
         }
 
         self.dispatcher_sender
-            .send(ListenerToDispatcherCmd::SessionRemoved(self.id))
+            .send(ListenerToDispatcherCmd::SessionRemoved(
+                SessionGid::new(self.id, session_id),
+                cached_session,
+            ))
             .await
             .map_err(Into::into)
     }
@@ -212,9 +218,14 @@ impl Listener {
         session_id: SessionId,
         packet: v3::PublishPacket,
     ) -> Result<(), Error> {
-        // Check ACL.
-        let cmd = ListenerToAclCmd::Publish(SessionGid::new(self.id, session_id), packet);
-        self.acl_sender.send(cmd).await.map_err(Into::into)
+        // ACL is checked in session, send publish packet to dispatcher shard directly.
+        let index = shard_index(packet.topic(), self.shard_senders.len());
+        let publisher = SessionGid::new(self.id, session_id);
+        let cmd = DispatcherShardCmd::Publish(Some(publisher), packet);
+        self.shard_senders[index]
+            .send(cmd)
+            .await
+            .map_err(Into::into)
     }
 
     async fn on_session_publish_v5(
@@ -222,76 +233,83 @@ impl Listener {
         session_id: SessionId,
         packet: v5::PublishPacket,
     ) -> Result<(), Error> {
-        // Check ACL.
-        let cmd = ListenerToAclCmd::PublishV5(SessionGid::new(self.id, session_id), packet);
-        self.acl_sender.send(cmd).await.map_err(Into::into)
+        // ACL is checked in session, send publish packet to dispatcher shard directly.
+        let index = shard_index(packet.topic(), self.shard_senders.len());
+        let publisher = SessionGid::new(self.id, session_id);
+        let cmd = DispatcherShardCmd::PublishV5(Some(publisher), packet);
+        self.shard_senders[index]
+            .send(cmd)
+            .await
+            .map_err(Into::into)
     }
 
-    /// Send disconnect cmd to session.
-    async fn disconnect_session(&mut self, session_id: SessionId) -> Result<(), Error> {
-        let cmd = ListenerToSessionCmd::Disconnect;
-        if let Some(session_sender) = self.session_senders.get(&session_id) {
-            session_sender.send(cmd).await.map_err(Into::into)
-        } else {
-            Err(Error::session_error(session_id))
+    /// Send a control cmd to session without waiting.
+    ///
+    /// Listener never waits for a session. A session whose channel is full cannot
+    /// follow its client, it is disconnected like a slow consumer.
+    fn send_session_cmd(
+        &mut self,
+        session_id: SessionId,
+        cmd: ListenerToSessionCmd,
+    ) -> Result<(), Error> {
+        let session_sender = self
+            .session_senders
+            .get(&session_id)
+            .ok_or_else(|| Error::session_error(session_id))?;
+        match session_sender.try_send(cmd) {
+            Ok(()) => Ok(()),
+            Err(TrySendError::Full(_cmd)) => {
+                self.close_slow_session(session_id);
+                Ok(())
+            }
+            // Session is exiting, its state is handled in `on_session_disconnect()`.
+            Err(TrySendError::Closed(_cmd)) => Err(Error::session_error(session_id)),
         }
     }
 
-    pub(crate) async fn session_send_connect_ack(
+    /// Send disconnect cmd to session.
+    fn disconnect_session(&mut self, session_id: SessionId) -> Result<(), Error> {
+        self.send_session_cmd(session_id, ListenerToSessionCmd::Disconnect)
+    }
+
+    pub(crate) fn session_send_connect_ack(
         &mut self,
         session_id: SessionId,
         reason: v3::ConnectReturnCode,
         cached_session: Option<CachedSession>,
     ) -> Result<(), Error> {
-        let ack_packet = v3::ConnectAckPacket::new(false, reason);
+        // If the Server accepts a connection with CleanSession set to 0, the value set in
+        // Session Present depends on whether the Server already has stored Session state
+        // for the supplied client ID [MQTT-3.2.2-2].
+        let ack_packet = v3::ConnectAckPacket::new(cached_session.is_some(), reason);
         let cmd = ListenerToSessionCmd::ConnectAck(ack_packet, cached_session);
-
-        if let Some(session_sender) = self.session_senders.get(&session_id) {
-            session_sender.send(cmd).await.map_err(Into::into)
-        } else {
-            Err(Error::session_error(session_id))
-        }
+        self.send_session_cmd(session_id, cmd)
     }
 
-    pub(crate) async fn session_send_connect_ack_v5(
+    pub(crate) fn session_send_connect_ack_v5(
         &mut self,
         session_id: SessionId,
         reason: v5::ReasonCode,
         cached_session: Option<CachedSession>,
     ) -> Result<(), Error> {
-        let ack_packet = v5::ConnectAckPacket::new(false, reason);
+        let ack_packet = v5::ConnectAckPacket::new(cached_session.is_some(), reason);
         let cmd = ListenerToSessionCmd::ConnectAckV5(ack_packet, cached_session);
-
-        if let Some(session_sender) = self.session_senders.get(&session_id) {
-            session_sender.send(cmd).await.map_err(Into::into)
-        } else {
-            Err(Error::session_error(session_id))
-        }
+        self.send_session_cmd(session_id, cmd)
     }
 
-    pub(super) async fn session_send_publish_ack(
+    pub(super) fn session_send_publish_ack(
         &mut self,
         session_id: SessionId,
         packet: v3::SubscribeAckPacket,
     ) -> Result<(), Error> {
-        if let Some(session_sender) = self.session_senders.get(&session_id) {
-            let cmd = ListenerToSessionCmd::SubscribeAck(packet);
-            session_sender.send(cmd).await.map_err(Into::into)
-        } else {
-            Err(Error::session_error(session_id))
-        }
+        self.send_session_cmd(session_id, ListenerToSessionCmd::SubscribeAck(packet))
     }
 
-    pub(super) async fn session_send_publish_ack_v5(
+    pub(super) fn session_send_publish_ack_v5(
         &mut self,
         session_id: SessionId,
         packet: v5::SubscribeAckPacket,
     ) -> Result<(), Error> {
-        if let Some(session_sender) = self.session_senders.get(&session_id) {
-            let cmd = ListenerToSessionCmd::SubscribeAckV5(packet);
-            session_sender.send(cmd).await.map_err(Into::into)
-        } else {
-            Err(Error::session_error(session_id))
-        }
+        self.send_session_cmd(session_id, ListenerToSessionCmd::SubscribeAckV5(packet))
     }
 }
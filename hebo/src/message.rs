@@ -0,0 +1,295 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Shared publish message used to fan out one PUBLISH packet to many subscribers.
+
+use bytes::{BufMut, Bytes, BytesMut};
+use codec::{
+    v3, v5, EncodeError, EncodePacket, FixedHeader, PacketId, PacketType, ProtocolLevel, QoS,
+    VarInt,
+};
+use std::sync::Arc;
+
+/// Reference counted, immutable publish message.
+///
+/// Topic name is encoded only once when this message is created, and v5 properties
+/// and payload are shared with the incoming packet without copying. Cloning it only
+/// increases a reference count, and fields that differ between subscribers
+/// (`QoS`, packet id, retain flag and protocol level) are patched into a small
+/// header when the packet is written to each client.
+#[derive(Debug, Clone)]
+pub struct PublishMessage(Arc<MessageInner>);
+
+#[derive(Debug)]
+struct MessageInner {
+    /// `QoS` of the incoming packet.
+    qos: QoS,
+
+    retain: bool,
+
+    /// Packet id of the incoming packet.
+    packet_id: PacketId,
+
+    /// Length prefixed topic name.
+    topic: Bytes,
+
+    /// Encoded v5 property list.
+    ///
+    /// It is an empty list if message is published with MQTT v3.1.1.
+    properties: v5::RawProperties,
+
+    payload: Bytes,
+}
+
+impl PublishMessage {
+    fn with_parts(
+        qos: QoS,
+        retain: bool,
+        packet_id: PacketId,
+        topic: &str,
+        properties: v5::RawProperties,
+        payload: Bytes,
+    ) -> Self {
+        let mut topic_buf = BytesMut::with_capacity(2 + topic.len());
+        #[allow(clippy::cast_possible_truncation)]
+        topic_buf.put_u16(topic.len() as u16);
+        topic_buf.put_slice(topic.as_bytes());
+
+        Self(Arc::new(MessageInner {
+            qos,
+            retain,
+            packet_id,
+            topic: topic_buf.freeze(),
+            properties,
+            payload,
+        }))
+    }
+
+    #[must_use]
+    pub fn from_v3(packet: &v3::PublishPacket) -> Self {
+        Self::with_parts(
+            packet.qos(),
+            packet.retain(),
+            packet.packet_id(),
+            packet.topic(),
+            v5::RawProperties::new(),
+            packet.message_bytes().clone(),
+        )
+    }
+
+    /// Properties are forwarded as they are received, except Topic Alias.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if properties are invalid.
+    pub fn from_v5(packet: &v5::PublishPacket) -> Result<Self, EncodeError> {
+        let properties = packet.properties().without_topic_alias()?;
+
+        Ok(Self::with_parts(
+            packet.qos(),
+            packet.retain(),
+            packet.packet_id(),
+            packet.topic(),
+            properties,
+            packet.message_bytes().clone(),
+        ))
+    }
+
+    /// Get `QoS` of the incoming packet.
+    #[must_use]
+    pub fn qos(&self) -> QoS {
+        self.0.qos
+    }
+
+    #[must_use]
+    pub fn retain(&self) -> bool {
+        self.0.retain
+    }
+
+    #[must_use]
+    pub fn packet_id(&self) -> PacketId {
+        self.0.packet_id
+    }
+
+    /// Get topic name.
+    #[must_use]
+    pub fn topic(&self) -> &str {
+        // Topic name has been validated when decoding packet.
+        std::str::from_utf8(&self.0.topic[2..]).unwrap_or_default()
+    }
+
+    #[must_use]
+    pub fn payload(&self) -> &Bytes {
+        &self.0.payload
+    }
+
+    /// Get bytes of topic name and payload, used to limit message queues.
+    #[must_use]
+    pub fn size(&self) -> usize {
+        self.0.topic.len() - 2 + self.0.payload.len()
+    }
+
+    /// Get byte length of packet sent to a client.
+    #[must_use]
+    pub fn bytes(&self, protocol_level: ProtocolLevel, qos: QoS) -> usize {
+        let remaining_length = self.remaining_length(protocol_level, qos);
+        let header_bytes = VarInt::from(remaining_length).map_or(0, |len| len.bytes());
+        1 + header_bytes + remaining_length
+    }
+
+    fn remaining_length(&self, protocol_level: ProtocolLevel, qos: QoS) -> usize {
+        let mut remaining_length = self.0.topic.len() + self.0.payload.len();
+        if qos != QoS::AtMostOnce {
+            remaining_length += PacketId::bytes();
+        }
+        if protocol_level == ProtocolLevel::V5 {
+            remaining_length += self.0.properties.bytes();
+        }
+        remaining_length
+    }
+
+    /// Encode fixed header and variable header, without payload.
+    ///
+    /// `dup` is set if this message is re-delivered to the same client.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if payload is too large.
+    pub fn encode_header(
+        &self,
+        protocol_level: ProtocolLevel,
+        qos: QoS,
+        packet_id: PacketId,
+        dup: bool,
+        retain: bool,
+        buf: &mut Vec<u8>,
+    ) -> Result<usize, EncodeError> {
+        let old_len = buf.len();
+        let packet_type = PacketType::Publish {
+            // The DUP flag MUST be set to 0 for all QoS 0 messages [MQTT-3.3.1-2].
+            dup: dup && qos != QoS::AtMostOnce,
+            retain,
+            qos,
+        };
+        let fixed_header =
+            FixedHeader::new(packet_type, self.remaining_length(protocol_level, qos))?;
+        fixed_header.encode(buf)?;
+        buf.extend_from_slice(&self.0.topic);
+
+        // The Packet Identifier field is only present in PUBLISH Packets where the QoS level is 1 or 2.
+        if qos != QoS::AtMostOnce {
+            packet_id.encode(buf)?;
+        }
+        if protocol_level == ProtocolLevel::V5 {
+            self.0.properties.encode(buf)?;
+        }
+        Ok(buf.len() - old_len)
+    }
+
+    /// Encode full packet sent to a client.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if payload is too large.
+    pub fn encode(
+        &self,
+        protocol_level: ProtocolLevel,
+        qos: QoS,
+        packet_id: PacketId,
+        dup: bool,
+        retain: bool,
+        buf: &mut Vec<u8>,
+    ) -> Result<usize, EncodeError> {
+        buf.reserve(self.bytes(protocol_level, qos));
+        let header_bytes = self.encode_header(protocol_level, qos, packet_id, dup, retain, buf)?;
+        buf.extend_from_slice(&self.0.payload);
+        Ok(header_bytes + self.0.payload.len())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use codec::{ByteArray, DecodePacket, StringPairData, U16Data};
+
+    use super::*;
+
+    #[test]
+    fn test_encode_v3() {
+        let mut packet =
+            v3::PublishPacket::new("sport/tennis", QoS::AtLeastOnce, b"hello").unwrap();
+        packet.set_packet_id(PacketId::new(42));
+        let message = PublishMessage::from_v3(&packet);
+
+        let mut expected = Vec::new();
+        packet.encode(&mut expected).unwrap();
+        let mut buf = Vec::new();
+        let n = message
+            .encode(
+                ProtocolLevel::V4,
+                QoS::AtLeastOnce,
+                PacketId::new(42),
+                false,
+                false,
+                &mut buf,
+            )
+            .unwrap();
+        assert_eq!(n, expected.len());
+        assert_eq!(buf, expected);
+
+        // Downgrade to QoS 0.
+        packet.set_qos(QoS::AtMostOnce);
+        expected.clear();
+        packet.encode(&mut expected).unwrap();
+        buf.clear();
+        message
+            .encode(
+                ProtocolLevel::V4,
+                QoS::AtMostOnce,
+                PacketId::new(0),
+                false,
+                false,
+                &mut buf,
+            )
+            .unwrap();
+        assert_eq!(buf, expected);
+        assert_eq!(message.bytes(ProtocolLevel::V4, QoS::AtMostOnce), buf.len());
+    }
+
+    #[test]
+    fn test_encode_v5() {
+        let mut packet = v5::PublishPacket::new("sport/tennis", QoS::AtMostOnce, b"hello").unwrap();
+        let mut properties = v5::Properties::new();
+        properties
+            .push(v5::Property::UserProperty(
+                StringPairData::new("key", "value").unwrap(),
+            ))
+            .unwrap();
+        let mut with_alias = properties.clone();
+        with_alias
+            .push(v5::Property::TopicAlias(U16Data::new(1)))
+            .unwrap();
+        packet.set_properties(&with_alias).unwrap();
+        let message = PublishMessage::from_v5(&packet).unwrap();
+        let mut buf = Vec::new();
+        message
+            .encode(
+                ProtocolLevel::V5,
+                QoS::AtMostOnce,
+                PacketId::new(0),
+                false,
+                false,
+                &mut buf,
+            )
+            .unwrap();
+        assert_eq!(message.bytes(ProtocolLevel::V5, QoS::AtMostOnce), buf.len());
+
+        let mut ba = ByteArray::new(&buf);
+        let decoded = v5::PublishPacket::decode(&mut ba).unwrap();
+        assert_eq!(decoded.topic(), "sport/tennis");
+        assert_eq!(decoded.message(), b"hello");
+        assert_eq!(message.topic(), "sport/tennis");
+        // Topic alias is not forwarded.
+        assert_eq!(decoded.properties().to_properties().unwrap(), properties);
+    }
+}
@@ -198,6 +198,27 @@ impl Metrics {
                 self.system.publish_messages_dropped += count;
                 self.system.publish_bytes_dropped += bytes;
             }
+            DispatcherToMetricsCmd::ConnectionsRejected(listener_id, count) => {
+                log::info!("{} connections rejected by #{}", count, listener_id);
+                if let Some(listener) = self.listeners.get_mut(&listener_id) {
+                    let count = count as i64;
+                    listener.connections_rejected += count;
+                    self.system.connections_rejected += count;
+                } else {
+                    log::error!("Failed to found listener with id: {}", listener_id);
+                }
+            }
+            DispatcherToMetricsCmd::HandshakeStats(listener_id, latency, failed) => {
+                log::info!("{} handshakes failed in #{}", failed, listener_id);
+                if let Some(listener) = self.listeners.get_mut(&listener_id) {
+                    let failed = failed as i64;
+                    listener.handshake_latency.merge(&latency);
+                    listener.handshakes_failed += failed;
+                    self.system.handshakes_failed += failed;
+                } else {
+                    log::error!("Failed to found listener with id: {}", listener_id);
+                }
+            }
             DispatcherToMetricsCmd::PacketSent(listener_id, count, bytes) => {
                 log::info!("{} packetSent added to #{}", count, listener_id);
                 if let Some(listener) = self.listeners.get_mut(&listener_id) {
@@ -4,17 +4,20 @@
 
 //! Init server context internal modules and apps.
 
+use std::sync::{Arc, Mutex, RwLock};
 use tokio::runtime::Runtime;
-use tokio::sync::mpsc;
+use tokio::sync::{mpsc, watch};
 
 use super::{ServerContext, CHANNEL_CAPACITY};
-use crate::acl::AclApp;
+use crate::acl::{AclApp, AclSnapshot};
 use crate::auth::AuthApp;
 use crate::backends::BackendsApp;
 use crate::bridge::BridgeApp;
 use crate::commands::DispatcherToMetricsCmd;
 use crate::dashboard::DashboardApp;
-use crate::dispatcher::Dispatcher;
+use crate::dispatcher::{
+    retain::RetainStore, sessions::CachedSessions, trie::SubTrie, Dispatcher, DispatcherShard,
+};
 use crate::error::Error;
 use crate::gateway::GatewayApp;
 use crate::listener::Listener;
@@ -34,6 +37,17 @@ impl ServerContext {
         let mut auth_to_listener_senders = Vec::new();
         let (listeners_to_acl_sender, listeners_to_acl_receiver) = mpsc::channel(CHANNEL_CAPACITY);
         let mut acl_to_listener_senders = Vec::new();
+        // Publish packets are checked by sessions with the latest ACL snapshot.
+        let (acl_snapshot_sender, acl_snapshot_receiver) = watch::channel(AclSnapshot::default());
+
+        // Dispatcher shards, publish packets are sent from listeners to shards directly.
+        let mut shard_senders = Vec::new();
+        let mut shard_receivers = Vec::new();
+        for _i in 0..self.config.dispatcher().shards() {
+            let (shard_sender, shard_receiver) = mpsc::channel(CHANNEL_CAPACITY);
+            shard_senders.push(shard_sender);
+            shard_receivers.push(shard_receiver);
+        }
 
         let mut handles = Vec::new();
         let mut listeners_info = Vec::new();
@@ -56,16 +70,19 @@ impl ServerContext {
 
             let listener = Listener::bind(
                 listener_id,
+                self.config.general().clone(),
                 l.clone(),
                 // dispatcher module
                 listeners_to_dispatcher_sender.clone(),
                 dispatcher_to_listener_receiver,
+                shard_senders.clone(),
                 // Auth module
                 listeners_to_auth_sender.clone(),
                 auth_to_listener_receiver,
                 // acl module
                 listeners_to_acl_sender.clone(),
                 acl_to_listener_receiver,
+                acl_snapshot_receiver.clone(),
             )
             .await
             .unwrap_or_else(|_| panic!("Failed to listen at {:?}", &listeners_info.last()));
@@ -133,6 +150,7 @@ impl ServerContext {
             // listeners
             acl_to_listener_senders,
             listeners_to_acl_receiver,
+            acl_snapshot_sender,
             // server ctx
             self.acl_receiver.take().unwrap(),
         );
@@ -223,7 +241,40 @@ impl ServerContext {
         handles.push(rule_engine_handle);
 
         // Dispatcher module.
+        let sub_trie = Arc::new(RwLock::new(SubTrie::with_strategy(
+            self.config.dispatcher().shared_subscription_strategy(),
+        )));
+        let retain_store = Arc::new(RwLock::new(RetainStore::new(
+            self.config.dispatcher().max_retained_messages(),
+            self.config.dispatcher().max_retained_bytes(),
+        )));
+        let cached_sessions = Arc::new(Mutex::new(CachedSessions::new(
+            self.config.general().max_queued_messages(),
+            self.config.general().max_queued_bytes(),
+            self.config.general().queue_drop_policy(),
+        )));
+        for (shard_id, shard_receiver) in shard_receivers.into_iter().enumerate() {
+            let mut shard = DispatcherShard::new(
+                shard_id,
+                sub_trie.clone(),
+                retain_store.clone(),
+                cached_sessions.clone(),
+                dispatcher_to_listener_senders.clone(),
+                dispatcher_to_metrics_sender.clone(),
+                shard_receiver,
+            );
+            let shard_handle = runtime.spawn(async move {
+                shard.run_loop().await;
+            });
+            handles.push(shard_handle);
+        }
+
         let mut dispatcher = Dispatcher::new(
+            self.config.dispatcher().clone(),
+            sub_trie,
+            shard_senders,
+            retain_store,
+            cached_sessions,
             // backends module
             dispatcher_to_backends_sender,
             backends_to_dispatcher_receiver,
@@ -2,27 +2,272 @@
 // Use of this source is governed by Affero General Public License that can be found
 // in the LICENSE file.
 
-use super::Session;
+//! State of persistent sessions kept after client disconnects.
+//!
+//! Subscriptions of a cached session are kept in subscription trie and moved to
+//! the new session on reconnect, messages matching them are appended to `OfflineQueue`.
+
+use codec::{PacketId, QoS};
+use std::collections::{HashSet, VecDeque};
+use std::time::Duration;
+
+use super::{OutboundInflight, Session, Status};
+use crate::config::QueueDropPolicy;
+use crate::error::Error;
+use crate::message::PublishMessage;
 
 #[derive(Debug, Clone)]
 pub struct CachedSession {
     client_id: String,
+
+    /// Session state is removed if client does not reconnect in this interval.
+    expiry_interval: Duration,
+
+    /// Packet ids of received QoS 2 messages, waiting for PUBREL from client.
+    pub_recv_packets: HashSet<PacketId>,
+
+    /// Messages sent to client but not acknowledged yet, and messages waiting
+    /// for inflight window.
+    outbound_inflight: OutboundInflight,
+
+    messages: OfflineQueue,
 }
 
 impl CachedSession {
     #[must_use]
-    pub const fn new(client_id: String) -> Self {
-        Self { client_id }
+    pub fn new(client_id: String, expiry_interval: Duration) -> Self {
+        Self {
+            client_id,
+            expiry_interval,
+            pub_recv_packets: HashSet::new(),
+            outbound_inflight: OutboundInflight::default(),
+            messages: OfflineQueue::default(),
+        }
     }
 
     #[must_use]
     pub fn client_id(&self) -> &str {
         &self.client_id
     }
+
+    #[must_use]
+    pub const fn expiry_interval(&self) -> Duration {
+        self.expiry_interval
+    }
+
+    #[must_use]
+    pub const fn messages(&self) -> &OfflineQueue {
+        &self.messages
+    }
+
+    pub fn messages_mut(&mut self) -> &mut OfflineQueue {
+        &mut self.messages
+    }
+}
+
+/// Messages published to a session while its client is offline, or while it
+/// cannot keep up with incoming messages.
+///
+/// Each item is `(qos, message, retain)`.
+#[derive(Debug, Default, Clone)]
+pub struct OfflineQueue {
+    messages: VecDeque<(QoS, PublishMessage, bool)>,
+    bytes: usize,
+}
+
+impl OfflineQueue {
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.messages.len()
+    }
+
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.messages.is_empty()
+    }
+
+    /// Total bytes of topics and payloads in queue.
+    #[must_use]
+    pub const fn bytes(&self) -> usize {
+        self.bytes
+    }
+
+    /// Append a message, messages are dropped with `policy` if queue is full.
+    ///
+    /// `max_messages` and `max_bytes` are ignored if they are 0.
+    ///
+    /// Returns number of messages and bytes dropped.
+    pub fn push(
+        &mut self,
+        qos: QoS,
+        message: PublishMessage,
+        retain: bool,
+        max_messages: usize,
+        max_bytes: usize,
+        policy: QueueDropPolicy,
+    ) -> (usize, usize) {
+        let new_bytes = message.size();
+        let is_full = |queue: &Self| {
+            (max_messages > 0 && queue.messages.len() + 1 > max_messages)
+                || (max_bytes > 0 && queue.bytes + new_bytes > max_bytes)
+        };
+
+        let mut dropped = (0, 0);
+        if policy == QueueDropPolicy::DropOldest {
+            while !self.messages.is_empty() && is_full(self) {
+                if let Some((_qos, old, _retain)) = self.messages.pop_front() {
+                    let old_bytes = old.size();
+                    self.bytes -= old_bytes;
+                    dropped.0 += 1;
+                    dropped.1 += old_bytes;
+                }
+            }
+        }
+        if is_full(self) {
+            dropped.0 += 1;
+            dropped.1 += new_bytes;
+            return dropped;
+        }
+
+        self.messages.push_back((qos, message, retain));
+        self.bytes += new_bytes;
+        dropped
+    }
+
+    #[must_use]
+    pub fn front(&self) -> Option<&(QoS, PublishMessage, bool)> {
+        self.messages.front()
+    }
+
+    pub fn pop_front(&mut self) -> Option<(QoS, PublishMessage, bool)> {
+        let item = self.messages.pop_front()?;
+        self.bytes -= item.1.size();
+        Some(item)
+    }
 }
 
 impl Session {
-    pub(crate) fn load_cached_session(&mut self, _cached_session: CachedSession) {
-        // Do nothing currently.
+    /// Get state to be cached after client disconnects.
+    ///
+    /// Returns None if session is not persistent.
+    pub(super) fn cached_session(&mut self) -> Option<CachedSession> {
+        if !self.persistent {
+            return None;
+        }
+        let mut cached_session = CachedSession::new(
+            self.client_id.clone(),
+            self.config.session_expiry_interval(),
+        );
+        cached_session.pub_recv_packets = std::mem::take(&mut self.pub_recv_packets);
+        cached_session.outbound_inflight = std::mem::take(&mut self.outbound_inflight);
+        Some(cached_session)
+    }
+
+    /// Restore session state and send offline messages to client.
+    pub(super) async fn load_cached_session(
+        &mut self,
+        cached_session: CachedSession,
+    ) -> Result<(), Error> {
+        if self.status != Status::Connected {
+            return Ok(());
+        }
+        self.pub_recv_packets = cached_session.pub_recv_packets;
+
+        // Packet ids of unacknowledged messages are kept, window of new connection is used.
+        let window = self.outbound_inflight.window();
+        let mut outbound_inflight = std::mem::replace(
+            &mut self.outbound_inflight,
+            cached_session.outbound_inflight,
+        );
+        self.outbound_inflight.set_window(window);
+        // Queued messages are counted as messages from listener.
+        self.inflight
+            .increase_bytes(self.outbound_inflight.pending_bytes());
+        self.resend_inflight_messages().await?;
+
+        for (qos, message, retain) in cached_session.messages.messages {
+            self.inflight.increase_bytes(message.size());
+            self.publish_message(qos, message, retain).await?;
+        }
+
+        // Messages received before CONNACK are sent after cached ones,
+        // they are already counted in inflight counter.
+        for (qos, message, retain) in outbound_inflight.take_pending() {
+            self.publish_message(qos, message, retain).await?;
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::OfflineQueue;
+    use crate::config::QueueDropPolicy;
+    use crate::message::PublishMessage;
+    use codec::{v3, QoS};
+
+    fn message(payload: &[u8]) -> PublishMessage {
+        let packet = v3::PublishPacket::new("a/b", QoS::AtLeastOnce, payload).unwrap();
+        PublishMessage::from_v3(&packet)
+    }
+
+    #[test]
+    fn test_offline_queue() {
+        let mut queue = OfflineQueue::default();
+        for i in 0..3_u8 {
+            let dropped = queue.push(
+                QoS::AtLeastOnce,
+                message(&[i]),
+                false,
+                2,
+                0,
+                QueueDropPolicy::DropOldest,
+            );
+            assert_eq!(dropped, if i < 2 { (0, 0) } else { (1, 4) });
+        }
+        assert_eq!(queue.len(), 2);
+        assert_eq!(queue.messages[0].1.payload().as_ref(), &[1]);
+
+        let dropped = queue.push(
+            QoS::AtLeastOnce,
+            message(&[3]),
+            false,
+            2,
+            0,
+            QueueDropPolicy::DropNewest,
+        );
+        assert_eq!(dropped, (1, 4));
+        assert_eq!(queue.messages[1].1.payload().as_ref(), &[2]);
+
+        // Limited by bytes.
+        let mut queue = OfflineQueue::default();
+        assert_eq!(
+            queue.push(
+                QoS::AtLeastOnce,
+                message(b"12"),
+                false,
+                0,
+                10,
+                QueueDropPolicy::DropOldest
+            ),
+            (0, 0)
+        );
+        assert_eq!(
+            queue.push(
+                QoS::AtLeastOnce,
+                message(b"1234"),
+                false,
+                0,
+                10,
+                QueueDropPolicy::DropOldest
+            ),
+            (1, 5)
+        );
+        assert_eq!(queue.bytes(), 7);
+
+        assert_eq!(queue.front().map(|item| item.1.size()), Some(7));
+        assert!(queue.pop_front().is_some());
+        assert_eq!(queue.bytes(), 0);
+        assert!(queue.is_empty());
     }
 }
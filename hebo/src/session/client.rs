@@ -4,9 +4,10 @@
 
 //! Handles client packets
 
+use bytes::Bytes;
 use codec::{
-    utils::random_client_id, v3, v5, ByteArray, DecodeError, DecodePacket, FixedHeader, PacketType,
-    ProtocolLevel, QoS,
+    utils::random_client_id, v3, v5, ByteArray, DecodeError, DecodePacket, FixedHeader, PacketId,
+    PacketType, ProtocolLevel, QoS,
 };
 
 use super::{Session, Status};
@@ -14,7 +15,7 @@ use crate::commands::SessionToListenerCmd;
 use crate::error::{Error, ErrorKind};
 
 impl Session {
-    pub(super) async fn handle_client_packet(&mut self, buf: &[u8]) -> Result<(), Error> {
+    pub(super) async fn handle_client_packet(&mut self, buf: &Bytes) -> Result<(), Error> {
         let mut ba = ByteArray::new(buf);
         let fixed_header = match FixedHeader::decode(&mut ba) {
             Ok(fixed_header) => fixed_header,
@@ -35,8 +36,6 @@ impl Session {
         // a PINGREQ Packet [MQTT-3.1.2-23].
         self.reset_instant();
 
-        // TODO(Shaohua): Check packet oversize.
-
         match fixed_header.packet_type() {
             PacketType::Connect => self.on_client_connect(buf).await,
             PacketType::PingRequest => {
@@ -53,6 +52,27 @@ impl Session {
                     self.on_client_publish(buf).await
                 }
             }
+            PacketType::PublishAck => {
+                if self.protocol_level == ProtocolLevel::V5 {
+                    self.on_client_publish_ack_v5(buf).await
+                } else {
+                    self.on_client_publish_ack(buf).await
+                }
+            }
+            PacketType::PublishReceived => {
+                if self.protocol_level == ProtocolLevel::V5 {
+                    self.on_client_publish_received_v5(buf).await
+                } else {
+                    self.on_client_publish_received(buf).await
+                }
+            }
+            PacketType::PublishComplete => {
+                if self.protocol_level == ProtocolLevel::V5 {
+                    self.on_client_publish_complete_v5(buf).await
+                } else {
+                    self.on_client_publish_complete(buf).await
+                }
+            }
             PacketType::PublishRelease { .. } => {
                 if self.protocol_level == ProtocolLevel::V5 {
                     self.on_client_publish_release_v5(buf).await
@@ -203,6 +223,7 @@ impl Session {
             }
         }
         self.client_id = packet.client_id().to_string();
+        self.username = packet.username().to_string();
 
         // Update keep_alive timer.
         //
@@ -230,6 +251,7 @@ impl Session {
         // TODO(Shaohua): Handle other connection flags.
 
         // Send the connect packet to listener.
+        self.timer.set_keep_alive(self.config.keep_alive());
         self.status = Status::Connecting;
         self.sender
             .send(SessionToListenerCmd::Connect(self.id, packet))
@@ -247,10 +269,10 @@ impl Session {
         self.send(ping_resp_packet).await
     }
 
-    async fn on_client_publish(&mut self, buf: &[u8]) -> Result<(), Error> {
+    async fn on_client_publish(&mut self, buf: &Bytes) -> Result<(), Error> {
         log::info!("Session::on_client_publish()");
-        let mut ba = ByteArray::new(buf);
-        let packet = v3::PublishPacket::decode(&mut ba)?;
+        // Payload is not copied, it shares memory with packet frame.
+        let packet = v3::PublishPacket::decode_frame(buf)?;
 
         // Check dup flag for QoS2.
         if packet.qos() == QoS::ExactOnce && packet.dup() {
@@ -262,6 +284,31 @@ impl Session {
             }
         }
 
+        // Check ACL with current snapshot, without a round trip to acl app.
+        let accepted = self
+            .acl
+            .borrow()
+            .check_publish(&self.username, packet.topic());
+
+        // If a Server implementation does not authorize a PUBLISH to be performed by a Client;
+        // it has no way of informing that Client. It MUST either make a positive acknowledgement,
+        // according to the normal QoS rules, or close the Network Connection [MQTT-3.3.5-2].
+        if !accepted {
+            log::warn!(
+                "session: Publish to {} is not authorized, {}",
+                packet.topic(),
+                self.id
+            );
+            return self.send_disconnect().await;
+        }
+
+        if !self
+            .send_publish_ack(packet.packet_id(), packet.qos())
+            .await?
+        {
+            return Ok(());
+        }
+
         // Send the publish packet to listener.
         self.sender
             .send(SessionToListenerCmd::Publish(self.id, packet))
@@ -270,6 +317,32 @@ impl Session {
         Ok(())
     }
 
+    /// Send ack to client.
+    ///
+    /// Returns false if client is disconnected.
+    async fn send_publish_ack(&mut self, packet_id: PacketId, qos: QoS) -> Result<bool, Error> {
+        // Check qos and send publish ack packet to client.
+        if qos == QoS::AtLeastOnce {
+            let ack_packet = v3::PublishAckPacket::new(packet_id);
+            // TODO(Shaohua): Catch errors
+            self.send(ack_packet).await?;
+        } else if qos == QoS::ExactOnce {
+            // Check inflight messages overflow.
+            if self.pub_recv_packets.len() > self.config.maximum_inflight_messages() {
+                log::error!("session: Too many unacknowledged qos=2 messages, disconnect client!");
+                self.send_disconnect().await?;
+                return Ok(false);
+            }
+
+            // Send PublishReceived.
+            self.pub_recv_packets.insert(packet_id);
+            let ack_packet = v3::PublishReceivedPacket::new(packet_id);
+            // TODO(Shaohua): Catch errors
+            self.send(ack_packet).await?;
+        }
+        Ok(true)
+    }
+
     async fn on_client_publish_release(&mut self, buf: &[u8]) -> Result<(), Error> {
         let mut ba = ByteArray::new(buf);
         let packet = match v3::PublishReleasePacket::decode(&mut ba) {
@@ -302,6 +375,59 @@ impl Session {
         }
     }
 
+    async fn on_client_publish_ack(&mut self, buf: &[u8]) -> Result<(), Error> {
+        let mut ba = ByteArray::new(buf);
+        let packet = v3::PublishAckPacket::decode(&mut ba)?;
+        if !self.outbound_inflight.on_ack(packet.packet_id()) {
+            log::warn!(
+                "session: No QoS 1 message waiting for PUBACK {}, {}",
+                packet.packet_id(),
+                self.id
+            );
+            return Ok(());
+        }
+        self.send_pending_publishes().await
+    }
+
+    async fn on_client_publish_received(&mut self, buf: &[u8]) -> Result<(), Error> {
+        let mut ba = ByteArray::new(buf);
+        let packet = v3::PublishReceivedPacket::decode(&mut ba)?;
+        if !self.outbound_inflight.on_received(packet.packet_id()) {
+            log::warn!(
+                "session: No QoS 2 message waiting for PUBREC {}, {}",
+                packet.packet_id(),
+                self.id
+            );
+            return Ok(());
+        }
+        self.send_publish_release(packet.packet_id()).await
+    }
+
+    async fn on_client_publish_complete(&mut self, buf: &[u8]) -> Result<(), Error> {
+        let mut ba = ByteArray::new(buf);
+        let packet = v3::PublishCompletePacket::decode(&mut ba)?;
+        if !self.outbound_inflight.on_complete(packet.packet_id()) {
+            log::warn!(
+                "session: No QoS 2 message waiting for PUBCOMP {}, {}",
+                packet.packet_id(),
+                self.id
+            );
+            return Ok(());
+        }
+        self.send_pending_publishes().await
+    }
+
+    /// Send PUBREL to client after PUBREC is received.
+    pub(super) async fn send_publish_release(&mut self, packet_id: PacketId) -> Result<(), Error> {
+        // The PUBREL Packet MUST contain the same Packet Identifier as the original
+        // PUBLISH Packet [MQTT-4.3.3-1].
+        if self.protocol_level == ProtocolLevel::V5 {
+            self.send(v5::PublishReleasePacket::new(packet_id)).await
+        } else {
+            self.send(v3::PublishReleasePacket::new(packet_id)).await
+        }
+    }
+
     async fn on_client_subscribe(&mut self, buf: &[u8]) -> Result<(), Error> {
         let mut ba = ByteArray::new(buf);
         let packet = match v3::SubscribePacket::decode(&mut ba) {
@@ -391,11 +517,8 @@ impl Session {
 
     /// Handle disconnect request from client.
     async fn on_client_disconnect(&mut self, _buf: &[u8]) -> Result<(), Error> {
+        // Listener is notified when main loop exits.
         self.status = Status::Disconnected;
-        let cmd = SessionToListenerCmd::Disconnect(self.id);
-        if let Err(err) = self.sender.send(cmd).await {
-            log::warn!("Failed to send disconnect command to server: {:?}", err);
-        }
         Ok(())
     }
 
@@ -421,4 +544,31 @@ impl Session {
         self.status = Status::Disconnected;
         Ok(())
     }
+
+    /// Disconnect client with `reason_code`.
+    ///
+    /// Reason code is only sent to MQTT v5 clients.
+    pub(super) async fn send_disconnect_with_reason(
+        &mut self,
+        reason_code: v5::ReasonCode,
+    ) -> Result<(), Error> {
+        if self.protocol_level != ProtocolLevel::V5 {
+            return self.send_disconnect().await;
+        }
+
+        log::info!("send_disconnect_with_reason(), {:?}", reason_code);
+        self.status = Status::Disconnecting;
+        let mut packet = v5::DisconnectPacket::new();
+        packet.set_reason_code(reason_code);
+        if let Err(err) = self.send(packet).await {
+            log::error!(
+                "session: Failed to send v5 disconnect packet, {}, err: {:?}",
+                self.id,
+                err
+            );
+            return Err(err);
+        }
+        self.status = Status::Disconnected;
+        Ok(())
+    }
 }
@@ -2,7 +2,8 @@
 // Use of this source is governed by Apache-2.0 License that can be found
 // in the LICENSE file.
 
-use codec::{utils::random_client_id, v5, ByteArray, DecodeError, DecodePacket, QoS};
+use bytes::Bytes;
+use codec::{utils::random_client_id, v5, ByteArray, DecodeError, DecodePacket, PacketId, QoS};
 
 use super::{Session, Status};
 use crate::commands::SessionToListenerCmd;
@@ -59,6 +60,7 @@ impl Session {
             }
         }
         self.client_id = packet.client_id().to_string();
+        self.username = packet.username().to_string();
 
         if packet.keep_alive() > 0 {
             self.config.set_keep_alive(packet.keep_alive());
@@ -75,11 +77,15 @@ impl Session {
         // TODO(Shaohua): Handle other connection flags.
         // TODO(Shaohua): Check will and will_qos is valid.
 
+        // If the Session Expiry Interval is absent the value 0 is used, the Session ends
+        // when the Network Connection is closed.
+        self.config.set_session_expiry_interval(0);
         self.process_connect_properties(&packet)?;
 
         // TODO(Shaohua): Read auth-method and auth-data in properties.
 
         // Send the connect packet to listener.
+        self.timer.set_keep_alive(self.config.keep_alive());
         self.status = Status::Connecting;
         self.sender
             .send(SessionToListenerCmd::ConnectV5(self.id, packet))
@@ -97,10 +103,10 @@ impl Session {
         self.send(ping_resp_packet).await
     }
 
-    pub(super) async fn on_client_publish_v5(&mut self, buf: &[u8]) -> Result<(), Error> {
+    pub(super) async fn on_client_publish_v5(&mut self, buf: &Bytes) -> Result<(), Error> {
         log::info!("Session::on_client_publish_v5()");
-        let mut ba = ByteArray::new(buf);
-        let packet = v5::PublishPacket::decode(&mut ba)?;
+        // Payload is not copied, it shares memory with packet frame.
+        let packet = v5::PublishPacket::decode_frame(buf)?;
 
         // Check dup flag for QoS2.
         if packet.qos() == QoS::ExactOnce && packet.dup() {
@@ -112,6 +118,32 @@ impl Session {
             }
         }
 
+        // Check ACL with current snapshot, without a round trip to acl app.
+        let accepted = self
+            .acl
+            .borrow()
+            .check_publish(&self.username, packet.topic());
+
+        // Unauthorized messages are dropped, and client is informed with
+        // reason code 0x87 (Not authorized) in PUBACK or PUBREC.
+        if !accepted {
+            log::warn!(
+                "session: Publish to {} is not authorized, {}",
+                packet.topic(),
+                self.id
+            );
+            return self
+                .reject_publish_v5(packet.packet_id(), packet.qos())
+                .await;
+        }
+
+        if !self
+            .send_publish_ack_v5(packet.packet_id(), packet.qos())
+            .await?
+        {
+            return Ok(());
+        }
+
         // Send the publish packet to listener.
         self.sender
             .send(SessionToListenerCmd::PublishV5(self.id, packet))
@@ -120,6 +152,54 @@ impl Session {
         Ok(())
     }
 
+    /// Send ack to client.
+    ///
+    /// Returns false if client is disconnected.
+    async fn send_publish_ack_v5(&mut self, packet_id: PacketId, qos: QoS) -> Result<bool, Error> {
+        // Check qos and send publish ack packet to client.
+        if qos == QoS::AtLeastOnce {
+            let ack_packet = v5::PublishAckPacket::new(packet_id);
+            // TODO(Shaohua): Catch errors
+            self.send(ack_packet).await?;
+        } else if qos == QoS::ExactOnce {
+            // Check inflight messages overflow.
+            if self.pub_recv_packets.len() > self.config.maximum_inflight_messages() {
+                log::error!("session: Too many unacknowledged qos=2 messages, disconnect client!");
+                self.send_disconnect().await?;
+                return Ok(false);
+            }
+
+            // Send PublishReceived.
+            self.pub_recv_packets.insert(packet_id);
+            let ack_packet = v5::PublishReceivedPacket::new(packet_id);
+            // TODO(Shaohua): Catch errors
+            self.send(ack_packet).await?;
+        }
+        Ok(true)
+    }
+
+    /// Inform client that its publish packet is not authorized, with reason code
+    /// 0x87 (Not authorized) in PUBACK or PUBREC.
+    pub(super) async fn reject_publish_v5(
+        &mut self,
+        packet_id: PacketId,
+        qos: QoS,
+    ) -> Result<(), Error> {
+        match qos {
+            QoS::AtMostOnce => Ok(()),
+            QoS::AtLeastOnce => {
+                let mut ack_packet = v5::PublishAckPacket::new(packet_id);
+                ack_packet.set_reason_code(v5::ReasonCode::NotAuthorized);
+                self.send(ack_packet).await
+            }
+            QoS::ExactOnce => {
+                let mut ack_packet = v5::PublishReceivedPacket::new(packet_id);
+                ack_packet.set_reason_code(v5::ReasonCode::NotAuthorized);
+                self.send(ack_packet).await
+            }
+        }
+    }
+
     pub(super) async fn on_client_publish_release_v5(&mut self, buf: &[u8]) -> Result<(), Error> {
         let mut ba = ByteArray::new(buf);
         let packet = match v5::PublishReleasePacket::decode(&mut ba) {
@@ -150,6 +230,58 @@ impl Session {
         }
     }
 
+    pub(super) async fn on_client_publish_ack_v5(&mut self, buf: &[u8]) -> Result<(), Error> {
+        let mut ba = ByteArray::new(buf);
+        let packet = v5::PublishAckPacket::decode(&mut ba)?;
+        if !self.outbound_inflight.on_ack(packet.packet_id()) {
+            log::warn!(
+                "session: No QoS 1 message waiting for PUBACK {}, {}",
+                packet.packet_id(),
+                self.id
+            );
+            return Ok(());
+        }
+        self.send_pending_publishes().await
+    }
+
+    pub(super) async fn on_client_publish_received_v5(&mut self, buf: &[u8]) -> Result<(), Error> {
+        let mut ba = ByteArray::new(buf);
+        let packet = v5::PublishReceivedPacket::decode(&mut ba)?;
+
+        // A PUBREC with a Reason Code of 0x80 or greater completes the delivery,
+        // PUBREL is not sent and the slot is released.
+        if packet.reason_code() as u8 >= 0x80 {
+            if self.outbound_inflight.remove(packet.packet_id()).is_some() {
+                return self.send_pending_publishes().await;
+            }
+            return Ok(());
+        }
+
+        if !self.outbound_inflight.on_received(packet.packet_id()) {
+            log::warn!(
+                "session: No QoS 2 message waiting for PUBREC {}, {}",
+                packet.packet_id(),
+                self.id
+            );
+            return Ok(());
+        }
+        self.send_publish_release(packet.packet_id()).await
+    }
+
+    pub(super) async fn on_client_publish_complete_v5(&mut self, buf: &[u8]) -> Result<(), Error> {
+        let mut ba = ByteArray::new(buf);
+        let packet = v5::PublishCompletePacket::decode(&mut ba)?;
+        if !self.outbound_inflight.on_complete(packet.packet_id()) {
+            log::warn!(
+                "session: No QoS 2 message waiting for PUBCOMP {}, {}",
+                packet.packet_id(),
+                self.id
+            );
+            return Ok(());
+        }
+        self.send_pending_publishes().await
+    }
+
     pub(super) async fn on_client_subscribe_v5(&mut self, buf: &[u8]) -> Result<(), Error> {
         let mut ba = ByteArray::new(buf);
         let packet = match v5::SubscribePacket::decode(&mut ba) {
@@ -227,12 +359,32 @@ impl Session {
         self.send(unsubscribe_ack_packet).await
     }
 
-    pub(super) async fn on_client_disconnect_v5(&mut self, _buf: &[u8]) -> Result<(), Error> {
-        self.status = Status::Disconnected;
-        let cmd = SessionToListenerCmd::DisconnectV5(self.id);
-        if let Err(err) = self.sender.send(cmd).await {
-            log::warn!("Failed to send disconnect command to server: {:?}", err);
+    pub(super) async fn on_client_disconnect_v5(&mut self, buf: &[u8]) -> Result<(), Error> {
+        let mut ba = ByteArray::new(buf);
+        let packet = v5::DisconnectPacket::decode(&mut ba)?;
+        for property in packet.properties().as_ref() {
+            if let v5::Property::SessionExpiryInterval(interval) = property {
+                // If the Session Expiry Interval in the CONNECT packet was zero, then it is
+                // a Protocol Error to set a non-zero Session Expiry Interval in the DISCONNECT
+                // packet sent by the Client.
+                if self.config.session_expiry_interval().is_zero() && interval.value() != 0 {
+                    log::warn!(
+                        "session: Session Expiry Interval is set on DISCONNECT, {}",
+                        self.id
+                    );
+                    return self
+                        .send_disconnect_with_reason(v5::ReasonCode::ProtocolError)
+                        .await;
+                }
+                // Cached session expires with the new interval, or is discarded at once
+                // if it is 0.
+                self.config.set_session_expiry_interval(interval.value());
+                self.persistent = self.persistent && interval.value() != 0;
+            }
         }
+
+        // Listener is notified when main loop exits.
+        self.status = Status::Disconnected;
         Ok(())
     }
 }
@@ -9,14 +9,29 @@ pub struct SessionConfig {
     keep_alive: Duration,
     connect_timeout: Duration,
 
+    /// Maximum number of QoS 1 and 2 messages inflight, set in listener config.
     maximum_inflight_messages: usize,
+
+    /// Receive Maximum of client, set by client in CONNECT properties.
+    receive_maximum: u16,
+
+    /// Maximum size of packets sent to client, set by client in CONNECT properties.
     maximum_packet_size: usize,
+
+    /// Maximum size of packets received from client.
+    ///
+    /// 0 means no limit.
+    maximum_incoming_packet_size: usize,
     maximum_topic_alias: u16,
 
     allow_empty_client_id: bool,
 
-    out_packet_count: usize,
-    last_packet_id: u16,
+    /// Packets larger than read buffer are assembled in a buffer of their own.
+    read_buffer_size: usize,
+
+    write_buffer_size: usize,
+    write_flush_delay: Duration,
+
     session_expiry_interval: Duration,
 }
 
@@ -34,13 +49,17 @@ impl SessionConfig {
             connect_timeout: Duration::from_secs(30),
 
             maximum_inflight_messages: 10,
+            receive_maximum: u16::MAX,
             maximum_packet_size: 10,
+            maximum_incoming_packet_size: 0,
             maximum_topic_alias: 10,
 
             allow_empty_client_id: false,
 
-            out_packet_count: 0,
-            last_packet_id: 0,
+            read_buffer_size: 64 * 1024,
+            write_buffer_size: 64 * 1024,
+            write_flush_delay: Duration::from_millis(0),
+
             session_expiry_interval: Duration::from_secs(180),
         }
     }
@@ -79,6 +98,30 @@ impl SessionConfig {
         self.maximum_inflight_messages
     }
 
+    pub fn set_receive_maximum(&mut self, receive_maximum: u16) -> &mut Self {
+        self.receive_maximum = receive_maximum;
+        self
+    }
+
+    #[inline]
+    #[must_use]
+    pub const fn receive_maximum(&self) -> u16 {
+        self.receive_maximum
+    }
+
+    /// Maximum number of QoS 1 and 2 messages sent to client and not acknowledged yet.
+    ///
+    /// `maximum_inflight_messages` is ignored if it is 0.
+    #[must_use]
+    pub fn outbound_inflight_window(&self) -> usize {
+        let receive_maximum = usize::from(self.receive_maximum);
+        if self.maximum_inflight_messages == 0 {
+            receive_maximum
+        } else {
+            self.maximum_inflight_messages.min(receive_maximum)
+        }
+    }
+
     pub fn set_maximum_packet_size(&mut self, maximum_packet_size: u32) -> &mut Self {
         self.maximum_packet_size = maximum_packet_size as usize;
         self
@@ -90,6 +133,20 @@ impl SessionConfig {
         self.maximum_packet_size
     }
 
+    pub fn set_maximum_incoming_packet_size(
+        &mut self,
+        maximum_incoming_packet_size: u32,
+    ) -> &mut Self {
+        self.maximum_incoming_packet_size = maximum_incoming_packet_size as usize;
+        self
+    }
+
+    #[inline]
+    #[must_use]
+    pub const fn maximum_incoming_packet_size(&self) -> usize {
+        self.maximum_incoming_packet_size
+    }
+
     pub fn set_maximum_topic_alias(&mut self, maximum_topic_alias: u16) -> &mut Self {
         self.maximum_topic_alias = maximum_topic_alias;
         self
@@ -112,24 +169,37 @@ impl SessionConfig {
         self.allow_empty_client_id
     }
 
-    pub fn out_packet_count_add_one(&mut self) {
-        self.out_packet_count += 1;
+    pub fn set_read_buffer_size(&mut self, read_buffer_size: usize) -> &mut Self {
+        self.read_buffer_size = read_buffer_size;
+        self
     }
 
-    pub const fn out_packet_count(&self) -> usize {
-        self.out_packet_count
+    #[inline]
+    #[must_use]
+    pub const fn read_buffer_size(&self) -> usize {
+        self.read_buffer_size
     }
 
-    pub fn renew_last_packet_id(&mut self) -> u16 {
-        let last_packet_id = self.last_packet_id;
-        self.last_packet_id += 1;
-        last_packet_id
+    pub fn set_write_buffer_size(&mut self, write_buffer_size: usize) -> &mut Self {
+        self.write_buffer_size = write_buffer_size;
+        self
+    }
+
+    #[inline]
+    #[must_use]
+    pub const fn write_buffer_size(&self) -> usize {
+        self.write_buffer_size
+    }
+
+    pub fn set_write_flush_delay(&mut self, write_flush_delay: u16) -> &mut Self {
+        self.write_flush_delay = Duration::from_millis(u64::from(write_flush_delay));
+        self
     }
 
     #[inline]
     #[must_use]
-    pub const fn last_packet_id(&self) -> u16 {
-        self.last_packet_id
+    pub const fn write_flush_delay(&self) -> Duration {
+        self.write_flush_delay
     }
 
     pub fn set_session_expiry_interval(&mut self, session_expiry_interval: u32) -> &mut Self {
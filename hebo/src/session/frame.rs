@@ -0,0 +1,322 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Split byte stream into complete control packets.
+
+use bytes::{Buf, Bytes, BytesMut};
+use codec::{
+    topic::validate_pub_topic, ByteArray, DecodeError, FixedHeader, PacketId, PacketType, QoS,
+};
+
+/// Packet split from the front of read buffer.
+#[derive(Debug)]
+pub enum Frame {
+    /// A complete packet.
+    Packet(Bytes),
+
+    /// Head of a packet larger than read buffer, the rest of it is moved in
+    /// with `PartialFrame::extend()` as it arrives.
+    Partial(PartialFrame),
+}
+
+/// Try to split one packet from the front of `buf`.
+///
+/// Returns `Ok(None)` if more bytes are required. Leftover bytes of a partial packet
+/// are kept in `buf`, so this function can be called again after next read.
+/// Packets larger than `read_buffer_size` are moved out of `buf` as `Frame::Partial`,
+/// so that `buf` never grows beyond that size.
+///
+/// If `maximum_packet_size` is not 0, size of packet is checked as soon as its fixed
+/// header is available, before the packet body is buffered.
+///
+/// # Errors
+///
+/// Returns `TooManyData` if packet is larger than `maximum_packet_size`, or other
+/// errors if fixed header is malformed.
+pub fn next_frame(
+    buf: &mut BytesMut,
+    maximum_packet_size: usize,
+    read_buffer_size: usize,
+) -> Result<Option<Frame>, DecodeError> {
+    if buf.is_empty() {
+        return Ok(None);
+    }
+
+    let (fixed_header, header_bytes) = match FixedHeader::peek(buf)? {
+        Some(header) => header,
+        // Remaining length is not fully received yet.
+        None => return Ok(None),
+    };
+
+    // The Maximum Packet Size is the total number of bytes in an MQTT Control Packet,
+    // including fixed header.
+    let packet_size = header_bytes + fixed_header.remaining_length();
+    if maximum_packet_size > 0 && packet_size > maximum_packet_size {
+        return Err(DecodeError::TooManyData);
+    }
+
+    if buf.len() < packet_size {
+        if packet_size > read_buffer_size {
+            let partial = PartialFrame::new(fixed_header, header_bytes, packet_size, buf);
+            return Ok(Some(Frame::Partial(partial)));
+        }
+        buf.reserve(packet_size - buf.len());
+        return Ok(None);
+    }
+
+    Ok(Some(Frame::Packet(buf.split_to(packet_size).freeze())))
+}
+
+/// A packet larger than read buffer, assembled in a buffer of its own.
+///
+/// Payload is not streamed to dispatcher in chunks. What is done before the packet
+/// is complete:
+/// - ACL of a publish packet is checked as soon as its topic is received, and
+///   payload of a rejected packet is discarded as it arrives.
+/// - Read buffer of session stays at `read_buffer_size`.
+///
+/// An accepted packet is buffered as a whole before it is handled, so its memory is
+/// limited by maximum packet size, not by read buffer size or any chunk size.
+/// Remaining length is not trusted blindly, the buffer grows as data arrives, up to
+/// exactly the packet size, so no spare capacity is kept by the packet after it is
+/// forwarded.
+#[derive(Debug)]
+pub struct PartialFrame {
+    fixed_header: FixedHeader,
+    header_bytes: usize,
+    packet_size: usize,
+
+    /// Number of bytes received, including discarded ones.
+    received: usize,
+
+    buf: Vec<u8>,
+
+    /// Set once topic of publish packet is checked.
+    checked: bool,
+
+    /// Payload is dropped as it arrives instead of being buffered.
+    discarded: bool,
+}
+
+impl PartialFrame {
+    fn new(
+        fixed_header: FixedHeader,
+        header_bytes: usize,
+        packet_size: usize,
+        src: &mut BytesMut,
+    ) -> Self {
+        let mut frame = Self {
+            fixed_header,
+            header_bytes,
+            packet_size,
+            received: 0,
+            buf: Vec::new(),
+            checked: false,
+            discarded: false,
+        };
+        frame.extend(src);
+        frame
+    }
+
+    #[must_use]
+    pub const fn fixed_header(&self) -> FixedHeader {
+        self.fixed_header
+    }
+
+    #[must_use]
+    pub const fn is_complete(&self) -> bool {
+        self.received == self.packet_size
+    }
+
+    #[must_use]
+    pub const fn is_checked(&self) -> bool {
+        self.checked
+    }
+
+    pub fn set_checked(&mut self) {
+        self.checked = true;
+    }
+
+    #[must_use]
+    pub const fn is_discarded(&self) -> bool {
+        self.discarded
+    }
+
+    /// Drop bytes received and all the remaining bytes of this packet.
+    pub fn discard(&mut self) {
+        self.checked = true;
+        self.discarded = true;
+        self.buf = Vec::new();
+    }
+
+    /// Move bytes of this packet from the front of `src`.
+    pub fn extend(&mut self, src: &mut BytesMut) {
+        let n = (self.packet_size - self.received).min(src.len());
+        self.received += n;
+        if self.discarded {
+            src.advance(n);
+            return;
+        }
+
+        if self.buf.capacity() - self.buf.len() < n {
+            // Double capacity, but never beyond packet size.
+            let capacity = (self.buf.capacity() * 2)
+                .max(self.buf.len() + n)
+                .min(self.packet_size);
+            self.buf.reserve_exact(capacity - self.buf.len());
+        }
+        self.buf.extend_from_slice(&src[..n]);
+        src.advance(n);
+    }
+
+    /// Decode topic and packet id of a publish packet, once they are received.
+    ///
+    /// Topic Name and Packet Identifier are the leading fields of variable header
+    /// in both MQTT v3.1.1 and v5.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if topic is invalid.
+    pub fn publish_header(&self) -> Result<Option<(&str, PacketId)>, DecodeError> {
+        let qos = match self.fixed_header.packet_type() {
+            PacketType::Publish { qos, .. } => qos,
+            _ => return Ok(None),
+        };
+        let data = match self.buf.get(self.header_bytes..) {
+            Some(data) if data.len() >= 2 => data,
+            _ => return Ok(None),
+        };
+        let topic_end = 2 + usize::from(u16::from_be_bytes([data[0], data[1]]));
+        let header_end = if qos == QoS::AtMostOnce {
+            topic_end
+        } else {
+            topic_end + 2
+        };
+        if data.len() < header_end {
+            return Ok(None);
+        }
+
+        // Lengths are checked, so that reading partial fields is not logged as error.
+        let mut ba = ByteArray::new(&data[..header_end]);
+        let topic_len = ba.read_u16()?;
+        let topic = ba.read_str(topic_len as usize)?;
+        // Topic is empty if Topic Alias is used in v5.
+        if !topic.is_empty() {
+            validate_pub_topic(topic)?;
+        }
+        let packet_id = if qos == QoS::AtMostOnce {
+            PacketId::new(0)
+        } else {
+            PacketId::new(ba.read_u16()?)
+        };
+        Ok(Some((topic, packet_id)))
+    }
+
+    /// Convert a complete packet into frame.
+    #[must_use]
+    pub fn into_frame(self) -> Bytes {
+        Bytes::from(self.buf)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use codec::{v3, EncodePacket};
+
+    use super::*;
+
+    const READ_BUFFER_SIZE: usize = 1024;
+
+    fn publish_packet(topic: &str) -> Vec<u8> {
+        let packet = v3::PublishPacket::new(topic, QoS::AtMostOnce, b"hello").unwrap();
+        let mut buf = Vec::new();
+        packet.encode(&mut buf).unwrap();
+        buf
+    }
+
+    /// Split a complete packet.
+    fn next_packet(buf: &mut BytesMut, maximum_packet_size: usize) -> Option<Bytes> {
+        match next_frame(buf, maximum_packet_size, READ_BUFFER_SIZE).unwrap() {
+            Some(Frame::Packet(packet)) => Some(packet),
+            Some(Frame::Partial(_)) => panic!("Unexpected partial frame"),
+            None => None,
+        }
+    }
+
+    #[test]
+    fn test_coalesced_and_partial() {
+        let first = publish_packet("a/b");
+        let second = publish_packet("c/d/e");
+        let mut stream = first.clone();
+        stream.extend_from_slice(&second);
+
+        // Two packets in one read, then the rest of a third one.
+        let mut buf = BytesMut::from(&stream[..first.len() + 3]);
+        assert_eq!(next_packet(&mut buf, 0).unwrap(), &first[..]);
+        assert!(next_packet(&mut buf, 0).is_none());
+        assert_eq!(buf.len(), 3);
+
+        buf.extend_from_slice(&stream[first.len() + 3..]);
+        assert_eq!(next_packet(&mut buf, 0).unwrap(), &second[..]);
+        assert!(next_packet(&mut buf, 0).is_none());
+        assert!(buf.is_empty());
+
+        // Only the first byte of remaining length is received.
+        let mut buf = BytesMut::from(&[0x30, 0x80][..]);
+        assert!(next_packet(&mut buf, 0).is_none());
+    }
+
+    #[test]
+    fn test_oversize() {
+        // Fixed header of a 16KiB publish packet, without its body.
+        let mut buf = BytesMut::from(&[0x30, 0x80, 0x80, 0x01][..]);
+        assert!(matches!(
+            next_frame(&mut buf, 1024, READ_BUFFER_SIZE),
+            Err(DecodeError::TooManyData)
+        ));
+        assert!(next_frame(&mut buf, 0, 64 * 1024).unwrap().is_none());
+        assert!(matches!(
+            next_frame(&mut buf, 0, READ_BUFFER_SIZE),
+            Ok(Some(Frame::Partial(_)))
+        ));
+    }
+
+    #[test]
+    fn test_partial_frame() {
+        let payload = vec![b'x'; 10 * READ_BUFFER_SIZE];
+        let mut packet = v3::PublishPacket::new("a/b", QoS::AtLeastOnce, &payload).unwrap();
+        packet.set_packet_id(PacketId::new(7));
+        let mut stream = Vec::new();
+        packet.encode(&mut stream).unwrap();
+        stream.extend_from_slice(&publish_packet("c/d"));
+
+        // Fixed header and part of topic.
+        let mut buf = BytesMut::from(&stream[..4]);
+        let mut partial = match next_frame(&mut buf, 0, READ_BUFFER_SIZE).unwrap() {
+            Some(Frame::Partial(partial)) => partial,
+            _ => panic!("Expected partial frame"),
+        };
+        assert!(buf.is_empty());
+        assert!(partial.publish_header().unwrap().is_none());
+
+        // Packet is received in chunks of read buffer size.
+        let mut offset = 4;
+        while !partial.is_complete() {
+            let end = (offset + READ_BUFFER_SIZE).min(stream.len());
+            buf.extend_from_slice(&stream[offset..end]);
+            offset = end;
+            partial.extend(&mut buf);
+            assert_eq!(
+                partial.publish_header().unwrap(),
+                Some(("a/b", PacketId::new(7)))
+            );
+        }
+        let packet_len = stream.len() - publish_packet("c/d").len();
+        assert_eq!(partial.buf.capacity(), packet_len);
+        assert_eq!(partial.into_frame(), &stream[..packet_len]);
+
+        // Bytes of next packet are kept in read buffer.
+        assert_eq!(next_packet(&mut buf, 0).unwrap(), &stream[packet_len..]);
+    }
+}
@@ -0,0 +1,476 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Outbound QoS 1 and QoS 2 messages waiting for acknowledgement from client.
+//!
+//! Messages are kept in a ring of slots indexed by packet id, so that handling
+//! PUBACK, PUBREC and PUBCOMP is a single slot lookup. At most `window` messages
+//! are inflight, which is the minimum of `maximum_inflight_messages` of listener
+//! and Receive Maximum of client. Other messages wait in `pending` until slots are
+//! released by acknowledgements, so that a slow client is throttled instead of
+//! flooding its socket buffer.
+
+use codec::{PacketId, QoS};
+use std::collections::VecDeque;
+
+use super::{Session, Status};
+use crate::error::Error;
+use crate::message::PublishMessage;
+
+/// Initial number of slots, ring grows when it is full.
+const INITIAL_SLOTS: usize = 16;
+
+/// Maximum number of packet ids, no slots collide in a ring of this size.
+const MAX_SLOTS: usize = u16::MAX as usize + 1;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum InflightState {
+    /// QoS 1 message, waiting for PUBACK.
+    WaitAck,
+
+    /// QoS 2 message, waiting for PUBREC.
+    WaitReceived,
+
+    /// QoS 2 message, PUBREL is sent and waiting for PUBCOMP.
+    WaitComplete,
+}
+
+#[derive(Debug, Clone)]
+pub struct InflightMessage {
+    packet_id: PacketId,
+    qos: QoS,
+    retain: bool,
+    message: PublishMessage,
+    state: InflightState,
+
+    /// Sequence number, messages are retransmitted in their original order.
+    seq: u64,
+}
+
+impl InflightMessage {
+    #[must_use]
+    pub const fn packet_id(&self) -> PacketId {
+        self.packet_id
+    }
+
+    #[must_use]
+    pub const fn qos(&self) -> QoS {
+        self.qos
+    }
+
+    #[must_use]
+    pub const fn retain(&self) -> bool {
+        self.retain
+    }
+
+    #[must_use]
+    pub const fn message(&self) -> &PublishMessage {
+        &self.message
+    }
+
+    #[must_use]
+    pub const fn state(&self) -> InflightState {
+        self.state
+    }
+}
+
+#[derive(Debug, Clone)]
+pub struct OutboundInflight {
+    /// Message with packet id `n` is stored at `slots[n % slots.len()]`.
+    ///
+    /// Ring grows up to `window` slots, and may be larger if packet ids collide.
+    slots: Vec<Option<InflightMessage>>,
+    len: usize,
+
+    /// Maximum number of inflight messages.
+    window: usize,
+
+    next_packet_id: u16,
+    next_seq: u64,
+
+    /// Messages waiting for a free slot, with `QoS` and retain flag.
+    pending: VecDeque<(QoS, PublishMessage, bool)>,
+    pending_bytes: usize,
+}
+
+impl Default for OutboundInflight {
+    fn default() -> Self {
+        Self::new(usize::from(u16::MAX))
+    }
+}
+
+impl OutboundInflight {
+    /// Create a table with at most `window` inflight messages.
+    ///
+    /// `window` is limited to `1..=65535`, as packet id 0 is invalid.
+    #[must_use]
+    pub fn new(window: usize) -> Self {
+        let window = window.max(1).min(usize::from(u16::MAX));
+        Self {
+            slots: vec![None; window.min(INITIAL_SLOTS)],
+            len: 0,
+            window,
+            next_packet_id: 1,
+            next_seq: 0,
+            pending: VecDeque::new(),
+            pending_bytes: 0,
+        }
+    }
+
+    #[must_use]
+    pub const fn window(&self) -> usize {
+        self.window
+    }
+
+    /// Number of inflight messages.
+    #[must_use]
+    pub const fn len(&self) -> usize {
+        self.len
+    }
+
+    #[must_use]
+    pub const fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    #[must_use]
+    pub const fn is_full(&self) -> bool {
+        self.len >= self.window
+    }
+
+    /// Number of messages waiting for free slots.
+    #[must_use]
+    pub fn pending_len(&self) -> usize {
+        self.pending.len()
+    }
+
+    /// Bytes of topics and payloads of messages waiting for free slots.
+    #[must_use]
+    pub const fn pending_bytes(&self) -> usize {
+        self.pending_bytes
+    }
+
+    /// Queue a message until a slot is free.
+    fn push_pending(&mut self, qos: QoS, message: PublishMessage, retain: bool) {
+        self.pending_bytes += message.size();
+        self.pending.push_back((qos, message, retain));
+    }
+
+    /// Take all the queued messages.
+    pub fn take_pending(&mut self) -> VecDeque<(QoS, PublishMessage, bool)> {
+        self.pending_bytes = 0;
+        std::mem::take(&mut self.pending)
+    }
+
+    /// Update maximum number of inflight messages.
+    ///
+    /// Inflight messages are kept even if there are more than `window`,
+    /// new messages are queued until some of them are acknowledged.
+    pub fn set_window(&mut self, window: usize) {
+        self.window = window.max(1).min(usize::from(u16::MAX));
+    }
+
+    /// Move messages to a new ring with at least `capacity` slots.
+    fn rebuild(&mut self, capacity: usize) {
+        let messages: Vec<InflightMessage> =
+            self.slots.iter_mut().filter_map(Option::take).collect();
+        let mut capacity = capacity;
+        'outer: loop {
+            let mut slots = vec![None; capacity];
+            for message in &messages {
+                let index = usize::from(message.packet_id.value()) % capacity;
+                if slots[index].is_some() {
+                    // Packet ids collide in the new ring, try a larger one. No collision
+                    // is possible once there is one slot for each packet id.
+                    capacity = (capacity * 2).min(MAX_SLOTS);
+                    continue 'outer;
+                }
+                slots[index] = Some(message.clone());
+            }
+            self.slots = slots;
+            return;
+        }
+    }
+
+    fn slot_index(&self, packet_id: PacketId) -> usize {
+        usize::from(packet_id.value()) % self.slots.len()
+    }
+
+    /// Get a free packet id, its slot is empty.
+    fn alloc_packet_id(&mut self) -> PacketId {
+        loop {
+            let packet_id = PacketId::new(self.next_packet_id);
+            self.next_packet_id = self.next_packet_id.checked_add(1).unwrap_or(1);
+            if self.slots[self.slot_index(packet_id)].is_none() {
+                return packet_id;
+            }
+        }
+    }
+
+    /// Add a message to inflight table.
+    ///
+    /// Returns packet id of this message, or None if window is full and the message
+    /// is queued.
+    pub fn push(&mut self, qos: QoS, message: PublishMessage, retain: bool) -> Option<PacketId> {
+        if self.is_full() || !self.pending.is_empty() {
+            self.push_pending(qos, message, retain);
+            return None;
+        }
+        Some(self.insert(qos, message, retain))
+    }
+
+    fn insert(&mut self, qos: QoS, message: PublishMessage, retain: bool) -> PacketId {
+        if self.len >= self.slots.len() {
+            self.rebuild((self.slots.len() * 2).min(MAX_SLOTS));
+        }
+        let packet_id = self.alloc_packet_id();
+        let state = if qos == QoS::ExactOnce {
+            InflightState::WaitReceived
+        } else {
+            InflightState::WaitAck
+        };
+        let index = self.slot_index(packet_id);
+        self.slots[index] = Some(InflightMessage {
+            packet_id,
+            qos,
+            retain,
+            message,
+            state,
+            seq: self.next_seq,
+        });
+        self.next_seq += 1;
+        self.len += 1;
+        packet_id
+    }
+
+    /// Move one queued message to inflight table if window is not full.
+    pub fn pop_pending(&mut self) -> Option<(PacketId, InflightMessage)> {
+        if self.is_full() {
+            return None;
+        }
+        let (qos, message, retain) = self.pending.pop_front()?;
+        self.pending_bytes -= message.size();
+        let packet_id = self.insert(qos, message, retain);
+        let index = self.slot_index(packet_id);
+        self.slots[index]
+            .clone()
+            .map(|message| (packet_id, message))
+    }
+
+    fn get_mut(&mut self, packet_id: PacketId) -> Option<&mut InflightMessage> {
+        let index = self.slot_index(packet_id);
+        self.slots[index]
+            .as_mut()
+            .filter(|message| message.packet_id == packet_id)
+    }
+
+    /// Remove message from inflight table.
+    pub fn remove(&mut self, packet_id: PacketId) -> Option<InflightMessage> {
+        self.get_mut(packet_id)?;
+        let index = self.slot_index(packet_id);
+        self.len -= 1;
+        self.slots[index].take()
+    }
+
+    /// Handle PUBACK from client.
+    ///
+    /// Returns false if no QoS 1 message is waiting for it.
+    pub fn on_ack(&mut self, packet_id: PacketId) -> bool {
+        match self.get_mut(packet_id) {
+            Some(message) if message.state == InflightState::WaitAck => {
+                self.remove(packet_id);
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Handle PUBREC from client, PUBREL shall be sent to client.
+    ///
+    /// Returns false if no QoS 2 message is waiting for it.
+    pub fn on_received(&mut self, packet_id: PacketId) -> bool {
+        match self.get_mut(packet_id) {
+            // PUBREC of a retransmitted message may arrive after PUBREL is sent.
+            Some(message) if message.state != InflightState::WaitAck => {
+                message.state = InflightState::WaitComplete;
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Handle PUBCOMP from client.
+    ///
+    /// Returns false if no QoS 2 message is waiting for it.
+    pub fn on_complete(&mut self, packet_id: PacketId) -> bool {
+        match self.get_mut(packet_id) {
+            Some(message) if message.state == InflightState::WaitComplete => {
+                self.remove(packet_id);
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Get inflight messages in the order they were sent.
+    #[must_use]
+    pub fn messages(&self) -> Vec<&InflightMessage> {
+        let mut messages: Vec<&InflightMessage> = self.slots.iter().flatten().collect();
+        messages.sort_by_key(|message| message.seq);
+        messages
+    }
+}
+
+impl Session {
+    /// Send QoS 1 and QoS 2 messages within inflight window, others are queued.
+    ///
+    /// Bytes of `message` shall have been counted in inflight counter, they are
+    /// removed from counter after the message is written to stream.
+    pub(super) async fn publish_message(
+        &mut self,
+        qos: QoS,
+        message: PublishMessage,
+        retain: bool,
+    ) -> Result<(), Error> {
+        if qos == QoS::AtMostOnce {
+            self.sent_publish_bytes += message.size();
+            return self
+                .send_publish(&message, qos, PacketId::new(0), false, retain)
+                .await;
+        }
+        if self.status != Status::Connected {
+            // Message is kept in queue of a persistent session.
+            self.outbound_inflight.push_pending(qos, message, retain);
+            return Ok(());
+        }
+        match self.outbound_inflight.push(qos, message.clone(), retain) {
+            Some(packet_id) => {
+                self.sent_publish_bytes += message.size();
+                self.send_publish(&message, qos, packet_id, false, retain)
+                    .await
+            }
+            None => {
+                log::debug!(
+                    "session: Inflight window is full, {} messages queued, {}",
+                    self.outbound_inflight.pending_len(),
+                    self.id
+                );
+                Ok(())
+            }
+        }
+    }
+
+    /// Send queued messages after inflight slots are released.
+    pub(super) async fn send_pending_publishes(&mut self) -> Result<(), Error> {
+        while let Some((packet_id, inflight)) = self.outbound_inflight.pop_pending() {
+            self.sent_publish_bytes += inflight.message().size();
+            self.send_publish(
+                inflight.message(),
+                inflight.qos(),
+                packet_id,
+                false,
+                inflight.retain(),
+            )
+            .await?;
+        }
+        Ok(())
+    }
+
+    /// Retransmit unacknowledged messages after client reconnects.
+    pub(super) async fn resend_inflight_messages(&mut self) -> Result<(), Error> {
+        let messages: Vec<InflightMessage> = self
+            .outbound_inflight
+            .messages()
+            .into_iter()
+            .cloned()
+            .collect();
+        for inflight in messages {
+            if inflight.state() == InflightState::WaitComplete {
+                // PUBREL is resent if PUBREC has been received.
+                self.send_publish_release(inflight.packet_id()).await?;
+            } else {
+                // When a Client reconnects with CleanSession set to 0, both the Client and Server
+                // MUST re-send any unacknowledged PUBLISH Packets (where QoS > 0) and PUBREL Packets
+                // using their original Packet Identifiers [MQTT-4.4.0-1].
+                //
+                // The DUP flag MUST be set to 1 by the Client or Server when it attempts to
+                // re-deliver a PUBLISH Packet [MQTT-3.3.1-1].
+                self.send_publish(
+                    inflight.message(),
+                    inflight.qos(),
+                    inflight.packet_id(),
+                    true,
+                    inflight.retain(),
+                )
+                .await?;
+            }
+        }
+        self.send_pending_publishes().await
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{InflightState, OutboundInflight};
+    use crate::message::PublishMessage;
+    use codec::{v3, PacketId, QoS};
+
+    fn message() -> PublishMessage {
+        let packet = v3::PublishPacket::new("a/b", QoS::ExactOnce, b"1").unwrap();
+        PublishMessage::from_v3(&packet)
+    }
+
+    #[test]
+    fn test_window() {
+        let mut inflight = OutboundInflight::new(2);
+        let p1 = inflight.push(QoS::AtLeastOnce, message(), false).unwrap();
+        let p2 = inflight.push(QoS::ExactOnce, message(), false).unwrap();
+        assert_ne!(p1, p2);
+        assert!(inflight.push(QoS::AtLeastOnce, message(), false).is_none());
+        assert!(inflight.is_full());
+        assert!(inflight.pop_pending().is_none());
+
+        // Acks with wrong packet type or id are ignored.
+        assert!(!inflight.on_ack(p2));
+        assert!(!inflight.on_complete(p2));
+        assert!(!inflight.on_ack(PacketId::new(100)));
+
+        assert!(inflight.on_received(p2));
+        assert_eq!(inflight.messages()[1].state(), InflightState::WaitComplete);
+        assert!(inflight.on_complete(p2));
+        let (p3, _message) = inflight.pop_pending().unwrap();
+        assert_eq!(inflight.pending_len(), 0);
+        assert!(inflight.on_ack(p1));
+        assert_eq!(inflight.len(), 1);
+        assert_eq!(inflight.messages()[0].packet_id(), p3);
+
+        assert!(inflight.push(QoS::AtLeastOnce, message(), false).is_some());
+        assert!(inflight.push(QoS::AtLeastOnce, message(), false).is_none());
+        assert_eq!(inflight.take_pending().len(), 1);
+        assert_eq!(inflight.pending_bytes(), 0);
+    }
+
+    #[test]
+    fn test_set_window() {
+        let mut inflight = OutboundInflight::new(3);
+        let ids: Vec<PacketId> = (0..3)
+            .map(|_i| inflight.push(QoS::AtLeastOnce, message(), false).unwrap())
+            .collect();
+        inflight.set_window(20);
+        assert!(!inflight.is_full());
+        // Ring grows after 16 messages.
+        let more: Vec<PacketId> = (0..17)
+            .map(|_i| inflight.push(QoS::AtLeastOnce, message(), false).unwrap())
+            .collect();
+        assert!(inflight.is_full());
+        assert!(inflight.slots.len() >= 20);
+        for packet_id in &more {
+            assert!(inflight.on_ack(*packet_id));
+        }
+        for packet_id in &ids {
+            assert!(inflight.on_ack(*packet_id));
+        }
+        assert!(inflight.is_empty());
+    }
+}
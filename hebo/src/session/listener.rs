@@ -4,11 +4,13 @@
 
 //! Handles commands from listener.
 
-use codec::{v3, v5, PacketId, QoS};
+use codec::{v3, v5, QoS};
+use std::time::Instant;
 
 use super::{Session, Status};
 use crate::commands::ListenerToSessionCmd;
 use crate::error::Error;
+use crate::message::PublishMessage;
 use crate::session::CachedSession;
 
 impl Session {
@@ -24,15 +26,12 @@ impl Session {
                 self.on_listener_connect_ack_v5(packet, cached_session)
                     .await
             }
-            ListenerToSessionCmd::PublishAck(packet_id, qos, accepted) => {
-                self.on_listener_publish_ack(packet_id, qos, accepted).await
+            ListenerToSessionCmd::Publish(qos, message) => {
+                self.on_listener_publish(qos, message, false).await
             }
-            ListenerToSessionCmd::PublishAckV5(packet_id, qos, accepted) => {
-                self.on_listener_publish_ack_v5(packet_id, qos, accepted)
-                    .await
+            ListenerToSessionCmd::PublishRetained(qos, message) => {
+                self.on_listener_publish(qos, message, true).await
             }
-            ListenerToSessionCmd::Publish(packet) => self.on_listener_publish(packet).await,
-            ListenerToSessionCmd::PublishV5(packet) => self.on_listener_publish_v5(packet).await,
             ListenerToSessionCmd::SubscribeAck(packet) => {
                 self.on_listener_subscribe_ack(packet).await
             }
@@ -41,6 +40,7 @@ impl Session {
             }
             ListenerToSessionCmd::Disconnect => self.on_listener_disconnect().await,
             ListenerToSessionCmd::DisconnectV5 => self.on_listener_disconnect().await,
+            ListenerToSessionCmd::Timeout => self.on_listener_timeout().await,
         }
     }
 
@@ -57,9 +57,18 @@ impl Session {
             v3::ConnectReturnCode::Accepted => Status::Connected,
             _ => Status::Disconnected,
         };
+        // When CleanSession is set to 0 the Server MUST resume communications with the Client
+        // based on state from the current Session. After the disconnection of a Session that had
+        // CleanSession set to 0, the Server MUST store further QoS 1 and QoS 2 messages that match
+        // any subscriptions that the client had at the time of disconnection as part
+        // of the Session state [MQTT-3.1.2-4], [MQTT-3.1.2-5].
+        self.persistent = self.status == Status::Connected && !self.clean_session;
 
         if let Some(cached_session) = cached_session {
-            self.load_cached_session(cached_session);
+            self.load_cached_session(cached_session).await?;
+        } else if self.status == Status::Connected {
+            // Messages received before CONNACK.
+            self.send_pending_publishes().await?;
         }
 
         Ok(())
@@ -78,90 +87,43 @@ impl Session {
             v5::ReasonCode::Success => Status::Connected,
             _ => Status::Disconnected,
         };
+        // The Client and Server MUST store the Session State after the Network Connection
+        // is closed if the Session Expiry Interval is greater than 0 [MQTT-3.1.2-23].
+        self.persistent =
+            self.status == Status::Connected && !self.config.session_expiry_interval().is_zero();
 
         if let Some(cached_session) = cached_session {
-            self.load_cached_session(cached_session);
+            self.load_cached_session(cached_session).await?;
+        } else if self.status == Status::Connected {
+            // Messages received before CONNACK.
+            self.send_pending_publishes().await?;
         }
 
         Ok(())
     }
 
-    /// Send ack to client.
-    async fn on_listener_publish_ack(
+    async fn on_listener_publish(
         &mut self,
-        packet_id: PacketId,
-        qos: QoS,
-        accepted: bool,
+        granted_qos: QoS,
+        message: PublishMessage,
+        retained: bool,
     ) -> Result<(), Error> {
-        // If a Server implementation does not authorize a PUBLISH to be performed by a Client;
-        // it has no way of informing that Client. It MUST either make a positive acknowledgement,
-        // according to the normal QoS rules, or close the Network Connection [MQTT-3.3.5-2].
-        if !accepted {
-            return self.send_disconnect().await;
-        }
-
-        // Check qos and send publish ack packet to client.
-        if qos == QoS::AtLeastOnce {
-            let ack_packet = v3::PublishAckPacket::new(packet_id);
-            // TODO(Shaohua): Catch errors
-            self.send(ack_packet).await?;
-        } else if qos == QoS::ExactOnce {
-            // Check inflight messages overflow.
-            if self.pub_recv_packets.len() > self.config.maximum_inflight_messages() {
-                log::error!("session: Too many unacknowledged qos=2 messages, disconnect client!");
-                return self.send_disconnect().await;
-            }
-
-            // Send PublishReceived.
-            self.pub_recv_packets.insert(packet_id);
-            let ack_packet = v3::PublishReceivedPacket::new(packet_id);
-            // TODO(Shaohua): Catch errors
-            self.send(ack_packet).await?;
-        }
-        Ok(())
-    }
-
-    /// Send ack to client.
-    async fn on_listener_publish_ack_v5(
-        &mut self,
-        packet_id: PacketId,
-        qos: QoS,
-        accepted: bool,
-    ) -> Result<(), Error> {
-        // If a Server implementation does not authorize a PUBLISH to be performed by a Client;
-        // it has no way of informing that Client. It MUST either make a positive acknowledgement,
-        // according to the normal QoS rules, or close the Network Connection [MQTT-3.3.5-2].
-        if !accepted {
-            return self.send_disconnect().await;
-        }
-
-        // Check qos and send publish ack packet to client.
-        if qos == QoS::AtLeastOnce {
-            let ack_packet = v5::PublishAckPacket::new(packet_id);
-            // TODO(Shaohua): Catch errors
-            self.send(ack_packet).await?;
-        } else if qos == QoS::ExactOnce {
-            // Check inflight messages overflow.
-            if self.pub_recv_packets.len() > self.config.maximum_inflight_messages() {
-                log::error!("session: Too many unacknowledged qos=2 messages, disconnect client!");
-                return self.send_disconnect().await;
-            }
-
-            // Send PublishReceived.
-            self.pub_recv_packets.insert(packet_id);
-            let ack_packet = v5::PublishReceivedPacket::new(packet_id);
-            // TODO(Shaohua): Catch errors
-            self.send(ack_packet).await?;
-        }
-        Ok(())
-    }
-
-    async fn on_listener_publish(&mut self, packet: v3::PublishPacket) -> Result<(), Error> {
-        self.send(packet).await
-    }
-
-    async fn on_listener_publish_v5(&mut self, packet: v5::PublishPacket) -> Result<(), Error> {
-        self.send(packet).await
+        // Counted in inflight counter until next flush, even if it is not sent.
+        self.pending_publishes += 1;
+
+        // The QoS of Payload Messages sent in response to a Subscription MUST be the minimum
+        // of the QoS of the originally published message and the maximum QoS granted
+        // by the Server [MQTT-3.8.4-6].
+        let qos = message.qos().min(granted_qos);
+
+        // When sending a PUBLISH Packet to a Client the Server MUST set the RETAIN flag to 1
+        // if a message is sent as a result of a new subscription being made by a Client
+        // [MQTT-3.3.1-8].
+        //
+        // The Server MUST set the RETAIN flag to 0 when a PUBLISH Packet is sent to a Client
+        // because it matches an established subscription regardless of how the RETAIN flag
+        // was set in the message it received [MQTT-3.3.1-9].
+        self.publish_message(qos, message, retained).await
     }
 
     async fn on_listener_subscribe_ack(
@@ -185,4 +147,35 @@ impl Session {
     async fn on_listener_disconnect(&mut self) -> Result<(), Error> {
         self.send_disconnect().await
     }
+
+    async fn on_listener_timeout(&mut self) -> Result<(), Error> {
+        // Client may have sent packets after this cmd is sent by listener.
+        let expired = self
+            .timer
+            .deadline(self.config.connect_timeout())
+            .map_or(false, |deadline| deadline <= Instant::now());
+        if !expired {
+            return Ok(());
+        }
+
+        if self.status == Status::Invalid {
+            // If the Server does not receive a CONNECT Packet within a reasonable amount
+            // of time after the Network Connection is established, the Server SHOULD
+            // close the connection.
+            log::warn!("session: CONNECT packet not received in time, {}", self.id);
+            self.status = Status::Disconnected;
+            return Ok(());
+        }
+
+        // If the Keep Alive value is non-zero and the Server does not receive a Control Packet
+        // from the Client within one and a half times the Keep Alive time period,
+        // it MUST disconnect the Network Connection to the Client as if the network had
+        // failed [MQTT-3.1.2-24].
+        log::warn!(
+            "session: keep_alive time reached, disconnect client, {}",
+            self.id
+        );
+        self.send_disconnect_with_reason(v5::ReasonCode::KeepAliveTimeout)
+            .await
+    }
 }
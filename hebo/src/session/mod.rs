@@ -4,25 +4,40 @@
 
 #![allow(clippy::module_name_repetitions)]
 
-use codec::{EncodePacket, Packet, PacketId, PacketType, ProtocolLevel};
+use bytes::{Bytes, BytesMut};
+use codec::{v5, DecodeError, EncodePacket, Packet, PacketId, PacketType, ProtocolLevel, QoS};
 use std::collections::HashSet;
-use std::time::Instant;
 use tokio::sync::mpsc::{Receiver, Sender};
+use tokio::sync::watch;
+use tokio::time;
 
+use crate::acl::AclSnapshot;
 use crate::commands::{ListenerToSessionCmd, SessionToListenerCmd};
 use crate::error::{Error, ErrorKind};
+use crate::message::PublishMessage;
 use crate::stream::Stream;
-use crate::types::SessionId;
+use crate::types::{InflightCounter, SessionId, SessionTimer};
 
 mod cache;
 mod client;
 mod client_v5;
 mod config;
+mod frame;
+mod inflight;
 mod listener;
+mod outbound;
 mod properties;
 
-pub use cache::CachedSession;
+use frame::{Frame, PartialFrame};
+
+pub use cache::{CachedSession, OfflineQueue};
 pub use config::SessionConfig;
+pub use inflight::{InflightMessage, InflightState, OutboundInflight};
+use outbound::OutboundQueue;
+pub use outbound::WriteStats;
+
+/// Maximum number of listener commands handled before flushing outgoing packets.
+const MAX_BATCH_COMMANDS: usize = 64;
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum Status {
@@ -46,25 +61,55 @@ pub struct Session {
 
     status: Status,
     client_id: String,
+    username: String,
     // TODO(Shaohua): Handle Will Message
     // TODO(Shaohua): Add session flag
-    instant: Instant,
+    /// Checked by listener to disconnect idle client.
+    timer: SessionTimer,
     clean_session: bool,
 
+    /// Session state is cached after client disconnects.
+    persistent: bool,
+
     pub_recv_packets: HashSet<PacketId>,
 
+    /// QoS 1 and QoS 2 messages sent to client, waiting for acknowledgement.
+    outbound_inflight: OutboundInflight,
+
+    outbound: OutboundQueue,
+    flush_deadline: Option<time::Instant>,
+
+    /// Publish messages received from listener since last flush.
+    pending_publishes: usize,
+
+    /// Bytes of publish messages written to buffer since last flush.
+    sent_publish_bytes: usize,
+    inflight: InflightCounter,
+
+    /// Packet larger than read buffer, which is not fully received yet.
+    partial_frame: Option<PartialFrame>,
+
+    /// Latest ACL rules, used to check publish packets from client.
+    acl: watch::Receiver<AclSnapshot>,
+
     sender: Sender<SessionToListenerCmd>,
     receiver: Receiver<ListenerToSessionCmd>,
 }
 
 impl Session {
+    #[allow(clippy::too_many_arguments)]
     pub fn new(
         id: SessionId,
         config: SessionConfig,
         stream: Stream,
         sender: Sender<SessionToListenerCmd>,
         receiver: Receiver<ListenerToSessionCmd>,
+        inflight: InflightCounter,
+        timer: SessionTimer,
+        acl: watch::Receiver<AclSnapshot>,
     ) -> Self {
+        let outbound = OutboundQueue::new(config.write_buffer_size());
+        let outbound_inflight = OutboundInflight::new(config.outbound_inflight_window());
         Self {
             id,
             protocol_level: ProtocolLevel::default(),
@@ -74,47 +119,183 @@ impl Session {
 
             status: Status::Invalid,
             client_id: String::new(),
-            instant: Instant::now(),
+            username: String::new(),
+            timer,
             clean_session: true,
+            persistent: false,
 
             pub_recv_packets: HashSet::new(),
 
+            outbound_inflight,
+
+            outbound,
+            flush_deadline: None,
+
+            pending_publishes: 0,
+            sent_publish_bytes: 0,
+            inflight,
+
+            partial_frame: None,
+            acl,
+
             sender,
             receiver,
         }
     }
 
-    pub async fn run_loop(mut self) {
-        // TODO(Shaohua): Set buffer cap based on settings
-        let mut buf = Vec::with_capacity(1024);
+    /// Handle every complete packet in `buf`.
+    ///
+    /// A stream read may contain several packets or only part of one packet,
+    /// bytes of the partial packet are kept in `buf` until next read.
+    /// Packets larger than read buffer are moved into `partial_frame` instead.
+    async fn handle_client_frames(&mut self, buf: &mut BytesMut) -> Result<(), Error> {
+        while self.status != Status::Disconnected {
+            if let Some(mut partial) = self.partial_frame.take() {
+                partial.extend(buf);
+                // Client is still sending, even if no packet is complete.
+                self.reset_instant();
+                if partial.is_complete() {
+                    if !partial.is_discarded() {
+                        self.handle_client_packet(&partial.into_frame()).await?;
+                    }
+                    continue;
+                }
+                if !partial.is_checked() {
+                    self.check_partial_publish(&mut partial).await?;
+                }
+                self.partial_frame = Some(partial);
+                break;
+            }
 
-        let connect_timeout = Instant::now();
+            match frame::next_frame(
+                buf,
+                self.config.maximum_incoming_packet_size(),
+                self.config.read_buffer_size(),
+            ) {
+                Ok(Some(Frame::Packet(frame))) => self.handle_client_packet(&frame).await?,
+                Ok(Some(Frame::Partial(partial))) => self.partial_frame = Some(partial),
+                Ok(None) => break,
+                Err(DecodeError::TooManyData) => {
+                    // Where a Packet is too large to process, the Server uses a DISCONNECT
+                    // packet with Reason Code 0x95 (Packet too large).
+                    log::warn!(
+                        "session: Packet exceeds maximum packet size {}, {}",
+                        self.config.maximum_incoming_packet_size(),
+                        self.id
+                    );
+                    self.send_disconnect_with_reason(v5::ReasonCode::PacketTooLarge)
+                        .await?;
+                    return Err(DecodeError::TooManyData.into());
+                }
+                Err(err) => {
+                    log::error!("session: Invalid packet: {:?}, {}", err, self.id);
+                    self.send_disconnect_with_reason(v5::ReasonCode::MalformedPacket)
+                        .await?;
+                    return Err(err.into());
+                }
+            }
+        }
+        Ok(())
+    }
 
-        loop {
-            // If the Server does not receive a CONNECT Packet within a reasonable amount of time after the
-            // Network Connection is established, the Server SHOULD close the connection.
-            if self.status == Status::Invalid
-                && !self.config.connect_timeout().is_zero()
-                && connect_timeout.elapsed() > self.config.connect_timeout()
-            {
-                break;
+    /// Check ACL of a large publish packet as soon as its topic is received,
+    /// so that payload of an unauthorized packet is not buffered.
+    async fn check_partial_publish(&mut self, partial: &mut PartialFrame) -> Result<(), Error> {
+        if self.status != Status::Connected {
+            // Packet is rejected once it is complete.
+            partial.set_checked();
+            return Ok(());
+        }
+
+        let (topic, packet_id) = match partial.publish_header() {
+            Ok(Some(header)) => header,
+            // Wait for more bytes, or this is not a publish packet.
+            Ok(None) => {
+                if !matches!(
+                    partial.fixed_header().packet_type(),
+                    PacketType::Publish { .. }
+                ) {
+                    partial.set_checked();
+                }
+                return Ok(());
+            }
+            Err(err) => {
+                log::error!("session: Invalid publish packet: {:?}, {}", err, self.id);
+                self.send_disconnect_with_reason(v5::ReasonCode::MalformedPacket)
+                    .await?;
+                return Err(err.into());
             }
+        };
+
+        // Topic Alias of incoming packets is not supported yet, a packet without Topic Name
+        // can be neither checked nor routed.
+        if topic.is_empty() {
+            log::warn!("session: Publish packet without topic name, {}", self.id);
+            partial.discard();
+            return self
+                .send_disconnect_with_reason(v5::ReasonCode::TopicAliasInvalid)
+                .await;
+        }
+
+        if self.acl.borrow().check_publish(&self.username, topic) {
+            partial.set_checked();
+            return Ok(());
+        }
+
+        log::warn!(
+            "session: Publish to {} is not authorized, {}",
+            topic,
+            self.id
+        );
+        let qos = match partial.fixed_header().packet_type() {
+            PacketType::Publish { qos, .. } => qos,
+            _ => QoS::AtMostOnce,
+        };
+        partial.discard();
+        if self.protocol_level == ProtocolLevel::V5 {
+            self.reject_publish_v5(packet_id, qos).await
+        } else {
+            self.send_disconnect().await
+        }
+    }
 
+    pub async fn run_loop(mut self) {
+        let mut buf = BytesMut::with_capacity(1024);
+
+        // Keep alive and connect timeout are checked by timer wheel in listener,
+        // which sends `Timeout` cmd if client is idle for too long.
+        loop {
             if self.status == Status::Disconnected {
                 log::info!("status is Disconnected");
                 break;
             }
 
+            let flush_deadline = self.flush_deadline.unwrap_or_else(time::Instant::now);
+
+            // Datagrams of QUIC stream must not be mixed into a partial packet.
+            let in_packet = self.partial_frame.is_some();
             tokio::select! {
-                Ok(n_recv) = self.stream.read_buf(&mut buf) => {
+                ret = self.stream.read_buf(&mut buf, in_packet) => {
+                    let n_recv = match ret {
+                        Ok(n_recv) => n_recv,
+                        Err(err) => {
+                            // Like text frames in websocket, which MUST close the connection
+                            // [MQTT-6.0.0-1].
+                            log::error!("session: Failed to read from stream: {:?}, {}", err, self.id);
+                            break;
+                        }
+                    };
                     log::info!("n_recv: {}", n_recv);
                     if n_recv > 0 {
-                        if let Err(err) = self.handle_client_packet(&buf).await {
+                        if let Err(err) = self.handle_client_frames(&mut buf).await {
                             log::error!("handle_client_packet() failed: {:?}", err);
                             break;
                         }
-                        buf.clear();
-
+                        // Acknowledgements are sent once all packets in this read are handled.
+                        if let Err(err) = self.flush().await {
+                            log::error!("session: Failed to write to stream: {:?}", err);
+                            break;
+                        }
                     } else {
                         log::info!("session: Empty packet received, disconnect client, {}", self.id);
                         if let Err(err) = self.send_disconnect().await {
@@ -123,40 +304,54 @@ impl Session {
                         break;
                     }
                 }
-                Some(cmd) = self.receiver.recv() => {
-                    if let Err(err) = self.handle_listener_cmd(cmd).await {
-                        log::error!("Failed to handle server packet: {:?}", err);
+                cmd = self.receiver.recv() => {
+                    match cmd {
+                        Some(cmd) => {
+                            if let Err(err) = self.handle_listener_cmds(cmd).await {
+                                log::error!("session: Failed to write to stream: {:?}", err);
+                                break;
+                            }
+                        }
+                        None => {
+                            // Listener closes channel to disconnect a slow client.
+                            log::warn!("session: Channel closed by listener, {}", self.id);
+                            if let Err(err) = self
+                                .send_disconnect_with_reason(v5::ReasonCode::QuotaExceeded)
+                                .await
+                            {
+                                log::error!("session: Failed to send disconnect packet: {:?}", err);
+                            }
+                            break;
+                        }
                     }
                 },
-            }
-
-            // From [MQTT-3.1.2-24]
-            //
-            // If the Keep Alive value is non-zero and the Server does not receive a Control Packet
-            // from the Client within one and a half times the Keep Alive time period,
-            // it MUST disconnect the Network Connection to the Client as if the network had
-            // failed.
-            //
-            // A Keep Alive value of zero (0) has the effect of turning off the keep alive mechanism.
-            // This means that, in this case, the Server is not required to disconnect the Client
-            // on the grounds of inactivity.
-            //
-            // Note that a Server is permitted to disconnect a Client that it determines to be inactive
-            // or non-responsive at any time, regardless of the Keep Alive value provided by that Client.
-            if !self.config.keep_alive().is_zero()
-                && self.instant.elapsed() > self.config.keep_alive()
-            {
-                log::warn!("sessoin: keep_alive time reached, disconnect client!");
-                if let Err(err) = self.send_disconnect().await {
-                    log::error!("session: Failed to send disconnect packet: {:?}", err);
+                _ = time::sleep_until(flush_deadline), if self.flush_deadline.is_some() => {
+                    if let Err(err) = self.flush().await {
+                        log::error!("session: Failed to write to stream: {:?}", err);
+                        break;
+                    }
                 }
-                break;
             }
         }
 
+        // Send remaining packets, like DISCONNECT, before stream is closed.
+        if let Err(err) = self.flush().await {
+            log::error!("session: Failed to write to stream: {:?}", err);
+        }
+        let stats = self.outbound.stats();
+        log::info!(
+            "session: {} sent {} packets, {} bytes in {} writes, {:.3} writes per packet",
+            self.id,
+            stats.packets(),
+            stats.bytes(),
+            stats.writes(),
+            stats.writes_per_packet()
+        );
+
+        let cached_session = self.cached_session();
         if let Err(err) = self
             .sender
-            .send(SessionToListenerCmd::Disconnect(self.id))
+            .send(SessionToListenerCmd::Disconnect(self.id, cached_session))
             .await
         {
             log::error!(
@@ -171,11 +366,55 @@ impl Session {
         // Now session object goes out of scope and stream is dropped.
     }
 
-    /// Reset instant if packet is send to or receive from client.
+    /// Handle `cmd` and all other commands already queued in channel, so that
+    /// their packets are written to stream together.
+    ///
+    /// Returns error only if failed to write to stream.
+    async fn handle_listener_cmds(&mut self, cmd: ListenerToSessionCmd) -> Result<(), Error> {
+        let mut cmd = cmd;
+        for _i in 0..MAX_BATCH_COMMANDS {
+            if let Err(err) = self.handle_listener_cmd(cmd).await {
+                log::error!("Failed to handle server packet: {:?}", err);
+            }
+            if self.outbound.pending_bytes() >= self.config.write_buffer_size() {
+                self.flush().await?;
+            }
+            cmd = match self.receiver.try_recv() {
+                Ok(cmd) => cmd,
+                Err(_err) => break,
+            };
+        }
+
+        if self.config.write_flush_delay().is_zero() {
+            self.flush().await
+        } else {
+            if self.flush_deadline.is_none() && !self.outbound.is_empty() {
+                self.flush_deadline = Some(time::Instant::now() + self.config.write_flush_delay());
+            }
+            Ok(())
+        }
+    }
+
+    /// Write all buffered packets to stream.
+    async fn flush(&mut self) -> Result<(), Error> {
+        self.flush_deadline = None;
+        if !self.outbound.is_empty() {
+            self.outbound.flush(&mut self.stream).await?;
+            self.reset_instant();
+        }
+        self.inflight.decrease(self.pending_publishes);
+        self.pending_publishes = 0;
+        self.inflight.decrease_bytes(self.sent_publish_bytes);
+        self.sent_publish_bytes = 0;
+        Ok(())
+    }
+
+    /// Reset keep alive timer if packet is send to or receive from client.
     fn reset_instant(&mut self) {
-        self.instant = Instant::now();
+        self.timer.touch();
     }
 
+    /// Queue packet to send to client, it is written to stream at next flush.
     pub(super) async fn send<P: EncodePacket + Packet>(&mut self, packet: P) -> Result<(), Error> {
         // The CONNACK Packet is the packet sent by the Server in response to a CONNECT Packet
         // received from a Client. The first packet sent from the Server to the Client MUST be
@@ -200,21 +439,168 @@ impl Session {
             ));
         }
 
-        let mut buf = Vec::new();
-        packet.encode(&mut buf)?;
-        let n_write = self.stream.write(&buf).await?;
-        if n_write != buf.len() {
+        if let Err(err) = self.outbound.push_packet(&packet) {
             log::error!("packet: {:?}", packet);
+            return Err(err.into());
+        }
+        Ok(())
+    }
+
+    /// Send shared publish message to client.
+    ///
+    /// QoS 1 and QoS 2 messages shall be sent with `publish_message()`, which allocates
+    /// packet id and tracks acknowledgement.
+    pub(super) async fn send_publish(
+        &mut self,
+        message: &PublishMessage,
+        qos: QoS,
+        packet_id: PacketId,
+        dup: bool,
+        retain: bool,
+    ) -> Result<(), Error> {
+        if self.status != Status::Connected {
             return Err(Error::from_string(
-                ErrorKind::SocketError,
+                ErrorKind::SendError,
                 format!(
-                    "Failed to send packet, write bytes: {}, total: {}",
-                    n_write,
-                    buf.len()
+                    "session: Cannot send publish packet with status: {:?}",
+                    self.status
                 ),
             ));
         }
-        self.reset_instant();
+
+        if qos == QoS::AtMostOnce {
+            if let Some(max_size) = self.stream.max_datagram_size() {
+                if self.send_publish_datagram(message, retain, max_size) {
+                    return Ok(());
+                }
+            }
+        }
+
+        self.outbound
+            .push_publish(message, self.protocol_level, qos, packet_id, dup, retain)?;
         Ok(())
     }
+
+    /// Send QoS 0 message in an unreliable datagram, without waiting for flush.
+    ///
+    /// Returns false if it shall be sent in stream instead.
+    fn send_publish_datagram(
+        &mut self,
+        message: &PublishMessage,
+        retain: bool,
+        max_size: usize,
+    ) -> bool {
+        // Size is checked before the packet is copied into a datagram.
+        let packet_bytes = message.bytes(self.protocol_level, QoS::AtMostOnce);
+        if packet_bytes > max_size {
+            return false;
+        }
+        let mut buf = Vec::with_capacity(packet_bytes);
+        if message
+            .encode(
+                self.protocol_level,
+                QoS::AtMostOnce,
+                PacketId::new(0),
+                false,
+                retain,
+                &mut buf,
+            )
+            .is_err()
+        {
+            return false;
+        }
+        match self.stream.send_datagram(Bytes::from(buf)) {
+            Ok(()) => true,
+            Err(err) => {
+                log::warn!("session: Failed to send datagram: {:?}, {}", err, self.id);
+                false
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use futures_util::{SinkExt, StreamExt};
+    use std::time::Duration;
+    use tokio::net::{TcpListener, TcpStream};
+    use tokio::sync::{mpsc, watch};
+    use tokio::task::JoinHandle;
+    use tokio_tungstenite::tungstenite::protocol::{Message, Role};
+    use tokio_tungstenite::WebSocketStream;
+
+    use super::{Session, SessionConfig};
+    use crate::acl::AclSnapshot;
+    use crate::commands::{ListenerToSessionCmd, SessionToListenerCmd};
+    use crate::stream::{Stream, WsStream};
+    use crate::types::{InflightCounter, SessionTimer};
+
+    /// Channels to listener are kept open while session is running.
+    struct Channels {
+        _sender: mpsc::Sender<ListenerToSessionCmd>,
+        _receiver: mpsc::Receiver<SessionToListenerCmd>,
+    }
+
+    async fn tcp_pair() -> (TcpStream, TcpStream) {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let client = TcpStream::connect(listener.local_addr().unwrap())
+            .await
+            .unwrap();
+        let (server, _address) = listener.accept().await.unwrap();
+        (server, client)
+    }
+
+    fn spawn_session(stream: Stream) -> (JoinHandle<()>, Channels) {
+        let (sender, receiver) = mpsc::channel(1);
+        let (listener_sender, listener_receiver) = mpsc::channel(1);
+        let (_acl_sender, acl) = watch::channel(AclSnapshot::default());
+        let session = Session::new(
+            1,
+            SessionConfig::new(),
+            stream,
+            sender,
+            listener_receiver,
+            InflightCounter::new(),
+            SessionTimer::new(),
+            acl,
+        );
+        let handle = tokio::spawn(session.run_loop());
+        let channels = Channels {
+            _sender: listener_sender,
+            _receiver: receiver,
+        };
+        (handle, channels)
+    }
+
+    #[tokio::test]
+    async fn test_read_error() {
+        let (server, client) = tcp_pair().await;
+        let (handle, _channels) = spawn_session(Stream::Mqtt(server));
+
+        // Connection is reset by client.
+        client.set_linger(Some(Duration::ZERO)).unwrap();
+        drop(client);
+        tokio::time::timeout(Duration::from_secs(5), handle)
+            .await
+            .expect("Session is not closed")
+            .unwrap();
+    }
+
+    #[tokio::test]
+    async fn test_ws_text_frame() {
+        let (server, client) = tcp_pair().await;
+        let server = WebSocketStream::from_raw_socket(server, Role::Server, None).await;
+        let mut client = WebSocketStream::from_raw_socket(client, Role::Client, None).await;
+        let (handle, _channels) = spawn_session(Stream::Ws(Box::new(WsStream::new(server))));
+
+        client
+            .send(Message::Text("hello".to_string()))
+            .await
+            .unwrap();
+        tokio::time::timeout(Duration::from_secs(5), handle)
+            .await
+            .expect("Session is not closed")
+            .unwrap();
+        assert!(!matches!(client.next().await, Some(Ok(Message::Binary(_)))));
+    }
 }
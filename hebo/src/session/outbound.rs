@@ -0,0 +1,322 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Buffered outgoing packets, flushed to stream with vectored writes.
+
+use bytes::Bytes;
+use codec::{encode_packet, EncodeError, EncodePacket, Packet, PacketId, ProtocolLevel, QoS};
+use std::io::IoSlice;
+
+use crate::error::{Error, ErrorKind};
+use crate::message::PublishMessage;
+use crate::stream::Stream;
+
+/// Payloads smaller than this are copied into the encode buffer, larger ones are
+/// written with their own `IoSlice` without copying.
+const INLINE_PAYLOAD_BYTES: usize = 512;
+
+/// Maximum number of slices passed to one `writev()` call.
+const MAX_IO_SLICES: usize = 64;
+
+#[derive(Debug)]
+enum Segment {
+    /// Byte range in encode buffer.
+    Inline(usize, usize),
+
+    /// Shared publish payload.
+    Shared(Bytes),
+}
+
+/// Counters of outgoing packets and stream writes.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct WriteStats {
+    packets: u64,
+    writes: u64,
+    bytes: u64,
+}
+
+impl WriteStats {
+    #[must_use]
+    pub const fn packets(&self) -> u64 {
+        self.packets
+    }
+
+    /// Number of write calls to stream, each one is a system call for TCP streams.
+    #[must_use]
+    pub const fn writes(&self) -> u64 {
+        self.writes
+    }
+
+    #[must_use]
+    pub const fn bytes(&self) -> u64 {
+        self.bytes
+    }
+
+    #[must_use]
+    pub fn writes_per_packet(&self) -> f64 {
+        if self.packets == 0 {
+            0.0
+        } else {
+            self.writes as f64 / self.packets as f64
+        }
+    }
+}
+
+/// Packets queued to be written to client.
+///
+/// Control packets and publish headers are encoded into one reusable buffer,
+/// and large payloads of shared publish messages are referenced directly.
+/// All of them are written with as few `writev()` calls as possible.
+#[derive(Debug)]
+pub struct OutboundQueue {
+    buf: Vec<u8>,
+    segments: Vec<Segment>,
+
+    /// Start of encode buffer which is not added to `segments` yet.
+    inline_start: usize,
+
+    /// Index of first segment not fully written.
+    index: usize,
+
+    /// Written bytes in segment at `index`.
+    offset: usize,
+
+    pending_bytes: usize,
+    stats: WriteStats,
+}
+
+impl OutboundQueue {
+    #[must_use]
+    pub fn new(capacity: usize) -> Self {
+        Self {
+            buf: Vec::with_capacity(capacity),
+            segments: Vec::new(),
+            inline_start: 0,
+            index: 0,
+            offset: 0,
+            pending_bytes: 0,
+            stats: WriteStats::default(),
+        }
+    }
+
+    #[must_use]
+    pub const fn is_empty(&self) -> bool {
+        self.pending_bytes == 0
+    }
+
+    /// Get number of bytes not written to stream yet.
+    #[must_use]
+    pub const fn pending_bytes(&self) -> usize {
+        self.pending_bytes
+    }
+
+    #[must_use]
+    pub const fn stats(&self) -> &WriteStats {
+        &self.stats
+    }
+
+    /// Encode `packet` into buffer.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if failed to encode packet.
+    pub fn push_packet<P: EncodePacket + Packet>(
+        &mut self,
+        packet: &P,
+    ) -> Result<usize, EncodeError> {
+        let old_len = self.buf.len();
+        if let Err(err) = encode_packet(packet, &mut self.buf) {
+            self.buf.truncate(old_len);
+            return Err(err);
+        }
+        let n_bytes = self.buf.len() - old_len;
+        self.pending_bytes += n_bytes;
+        self.stats.packets += 1;
+        Ok(n_bytes)
+    }
+
+    /// Encode header of shared publish `message` into buffer, and append its payload.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if failed to encode packet.
+    pub fn push_publish(
+        &mut self,
+        message: &PublishMessage,
+        protocol_level: ProtocolLevel,
+        qos: QoS,
+        packet_id: PacketId,
+        dup: bool,
+        retain: bool,
+    ) -> Result<usize, EncodeError> {
+        let old_len = self.buf.len();
+        let header_bytes =
+            match message.encode_header(protocol_level, qos, packet_id, dup, retain, &mut self.buf)
+            {
+                Ok(n_bytes) => n_bytes,
+                Err(err) => {
+                    self.buf.truncate(old_len);
+                    return Err(err);
+                }
+            };
+
+        let payload = message.payload();
+        if payload.len() < INLINE_PAYLOAD_BYTES {
+            self.buf.extend_from_slice(payload);
+        } else {
+            self.seal_inline();
+            self.segments.push(Segment::Shared(payload.clone()));
+        }
+        let n_bytes = header_bytes + payload.len();
+        self.pending_bytes += n_bytes;
+        self.stats.packets += 1;
+        Ok(n_bytes)
+    }
+
+    /// Write all queued packets to `stream`.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if stream gets error.
+    pub async fn flush(&mut self, stream: &mut Stream) -> Result<usize, Error> {
+        self.seal_inline();
+        let total = self.pending_bytes;
+
+        while self.index < self.segments.len() {
+            let mut slices = [IoSlice::new(&[]); MAX_IO_SLICES];
+            let count = self.fill_slices(&mut slices);
+            let n_write = stream.write_vectored(&slices[..count]).await?;
+            self.stats.writes += 1;
+            if n_write == 0 {
+                return Err(Error::from_string(
+                    ErrorKind::SocketError,
+                    format!(
+                        "Failed to send packets, remaining bytes: {}",
+                        self.pending_bytes
+                    ),
+                ));
+            }
+            self.advance(n_write);
+        }
+        stream.flush().await?;
+
+        self.stats.bytes += total as u64;
+        self.clear();
+        Ok(total)
+    }
+
+    /// Move bytes of encode buffer after last segment to a new segment.
+    fn seal_inline(&mut self) {
+        if self.buf.len() > self.inline_start {
+            self.segments
+                .push(Segment::Inline(self.inline_start, self.buf.len()));
+            self.inline_start = self.buf.len();
+        }
+    }
+
+    fn segment_bytes<'a>(&'a self, segment: &'a Segment) -> &'a [u8] {
+        match segment {
+            Segment::Inline(start, end) => &self.buf[*start..*end],
+            Segment::Shared(bytes) => bytes,
+        }
+    }
+
+    /// Fill `slices` with unwritten segments, returns number of slices filled.
+    fn fill_slices<'a>(&'a self, slices: &mut [IoSlice<'a>]) -> usize {
+        let mut count = 0;
+        for (slice, segment) in slices.iter_mut().zip(&self.segments[self.index..]) {
+            let bytes = self.segment_bytes(segment);
+            *slice = if count == 0 {
+                IoSlice::new(&bytes[self.offset..])
+            } else {
+                IoSlice::new(bytes)
+            };
+            count += 1;
+        }
+        count
+    }
+
+    /// Mark `n_bytes` as written.
+    fn advance(&mut self, mut n_bytes: usize) {
+        self.pending_bytes -= n_bytes;
+        while n_bytes > 0 && self.index < self.segments.len() {
+            let remaining = self.segment_bytes(&self.segments[self.index]).len() - self.offset;
+            if n_bytes >= remaining {
+                n_bytes -= remaining;
+                self.index += 1;
+                self.offset = 0;
+            } else {
+                self.offset += n_bytes;
+                n_bytes = 0;
+            }
+        }
+    }
+
+    /// Reset queue, capacity of encode buffer is kept.
+    fn clear(&mut self) {
+        self.buf.clear();
+        self.segments.clear();
+        self.inline_start = 0;
+        self.index = 0;
+        self.offset = 0;
+        self.pending_bytes = 0;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use codec::v3;
+
+    use super::*;
+
+    #[test]
+    fn test_partial_writes() {
+        let mut queue = OutboundQueue::new(64);
+        let mut expected = Vec::new();
+
+        let ack = v3::PublishAckPacket::new(PacketId::new(1));
+        queue.push_packet(&ack).unwrap();
+        ack.encode(&mut expected).unwrap();
+
+        let payload = vec![42_u8; INLINE_PAYLOAD_BYTES * 2];
+        let packet = v3::PublishPacket::new("a/b", QoS::AtMostOnce, &payload).unwrap();
+        let message = PublishMessage::from_v3(&packet);
+        queue
+            .push_publish(
+                &message,
+                ProtocolLevel::V4,
+                QoS::AtMostOnce,
+                PacketId::new(0),
+                false,
+                false,
+            )
+            .unwrap();
+        packet.encode(&mut expected).unwrap();
+
+        queue.push_packet(&ack).unwrap();
+        ack.encode(&mut expected).unwrap();
+        queue.seal_inline();
+        assert_eq!(queue.segments.len(), 3);
+        assert_eq!(queue.pending_bytes(), expected.len());
+
+        // Simulate short writes of a stream.
+        let mut written = Vec::new();
+        while !queue.is_empty() {
+            let mut slices = [IoSlice::new(&[]); MAX_IO_SLICES];
+            let count = queue.fill_slices(&mut slices);
+            let mut n_write = 0;
+            for slice in &slices[..count] {
+                let n = slice.len().min(100 - n_write);
+                written.extend_from_slice(&slice[..n]);
+                n_write += n;
+                if n_write == 100 {
+                    break;
+                }
+            }
+            queue.advance(n_write);
+        }
+        assert_eq!(written, expected);
+        assert_eq!(queue.stats().packets(), 3);
+    }
+}
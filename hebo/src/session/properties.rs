@@ -5,7 +5,7 @@
 use codec::v5;
 
 use super::Session;
-use crate::error::Error;
+use crate::error::{Error, ErrorKind};
 
 impl Session {
     /// Handle properties in connect packet.
@@ -19,8 +19,17 @@ impl Session {
                     self.config.set_session_expiry_interval(interval.value());
                 }
                 v5::Property::ReceiveMaximum(receive) => {
-                    // TODO(Shaohua): Check receive > 0
-                    self.config.set_maximum_inflight_messages(receive.value());
+                    // The Client uses this value to limit the number of QoS 1 and QoS 2
+                    // publications that it is willing to process concurrently.
+                    // It is a Protocol Error to include the Receive Maximum value more than
+                    // once or for it to have the value 0.
+                    if receive.value() == 0 {
+                        return Err(Error::new(
+                            ErrorKind::DecodeError,
+                            "session: Receive Maximum is 0",
+                        ));
+                    }
+                    self.config.set_receive_maximum(receive.value());
                 }
                 v5::Property::MaximumPacketSize(packet_size) => {
                     self.config.set_maximum_packet_size(packet_size.value());
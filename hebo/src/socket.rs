@@ -4,12 +4,22 @@
 
 #![allow(clippy::module_name_repetitions)]
 
-use std::net::UdpSocket;
+use std::net::{SocketAddr, UdpSocket};
 use std::os::unix::io::{AsRawFd, RawFd};
-use tokio::net::TcpListener;
+use std::thread;
+use std::time::Duration;
+use tokio::net::{TcpListener, TcpSocket, TcpStream};
+use tokio::sync::mpsc;
 
+use crate::config::SocketOptions;
 use crate::error::{Error, ErrorKind};
 
+/// Number of accepted sockets waiting to be handled by owner of `AcceptorPool`.
+const ACCEPTOR_CHANNEL_CAPACITY: usize = 64;
+
+/// Delay before calling accept() again if it failed.
+const ACCEPT_ERROR_DELAY: Duration = Duration::from_millis(10);
+
 fn bind_device(socket_fd: RawFd, device: &str) -> Result<(), Error> {
     if !device.is_empty() {
         unsafe {
@@ -37,32 +47,233 @@ fn bind_device(socket_fd: RawFd, device: &str) -> Result<(), Error> {
     Ok(())
 }
 
-fn enable_fast_open(socket_fd: RawFd) -> Result<(), Error> {
+/// Set an integer socket option.
+fn set_option(
+    socket_fd: RawFd,
+    level: i32,
+    name: i32,
+    value: u32,
+    option_name: &str,
+) -> Result<(), Error> {
+    let value = i32::try_from(value).unwrap_or(i32::MAX);
+    let value_ptr = std::ptr::addr_of!(value) as usize;
+
+    unsafe {
+        #[allow(clippy::cast_possible_truncation)]
+        let len = std::mem::size_of_val(&value) as u32;
+        nc::setsockopt(socket_fd, level, name, value_ptr, len).map_err(|errno| {
+            Error::from_string(
+                ErrorKind::KernelError,
+                format!(
+                    "Failed to set socket option {} to {}, got err: {}",
+                    option_name,
+                    value,
+                    nc::strerror(errno)
+                ),
+            )
+        })
+    }
+}
+
+fn enable_fast_open(socket_fd: RawFd, queue_len: u32) -> Result<(), Error> {
+    if queue_len == 0 {
+        return Ok(());
+    }
     // For Linux, value is the queue length of pending packets.
-    //
-    // TODO(Shaohua): Add a config option
     #[cfg(target_os = "linux")]
-    let queue_len: i32 = 5;
+    let value = queue_len;
     // For the others, just a boolean value for enable and disable.
     #[cfg(not(target_os = "linux"))]
-    let queue_len: i32 = 1;
-    let queue_len_ptr = std::ptr::addr_of!(queue_len) as usize;
+    let value = 1;
 
-    unsafe {
-        #[allow(clippy::cast_possible_truncation)]
-        let len = std::mem::size_of_val(&queue_len) as u32;
-        nc::setsockopt(
+    set_option(
+        socket_fd,
+        nc::IPPROTO_TCP,
+        nc::TCP_FASTOPEN,
+        value,
+        "TCP_FASTOPEN",
+    )
+}
+
+fn set_buffer_sizes(socket_fd: RawFd, options: &SocketOptions) -> Result<(), Error> {
+    if options.recv_buffer_size() > 0 {
+        set_option(
+            socket_fd,
+            nc::SOL_SOCKET,
+            nc::SO_RCVBUF,
+            options.recv_buffer_size(),
+            "SO_RCVBUF",
+        )?;
+    }
+    if options.send_buffer_size() > 0 {
+        set_option(
+            socket_fd,
+            nc::SOL_SOCKET,
+            nc::SO_SNDBUF,
+            options.send_buffer_size(),
+            "SO_SNDBUF",
+        )?;
+    }
+    Ok(())
+}
+
+/// Set options of an accepted client socket.
+///
+/// `no_delay` overrides `options.no_delay()`, as it may be set in general section.
+///
+/// # Errors
+///
+/// Returns error if failed to set any of these options.
+pub fn set_stream_options(
+    stream: &TcpStream,
+    options: &SocketOptions,
+    no_delay: bool,
+) -> Result<(), Error> {
+    if no_delay {
+        stream.set_nodelay(true)?;
+    }
+    let socket_fd = stream.as_raw_fd();
+    set_buffer_sizes(socket_fd, options)?;
+
+    if options.keep_alive() {
+        set_option(
+            socket_fd,
+            nc::SOL_SOCKET,
+            nc::SO_KEEPALIVE,
+            1,
+            "SO_KEEPALIVE",
+        )?;
+        let probes = [
+            (nc::TCP_KEEPIDLE, options.keep_alive_idle(), "TCP_KEEPIDLE"),
+            (
+                nc::TCP_KEEPINTVL,
+                options.keep_alive_interval(),
+                "TCP_KEEPINTVL",
+            ),
+            (nc::TCP_KEEPCNT, options.keep_alive_count(), "TCP_KEEPCNT"),
+        ];
+        for (name, value, option_name) in probes {
+            if value > 0 {
+                set_option(socket_fd, nc::IPPROTO_TCP, name, value, option_name)?;
+            }
+        }
+    }
+
+    #[cfg(target_os = "linux")]
+    if options.user_timeout() > 0 {
+        set_option(
             socket_fd,
             nc::IPPROTO_TCP,
-            nc::TCP_FASTOPEN,
-            queue_len_ptr,
-            len,
+            nc::TCP_USER_TIMEOUT,
+            options.user_timeout(),
+            "TCP_USER_TIMEOUT",
+        )?;
+    }
+
+    Ok(())
+}
+
+fn bind_tcp_socket(
+    addr: SocketAddr,
+    device: &str,
+    backlog: u32,
+    options: &SocketOptions,
+    reuse_port: bool,
+) -> Result<TcpListener, Error> {
+    let socket = if addr.is_ipv4() {
+        TcpSocket::new_v4()?
+    } else {
+        TcpSocket::new_v6()?
+    };
+    socket.set_reuseaddr(true)?;
+    if reuse_port {
+        socket.set_reuseport(true)?;
+    }
+    let socket_fd: RawFd = socket.as_raw_fd();
+    bind_device(socket_fd, device)?;
+    // Buffer sizes shall be set before listen(), window scale is negotiated in
+    // the handshake.
+    set_buffer_sizes(socket_fd, options)?;
+    socket.bind(addr)?;
+    let listener = socket.listen(backlog)?;
+
+    enable_fast_open(socket_fd, options.fast_open_queue_len())?;
+
+    Ok(listener)
+}
+
+/// Create a new tcp server socket at `address` and binds to `device`.
+///
+/// `backlog` is maximum length of queue of pending connections.
+///
+/// # Errors
+///
+/// Returns error if socket `address` is invalid or failed to bind to specific `device`.
+pub async fn new_tcp_listener(
+    address: &str,
+    device: &str,
+    backlog: u32,
+    options: &SocketOptions,
+) -> Result<TcpListener, Error> {
+    let mut listeners = new_tcp_listeners(address, device, backlog, options, 1).await?;
+    Ok(listeners.remove(0))
+}
+
+/// Create `count` tcp server sockets sharing the same `address`, with `SO_REUSEPORT`.
+///
+/// Kernel distributes new connections among these sockets. If port in `address`
+/// is 0, all sockets use the port picked for the first one.
+///
+/// # Errors
+///
+/// Returns error if socket `address` is invalid or failed to bind to specific `device`.
+pub async fn new_tcp_listeners(
+    address: &str,
+    device: &str,
+    backlog: u32,
+    options: &SocketOptions,
+    count: usize,
+) -> Result<Vec<TcpListener>, Error> {
+    let addr: SocketAddr = tokio::net::lookup_host(address)
+        .await?
+        .next()
+        .ok_or_else(|| {
+            Error::from_string(
+                ErrorKind::SocketError,
+                format!("Invalid socket address: {}", address),
+            )
+        })?;
+    let reuse_port = count > 1;
+    let first = bind_tcp_socket(addr, device, backlog, options, reuse_port)?;
+    let addr = first.local_addr()?;
+    let mut listeners = vec![first];
+    for _i in 1..count {
+        listeners.push(bind_tcp_socket(addr, device, backlog, options, reuse_port)?);
+    }
+    Ok(listeners)
+}
+
+/// Pin current thread to `cpu`.
+///
+/// # Errors
+///
+/// Returns error if `cpu` is invalid.
+pub fn set_cpu_affinity(cpu: usize) -> Result<(), Error> {
+    let mut cpu_set = nc::cpu_set_t::default();
+    cpu_set.set(cpu).map_err(|errno| {
+        Error::from_string(
+            ErrorKind::ParameterError,
+            format!("Invalid cpu: {}, err: {}", cpu, nc::strerror(errno)),
         )
-        .map_err(|errno| {
+    })?;
+    // pid 0 means the calling thread.
+    unsafe {
+        nc::sched_setaffinity(0, &cpu_set).map_err(|errno| {
             Error::from_string(
                 ErrorKind::KernelError,
                 format!(
-                    "Failed to enable socket fast open, got err: {}",
+                    "Failed to set cpu affinity to {}, err: {}",
+                    cpu,
                     nc::strerror(errno)
                 ),
             )
@@ -70,22 +281,119 @@ fn enable_fast_open(socket_fd: RawFd) -> Result<(), Error> {
     }
 }
 
-/// Create a new tcp server socket at `address` and binds to `device`.
-///
-/// # Errors
+type AcceptedSocket = (std::net::TcpStream, SocketAddr);
+
+/// Accept tcp sockets in dedicated threads.
 ///
-/// Returns error if socket `address` is invalid or failed to bind to specific `device`.
-pub async fn new_tcp_listener(address: &str, device: &str) -> Result<TcpListener, Error> {
-    let listener = TcpListener::bind(address).await?;
-    let socket_fd: RawFd = listener.as_raw_fd();
+/// Each socket of a `SO_REUSEPORT` group is accepted in its own thread, which may be
+/// pinned to a cpu. Accepted sockets are handed to the owner of the pool, so that
+/// accept() syscalls of a busy listener are spread over several cores.
+#[derive(Debug)]
+pub struct AcceptorPool {
+    /// Sockets not handled by threads yet, threads are started on first accept().
+    listeners: Vec<std::net::TcpListener>,
+    cpu_affinity: Vec<usize>,
+    sender: Option<mpsc::Sender<AcceptedSocket>>,
+    receiver: mpsc::Receiver<AcceptedSocket>,
+}
 
-    bind_device(socket_fd, device)?;
-    enable_fast_open(socket_fd)?;
+impl AcceptorPool {
+    /// Create a pool with sockets returned from `new_tcp_listeners()`.
+    ///
+    /// Acceptor threads are pinned to cpus in `cpu_affinity` in turn, or are not
+    /// pinned if it is empty.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if failed to convert sockets.
+    pub fn new(listeners: Vec<TcpListener>, cpu_affinity: Vec<usize>) -> Result<Self, Error> {
+        let listeners = listeners
+            .into_iter()
+            .map(|listener| {
+                let listener = listener.into_std()?;
+                // Accepted with blocking syscall in acceptor threads.
+                listener.set_nonblocking(false)?;
+                Ok(listener)
+            })
+            .collect::<Result<Vec<_>, Error>>()?;
+        // Threads are blocked once this queue is full, and pending connections are
+        // kept in backlog of kernel.
+        let (sender, receiver) = mpsc::channel(ACCEPTOR_CHANNEL_CAPACITY);
+        Ok(Self {
+            listeners,
+            cpu_affinity,
+            sender: Some(sender),
+            receiver,
+        })
+    }
 
-    // TODO(Shaohua): Tuning tcp keep alive flag.
-    // TODO(Shaohua): Tuning cpu affinity flag.
+    fn start(&mut self) {
+        let sender = match self.sender.take() {
+            Some(sender) => sender,
+            None => return,
+        };
+        for (index, listener) in self.listeners.drain(..).enumerate() {
+            let cpu = if self.cpu_affinity.is_empty() {
+                None
+            } else {
+                Some(self.cpu_affinity[index % self.cpu_affinity.len()])
+            };
+            let sender = sender.clone();
+            let ret = thread::Builder::new()
+                .name(format!("hebo-acceptor-{}", index))
+                .spawn(move || run_acceptor(&listener, cpu, &sender));
+            if let Err(err) = ret {
+                log::error!("Failed to spawn acceptor thread #{}: {:?}", index, err);
+            }
+        }
+    }
 
-    Ok(listener)
+    /// Get a new socket accepted by one of acceptor threads.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if all acceptor threads exited.
+    pub async fn accept(&mut self) -> Result<(TcpStream, SocketAddr), Error> {
+        if self.sender.is_some() {
+            self.start();
+        }
+        let (stream, address) = self
+            .receiver
+            .recv()
+            .await
+            .ok_or_else(|| Error::new(ErrorKind::SocketError, "All acceptor threads exited"))?;
+        stream.set_nonblocking(true)?;
+        let stream = TcpStream::from_std(stream)?;
+        Ok((stream, address))
+    }
+}
+
+fn run_acceptor(
+    listener: &std::net::TcpListener,
+    cpu: Option<usize>,
+    sender: &mpsc::Sender<AcceptedSocket>,
+) {
+    if let Some(cpu) = cpu {
+        if let Err(err) = set_cpu_affinity(cpu) {
+            log::warn!("acceptor: {:?}", err);
+        }
+    }
+
+    loop {
+        match listener.accept() {
+            Ok(socket) => {
+                if sender.blocking_send(socket).is_err() {
+                    log::info!("acceptor: Pool is dropped, exit");
+                    return;
+                }
+            }
+            Err(err) => {
+                log::error!("acceptor: Failed to accept socket: {:?}", err);
+                // Usually running out of file descriptors, do not spin.
+                thread::sleep(ACCEPT_ERROR_DELAY);
+            }
+        }
+    }
 }
 
 /// Create a new udp socket at `address` and binds to `device`.
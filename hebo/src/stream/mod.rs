@@ -0,0 +1,140 @@
+// Copyright (c) 2021 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+use bytes::{Bytes, BytesMut};
+use std::io::IoSlice;
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::net::{TcpStream, UnixStream};
+use tokio_rustls::server::TlsStream;
+
+use crate::error::{Error, ErrorKind};
+
+mod quic;
+mod ws;
+
+pub use quic::QuicStream;
+pub use ws::WsStream;
+
+/// Each Stream represents a duplex socket connection to client.
+#[derive(Debug)]
+pub enum Stream {
+    Mqtt(TcpStream),
+    Mqtts(Box<TlsStream<TcpStream>>),
+    Ws(Box<WsStream<TcpStream>>),
+    Wss(Box<WsStream<TlsStream<TcpStream>>>),
+    Uds(UnixStream),
+    Quic(Box<QuicStream>),
+}
+
+impl Stream {
+    /// Read from stream.
+    ///
+    /// `in_packet` is true if part of a packet has been read and moved out of `buf`,
+    /// following bytes from stream belong to that packet.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if stream/socket gets error.
+    pub async fn read_buf(&mut self, buf: &mut BytesMut, in_packet: bool) -> Result<usize, Error> {
+        match self {
+            Stream::Mqtt(ref mut tcp_stream) => Ok(tcp_stream.read_buf(buf).await?),
+            Stream::Mqtts(ref mut tls_stream) => Ok(tls_stream.read_buf(buf).await?),
+            Stream::Ws(ref mut ws_stream) => Ok(ws_stream.read_buf(buf).await?),
+            Stream::Wss(ref mut wss_stream) => Ok(wss_stream.read_buf(buf).await?),
+            Stream::Uds(ref mut uds_stream) => Ok(uds_stream.read_buf(buf).await?),
+            Stream::Quic(ref mut quic_stream) => quic_stream.read_buf(buf, in_packet).await,
+        }
+    }
+
+    /// Write buffer to stream.
+    ///
+    /// Websocket streams send the buffer in a frame at once.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if socket/stream gets error.
+    pub async fn write(&mut self, buf: &[u8]) -> Result<usize, Error> {
+        match self {
+            Stream::Mqtt(tcp_stream) => Ok(tcp_stream.write(buf).await?),
+            Stream::Mqtts(tls_stream) => Ok(tls_stream.write(buf).await?),
+            Stream::Ws(ws_stream) => {
+                let n_bytes = ws_stream.write(buf).await?;
+                ws_stream.flush().await?;
+                Ok(n_bytes)
+            }
+            Stream::Wss(wss_stream) => {
+                let n_bytes = wss_stream.write(buf).await?;
+                wss_stream.flush().await?;
+                Ok(n_bytes)
+            }
+            Stream::Uds(uds_stream) => Ok(uds_stream.write(buf).await?),
+            Stream::Quic(quic_stream) => quic_stream.write(buf).await,
+        }
+    }
+
+    /// Write a list of buffers to stream.
+    ///
+    /// TCP and unix domain socket streams use `writev()`, and QUIC stream writes
+    /// the buffers without copying them together. Websocket streams append
+    /// the buffers to next frame, which is sent on `flush()`.
+    ///
+    /// Returns number of bytes written, which may be less than total length of `bufs`.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if socket/stream gets error.
+    pub async fn write_vectored(&mut self, bufs: &[IoSlice<'_>]) -> Result<usize, Error> {
+        match self {
+            Stream::Mqtt(tcp_stream) => Ok(tcp_stream.write_vectored(bufs).await?),
+            Stream::Mqtts(tls_stream) => Ok(tls_stream.write_vectored(bufs).await?),
+            Stream::Uds(uds_stream) => Ok(uds_stream.write_vectored(bufs).await?),
+            Stream::Ws(ws_stream) => Ok(ws_stream.write_vectored(bufs).await?),
+            Stream::Wss(wss_stream) => Ok(wss_stream.write_vectored(bufs).await?),
+            Stream::Quic(quic_stream) => quic_stream.write_vectored(bufs).await,
+        }
+    }
+
+    /// Send buffered bytes to client.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if socket/stream gets error.
+    pub async fn flush(&mut self) -> Result<(), Error> {
+        match self {
+            Stream::Mqtt(tcp_stream) => Ok(tcp_stream.flush().await?),
+            Stream::Mqtts(tls_stream) => Ok(tls_stream.flush().await?),
+            Stream::Ws(ws_stream) => Ok(ws_stream.flush().await?),
+            Stream::Wss(wss_stream) => Ok(wss_stream.flush().await?),
+            Stream::Uds(uds_stream) => Ok(uds_stream.flush().await?),
+            // QUIC stream is not buffered.
+            Stream::Quic(_quic_stream) => Ok(()),
+        }
+    }
+
+    /// Get maximum size of a packet which can be sent in an unreliable datagram.
+    ///
+    /// Returns None if this stream does not send datagrams.
+    #[must_use]
+    pub fn max_datagram_size(&self) -> Option<usize> {
+        match self {
+            Stream::Quic(quic_stream) => quic_stream.max_datagram_size(),
+            _ => None,
+        }
+    }
+
+    /// Send a packet in an unreliable datagram.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if datagrams are not supported by this stream.
+    pub fn send_datagram(&self, packet: Bytes) -> Result<(), Error> {
+        match self {
+            Stream::Quic(quic_stream) => quic_stream.send_datagram(packet),
+            _ => Err(Error::new(
+                ErrorKind::SocketError,
+                "Datagram is not supported by stream",
+            )),
+        }
+    }
+}
@@ -0,0 +1,154 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! MQTT over QUIC.
+//!
+//! Client opens one bidirectional stream right after the connection is established,
+//! and MQTT packets are sent on it as on a tcp stream. Opening a stream per packet
+//! costs a round of stream setup and flow control per PUBLISH.
+//!
+//! Besides this stream, both sides may send QoS 0 PUBLISH packets in unreliable
+//! datagrams, one packet per datagram.
+
+use bytes::{Bytes, BytesMut};
+use futures_util::StreamExt;
+use std::collections::VecDeque;
+use std::fmt;
+use std::io::IoSlice;
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+
+use crate::error::{Error, ErrorKind};
+
+/// Maximum number of received datagrams waiting for a partial packet in read buffer.
+const MAX_PENDING_DATAGRAMS: usize = 64;
+
+pub struct QuicStream {
+    connection: quinn::Connection,
+    send: quinn::SendStream,
+    recv: quinn::RecvStream,
+
+    datagrams: quinn::Datagrams,
+
+    /// Datagrams received while part of a packet has been read.
+    pending_datagrams: VecDeque<Bytes>,
+
+    /// Send QoS 0 messages in datagrams if possible.
+    send_datagrams: bool,
+}
+
+impl fmt::Debug for QuicStream {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("QuicStream")
+            .field("remote_address", &self.connection.remote_address())
+            .field("pending_datagrams", &self.pending_datagrams.len())
+            .field("send_datagrams", &self.send_datagrams)
+            .finish()
+    }
+}
+
+impl QuicStream {
+    /// Wait for client to open the bidirectional stream of MQTT packets.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if connection is closed before that stream is opened.
+    pub async fn accept(
+        connection: quinn::NewConnection,
+        send_datagrams: bool,
+    ) -> Result<Self, Error> {
+        let quinn::NewConnection {
+            connection,
+            mut bi_streams,
+            datagrams,
+            ..
+        } = connection;
+        let (send, recv) = bi_streams.next().await.ok_or_else(|| {
+            Error::new(
+                ErrorKind::SocketError,
+                "Quic connection closed before stream is opened",
+            )
+        })??;
+        Ok(Self {
+            connection,
+            send,
+            recv,
+            datagrams,
+            pending_datagrams: VecDeque::new(),
+            send_datagrams,
+        })
+    }
+
+    /// Read from stream or datagrams.
+    ///
+    /// Each datagram contains a whole packet, it is appended to `buf` only if
+    /// there is no partial packet, neither in `buf` nor moved out of it as
+    /// `in_packet` tells.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if connection gets error.
+    pub async fn read_buf(&mut self, buf: &mut BytesMut, in_packet: bool) -> Result<usize, Error> {
+        let accept_datagram = |buf: &BytesMut| !in_packet && buf.is_empty();
+        if accept_datagram(buf) {
+            if let Some(datagram) = self.pending_datagrams.pop_front() {
+                buf.extend_from_slice(&datagram);
+                return Ok(datagram.len());
+            }
+        }
+
+        loop {
+            let datagram = tokio::select! {
+                ret = self.recv.read_buf(buf) => return Ok(ret?),
+                Some(datagram) = self.datagrams.next() => datagram?,
+            };
+            if accept_datagram(buf) {
+                buf.extend_from_slice(&datagram);
+                return Ok(datagram.len());
+            }
+            if self.pending_datagrams.len() >= MAX_PENDING_DATAGRAMS {
+                // QoS 0 messages may be lost.
+                log::warn!("quic: Too many pending datagrams, drop the oldest one");
+                self.pending_datagrams.pop_front();
+            }
+            self.pending_datagrams.push_back(datagram);
+        }
+    }
+
+    /// Write to stream.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if connection gets error.
+    pub async fn write(&mut self, buf: &[u8]) -> Result<usize, Error> {
+        Ok(self.send.write(buf).await?)
+    }
+
+    /// Write a list of buffers to stream.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if connection gets error.
+    pub async fn write_vectored(&mut self, bufs: &[IoSlice<'_>]) -> Result<usize, Error> {
+        Ok(AsyncWriteExt::write_vectored(&mut self.send, bufs).await?)
+    }
+
+    /// Get maximum size of a datagram, returns None if datagrams shall not be sent.
+    #[must_use]
+    pub fn max_datagram_size(&self) -> Option<usize> {
+        if self.send_datagrams {
+            self.connection.max_datagram_size()
+        } else {
+            None
+        }
+    }
+
+    /// Send a packet in a datagram.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if datagram is too large or not supported by client.
+    pub fn send_datagram(&self, packet: Bytes) -> Result<(), Error> {
+        Ok(self.connection.send_datagram(packet)?)
+    }
+}
@@ -0,0 +1,170 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! MQTT over WebSocket, as a byte stream.
+//!
+//! A single WebSocket data frame can contain multiple or partial MQTT Control
+//! Packets [MQTT-6.0.0-2], so frames are read into a byte stream for packet
+//! decoder, and packets written before a flush are sent in one binary frame.
+
+use bytes::{Buf, Bytes};
+use futures_util::{ready, Sink, StreamExt};
+use std::fmt;
+use std::io::{self, IoSlice};
+use std::pin::Pin;
+use std::task::{Context, Poll};
+use tokio::io::{AsyncRead, AsyncWrite, ReadBuf};
+use tokio_tungstenite::tungstenite::{self, protocol::Message};
+use tokio_tungstenite::WebSocketStream;
+
+/// Buffered bytes are sent in a frame when this size is reached, even before flush.
+const MAX_FRAME_SIZE: usize = 64 * 1024;
+
+pub struct WsStream<S> {
+    inner: WebSocketStream<S>,
+
+    /// Remaining bytes of last binary frame received.
+    read_buf: Bytes,
+
+    /// Bytes to be sent in next binary frame.
+    write_buf: Vec<u8>,
+}
+
+impl<S> fmt::Debug for WsStream<S> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("WsStream")
+            .field("read_buf", &self.read_buf.len())
+            .field("write_buf", &self.write_buf.len())
+            .finish()
+    }
+}
+
+fn to_io_error(err: tungstenite::Error) -> io::Error {
+    match err {
+        tungstenite::Error::Io(err) => err,
+        err => io::Error::new(io::ErrorKind::Other, err),
+    }
+}
+
+impl<S> WsStream<S> {
+    #[must_use]
+    pub fn new(inner: WebSocketStream<S>) -> Self {
+        Self {
+            inner,
+            read_buf: Bytes::new(),
+            write_buf: Vec::new(),
+        }
+    }
+}
+
+impl<S> WsStream<S>
+where
+    S: AsyncRead + AsyncWrite + Unpin,
+{
+    /// Move buffered bytes into a binary frame, without flushing the socket.
+    fn poll_send_frame(&mut self, cx: &mut Context<'_>) -> Poll<io::Result<()>> {
+        if self.write_buf.is_empty() {
+            return Poll::Ready(Ok(()));
+        }
+        ready!(Pin::new(&mut self.inner).poll_ready(cx)).map_err(to_io_error)?;
+        let data = std::mem::take(&mut self.write_buf);
+        Pin::new(&mut self.inner)
+            .start_send(Message::Binary(data))
+            .map_err(to_io_error)?;
+        Poll::Ready(Ok(()))
+    }
+}
+
+impl<S> AsyncRead for WsStream<S>
+where
+    S: AsyncRead + AsyncWrite + Unpin,
+{
+    fn poll_read(
+        self: Pin<&mut Self>,
+        cx: &mut Context<'_>,
+        buf: &mut ReadBuf<'_>,
+    ) -> Poll<io::Result<()>> {
+        let this = self.get_mut();
+        loop {
+            if !this.read_buf.is_empty() {
+                let n_bytes = buf.remaining().min(this.read_buf.len());
+                buf.put_slice(&this.read_buf[..n_bytes]);
+                this.read_buf.advance(n_bytes);
+                return Poll::Ready(Ok(()));
+            }
+
+            match ready!(this.inner.poll_next_unpin(cx)) {
+                Some(Ok(Message::Binary(data))) => this.read_buf = Bytes::from(data),
+                Some(Ok(Message::Text(_))) => {
+                    // MQTT Control Packets MUST be sent in WebSocket binary data frames.
+                    // If any other type of data frame is received the recipient MUST
+                    // close the Network Connection [MQTT-6.0.0-1].
+                    return Poll::Ready(Err(io::Error::new(
+                        io::ErrorKind::InvalidData,
+                        "Got text frame in websocket",
+                    )));
+                }
+                Some(Ok(Message::Close(_))) | None => return Poll::Ready(Ok(())),
+                // Ping frames are answered by tungstenite.
+                Some(Ok(_)) => (),
+                Some(Err(err)) => return Poll::Ready(Err(to_io_error(err))),
+            }
+        }
+    }
+}
+
+impl<S> AsyncWrite for WsStream<S>
+where
+    S: AsyncRead + AsyncWrite + Unpin,
+{
+    fn poll_write(
+        self: Pin<&mut Self>,
+        cx: &mut Context<'_>,
+        buf: &[u8],
+    ) -> Poll<io::Result<usize>> {
+        let this = self.get_mut();
+        if this.write_buf.len() >= MAX_FRAME_SIZE {
+            ready!(this.poll_send_frame(cx))?;
+        }
+        this.write_buf.extend_from_slice(buf);
+        Poll::Ready(Ok(buf.len()))
+    }
+
+    fn poll_write_vectored(
+        self: Pin<&mut Self>,
+        cx: &mut Context<'_>,
+        bufs: &[IoSlice<'_>],
+    ) -> Poll<io::Result<usize>> {
+        let this = self.get_mut();
+        if this.write_buf.len() >= MAX_FRAME_SIZE {
+            ready!(this.poll_send_frame(cx))?;
+        }
+        let mut n_bytes = 0;
+        for buf in bufs {
+            this.write_buf.extend_from_slice(buf);
+            n_bytes += buf.len();
+        }
+        Poll::Ready(Ok(n_bytes))
+    }
+
+    fn is_write_vectored(&self) -> bool {
+        true
+    }
+
+    fn poll_flush(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<io::Result<()>> {
+        let this = self.get_mut();
+        ready!(this.poll_send_frame(cx))?;
+        Pin::new(&mut this.inner)
+            .poll_flush(cx)
+            .map_err(to_io_error)
+    }
+
+    fn poll_shutdown(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<io::Result<()>> {
+        let this = self.get_mut();
+        ready!(this.poll_send_frame(cx))?;
+        Pin::new(&mut this.inner)
+            .poll_close(cx)
+            .map_err(to_io_error)
+    }
+}
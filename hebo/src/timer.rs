@@ -0,0 +1,217 @@
+// Copyright (c) 2022 Xu Shaohua <shaohua@biofan.org>. All rights reserved.
+// Use of this source is governed by Affero General Public License that can be found
+// in the LICENSE file.
+
+//! Hierarchical timing wheel.
+//!
+//! Timers of all sessions in a listener are kept in one wheel, instead of one
+//! tokio timer per session. Inserting a timer is O(1), and each timer is moved
+//! to a lower level at most `LEVELS - 1` times before it fires, so that firing is
+//! O(1) amortized.
+//!
+//! Timers can not be cancelled. Owner of the wheel shall check whether a fired
+//! timer is still valid, and insert it again with a new deadline if required.
+
+use std::time::{Duration, Instant};
+
+/// Number of slots in each level, in bits.
+const SLOT_BITS: u32 = 6;
+const SLOTS: usize = 1 << SLOT_BITS;
+const SLOT_MASK: u64 = SLOTS as u64 - 1;
+const LEVELS: usize = 4;
+
+/// Timers beyond this range are put into the highest level, and are moved again
+/// when that slot is reached.
+const MAX_TICKS: u64 = 1 << (SLOT_BITS * LEVELS as u32);
+
+#[derive(Debug)]
+pub struct TimerWheel<T> {
+    tick: Duration,
+    start: Instant,
+
+    /// Number of ticks elapsed since `start`.
+    elapsed: u64,
+
+    /// `levels[level][slot]` contains `(deadline_tick, value)` items.
+    levels: Vec<Vec<Vec<(u64, T)>>>,
+
+    /// Number of timers in each level, used to skip empty ticks.
+    level_lens: [usize; LEVELS],
+
+    /// Timers already expired when they are inserted.
+    expired: Vec<T>,
+
+    len: usize,
+}
+
+impl<T> TimerWheel<T> {
+    /// Create a new wheel, with resolution of `tick`.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `tick` is zero.
+    #[must_use]
+    pub fn new(tick: Duration, start: Instant) -> Self {
+        assert!(!tick.is_zero(), "tick of timer wheel is zero");
+        let levels = (0..LEVELS)
+            .map(|_| (0..SLOTS).map(|_| Vec::new()).collect())
+            .collect();
+        Self {
+            tick,
+            start,
+            elapsed: 0,
+            levels,
+            level_lens: [0; LEVELS],
+            expired: Vec::new(),
+            len: 0,
+        }
+    }
+
+    #[must_use]
+    pub const fn tick(&self) -> Duration {
+        self.tick
+    }
+
+    /// Get number of timers.
+    #[must_use]
+    pub const fn len(&self) -> usize {
+        self.len
+    }
+
+    #[must_use]
+    pub const fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Convert `instant` to ticks since start, rounding up.
+    fn ticks_of(&self, instant: Instant) -> u64 {
+        let duration = instant.saturating_duration_since(self.start);
+        let tick = self.tick.as_nanos();
+        ((duration.as_nanos() + tick - 1) / tick) as u64
+    }
+
+    /// Add a timer which fires at `deadline`.
+    ///
+    /// Timer fires at the first tick not earlier than `deadline`.
+    pub fn insert(&mut self, deadline: Instant, value: T) {
+        let when = self.ticks_of(deadline);
+        self.len += 1;
+        self.insert_at(when, value);
+    }
+
+    fn insert_at(&mut self, when: u64, value: T) {
+        if when <= self.elapsed {
+            self.expired.push(value);
+            return;
+        }
+
+        let delta = (when - self.elapsed).min(MAX_TICKS - 1);
+        let mut level = 0;
+        while level < LEVELS - 1 && delta >= 1 << (SLOT_BITS * (level as u32 + 1)) {
+            level += 1;
+        }
+        let target = self.elapsed + delta;
+        let slot = ((target >> (SLOT_BITS * level as u32)) & SLOT_MASK) as usize;
+        self.levels[level][slot].push((when, value));
+        self.level_lens[level] += 1;
+    }
+
+    /// Take all timers in a slot.
+    fn take_slot(&mut self, level: usize, slot: usize) -> Vec<(u64, T)> {
+        let items = std::mem::take(&mut self.levels[level][slot]);
+        self.level_lens[level] -= items.len();
+        items
+    }
+
+    /// Get the last tick before next one which may have timers to handle.
+    fn skip_empty_ticks(&self, now_tick: u64) -> u64 {
+        let lowest = match self.level_lens.iter().position(|len| *len > 0) {
+            Some(0) | None => return self.elapsed,
+            Some(level) => level,
+        };
+        let span = 1 << (SLOT_BITS * lowest as u32);
+        let next = (self.elapsed / span + 1) * span;
+        (next - 1).min(now_tick).max(self.elapsed)
+    }
+
+    /// Move wheel to `now`, and append values of expired timers to `expired`.
+    pub fn advance(&mut self, now: Instant, expired: &mut Vec<T>) {
+        let now_tick = self.ticks_of(now);
+        if self.len == 0 {
+            self.elapsed = self.elapsed.max(now_tick);
+            return;
+        }
+
+        while self.elapsed < now_tick {
+            self.elapsed = self.skip_empty_ticks(now_tick);
+            if self.elapsed == now_tick {
+                break;
+            }
+            self.elapsed += 1;
+            let elapsed = self.elapsed;
+
+            // Move timers of higher levels down first, they may expire in this tick.
+            for level in (1..LEVELS).rev() {
+                let shift = SLOT_BITS * level as u32;
+                if elapsed & ((1 << shift) - 1) == 0 {
+                    let slot = ((elapsed >> shift) & SLOT_MASK) as usize;
+                    let items = self.take_slot(level, slot);
+                    for (when, value) in items {
+                        self.insert_at(when, value);
+                    }
+                }
+            }
+
+            let slot = (elapsed & SLOT_MASK) as usize;
+            let items = self.take_slot(0, slot);
+            for (when, value) in items {
+                self.insert_at(when, value);
+            }
+
+            if !self.expired.is_empty() {
+                self.len -= self.expired.len();
+                expired.append(&mut self.expired);
+                if self.len == 0 {
+                    self.elapsed = now_tick;
+                }
+            }
+        }
+
+        if !self.expired.is_empty() {
+            self.len -= self.expired.len();
+            expired.append(&mut self.expired);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::TimerWheel;
+    use std::time::{Duration, Instant};
+
+    #[test]
+    fn test_timer_wheel() {
+        let start = Instant::now();
+        let tick = Duration::from_millis(100);
+        let mut wheel = TimerWheel::new(tick, start);
+        let deadlines = [0_u64, 1, 63, 64, 65, 4095, 4096, 300_000, 20_000_000];
+        for ticks in &deadlines {
+            wheel.insert(start + tick * (*ticks as u32), *ticks);
+        }
+        assert_eq!(wheel.len(), deadlines.len());
+
+        let mut expired = Vec::new();
+        wheel.advance(start, &mut expired);
+        assert_eq!(expired, [0]);
+
+        // Each timer fires exactly at its tick.
+        for ticks in &deadlines[1..] {
+            expired.clear();
+            wheel.advance(start + tick * (*ticks as u32 - 1), &mut expired);
+            assert!(expired.is_empty(), "{} fired too early", ticks);
+            wheel.advance(start + tick * (*ticks as u32), &mut expired);
+            assert_eq!(expired, [*ticks]);
+        }
+        assert!(wheel.is_empty());
+    }
+}
@@ -3,6 +3,9 @@
 // in the LICENSE file.
 
 use codec::QoS;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
 
 pub type ListenerId = u32;
 pub type SessionId = u64;
@@ -41,6 +44,142 @@ impl SessionGid {
     }
 }
 
+/// Number of publish messages sent to a session but not written to its stream yet.
+///
+/// It is increased by listener and decreased by session after flushing stream,
+/// and read by dispatcher to balance shared subscriptions.
+///
+/// Bytes of these messages, including those waiting for inflight window of the session,
+/// are counted too, which are used by listener to limit queue of a slow session.
+#[derive(Debug, Default, Clone)]
+pub struct InflightCounter(Arc<InflightCounterInner>);
+
+#[derive(Debug, Default)]
+struct InflightCounterInner {
+    messages: AtomicUsize,
+    bytes: AtomicUsize,
+}
+
+impl InflightCounter {
+    #[must_use]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    #[must_use]
+    #[inline]
+    pub fn get(&self) -> usize {
+        self.0.messages.load(Ordering::Relaxed)
+    }
+
+    #[inline]
+    pub fn increase(&self) {
+        self.0.messages.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn decrease(&self, count: usize) {
+        if count > 0 {
+            self.0.messages.fetch_sub(count, Ordering::Relaxed);
+        }
+    }
+
+    /// Get bytes of queued messages.
+    #[must_use]
+    #[inline]
+    pub fn bytes(&self) -> usize {
+        self.0.bytes.load(Ordering::Relaxed)
+    }
+
+    #[inline]
+    pub fn increase_bytes(&self, bytes: usize) {
+        if bytes > 0 {
+            self.0.bytes.fetch_add(bytes, Ordering::Relaxed);
+        }
+    }
+
+    #[inline]
+    pub fn decrease_bytes(&self, bytes: usize) {
+        if bytes > 0 {
+            self.0.bytes.fetch_sub(bytes, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Activity of a session, shared between session and listener.
+///
+/// It is updated by session when packets are sent to or received from client,
+/// and checked by timer wheel of listener to disconnect idle clients.
+#[derive(Debug, Clone)]
+pub struct SessionTimer(Arc<SessionTimerInner>);
+
+#[derive(Debug)]
+struct SessionTimerInner {
+    created_at: Instant,
+
+    /// Milliseconds since `created_at`.
+    last_active: AtomicU64,
+
+    /// Keep alive in milliseconds, 0 to disable it.
+    ///
+    /// It is `CONNECT_PENDING` before CONNECT packet is received.
+    keep_alive: AtomicU64,
+}
+
+const CONNECT_PENDING: u64 = u64::MAX;
+
+impl Default for SessionTimer {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl SessionTimer {
+    #[must_use]
+    pub fn new() -> Self {
+        Self(Arc::new(SessionTimerInner {
+            created_at: Instant::now(),
+            last_active: AtomicU64::new(0),
+            keep_alive: AtomicU64::new(CONNECT_PENDING),
+        }))
+    }
+
+    /// Reset timer if packet is sent to or received from client.
+    #[inline]
+    pub fn touch(&self) {
+        let elapsed = self.0.created_at.elapsed().as_millis() as u64;
+        self.0.last_active.store(elapsed, Ordering::Relaxed);
+    }
+
+    /// Update keep alive, after CONNECT packet is received.
+    pub fn set_keep_alive(&self, keep_alive: Duration) {
+        let keep_alive = (keep_alive.as_millis() as u64).min(CONNECT_PENDING - 1);
+        self.0.keep_alive.store(keep_alive, Ordering::Relaxed);
+    }
+
+    /// Returns true if CONNECT packet is not received yet.
+    #[must_use]
+    pub fn is_connect_pending(&self) -> bool {
+        self.0.keep_alive.load(Ordering::Relaxed) == CONNECT_PENDING
+    }
+
+    /// Get time when client shall be disconnected.
+    ///
+    /// Returns None if there is no time limit.
+    #[must_use]
+    pub fn deadline(&self, connect_timeout: Duration) -> Option<Instant> {
+        match self.0.keep_alive.load(Ordering::Relaxed) {
+            CONNECT_PENDING if connect_timeout.is_zero() => None,
+            CONNECT_PENDING => Some(self.0.created_at + connect_timeout),
+            0 => None,
+            keep_alive => {
+                let last_active = self.0.last_active.load(Ordering::Relaxed);
+                Some(self.0.created_at + Duration::from_millis(last_active + keep_alive))
+            }
+        }
+    }
+}
+
 /// Represents a session object.
 #[derive(Debug, Clone)]
 pub struct SessionInfo {
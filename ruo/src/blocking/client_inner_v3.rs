@@ -7,7 +7,10 @@ use codec::v3::{
     PublishAckPacket, PublishPacket, SubscribeAckPacket, SubscribePacket, UnsubscribeAckPacket,
     UnsubscribePacket,
 };
-use codec::{ByteArray, DecodePacket, EncodePacket, FixedHeader, PacketId, PacketType, QoS};
+use codec::{
+    encode_packet, ByteArray, DecodePacket, EncodePacket, FixedHeader, Packet, PacketId,
+    PacketType, QoS,
+};
 use std::collections::HashMap;
 
 use super::Stream;
@@ -301,10 +304,9 @@ impl ClientInnerV3 {
         )
     }
 
-    fn send_packet<P: EncodePacket>(&mut self, packet: &P) -> Result<(), Error> {
-        // TODO(Shaohua): Replace Vec<u8> with ByteArray.
+    fn send_packet<P: EncodePacket + Packet>(&mut self, packet: &P) -> Result<(), Error> {
         let mut buf = Vec::new();
-        packet.encode(&mut buf)?;
+        encode_packet(packet, &mut buf)?;
         self.stream.as_mut().map_or_else(
             || {
                 Err(Error::new(
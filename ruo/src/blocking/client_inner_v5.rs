@@ -7,7 +7,10 @@ use codec::v5::{
     PublishPacket, ReasonCode, SubscribeAckPacket, SubscribePacket, UnsubscribeAckPacket,
     UnsubscribePacket,
 };
-use codec::{ByteArray, DecodePacket, EncodePacket, FixedHeader, PacketId, PacketType, QoS};
+use codec::{
+    encode_packet, ByteArray, DecodePacket, EncodePacket, FixedHeader, Packet, PacketId,
+    PacketType, QoS,
+};
 use std::collections::HashMap;
 
 use super::Stream;
@@ -299,10 +302,9 @@ impl ClientInnerV5 {
         )
     }
 
-    fn send_packet<P: EncodePacket>(&mut self, packet: &P) -> Result<(), Error> {
-        // TODO(Shaohua): Replace Vec<u8> with ByteArray.
+    fn send_packet<P: EncodePacket + Packet>(&mut self, packet: &P) -> Result<(), Error> {
         let mut buf = Vec::new();
-        packet.encode(&mut buf)?;
+        encode_packet(packet, &mut buf)?;
         self.stream.as_mut().map_or_else(
             || {
                 Err(Error::new(
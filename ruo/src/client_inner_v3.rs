@@ -8,7 +8,8 @@ use codec::v3::{
     UnsubscribePacket,
 };
 use codec::{
-    ByteArray, DecodePacket, EncodePacket, FixedHeader, Packet, PacketId, PacketType, QoS,
+    encode_packet, ByteArray, DecodePacket, EncodePacket, FixedHeader, Packet, PacketId,
+    PacketType, QoS,
 };
 use std::collections::HashMap;
 use tokio::time::interval;
@@ -111,7 +112,7 @@ impl ClientInnerV3 {
 
     async fn send<P: EncodePacket + Packet>(&mut self, packet: P) -> Result<(), Error> {
         let mut buf = Vec::new();
-        packet.encode(&mut buf)?;
+        encode_packet(&packet, &mut buf)?;
         match &mut self.stream {
             Stream::None => Err(Error::new(
                 ErrorKind::SocketError,